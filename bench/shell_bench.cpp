@@ -0,0 +1,258 @@
+// shell_bench: microbenchmarks for the parser, the launcher, pipelines and
+// the builtin loop. Results are appended as "name value unit" lines to
+// bench_output.txt (or the file given as the only argument), one run per
+// block, so successive releases can be compared line by line.
+
+#include "arena.h"
+#include "executor.h"
+#include "fdplan.h"
+#include "launch.h"
+#include "parser.h"
+#include "shell.h"
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+extern char** environ;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kParseRounds = 20;
+constexpr int kLaunchRuns = 400;
+constexpr size_t kPipelineBytes = 256u << 20;
+constexpr int kLoopIterations = 100000;
+
+double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+class Report {
+public:
+    explicit Report(const char* path) : out_(std::fopen(path, "a")) {}
+    ~Report()
+    {
+        if (out_)
+            std::fclose(out_);
+    }
+
+    bool ok() const { return out_ != nullptr; }
+
+    void begin()
+    {
+        char stamp[32];
+        std::time_t now = std::time(nullptr);
+        std::strftime(stamp, sizeof stamp, "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+        std::fprintf(out_, "# run %s\n", stamp);
+    }
+
+    void add(const std::string& name, double value, const char* unit)
+    {
+        std::fprintf(out_, "%s %.6g %s\n", name.c_str(), value, unit);
+        std::printf("%-36s %14.6g %s\n", name.c_str(), value, unit);
+    }
+
+private:
+    std::FILE* out_;
+};
+
+// A script mixing the constructs real scripts use, repeated to size.
+std::string synthetic_script(int copies)
+{
+    static const char kBlock[] =
+        "# configuration\n"
+        "name=${1:-default} count=0\n"
+        "for f in a b \"c d\" $name; do\n"
+        "    case $f in\n"
+        "    a|b) count=$((count + 1)) ;;\n"
+        "    *) echo \"other: $f\" >> log.txt ;;\n"
+        "    esac\n"
+        "done\n"
+        "if [ -f \"$HOME/.profile\" ] && test $count -gt 1; then\n"
+        "    grep -v '^#' \"$HOME/.profile\" | sort | uniq -c > /dev/null 2>&1\n"
+        "elif false; then :; else echo no; fi\n"
+        "while read -r line; do printf '%s\\n' \"${line%%=*}\"; done <<EOF\n"
+        "key=value\n"
+        "EOF\n"
+        "greet() { echo \"hello $1\"; return 0; }\n"
+        "out=$(greet world) || exit 1\n";
+    std::string text;
+    for (int i = 0; i < copies; ++i)
+        text += kBlock;
+    return text;
+}
+
+void bench_parse(Report& report)
+{
+    std::string text = synthetic_script(2000);
+    size_t lines = std::count(text.begin(), text.end(), '\n');
+    sh::Arena arena;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < kParseRounds; ++i) {
+        sh::ParseResult result = sh::parse(text, arena);
+        if (result.status != sh::ParseResult::Status::Ok) {
+            std::fprintf(stderr, "shell_bench: %s\n", sh::describe_error(text, result).c_str());
+            std::exit(1);
+        }
+        arena.reset();
+    }
+    double elapsed = seconds_since(start);
+    report.add("parse.lines_per_s", static_cast<double>(lines) * kParseRounds / elapsed, "lines/s");
+    report.add("parse.mb_per_s", static_cast<double>(text.size()) * kParseRounds / elapsed / 1e6, "MB/s");
+}
+
+double percentile(std::vector<double>& samples, double p)
+{
+    std::sort(samples.begin(), samples.end());
+    size_t i = static_cast<size_t>(p * static_cast<double>(samples.size() - 1) + 0.5);
+    return samples[i];
+}
+
+void bench_launch(Report& report, sh::Shell& shell)
+{
+    const std::string* path = shell.commands.find("true", sh::search_path(shell));
+    if (!path) {
+        std::fprintf(stderr, "shell_bench: true: not found in PATH\n");
+        return;
+    }
+    char arg0[] = "true";
+    char* argv[] = {arg0, nullptr};
+    sh::FdPlan plan;
+    plan.open(0, "/dev/null", O_RDONLY);
+
+    for (sh::LaunchBackend backend : {sh::LaunchBackend::Spawn, sh::LaunchBackend::Vfork, sh::LaunchBackend::Fork}) {
+        sh::LaunchSpec spec;
+        spec.path = path->c_str();
+        spec.argv = argv;
+        spec.envp = environ;
+        spec.fds = &plan;
+
+        std::vector<double> samples;
+        samples.reserve(kLaunchRuns);
+        for (int i = 0; i < kLaunchRuns; ++i) {
+            Clock::time_point start = Clock::now();
+            pid_t pid = sh::launch(spec, backend);
+            if (pid < 0) {
+                std::fprintf(stderr, "shell_bench: launch: %s\n", std::strerror(errno));
+                return;
+            }
+            sh::wait_for(pid);
+            samples.push_back(seconds_since(start) * 1e6);
+        }
+        std::string name = std::string("launch.") + sh::backend_name(backend);
+        report.add(name + ".p50_us", percentile(samples, 0.50), "us");
+        report.add(name + ".p99_us", percentile(samples, 0.99), "us");
+    }
+}
+
+// A file of kPipelineBytes in $TMPDIR, unlinked by the destructor.
+struct ScratchFile {
+    std::string path;
+
+    ScratchFile()
+    {
+        const char* dir = std::getenv("TMPDIR");
+        path = std::string(dir && *dir ? dir : "/tmp") + "/shell-bench-XXXXXX";
+        int fd = ::mkstemp(path.data());
+        if (fd < 0) {
+            path.clear();
+            return;
+        }
+        std::vector<char> block(1 << 20, 'x');
+        for (size_t done = 0; done < kPipelineBytes; done += block.size()) {
+            if (::write(fd, block.data(), block.size()) != static_cast<ssize_t>(block.size())) {
+                ::unlink(path.c_str());
+                path.clear();
+                break;
+            }
+        }
+        ::close(fd);
+    }
+
+    ~ScratchFile()
+    {
+        if (!path.empty())
+            ::unlink(path.c_str());
+    }
+};
+
+void bench_pipeline(Report& report, sh::Shell& shell)
+{
+    ScratchFile file;
+    if (file.path.empty()) {
+        std::fprintf(stderr, "shell_bench: cannot create scratch file\n");
+        return;
+    }
+    // "builtin" stages are moved by the shell itself; "external" ones are
+    // the system cat, with the shell only setting up the pipes.
+    for (const char* kind : {"builtin", "external"}) {
+        std::string cat = std::strcmp(kind, "builtin") == 0 ? "cat" : "/bin/cat";
+        for (int stages : {2, 4, 8}) {
+            std::string command = cat + " '" + file.path + "'";
+            for (int i = 1; i < stages; ++i)
+                command += " | " + cat;
+            command += " > /dev/null";
+            Clock::time_point start = Clock::now();
+            sh::run_source(shell, command);
+            double elapsed = seconds_since(start);
+            report.add("pipeline." + std::string(kind) + "." + std::to_string(stages) + "_stages.gb_per_s",
+                       static_cast<double>(kPipelineBytes) / elapsed / 1e9, "GB/s");
+        }
+    }
+}
+
+void bench_builtin_loop(Report& report, sh::Shell& shell)
+{
+    std::string n = std::to_string(kLoopIterations);
+    struct Case {
+        const char* name;
+        std::string body;
+    };
+    const Case cases[] = {
+        {"arith", "i=0; while [ $i -lt " + n + " ]; do i=$((i + 1)); done"},
+        {"test_file", "i=0; while [ $i -lt " + n + " ]; do [ -f /dev/null ]; i=$((i + 1)); done"},
+        {"echo", "i=0; while [ $i -lt " + n + " ]; do echo $i; i=$((i + 1)); done > /dev/null"},
+    };
+    for (const Case& c : cases) {
+        Clock::time_point start = Clock::now();
+        sh::run_source(shell, c.body);
+        double elapsed = seconds_since(start);
+        report.add(std::string("loop.") + c.name + ".iterations_per_s", kLoopIterations / elapsed, "iter/s");
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const char* output = argc > 1 ? argv[1] : "bench_output.txt";
+    Report report(output);
+    if (!report.ok()) {
+        std::fprintf(stderr, "shell_bench: %s: %s\n", output, std::strerror(errno));
+        return 1;
+    }
+
+    sh::Shell shell;
+    shell.name = "shell_bench";
+    shell.pid = ::getpid();
+    shell.vars.import(environ);
+
+    report.begin();
+    bench_parse(report);
+    bench_launch(report, shell);
+    bench_pipeline(report, shell);
+    bench_builtin_loop(report, shell);
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace sh {
+
+namespace {
+
+constexpr size_t kMaxBlockSize = size_t(1) << 20;
+
+char* align_up(char* p, size_t align)
+{
+    auto v = reinterpret_cast<uintptr_t>(p);
+    return reinterpret_cast<char*>((v + align - 1) & ~(uintptr_t(align) - 1));
+}
+
+} // namespace
+
+Arena::Arena(size_t block_size) : block_size_(block_size)
+{
+}
+
+Arena::~Arena()
+{
+    release();
+}
+
+void* Arena::allocate(size_t size, size_t align)
+{
+    char* p = align_up(cur_, align);
+    if (!cur_ || p + size > end_) {
+        grow(size + align);
+        p = align_up(cur_, align);
+    }
+    cur_ = p + size;
+    return p;
+}
+
+std::string_view Arena::copy(std::string_view s)
+{
+    if (s.empty())
+        return {};
+    char* p = static_cast<char*>(allocate(s.size(), 1));
+    std::memcpy(p, s.data(), s.size());
+    return {p, s.size()};
+}
+
+void Arena::grow(size_t min_size)
+{
+    size_t size = std::max(block_size_, min_size + sizeof(Block));
+    auto* block = static_cast<Block*>(::operator new(size));
+    block->next = head_;
+    block->size = size;
+    head_ = block;
+    cur_ = reinterpret_cast<char*>(block + 1);
+    end_ = reinterpret_cast<char*>(block) + size;
+    capacity_ += size;
+    block_size_ = std::min(block_size_ * 2, kMaxBlockSize);
+}
+
+void Arena::release()
+{
+    while (head_) {
+        Block* next = head_->next;
+        ::operator delete(head_);
+        head_ = next;
+    }
+    cur_ = end_ = nullptr;
+    capacity_ = 0;
+}
+
+void Arena::reset()
+{
+    if (!head_)
+        return;
+    if (head_->next) {
+        // Coalesce: one block as large as everything used this round.
+        size_t total = capacity_;
+        release();
+        block_size_ = std::max(block_size_, total);
+        grow(0);
+        return;
+    }
+    cur_ = reinterpret_cast<char*>(head_ + 1);
+}
+
+} // namespace sh
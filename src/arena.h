@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace sh {
+
+// Bump allocator for data that lives exactly as long as one parsed line or
+// script: AST nodes, word parts and the occasional cooked string. Objects
+// are never freed one by one; reset() drops everything in one shot.
+//
+// After a reset that had spilled into several blocks the arena keeps a
+// single block big enough for all of them, so a reused arena settles at the
+// size of a typical line and stops calling the heap allocator.
+class Arena {
+public:
+    explicit Arena(size_t block_size = 8192);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args)
+    {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+        return ::new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Copies s into the arena; the result lives until the next reset().
+    std::string_view copy(std::string_view s);
+
+    // Copies items into the arena, like copy() a string.
+    template <typename T>
+    std::span<const T> copy(std::span<const T> items)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "arena objects are never destroyed");
+        if (items.empty())
+            return {};
+        T* p = static_cast<T*>(allocate(items.size_bytes(), alignof(T)));
+        std::uninitialized_copy(items.begin(), items.end(), p);
+        return {p, items.size()};
+    }
+
+    void reset();
+
+    // Bytes reserved from the heap across all blocks.
+    size_t capacity() const { return capacity_; }
+
+private:
+    struct Block {
+        Block* next;
+        size_t size;
+    };
+
+    void grow(size_t min_size);
+    void release();
+
+    Block* head_ = nullptr;
+    char* cur_ = nullptr;
+    char* end_ = nullptr;
+    size_t block_size_;
+    size_t capacity_ = 0;
+};
+
+// Intrusive singly linked list of arena objects. T must have a `T* next`
+// member; building one never allocates beyond the elements themselves.
+template <typename T>
+struct List {
+    T* head = nullptr;
+    T* tail = nullptr;
+    size_t size = 0;
+
+    void push(T* item)
+    {
+        item->next = nullptr;
+        if (tail)
+            tail->next = item;
+        else
+            head = item;
+        tail = item;
+        ++size;
+    }
+
+    void append(List& other)
+    {
+        if (!other.head)
+            return;
+        if (tail)
+            tail->next = other.head;
+        else
+            head = other.head;
+        tail = other.tail;
+        size += other.size;
+        other = {};
+    }
+
+    bool empty() const { return head == nullptr; }
+
+    struct iterator {
+        T* p;
+        T* operator*() const { return p; }
+        T* operator->() const { return p; }
+        iterator& operator++()
+        {
+            p = p->next;
+            return *this;
+        }
+        bool operator==(const iterator&) const = default;
+    };
+
+    iterator begin() const { return {head}; }
+    iterator end() const { return {nullptr}; }
+};
+
+} // namespace sh
@@ -0,0 +1,595 @@
+#include "arith.h"
+
+#include "arena.h"
+#include "expand.h"
+#include "lexer.h"
+#include "shell.h"
+
+#include <optional>
+#include <string>
+
+namespace sh {
+
+namespace {
+
+constexpr int kMaxDepth = 64;
+
+using Kind = ArithNode::Kind;
+using Op = ArithNode::Op;
+
+[[noreturn]] void fail(std::string_view text, const char* what)
+{
+    throw ExpansionError(std::string(text) + ": " + what);
+}
+
+long long wrap(unsigned long long v)
+{
+    return static_cast<long long>(v);
+}
+
+// a op b for a binary or unary (b unused) operator.
+long long apply(std::string_view text, Op op, long long a, long long b)
+{
+    auto ua = static_cast<unsigned long long>(a);
+    auto ub = static_cast<unsigned long long>(b);
+    switch (op) {
+    case Op::Add:
+        return wrap(ua + ub);
+    case Op::Sub:
+        return wrap(ua - ub);
+    case Op::Mul:
+        return wrap(ua * ub);
+    case Op::Div:
+    case Op::Mod:
+        if (b == 0)
+            fail(text, "division by zero");
+        if (b == -1)
+            return op == Op::Div ? wrap(0ULL - ua) : 0;
+        return op == Op::Div ? a / b : a % b;
+    case Op::Pow: {
+        if (b < 0)
+            fail(text, "exponent less than 0");
+        // By squaring, so a huge exponent costs at most 64 steps; 0, 1 and
+        // -1 are settled at once.
+        if (a == 0 || a == 1)
+            return b == 0 ? 1 : a;
+        if (a == -1)
+            return ub & 1 ? -1 : 1;
+        unsigned long long r = 1;
+        for (; ub; ub >>= 1) {
+            if (ub & 1)
+                r *= ua;
+            ua *= ua;
+        }
+        return wrap(r);
+    }
+    case Op::Shl:
+        return wrap(ua << (b & 63));
+    case Op::Shr:
+        return a >> (b & 63);
+    case Op::BitAnd:
+        return a & b;
+    case Op::BitXor:
+        return a ^ b;
+    case Op::BitOr:
+        return a | b;
+    case Op::Eq:
+        return a == b;
+    case Op::Ne:
+        return a != b;
+    case Op::Lt:
+        return a < b;
+    case Op::Le:
+        return a <= b;
+    case Op::Gt:
+        return a > b;
+    case Op::Ge:
+        return a >= b;
+    case Op::Neg:
+        return wrap(0ULL - ua);
+    case Op::Not:
+        return !a;
+    case Op::BitNot:
+        return ~a;
+    case Op::None:
+        break;
+    }
+    fail(text, "unknown operator");
+}
+
+// Whether apply() would fail rather than produce a value, so the error is
+// left for evaluation to raise (and only if that branch is taken).
+bool can_fail(Op op, long long b)
+{
+    return ((op == Op::Div || op == Op::Mod) && b == 0) || (op == Op::Pow && b < 0);
+}
+
+// Recursive descent over the expression text, building the tree bottom up
+// and folding any operator whose operands are constants.
+class ArithParser {
+public:
+    ArithParser(std::string_view src, Arena& arena) : s_(src), arena_(arena) {}
+
+    ArithExpr* run()
+    {
+        ArithExpr* expr = arena_.make<ArithExpr>();
+        expr->text = s_;
+        skip();
+        if (i_ == s_.size())
+            return expr;
+        expr->root = comma();
+        skip();
+        if (i_ != s_.size())
+            fail(s_, "syntax error in expression");
+        return expr;
+    }
+
+private:
+    void skip()
+    {
+        while (i_ < s_.size() && (s_[i_] == ' ' || s_[i_] == '\t' || s_[i_] == '\n'))
+            ++i_;
+    }
+
+    bool eat(std::string_view op)
+    {
+        skip();
+        if (s_.substr(i_, op.size()) != op)
+            return false;
+        i_ += op.size();
+        return true;
+    }
+
+    // Matches op only when it is not the prefix of a longer operator.
+    bool eat_exact(std::string_view op, std::string_view not_followed_by)
+    {
+        skip();
+        if (s_.substr(i_, op.size()) != op)
+            return false;
+        size_t next = i_ + op.size();
+        if (next < s_.size() && not_followed_by.find(s_[next]) != std::string_view::npos)
+            return false;
+        i_ = next;
+        return true;
+    }
+
+    ArithNode* make(Kind kind, Op op = Op::None, ArithNode* a = nullptr, ArithNode* b = nullptr, ArithNode* c = nullptr)
+    {
+        ArithNode* n = arena_.make<ArithNode>();
+        n->kind = kind;
+        n->op = op;
+        n->a = a;
+        n->b = b;
+        n->c = c;
+        return n;
+    }
+
+    ArithNode* number(long long v)
+    {
+        ArithNode* n = make(Kind::Number);
+        n->value = v;
+        return n;
+    }
+
+    static bool constant(const ArithNode* n) { return n->kind == Kind::Number; }
+
+    ArithNode* unary_op(Op op, ArithNode* a)
+    {
+        return constant(a) ? number(apply(s_, op, a->value, 0)) : make(Kind::Unary, op, a);
+    }
+
+    ArithNode* binary_op(Op op, ArithNode* a, ArithNode* b)
+    {
+        if (constant(a) && constant(b) && !can_fail(op, b->value))
+            return number(apply(s_, op, a->value, b->value));
+        return make(Kind::Binary, op, a, b);
+    }
+
+    ArithNode* named(Kind kind, std::string_view name, Op op = Op::None, ArithNode* a = nullptr)
+    {
+        ArithNode* n = make(kind, op, a);
+        n->name = name;
+        return n;
+    }
+
+    ArithNode* comma()
+    {
+        ArithNode* v = assignment();
+        while (eat(",")) {
+            ArithNode* next = assignment();
+            v = constant(v) ? next : make(Kind::Comma, Op::None, v, next);
+        }
+        return v;
+    }
+
+    ArithNode* assignment()
+    {
+        skip();
+        size_t save = i_;
+        if (i_ < s_.size() && is_name_start(s_[i_])) {
+            size_t end = i_;
+            while (end < s_.size() && is_name_char(s_[end]))
+                ++end;
+            std::string_view name = s_.substr(i_, end - i_);
+            i_ = end;
+            static constexpr struct {
+                std::string_view text;
+                Op op;
+            } ops[] = {
+                {"=", Op::None},     {"+=", Op::Add},     {"-=", Op::Sub},     {"*=", Op::Mul},
+                {"/=", Op::Div},     {"%=", Op::Mod},     {"<<=", Op::Shl},    {">>=", Op::Shr},
+                {"&=", Op::BitAnd},  {"^=", Op::BitXor},  {"|=", Op::BitOr},
+            };
+            skip();
+            for (const auto& op : ops) {
+                if (s_.substr(i_, op.text.size()) != op.text)
+                    continue;
+                if (op.text == "=" && i_ + 1 < s_.size() && s_[i_ + 1] == '=')
+                    break;
+                i_ += op.text.size();
+                return named(Kind::Assign, name, op.op, assignment());
+            }
+            i_ = save;
+        }
+        return ternary();
+    }
+
+    ArithNode* ternary()
+    {
+        ArithNode* cond = binary(0);
+        if (!eat("?"))
+            return cond;
+        ArithNode* a = assignment();
+        if (!eat(":"))
+            fail(s_, "expected ':'");
+        ArithNode* b = assignment();
+        if (constant(cond))
+            return cond->value ? a : b;
+        return make(Kind::Ternary, Op::None, cond, a, b);
+    }
+
+    // a && b or a || b. A constant left side decides the result, or leaves
+    // only the truth of the right.
+    ArithNode* logical(Kind kind, ArithNode* a, ArithNode* b)
+    {
+        if (!constant(a))
+            return make(kind, Op::None, a, b);
+        bool decided = kind == Kind::And ? !a->value : a->value != 0;
+        if (decided)
+            return number(kind == Kind::Or);
+        return binary_op(Op::Ne, b, number(0));
+    }
+
+    // Binary operators by precedence level, loosest first.
+    ArithNode* binary(int level)
+    {
+        switch (level) {
+        case 0: { // ||
+            ArithNode* v = binary(1);
+            while (eat("||"))
+                v = logical(Kind::Or, v, binary(1));
+            return v;
+        }
+        case 1: { // &&
+            ArithNode* v = binary(2);
+            while (eat("&&"))
+                v = logical(Kind::And, v, binary(2));
+            return v;
+        }
+        case 2: { // |
+            ArithNode* v = binary(3);
+            while (eat_exact("|", "|="))
+                v = binary_op(Op::BitOr, v, binary(3));
+            return v;
+        }
+        case 3: { // ^
+            ArithNode* v = binary(4);
+            while (eat_exact("^", "="))
+                v = binary_op(Op::BitXor, v, binary(4));
+            return v;
+        }
+        case 4: { // &
+            ArithNode* v = binary(5);
+            while (eat_exact("&", "&="))
+                v = binary_op(Op::BitAnd, v, binary(5));
+            return v;
+        }
+        case 5: { // == !=
+            ArithNode* v = binary(6);
+            for (;;) {
+                if (eat("=="))
+                    v = binary_op(Op::Eq, v, binary(6));
+                else if (eat("!="))
+                    v = binary_op(Op::Ne, v, binary(6));
+                else
+                    return v;
+            }
+        }
+        case 6: { // < <= > >=
+            ArithNode* v = binary(7);
+            for (;;) {
+                if (eat("<="))
+                    v = binary_op(Op::Le, v, binary(7));
+                else if (eat(">="))
+                    v = binary_op(Op::Ge, v, binary(7));
+                else if (eat_exact("<", "<"))
+                    v = binary_op(Op::Lt, v, binary(7));
+                else if (eat_exact(">", ">"))
+                    v = binary_op(Op::Gt, v, binary(7));
+                else
+                    return v;
+            }
+        }
+        case 7: { // << >>
+            ArithNode* v = binary(8);
+            for (;;) {
+                if (eat_exact("<<", "="))
+                    v = binary_op(Op::Shl, v, binary(8));
+                else if (eat_exact(">>", "="))
+                    v = binary_op(Op::Shr, v, binary(8));
+                else
+                    return v;
+            }
+        }
+        case 8: { // + -
+            ArithNode* v = binary(9);
+            for (;;) {
+                if (eat_exact("+", "+="))
+                    v = binary_op(Op::Add, v, binary(9));
+                else if (eat_exact("-", "-="))
+                    v = binary_op(Op::Sub, v, binary(9));
+                else
+                    return v;
+            }
+        }
+        case 9: { // * / %
+            ArithNode* v = power();
+            for (;;) {
+                if (eat_exact("*", "*="))
+                    v = binary_op(Op::Mul, v, power());
+                else if (eat_exact("/", "="))
+                    v = binary_op(Op::Div, v, power());
+                else if (eat_exact("%", "="))
+                    v = binary_op(Op::Mod, v, power());
+                else
+                    return v;
+            }
+        }
+        }
+        return unary();
+    }
+
+    ArithNode* power()
+    {
+        ArithNode* base = unary();
+        if (eat_exact("**", "="))
+            return binary_op(Op::Pow, base, power());
+        return base;
+    }
+
+    ArithNode* unary()
+    {
+        skip();
+        if (eat("++") || eat("--")) {
+            bool inc = s_[i_ - 1] == '+';
+            std::string_view name = identifier();
+            if (name.empty())
+                fail(s_, "operand expected");
+            return named(inc ? Kind::PreInc : Kind::PreDec, name);
+        }
+        if (eat_exact("+", "="))
+            return unary();
+        if (eat_exact("-", "="))
+            return unary_op(Op::Neg, unary());
+        if (eat_exact("!", "="))
+            return unary_op(Op::Not, unary());
+        if (eat("~"))
+            return unary_op(Op::BitNot, unary());
+        return postfix();
+    }
+
+    ArithNode* postfix()
+    {
+        skip();
+        if (eat("(")) {
+            ArithNode* v = comma();
+            if (!eat(")"))
+                fail(s_, "missing ')'");
+            return v;
+        }
+        if (i_ < s_.size() && s_[i_] >= '0' && s_[i_] <= '9')
+            return number(literal());
+        std::string_view name = identifier();
+        if (name.empty())
+            fail(s_, i_ < s_.size() ? "syntax error: operand expected" : "operand expected");
+        if (eat("++") || eat("--"))
+            return named(s_[i_ - 1] == '+' ? Kind::PostInc : Kind::PostDec, name);
+        return named(Kind::Var, name);
+    }
+
+    std::string_view identifier()
+    {
+        skip();
+        size_t start = i_;
+        if (i_ < s_.size() && is_name_start(s_[i_])) {
+            while (i_ < s_.size() && is_name_char(s_[i_]))
+                ++i_;
+        }
+        return s_.substr(start, i_ - start);
+    }
+
+    long long literal()
+    {
+        size_t start = i_;
+        while (i_ < s_.size() && (is_name_char(s_[i_]) || s_[i_] == '#'))
+            ++i_;
+        long long v;
+        if (!parse_integer(s_.substr(start, i_ - start), v))
+            fail(s_, "invalid number");
+        return v;
+    }
+
+    std::string_view s_;
+    Arena& arena_;
+    size_t i_ = 0;
+};
+
+long long eval_text(Shell& shell, std::string_view text, int depth);
+
+class ArithEval {
+public:
+    ArithEval(Shell& shell, std::string_view text, int depth) : shell_(shell), text_(text), depth_(depth) {}
+
+    long long eval(const ArithNode* n)
+    {
+        switch (n->kind) {
+        case Kind::Number:
+            return n->value;
+        case Kind::Var:
+            return variable(n->name);
+        case Kind::Assign: {
+            long long rhs = eval(n->a);
+            long long v = n->op == Op::None ? rhs : apply(text_, n->op, variable(n->name), rhs);
+            shell_.vars.set_number(n->name, v);
+            return v;
+        }
+        case Kind::PreInc:
+        case Kind::PreDec: {
+            long long v = wrap(static_cast<unsigned long long>(variable(n->name)) + (n->kind == Kind::PreInc ? 1 : -1ULL));
+            shell_.vars.set_number(n->name, v);
+            return v;
+        }
+        case Kind::PostInc:
+        case Kind::PostDec: {
+            long long v = variable(n->name);
+            shell_.vars.set_number(n->name, wrap(static_cast<unsigned long long>(v) + (n->kind == Kind::PostInc ? 1 : -1ULL)));
+            return v;
+        }
+        case Kind::Unary:
+            return apply(text_, n->op, eval(n->a), 0);
+        case Kind::Binary: {
+            long long a = eval(n->a);
+            return apply(text_, n->op, a, eval(n->b));
+        }
+        case Kind::And:
+            return eval(n->a) && eval(n->b);
+        case Kind::Or:
+            return eval(n->a) || eval(n->b);
+        case Kind::Ternary:
+            return eval(n->a) ? eval(n->b) : eval(n->c);
+        case Kind::Comma:
+            eval(n->a);
+            return eval(n->b);
+        }
+        return 0;
+    }
+
+private:
+    // A variable holding an integer constant is read from its cached
+    // number; any other text is itself evaluated as an expression.
+    long long variable(std::string_view name)
+    {
+        std::optional<long long> number;
+        const std::string* value = shell_.vars.get_number(name, number);
+        if (!value || value->empty())
+            return 0;
+        if (number)
+            return *number;
+        if (depth_ >= kMaxDepth)
+            fail(text_, "expression recursion level exceeded");
+        std::string text = *value;
+        return eval_text(shell_, text, depth_ + 1);
+    }
+
+    Shell& shell_;
+    std::string_view text_;
+    int depth_;
+};
+
+long long eval_text(Shell& shell, std::string_view text, int depth)
+{
+    Arena arena(512);
+    const ArithExpr* expr = ArithParser(text, arena).run();
+    return expr->root ? ArithEval(shell, text, depth).eval(expr->root) : 0;
+}
+
+} // namespace
+
+bool parse_integer(std::string_view text, long long& out)
+{
+    size_t i = 0;
+    while (i < text.size() && (text[i] == ' ' || text[i] == '\t'))
+        ++i;
+    bool neg = false;
+    if (i < text.size() && (text[i] == '-' || text[i] == '+'))
+        neg = text[i++] == '-';
+    if (i == text.size())
+        return false;
+    int base = 10;
+    size_t hash = text.find('#', i);
+    if (hash != std::string_view::npos) {
+        base = 0;
+        for (size_t k = i; k < hash; ++k) {
+            if (text[k] < '0' || text[k] > '9')
+                return false;
+            base = base * 10 + (text[k] - '0');
+        }
+        if (base < 2 || base > 64)
+            return false;
+        i = hash + 1;
+    } else if (text[i] == '0' && i + 1 < text.size() && (text[i + 1] == 'x' || text[i + 1] == 'X')) {
+        base = 16;
+        i += 2;
+    } else if (text[i] == '0' && i + 1 < text.size()) {
+        base = 8;
+        ++i;
+    }
+    size_t end = text.size();
+    while (end > i && (text[end - 1] == ' ' || text[end - 1] == '\t'))
+        --end;
+    if (i == end)
+        return false;
+    unsigned long long v = 0;
+    for (; i < end; ++i) {
+        char c = text[i];
+        int d;
+        if (c >= '0' && c <= '9')
+            d = c - '0';
+        else if (c >= 'a' && c <= 'z')
+            d = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'Z')
+            d = base <= 36 ? c - 'A' + 10 : c - 'A' + 36;
+        else if (c == '@')
+            d = 62;
+        else if (c == '_')
+            d = 63;
+        else
+            return false;
+        if (d >= base)
+            return false;
+        v = v * static_cast<unsigned>(base) + static_cast<unsigned>(d);
+    }
+    out = static_cast<long long>(neg ? 0ULL - v : v);
+    return true;
+}
+
+ArithExpr* compile_arith(std::string_view expr, Arena& arena)
+{
+    try {
+        return ArithParser(expr, arena).run();
+    } catch (const ExpansionError&) {
+        return nullptr;
+    }
+}
+
+long long eval_arith(Shell& shell, const ArithExpr& expr)
+{
+    return expr.root ? ArithEval(shell, expr.text, 0).eval(expr.root) : 0;
+}
+
+long long eval_arith(Shell& shell, std::string_view expr)
+{
+    return eval_text(shell, expr, 0);
+}
+
+} // namespace sh
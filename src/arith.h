@@ -0,0 +1,29 @@
+#pragma once
+
+#include "ast.h"
+
+#include <string_view>
+
+namespace sh {
+
+struct Shell;
+
+// Parses an arithmetic expression once into a tree allocated from arena,
+// folding constant subexpressions. Returns nullptr on a syntax error,
+// which evaluating the text reports. The tree refers to expr.
+ArithExpr* compile_arith(std::string_view expr, Arena& arena);
+
+// Evaluates a compiled expression. Variables are read and assigned through
+// shell.vars, whose integer values are kept parsed. Throws ExpansionError
+// on division by zero and the like.
+long long eval_arith(Shell& shell, const ArithExpr& expr);
+
+// Evaluates a shell arithmetic expression (the text of $((...)) after
+// expansion). Throws ExpansionError on a syntax error or division by zero.
+long long eval_arith(Shell& shell, std::string_view expr);
+
+// Parses an integer constant as arithmetic does: decimal, 0x hex, leading-0
+// octal or base#digits, with optional sign and surrounding blanks.
+bool parse_integer(std::string_view text, long long& out);
+
+} // namespace sh
@@ -0,0 +1,283 @@
+#include "ast.h"
+
+namespace sh {
+
+namespace {
+
+struct Cloner {
+    Arena& arena;
+
+    std::string_view str(std::string_view s) { return arena.copy(s); }
+
+    ArithNode* arith(const ArithNode* n)
+    {
+        if (!n)
+            return nullptr;
+        ArithNode* out = arena.make<ArithNode>(*n);
+        out->name = str(n->name);
+        out->a = arith(n->a);
+        out->b = arith(n->b);
+        out->c = arith(n->c);
+        return out;
+    }
+
+    ArithExpr* arith(const ArithExpr* e)
+    {
+        if (!e)
+            return nullptr;
+        ArithExpr* out = arena.make<ArithExpr>();
+        out->text = str(e->text);
+        out->root = arith(e->root);
+        return out;
+    }
+
+    PatternView* pattern(const PatternView* p)
+    {
+        if (!p)
+            return nullptr;
+        return arena.make<PatternView>(arena.copy(p->tokens), arena.copy(p->sets));
+    }
+
+    Word* word(const Word* w)
+    {
+        if (!w)
+            return nullptr;
+        Word* out = arena.make<Word>();
+        out->raw = str(w->raw);
+        for (const WordPart* p : w->parts) {
+            WordPart* q = arena.make<WordPart>();
+            q->kind = p->kind;
+            q->quoted = p->quoted;
+            q->text = str(p->text);
+            if (p->param) {
+                q->param = arena.make<ParamExp>(*p->param);
+                q->param->name = str(p->param->name);
+                q->param->arg = word(p->param->arg);
+                q->param->arg2 = word(p->param->arg2);
+                q->param->pattern = pattern(p->param->pattern);
+                q->param->offset = arith(p->param->offset);
+                q->param->length = arith(p->param->length);
+            }
+            q->command = node(p->command);
+            q->expr = word(p->expr);
+            q->arith = arith(p->arith);
+            out->parts.push(q);
+        }
+        return out;
+    }
+
+    void words(const List<Word>& in, List<Word>& out)
+    {
+        for (const Word* w : in)
+            out.push(word(w));
+    }
+
+    void nodes(const List<Node>& in, List<Node>& out)
+    {
+        for (const Node* n : in)
+            out.push(node(n));
+    }
+
+    template <typename T>
+    T* copy_base(const Node* n)
+    {
+        T* out = arena.make<T>();
+        out->async = n->async;
+        for (const Redir* r : n->redirs) {
+            Redir* c = arena.make<Redir>();
+            c->op = r->op;
+            c->fd = r->fd;
+            c->target = word(r->target);
+            out->redirs.push(c);
+        }
+        return out;
+    }
+
+    Node* node(const Node* n)
+    {
+        if (!n)
+            return nullptr;
+        switch (n->kind) {
+        case NodeKind::Simple: {
+            auto* src = static_cast<const SimpleCommand*>(n);
+            auto* out = copy_base<SimpleCommand>(n);
+            for (const Assign* a : src->assigns) {
+                Assign* c = arena.make<Assign>();
+                c->name = str(a->name);
+                c->value = word(a->value);
+                out->assigns.push(c);
+            }
+            words(src->words, out->words);
+            return out;
+        }
+        case NodeKind::Pipeline: {
+            auto* src = static_cast<const Pipeline*>(n);
+            auto* out = copy_base<Pipeline>(n);
+            out->negate = src->negate;
+            nodes(src->stages, out->stages);
+            return out;
+        }
+        case NodeKind::AndOr: {
+            auto* src = static_cast<const AndOr*>(n);
+            auto* out = copy_base<AndOr>(n);
+            out->is_and = src->is_and;
+            out->left = node(src->left);
+            out->right = node(src->right);
+            return out;
+        }
+        case NodeKind::Sequence: {
+            auto* out = copy_base<Sequence>(n);
+            nodes(static_cast<const Sequence*>(n)->items, out->items);
+            return out;
+        }
+        case NodeKind::Subshell: {
+            auto* out = copy_base<Subshell>(n);
+            out->body = node(static_cast<const Subshell*>(n)->body);
+            return out;
+        }
+        case NodeKind::Group: {
+            auto* out = copy_base<Group>(n);
+            out->body = node(static_cast<const Group*>(n)->body);
+            return out;
+        }
+        case NodeKind::If: {
+            auto* src = static_cast<const If*>(n);
+            auto* out = copy_base<If>(n);
+            out->cond = node(src->cond);
+            out->then_part = node(src->then_part);
+            out->else_part = node(src->else_part);
+            return out;
+        }
+        case NodeKind::Loop: {
+            auto* src = static_cast<const Loop*>(n);
+            auto* out = copy_base<Loop>(n);
+            out->until = src->until;
+            out->cond = node(src->cond);
+            out->body = node(src->body);
+            return out;
+        }
+        case NodeKind::For: {
+            auto* src = static_cast<const For*>(n);
+            auto* out = copy_base<For>(n);
+            out->var = str(src->var);
+            out->has_list = src->has_list;
+            words(src->items, out->items);
+            out->body = node(src->body);
+            return out;
+        }
+        case NodeKind::Case: {
+            auto* src = static_cast<const Case*>(n);
+            auto* out = copy_base<Case>(n);
+            out->subject = word(src->subject);
+            for (const CaseItem* item : src->items) {
+                CaseItem* c = arena.make<CaseItem>();
+                words(item->patterns, c->patterns);
+                c->body = node(item->body);
+                out->items.push(c);
+            }
+            return out;
+        }
+        case NodeKind::FuncDef: {
+            auto* src = static_cast<const FuncDef*>(n);
+            auto* out = copy_base<FuncDef>(n);
+            out->name = str(src->name);
+            out->body = node(src->body);
+            return out;
+        }
+        case NodeKind::Arith: {
+            auto* src = static_cast<const ArithCommand*>(n);
+            auto* out = copy_base<ArithCommand>(n);
+            out->expr = word(src->expr);
+            out->compiled = arith(src->compiled);
+            return out;
+        }
+        }
+        return nullptr;
+    }
+};
+
+} // namespace
+
+Node* clone_tree(const Node* node, Arena& arena)
+{
+    return Cloner{arena}.node(node);
+}
+
+const char* node_label(const Node* node)
+{
+    switch (node->kind) {
+    case NodeKind::Simple:
+        return "simple";
+    case NodeKind::Pipeline:
+        return "pipeline";
+    case NodeKind::AndOr:
+        return "and-or";
+    case NodeKind::Sequence:
+        return "list";
+    case NodeKind::Subshell:
+        return "( ... )";
+    case NodeKind::Group:
+        return "{ ... }";
+    case NodeKind::If:
+        return "if";
+    case NodeKind::Loop:
+        return static_cast<const Loop*>(node)->until ? "until" : "while";
+    case NodeKind::For:
+        return "for";
+    case NodeKind::Case:
+        return "case";
+    case NodeKind::FuncDef:
+        return "function definition";
+    case NodeKind::Arith:
+        return "(( ... ))";
+    }
+    return "";
+}
+
+std::string command_text(const Node* node)
+{
+    std::string text;
+    switch (node->kind) {
+    case NodeKind::Simple: {
+        auto* cmd = static_cast<const SimpleCommand*>(node);
+        for (const Assign* a : cmd->assigns) {
+            if (!text.empty())
+                text += ' ';
+            text += a->name;
+            text += '=';
+            if (a->value)
+                text += a->value->raw;
+        }
+        for (const Word* w : cmd->words) {
+            if (!text.empty())
+                text += ' ';
+            text += w->raw;
+        }
+        break;
+    }
+    case NodeKind::Pipeline: {
+        auto* pipe = static_cast<const Pipeline*>(node);
+        if (pipe->negate)
+            text += "! ";
+        for (const Node* stage : pipe->stages) {
+            if (stage != pipe->stages.head)
+                text += " | ";
+            text += command_text(stage);
+        }
+        break;
+    }
+    case NodeKind::AndOr: {
+        auto* andor = static_cast<const AndOr*>(node);
+        text = command_text(andor->left);
+        text += andor->is_and ? " && " : " || ";
+        text += command_text(andor->right);
+        break;
+    }
+    default:
+        text = node_label(node);
+        break;
+    }
+    return text;
+}
+
+} // namespace sh
@@ -0,0 +1,278 @@
+#pragma once
+
+#include "arena.h"
+#include "pattern.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace sh {
+
+// Syntax tree produced by parse(). Every node lives in an Arena and every
+// string_view points either into the parsed source buffer or into that
+// arena, so a tree is valid only while both are.
+
+struct Node;
+struct Word;
+
+// An arithmetic expression parsed once into a tree (see compile_arith()),
+// with constant subexpressions already folded.
+struct ArithNode {
+    enum class Kind : uint8_t {
+        Number,  // value
+        Var,     // name
+        Assign,  // name = a, or name op= a
+        PreInc,  // ++name
+        PreDec,  // --name
+        PostInc, // name++
+        PostDec, // name--
+        Unary,   // op a
+        Binary,  // a op b
+        And,     // a && b
+        Or,      // a || b
+        Ternary, // a ? b : c
+        Comma,   // a, b
+    };
+    enum class Op : uint8_t {
+        None,
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Mod,
+        Pow,
+        Shl,
+        Shr,
+        BitAnd,
+        BitXor,
+        BitOr,
+        Eq,
+        Ne,
+        Lt,
+        Le,
+        Gt,
+        Ge,
+        Neg,
+        Not,
+        BitNot,
+    };
+
+    Kind kind = Kind::Number;
+    Op op = Op::None;
+    long long value = 0;
+    std::string_view name;
+    ArithNode* a = nullptr;
+    ArithNode* b = nullptr;
+    ArithNode* c = nullptr;
+};
+
+struct ArithExpr {
+    std::string_view text;    // for diagnostics
+    ArithNode* root = nullptr; // null for an empty expression, which is 0
+};
+
+struct ParamExp {
+    enum class Op : uint8_t {
+        Plain,           // $x, ${x}
+        Length,          // ${#x}
+        Default,         // ${x-w}, ${x:-w}
+        Assign,          // ${x=w}, ${x:=w}
+        Error,           // ${x?w}, ${x:?w}
+        Alternate,       // ${x+w}, ${x:+w}
+        TrimSmallSuffix, // ${x%p}
+        TrimLargeSuffix, // ${x%%p}
+        TrimSmallPrefix, // ${x#p}
+        TrimLargePrefix, // ${x##p}
+        Replace,         // ${x/p/r}
+        ReplaceAll,      // ${x//p/r}
+        ReplacePrefix,   // ${x/#p/r}
+        ReplaceSuffix,   // ${x/%p/r}
+        Substring,       // ${x:off}, ${x:off:len}
+    };
+
+    std::string_view name;
+    Op op = Op::Plain;
+    bool colon = false;   // ':' form of Default/Assign/Error/Alternate
+    Word* arg = nullptr;  // word, pattern or offset
+    Word* arg2 = nullptr; // replacement or length
+    // Compiled with the word when they have nothing to expand: the pattern
+    // of a trim or replacement, or a substring's offset and length.
+    PatternView* pattern = nullptr;
+    ArithExpr* offset = nullptr;
+    ArithExpr* length = nullptr;
+};
+
+struct WordPart {
+    enum class Kind : uint8_t {
+        Literal, // text
+        Tilde,   // ~ or ~user (user name in text)
+        Param,   // param
+        Command, // $(...) or `...`
+        Arith,   // $((...)); expr is the expression as a word
+    };
+
+    Kind kind = Kind::Literal;
+    bool quoted = false; // exempt from field splitting and pathname expansion
+    WordPart* next = nullptr;
+    std::string_view text;
+    ParamExp* param = nullptr;
+    Node* command = nullptr;
+    Word* expr = nullptr;
+    // Arith whose expression has no expansions of its own: parsed once
+    // with the word, and evaluated with no expansion at all.
+    ArithExpr* arith = nullptr;
+};
+
+struct Word {
+    Word* next = nullptr;
+    List<WordPart> parts;
+    std::string_view raw; // source text of the whole word
+};
+
+struct Redir {
+    enum class Op : uint8_t {
+        In,         // <
+        Out,        // >
+        Append,     // >>
+        Clobber,    // >|
+        ReadWrite,  // <>
+        DupIn,      // <&
+        DupOut,     // >&
+        HereDoc,    // << and <<-; target is the body
+        HereString, // <<<
+    };
+
+    Redir* next = nullptr;
+    Op op = Op::In;
+    int fd = 0;
+    Word* target = nullptr;
+};
+
+struct Assign {
+    Assign* next = nullptr;
+    std::string_view name;
+    Word* value = nullptr;
+};
+
+enum class NodeKind : uint8_t {
+    Simple,
+    Pipeline,
+    AndOr,
+    Sequence,
+    Subshell,
+    Group,
+    If,
+    Loop,
+    For,
+    Case,
+    FuncDef,
+    Arith, // (( expr ))
+};
+
+struct Node {
+    explicit Node(NodeKind k) : kind(k) {}
+
+    NodeKind kind;
+    bool async = false; // terminated by '&'
+    Node* next = nullptr;
+    List<Redir> redirs;
+};
+
+struct SimpleCommand : Node {
+    SimpleCommand() : Node(NodeKind::Simple) {}
+    List<Assign> assigns;
+    List<Word> words;
+};
+
+struct Pipeline : Node {
+    Pipeline() : Node(NodeKind::Pipeline) {}
+    List<Node> stages;
+    bool negate = false;
+};
+
+struct AndOr : Node {
+    AndOr() : Node(NodeKind::AndOr) {}
+    bool is_and = true;
+    Node* left = nullptr;
+    Node* right = nullptr;
+};
+
+// A list of commands run in order: a program, a compound list or a body.
+struct Sequence : Node {
+    Sequence() : Node(NodeKind::Sequence) {}
+    List<Node> items;
+};
+
+struct Subshell : Node {
+    Subshell() : Node(NodeKind::Subshell) {}
+    Node* body = nullptr;
+};
+
+struct Group : Node {
+    Group() : Node(NodeKind::Group) {}
+    Node* body = nullptr;
+};
+
+struct If : Node {
+    If() : Node(NodeKind::If) {}
+    Node* cond = nullptr;
+    Node* then_part = nullptr;
+    Node* else_part = nullptr; // elif chains nest another If here
+};
+
+struct Loop : Node {
+    Loop() : Node(NodeKind::Loop) {}
+    bool until = false;
+    Node* cond = nullptr;
+    Node* body = nullptr;
+};
+
+struct For : Node {
+    For() : Node(NodeKind::For) {}
+    std::string_view var;
+    bool has_list = false; // false: iterate over "$@"
+    List<Word> items;
+    Node* body = nullptr;
+};
+
+struct CaseItem {
+    CaseItem* next = nullptr;
+    List<Word> patterns;
+    Node* body = nullptr; // may be null for an empty item
+};
+
+struct Case : Node {
+    Case() : Node(NodeKind::Case) {}
+    Word* subject = nullptr;
+    List<CaseItem> items;
+};
+
+struct FuncDef : Node {
+    FuncDef() : Node(NodeKind::FuncDef) {}
+    std::string_view name;
+    Node* body = nullptr;
+};
+
+// (( expr )): status 0 when expr is non-zero. Like the Arith word part,
+// compiled is set when expr expands to itself.
+struct ArithCommand : Node {
+    ArithCommand() : Node(NodeKind::Arith) {}
+    Word* expr = nullptr;
+    ArithExpr* compiled = nullptr;
+};
+
+// Deep-copies a tree, including every string it refers to, into arena.
+// Used when a node must outlive the buffer and arena it was parsed into,
+// e.g. the body of a function defined on an interactive line.
+Node* clone_tree(const Node* node, Arena& arena);
+
+// A short name for the kind of node ("if", "( ... )", ...).
+const char* node_label(const Node* node);
+
+// An approximation of the source of a command for job listings: simple
+// commands, pipelines and and-or lists are rebuilt from their words,
+// anything else is shown by node_label().
+std::string command_text(const Node* node);
+
+} // namespace sh
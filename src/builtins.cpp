@@ -0,0 +1,2009 @@
+#include "builtins.h"
+
+#include "arith.h"
+#include "executor.h"
+#include "fdplan.h"
+#include "lexer.h"
+#include "shell.h"
+#include "transfer.h"
+
+#include <fcntl.h>
+#include <linux/ioprio.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace sh {
+
+namespace {
+
+// Output of builtins run by the shell itself, kept for one descriptor at a
+// time: a write to another descriptor flushes first, so bytes still reach
+// the descriptors in the order they were written. There is one for the
+// process, as there is one stdout; builtin threads never use it.
+class OutputBuffer {
+public:
+    static constexpr size_t kLimit = 64 * 1024;
+
+    bool write(int fd, std::string_view text, PipeCounter* count)
+    {
+        if (fd != fd_ && !flush())
+            return false;
+        fd_ = fd;
+        count_ = count;
+        data_.append(text);
+        return data_.size() < kLimit || flush();
+    }
+
+    bool flush()
+    {
+        if (data_.empty())
+            return true;
+        bool ok = write_all(fd_, data_, count_);
+        data_.clear();
+        return ok;
+    }
+
+private:
+    int fd_ = -1;
+    PipeCounter* count_ = nullptr;
+    std::string data_;
+};
+
+OutputBuffer output;
+
+// Writes text to fd, one of the builtin's descriptors. Only out is
+// buffered: anything else is written at once, after what out holds.
+bool put(BuiltinIo& io, int fd, std::string_view text, PipeCounter* count = nullptr)
+{
+    if (!io.buffered)
+        return write_all(fd, text, count);
+    if (fd == io.out)
+        return output.write(fd, text, count);
+    return output.flush() && write_all(fd, text, count);
+}
+
+// Writes out the buffer before a builtin blocks, or moves data to its
+// descriptors other than through put().
+void flush(BuiltinIo& io)
+{
+    if (io.buffered)
+        output.flush();
+}
+
+// Writes builtin output to io.out, counting it against its pipe.
+bool emit(BuiltinIo& io, std::string_view text)
+{
+    return put(io, io.out, text, io.out_pipe);
+}
+
+// printf(3) to one of the builtin's descriptors.
+__attribute__((format(printf, 3, 4))) bool say(BuiltinIo& io, int fd, const char* fmt, ...)
+{
+    char small[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = std::vsnprintf(small, sizeof small, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        return false;
+    if (static_cast<size_t>(n) < sizeof small)
+        return put(io, fd, std::string_view(small, static_cast<size_t>(n)));
+
+    std::string big(static_cast<size_t>(n) + 1, '\0');
+    va_start(ap, fmt);
+    std::vsnprintf(big.data(), big.size(), fmt, ap);
+    va_end(ap);
+    big.pop_back();
+    return put(io, fd, big);
+}
+
+// Reports a failed write of the builtin's output, as a status to return.
+// A reader that went away is not reported: the builtin ends quietly with
+// the status of a process killed by SIGPIPE, as an external one would.
+int write_error(BuiltinIo& io, const char* name)
+{
+    if (errno == EPIPE)
+        return 128 + SIGPIPE;
+    say(io, io.err, "%s: write error: %s\n", name, std::strerror(errno));
+    return 1;
+}
+
+// Appends s in single quotes, so that the shell reads it back unchanged.
+void append_quoted(std::string& out, std::string_view s)
+{
+    out += '\'';
+    for (char c : s) {
+        if (c == '\'')
+            out += "'\\''";
+        else
+            out += c;
+    }
+    out += '\'';
+}
+
+// Decodes the backslash escape at text[i] (just after the backslash) for
+// echo -e, printf formats and printf %b. in_arg selects the %b rules, where
+// octal escapes are written \0NNN. Returns false for \c, which ends output.
+bool decode_escape(std::string_view text, size_t& i, std::string& out, bool in_arg)
+{
+    if (i >= text.size()) {
+        out += '\\';
+        return true;
+    }
+    char c = text[i++];
+    switch (c) {
+    case 'a': out += '\a'; break;
+    case 'b': out += '\b'; break;
+    case 'e': out += '\033'; break;
+    case 'f': out += '\f'; break;
+    case 'n': out += '\n'; break;
+    case 'r': out += '\r'; break;
+    case 't': out += '\t'; break;
+    case 'v': out += '\v'; break;
+    case '\\': out += '\\'; break;
+    case 'c':
+        return false;
+    case 'x': {
+        int value = 0;
+        int digits = 0;
+        while (digits < 2 && i < text.size() && std::isxdigit(static_cast<unsigned char>(text[i]))) {
+            char h = text[i++];
+            value = value * 16 + (std::isdigit(static_cast<unsigned char>(h)) ? h - '0' : (h | 0x20) - 'a' + 10);
+            ++digits;
+        }
+        if (digits == 0)
+            out += "\\x";
+        else
+            out += static_cast<char>(value);
+        break;
+    }
+    default:
+        if (c >= '0' && c <= '7') {
+            // printf formats take \NNN; %b and echo take \0NNN.
+            int value = c - '0';
+            int max = in_arg && c == '0' ? 3 : 2;
+            if (in_arg && c == '0')
+                value = 0;
+            for (int digits = 0; digits < max && i < text.size() && text[i] >= '0' && text[i] <= '7'; ++digits)
+                value = value * 8 + (text[i++] - '0');
+            out += static_cast<char>(value);
+        } else if (!in_arg && (c == '"' || c == '\'')) {
+            out += c;
+        } else {
+            out += '\\';
+            out += c;
+        }
+        break;
+    }
+    return true;
+}
+
+// cat [file...]: operands only (kNoOptions), moved with transfer().
+int builtin_cat(Shell&, BuiltinIo& io, int argc, char** argv)
+{
+    flush(io);
+    int status = 0;
+    for (int i = argc > 1 ? 1 : 0; i < argc; ++i) {
+        bool from_stdin = i == 0 || std::strcmp(argv[i], "-") == 0;
+        int fd = from_stdin ? io.in : ::open(argv[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            say(io, io.err, "cat: %s: %s\n", argv[i], std::strerror(errno));
+            status = 1;
+            continue;
+        }
+        bool ok = transfer(fd, io.out, from_stdin ? io.in_pipe : nullptr, io.out_pipe);
+        int err = errno;
+        if (!from_stdin)
+            ::close(fd);
+        if (!ok) {
+            if (err == EPIPE)
+                return 128 + SIGPIPE;
+            say(io, io.err, "cat: %s: %s\n", from_stdin ? "-" : argv[i], std::strerror(err));
+            status = 1;
+        }
+    }
+    return status;
+}
+
+int builtin_cd(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    int i = 1;
+    if (i < argc && (std::strcmp(argv[i], "-L") == 0 || std::strcmp(argv[i], "-P") == 0))
+        ++i;
+    if (i < argc && std::strcmp(argv[i], "--") == 0)
+        ++i;
+
+    const char* dir;
+    bool print = false;
+    if (i < argc && std::strcmp(argv[i], "-") == 0) {
+        const std::string* old = shell.vars.get("OLDPWD");
+        if (!old) {
+            say(io, io.err, "cd: OLDPWD not set\n");
+            return 1;
+        }
+        dir = old->c_str();
+        print = true;
+    } else if (i < argc) {
+        dir = argv[i];
+    } else {
+        const std::string* home = shell.vars.get("HOME");
+        if (!home) {
+            say(io, io.err, "cd: HOME not set\n");
+            return 1;
+        }
+        dir = home->c_str();
+    }
+
+    std::string target = dir; // dir may point into OLDPWD, which is about to change
+    if (::chdir(target.c_str()) < 0) {
+        say(io, io.err, "cd: %s: %s\n", target.c_str(), std::strerror(errno));
+        return 1;
+    }
+    const std::string* pwd = shell.vars.get("PWD");
+    shell.vars.set("OLDPWD", pwd ? std::string_view(*pwd) : std::string_view());
+    if (char* cwd = ::getcwd(nullptr, 0)) {
+        shell.vars.set("PWD", cwd);
+        if (print)
+            say(io, io.out, "%s\n", cwd);
+        std::free(cwd);
+    }
+    return 0;
+}
+
+int builtin_colon(Shell&, BuiltinIo&, int, char**)
+{
+    return 0;
+}
+
+int builtin_false(Shell&, BuiltinIo&, int, char**)
+{
+    return 1;
+}
+
+// echo [-neE] [arg...], with bash's defaults: no escapes unless -e.
+int builtin_echo(Shell&, BuiltinIo& io, int argc, char** argv)
+{
+    bool newline = true;
+    bool escapes = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; ++i) {
+        const char* opt = argv[i] + 1;
+        if (std::strspn(opt, "neE") != std::strlen(opt))
+            break;
+        for (; *opt; ++opt) {
+            if (*opt == 'n')
+                newline = false;
+            else
+                escapes = *opt == 'e';
+        }
+    }
+
+    std::string out;
+    for (int first = i; i < argc; ++i) {
+        if (i > first)
+            out += ' ';
+        if (!escapes) {
+            out += argv[i];
+            continue;
+        }
+        std::string_view arg = argv[i];
+        for (size_t k = 0; k < arg.size();) {
+            if (arg[k] != '\\') {
+                out += arg[k++];
+                continue;
+            }
+            ++k;
+            if (!decode_escape(arg, k, out, true))
+                return emit(io, out) ? 0 : write_error(io, "echo");
+        }
+    }
+    if (newline)
+        out += '\n';
+    return emit(io, out) ? 0 : write_error(io, "echo");
+}
+
+int builtin_exit(Shell& shell, BuiltinIo&, int argc, char** argv)
+{
+    shell.flow = Flow::Exit;
+    return shell.last_status = argc > 1 ? std::atoi(argv[1]) & 0xff : shell.last_status;
+}
+
+// export [-n] [-p] [name[=value]...]
+int builtin_export(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    bool unexport = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; ++i) {
+        std::string_view opt = argv[i];
+        if (opt == "--") {
+            ++i;
+            break;
+        }
+        if (opt == "-n") {
+            unexport = true;
+        } else if (opt != "-p") {
+            say(io, io.err, "export: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+    }
+
+    if (i == argc) {
+        std::vector<std::pair<std::string_view, const std::string*>> exported;
+        shell.vars.for_each([&](std::string_view name, const std::string& value, bool is_exported) {
+            if (is_exported)
+                exported.emplace_back(name, &value);
+        });
+        std::sort(exported.begin(), exported.end());
+        std::string out;
+        for (const auto& [name, value] : exported) {
+            out += "export ";
+            out += name;
+            out += '=';
+            append_quoted(out, *value);
+            out += '\n';
+        }
+        return emit(io, out) ? 0 : write_error(io, "export");
+    }
+
+    int status = 0;
+    for (; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string_view name = arg.substr(0, eq);
+        if (!is_name(name)) {
+            say(io, io.err, "export: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        if (eq != std::string_view::npos)
+            shell.vars.set(name, arg.substr(eq + 1));
+        shell.vars.set_exported(name, !unexport);
+    }
+    return status;
+}
+
+// local name[=value]...
+//
+// Makes each name local to the running function: it is restored as it was
+// when the function returns.
+int builtin_local(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    if (shell.function_depth == 0) {
+        say(io, io.err, "local: can only be used in a function\n");
+        return 1;
+    }
+    int status = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string_view name = arg.substr(0, eq);
+        if (!is_name(name)) {
+            say(io, io.err, "local: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        shell.vars.make_local(name);
+        if (eq != std::string_view::npos)
+            shell.vars.set(name, arg.substr(eq + 1));
+    }
+    return status;
+}
+
+// mapfile -p [-t] / readarray -p [-t]
+//
+// Reads all of standard input in one pass and makes each line a positional
+// parameter, for `for line; do ...; done`. The shell has no arrays, so
+// bash's default of filling MAPFILE, or a named array, is refused rather
+// than letting a bash script lose "$@" without notice: -p asks for the
+// positional parameters explicitly. -t strips the trailing newline from
+// each line.
+int builtin_mapfile(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    bool trim = false, positional = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-t") == 0) {
+            trim = true;
+        } else if (std::strcmp(argv[i], "-p") == 0) {
+            positional = true;
+        } else if (argv[i][0] == '-') {
+            say(io, io.err, "%s: %s: invalid option\n", argv[0], argv[i]);
+            return 2;
+        } else {
+            say(io, io.err, "%s: %s: arrays are not supported; -p reads into the positional parameters\n",
+                argv[0], argv[i]);
+            return 2;
+        }
+    }
+    if (!positional) {
+        say(io, io.err, "%s: arrays are not supported; -p reads into the positional parameters\n", argv[0]);
+        return 2;
+    }
+
+    std::string text;
+    char buf[65536];
+    for (;;) {
+        ssize_t n = ::read(io.in, buf, sizeof buf);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            say(io, io.err, "%s: read error: %s\n", argv[0], std::strerror(errno));
+            return 1;
+        }
+        if (n == 0)
+            break;
+        text.append(buf, static_cast<size_t>(n));
+    }
+
+    std::vector<std::string> lines;
+    for (size_t start = 0; start < text.size();) {
+        size_t end = text.find('\n', start);
+        size_t next = end == std::string::npos ? text.size() : end + 1;
+        lines.emplace_back(text, start, (trim && end != std::string::npos ? end : next) - start);
+        start = next;
+    }
+    shell.positional = std::move(lines);
+    return 0;
+}
+
+int builtin_return(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    if (shell.function_depth == 0 && shell.source_depth == 0) {
+        say(io, io.err, "return: can only return from a function\n");
+        return 1;
+    }
+    shell.flow = Flow::Return;
+    return argc > 1 ? std::atoi(argv[1]) & 0xff : shell.last_status;
+}
+
+// break [n] / continue [n]
+int loop_control(Shell& shell, BuiltinIo& io, int argc, char** argv, Flow flow)
+{
+    int levels = argc > 1 ? std::atoi(argv[1]) : 1;
+    if (levels < 1) {
+        say(io, io.err, "%s: %s: loop count out of range\n", argv[0], argv[1]);
+        return 1;
+    }
+    if (shell.loop_depth == 0)
+        return 0;
+    shell.flow = flow;
+    shell.flow_levels = std::min(levels, shell.loop_depth);
+    return 0;
+}
+
+int builtin_break(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    return loop_control(shell, io, argc, argv, Flow::Break);
+}
+
+int builtin_continue(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    return loop_control(shell, io, argc, argv, Flow::Continue);
+}
+
+// bytecode [-c command] [name...]
+//
+// Prints what the named functions, or command, compile to (see bytecode.h).
+int builtin_bytecode(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    int status = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-c") == 0) {
+            if (++i == argc) {
+                say(io, io.err, "bytecode: -c: option requires an argument\n");
+                return 2;
+            }
+            Arena arena;
+            ParseResult result = parse(argv[i], arena);
+            if (result.status != ParseResult::Status::Ok) {
+                say(io, io.err, "bytecode: %s\n", describe_error(argv[i], result).c_str());
+                status = 2;
+                continue;
+            }
+            if (result.program && !emit(io, dump(compile(result.program))))
+                return write_error(io, "bytecode");
+            continue;
+        }
+        auto fn = shell.functions.find(argv[i]);
+        if (fn == shell.functions.end()) {
+            say(io, io.err, "bytecode: %s: not a function\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        if (!emit(io, std::string(argv[i]) + ":\n" + dump(fn->second->code)))
+            return write_error(io, "bytecode");
+    }
+    return status;
+}
+
+// hash [-r] [-s] [-d name...] [name...]
+int builtin_hash(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    CommandHash& commands = shell.commands;
+    bool forget = false;
+    int status = 0;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; ++i) {
+        std::string_view opt = argv[i];
+        if (opt == "--") {
+            ++i;
+            break;
+        }
+        if (opt == "-r") {
+            commands.reset();
+        } else if (opt == "-s") {
+            const CommandHashStats& st = commands.stats();
+            say(io, io.out, "hits %llu misses %llu\n", static_cast<unsigned long long>(st.hits),
+                static_cast<unsigned long long>(st.misses));
+        } else if (opt == "-d") {
+            forget = true;
+        } else {
+            say(io, io.err, "hash: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+    }
+    if (i == argc && argc == 1) {
+        commands.for_each([&](std::string_view, const CommandHash::Entry& e) {
+            say(io, io.out, "%4llu\t%s\n", static_cast<unsigned long long>(e.hits), e.path.c_str());
+        });
+        return 0;
+    }
+    for (; i < argc; ++i) {
+        bool ok = forget ? commands.forget(argv[i]) : commands.add(argv[i], search_path(shell));
+        if (!ok) {
+            say(io, io.err, "hash: %s: not found\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// Converts a printf numeric argument; a leading quote yields the code of
+// the character after it. Reports bad input and sets status to 1.
+long long printf_integer(BuiltinIo& io, const char* arg, int& status)
+{
+    if (arg[0] == '\'' || arg[0] == '"')
+        return static_cast<unsigned char>(arg[1]);
+    long long value = 0;
+    if (*arg && !parse_integer(arg, value)) {
+        say(io, io.err, "printf: %s: invalid number\n", arg);
+        status = 1;
+    }
+    return value;
+}
+
+double printf_float(BuiltinIo& io, const char* arg, int& status)
+{
+    if (arg[0] == '\'' || arg[0] == '"')
+        return static_cast<unsigned char>(arg[1]);
+    char* end;
+    double value = std::strtod(arg, &end);
+    if (*end) {
+        say(io, io.err, "printf: %s: invalid number\n", arg);
+        status = 1;
+    }
+    return value;
+}
+
+// printf format [arg...]: the format is reused until the arguments run out.
+int builtin_printf(Shell&, BuiltinIo& io, int argc, char** argv)
+{
+    int i = 1;
+    if (i < argc && std::strcmp(argv[i], "--") == 0)
+        ++i;
+    if (i >= argc) {
+        say(io, io.err, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+    std::string_view format = argv[i++];
+    int status = 0;
+    std::string out;
+    auto next_arg = [&]() -> const char* { return i < argc ? argv[i++] : nullptr; };
+
+    for (;;) {
+        bool consumed = false;
+        for (size_t k = 0; k < format.size();) {
+            char c = format[k++];
+            if (c == '\\') {
+                if (!decode_escape(format, k, out, false))
+                    return emit(io, out) ? status : write_error(io, "printf");
+                continue;
+            }
+            if (c != '%') {
+                out += c;
+                continue;
+            }
+            if (k < format.size() && format[k] == '%') {
+                out += '%';
+                ++k;
+                continue;
+            }
+
+            // Rebuild the conversion for snprintf, resolving any '*'.
+            std::string spec = "%";
+            while (k < format.size() && std::strchr("-+ #0", format[k]))
+                spec += format[k++];
+            for (int part = 0; part < 2; ++part) {
+                if (part == 1) {
+                    if (k >= format.size() || format[k] != '.')
+                        break;
+                    spec += format[k++];
+                }
+                if (k < format.size() && format[k] == '*') {
+                    ++k;
+                    const char* arg = next_arg();
+                    consumed = true;
+                    spec += std::to_string(arg ? printf_integer(io, arg, status) : 0);
+                } else {
+                    while (k < format.size() && std::isdigit(static_cast<unsigned char>(format[k])))
+                        spec += format[k++];
+                }
+            }
+            if (k >= format.size()) {
+                say(io, io.err, "printf: %s: missing conversion\n", spec.c_str());
+                return 1;
+            }
+
+            char conv = format[k++];
+            const char* arg = next_arg();
+            if (arg)
+                consumed = true;
+            char buf[512];
+            int n = 0;
+            switch (conv) {
+            case 'd':
+            case 'i':
+                spec += "ll";
+                spec += conv;
+                n = std::snprintf(buf, sizeof buf, spec.c_str(), arg ? printf_integer(io, arg, status) : 0LL);
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                spec += "ll";
+                spec += conv;
+                n = std::snprintf(buf, sizeof buf, spec.c_str(),
+                                  static_cast<unsigned long long>(arg ? printf_integer(io, arg, status) : 0));
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                spec += conv;
+                n = std::snprintf(buf, sizeof buf, spec.c_str(), arg ? printf_float(io, arg, status) : 0.0);
+                break;
+            case 'c':
+                // %c of an empty argument prints nothing but the padding.
+                spec += arg && *arg ? 'c' : 's';
+                if (arg && *arg)
+                    n = std::snprintf(buf, sizeof buf, spec.c_str(), *arg);
+                else
+                    n = std::snprintf(buf, sizeof buf, spec.c_str(), "");
+                break;
+            case 's':
+            case 'b': {
+                std::string value;
+                bool stop = false;
+                if (conv == 'b' && arg) {
+                    std::string_view text = arg;
+                    for (size_t j = 0; j < text.size() && !stop;) {
+                        if (text[j] != '\\') {
+                            value += text[j++];
+                            continue;
+                        }
+                        ++j;
+                        stop = !decode_escape(text, j, value, true);
+                    }
+                } else if (arg) {
+                    value = arg;
+                }
+                spec += 's';
+                std::vector<char> wide(value.size() + sizeof buf);
+                n = std::snprintf(wide.data(), wide.size(), spec.c_str(), value.c_str());
+                if (n > 0)
+                    out.append(wide.data(), std::min(static_cast<size_t>(n), wide.size() - 1));
+                if (stop)
+                    return emit(io, out) ? status : write_error(io, "printf");
+                continue;
+            }
+            default:
+                say(io, io.err, "printf: %%%c: invalid conversion\n", conv);
+                return 1;
+            }
+            if (n > 0)
+                out.append(buf, std::min(static_cast<size_t>(n), sizeof buf - 1));
+        }
+        if (i >= argc || !consumed)
+            break;
+    }
+    return emit(io, out) ? status : write_error(io, "printf");
+}
+
+// pwd [-L|-P]
+int builtin_pwd(Shell&, BuiltinIo& io, int, char**)
+{
+    char* cwd = ::getcwd(nullptr, 0);
+    if (!cwd) {
+        say(io, io.err, "pwd: %s\n", std::strerror(errno));
+        return 1;
+    }
+    std::string line = cwd;
+    std::free(cwd);
+    line += '\n';
+    bool ok = emit(io, line);
+    return ok ? 0 : write_error(io, "pwd");
+}
+
+// What read consumes of its input. Nothing past the line may be taken
+// from a pipe or terminal, whose other readers would lose it, so those are
+// read a byte at a time. A regular file is read a block at a time and the
+// offset put back just after the line by release().
+class LineInput {
+public:
+    explicit LineInput(int fd) : fd_(fd)
+    {
+        struct stat st;
+        block_ = ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    }
+
+    bool next(char& c)
+    {
+        if (pos_ == len_ && !fill())
+            return false;
+        c = buf_[pos_++];
+        return true;
+    }
+
+    void release()
+    {
+        if (pos_ < len_)
+            ::lseek(fd_, -static_cast<off_t>(len_ - pos_), SEEK_CUR);
+        pos_ = len_ = 0;
+    }
+
+private:
+    bool fill()
+    {
+        for (;;) {
+            ssize_t n = ::read(fd_, buf_, block_ ? sizeof buf_ : 1);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            pos_ = 0;
+            len_ = static_cast<size_t>(n);
+            return true;
+        }
+    }
+
+    int fd_;
+    bool block_;
+    char buf_[4096];
+    size_t pos_ = 0;
+    size_t len_ = 0;
+};
+
+// read [-r] [-p prompt] [name...]
+int builtin_read(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    flush(io);
+    bool raw = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; ++i) {
+        std::string_view opt = argv[i];
+        if (opt == "--") {
+            ++i;
+            break;
+        }
+        if (opt == "-r") {
+            raw = true;
+        } else if (opt == "-p" && i + 1 < argc) {
+            if (::isatty(io.in))
+                say(io, io.err, "%s", argv[++i]);
+            else
+                ++i;
+        } else {
+            say(io, io.err, "read: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+    }
+    std::vector<std::string_view> names;
+    for (; i < argc; ++i) {
+        if (!is_name(argv[i])) {
+            say(io, io.err, "read: `%s': not a valid identifier\n", argv[i]);
+            return 1;
+        }
+        names.emplace_back(argv[i]);
+    }
+    if (names.empty())
+        names.emplace_back("REPLY");
+
+    std::string line;
+    std::vector<bool> escaped; // parallel to line: protected from splitting
+    bool newline = false;
+    bool pending_backslash = false;
+    LineInput input(io.in);
+    char c;
+    while (input.next(c)) {
+        if (pending_backslash) {
+            pending_backslash = false;
+            if (c == '\n')
+                continue;
+            line += c;
+            escaped.push_back(true);
+            continue;
+        }
+        if (c == '\\' && !raw) {
+            pending_backslash = true;
+            continue;
+        }
+        if (c == '\n') {
+            newline = true;
+            break;
+        }
+        line += c;
+        escaped.push_back(false);
+    }
+    input.release();
+
+    const std::string* ifs_var = shell.vars.get("IFS");
+    std::string_view ifs = ifs_var ? std::string_view(*ifs_var) : std::string_view(" \t\n");
+    auto is_ifs = [&](size_t k) { return !escaped[k] && ifs.find(line[k]) != std::string_view::npos; };
+    auto is_ifs_space = [&](size_t k) { return is_ifs(k) && (line[k] == ' ' || line[k] == '\t' || line[k] == '\n'); };
+
+    size_t pos = 0;
+    while (pos < line.size() && is_ifs_space(pos))
+        ++pos;
+    for (size_t v = 0; v < names.size(); ++v) {
+        if (v + 1 == names.size()) {
+            size_t end = line.size();
+            while (end > pos && is_ifs_space(end - 1))
+                --end;
+            shell.vars.set(names[v], std::string_view(line).substr(pos, end - pos));
+            break;
+        }
+        size_t start = pos;
+        while (pos < line.size() && !is_ifs(pos))
+            ++pos;
+        shell.vars.set(names[v], std::string_view(line).substr(start, pos - start));
+        // Skip the delimiter: surrounding IFS white space and at most one
+        // other IFS character.
+        while (pos < line.size() && is_ifs_space(pos))
+            ++pos;
+        if (pos < line.size() && is_ifs(pos)) {
+            ++pos;
+            while (pos < line.size() && is_ifs_space(pos))
+                ++pos;
+        }
+    }
+    return newline ? 0 : 1;
+}
+
+// Options set with `set -o name` and cleared with `set +o name`.
+struct ShellOption {
+    std::string_view name;
+    bool Shell::*flag;
+};
+
+constexpr ShellOption kOptions[] = {
+    {"autobatch", &Shell::autobatch},
+    {"trace-timing", &Shell::trace_timing},
+};
+
+// set [-o|+o [name]]... [--] [arg...]
+int builtin_set(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    if (argc == 1) {
+        std::vector<std::pair<std::string_view, const std::string*>> vars;
+        shell.vars.for_each(
+            [&](std::string_view name, const std::string& value, bool) { vars.emplace_back(name, &value); });
+        std::sort(vars.begin(), vars.end());
+        std::string out;
+        for (const auto& [name, value] : vars) {
+            out += name;
+            out += '=';
+            append_quoted(out, *value);
+            out += '\n';
+        }
+        return emit(io, out) ? 0 : write_error(io, "set");
+    }
+
+    int i = 1;
+    for (; i < argc && (argv[i][0] == '-' || argv[i][0] == '+') && argv[i][1]; ++i) {
+        std::string_view opt = argv[i];
+        if (opt == "--") {
+            ++i;
+            shell.positional.assign(argv + i, argv + argc);
+            return 0;
+        }
+        if (opt != "-o" && opt != "+o") {
+            say(io, io.err, "set: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+        bool on = opt[0] == '-';
+        if (i + 1 == argc) {
+            std::string out;
+            for (const ShellOption& o : kOptions) {
+                bool value = shell.*o.flag;
+                if (on) {
+                    out += o.name;
+                    out += value ? "\ton\n" : "\toff\n";
+                } else {
+                    out += value ? "set -o " : "set +o ";
+                    out += o.name;
+                    out += '\n';
+                }
+            }
+            return emit(io, out) ? 0 : write_error(io, "set");
+        }
+        std::string_view name = argv[++i];
+        const ShellOption* found = nullptr;
+        for (const ShellOption& o : kOptions) {
+            if (o.name == name)
+                found = &o;
+        }
+        if (!found) {
+            say(io, io.err, "set: %s: invalid option name\n", argv[i]);
+            return 2;
+        }
+        shell.*found->flag = on;
+    }
+    if (i < argc)
+        shell.positional.assign(argv + i, argv + argc);
+    return 0;
+}
+
+// Locates the file for `. name`: names without '/' are searched in $PATH,
+// then taken relative to the current directory.
+std::string source_path(Shell& shell, const char* name)
+{
+    if (std::strchr(name, '/'))
+        return name;
+    std::string_view path = search_path(shell);
+    std::string candidate;
+    for (;;) {
+        size_t colon = path.find(':');
+        std::string_view dir = path.substr(0, colon);
+        candidate.assign(dir.empty() ? std::string_view(".") : dir);
+        candidate += '/';
+        candidate += name;
+        struct stat st;
+        if (::stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) && ::access(candidate.c_str(), R_OK) == 0)
+            return candidate;
+        if (colon == std::string_view::npos)
+            break;
+        path.remove_prefix(colon + 1);
+    }
+    return name;
+}
+
+// . file [arg...]
+int builtin_source(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    if (argc < 2) {
+        say(io, io.err, "%s: filename argument required\n", argv[0]);
+        return 2;
+    }
+    std::shared_ptr<const ParsedScript> script = shell.scripts.load(source_path(shell, argv[1]));
+    if (!script) {
+        say(io, io.err, "%s: %s: %s\n", argv[0], argv[1], std::strerror(errno));
+        return 1;
+    }
+
+    bool has_args = argc > 2;
+    std::vector<std::string> saved;
+    if (has_args) {
+        saved = std::move(shell.positional);
+        shell.positional.assign(argv + 2, argv + argc);
+    }
+    ++shell.source_depth;
+    int status = run_parsed(shell, script->text, script->result, argv[1]);
+    --shell.source_depth;
+    if (has_args)
+        shell.positional = std::move(saved);
+    if (shell.flow == Flow::Return)
+        shell.flow = Flow::Normal;
+    return status;
+}
+
+// scriptcache [-r]: show the parse cache used by `.` and scripts, or clear
+// it and its counters.
+int builtin_scriptcache(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    ScriptCache& cache = shell.scripts;
+    if (argc > 1) {
+        if (std::strcmp(argv[1], "-r") != 0) {
+            say(io, io.err, "scriptcache: %s: invalid option\n", argv[1]);
+            return 2;
+        }
+        cache.clear();
+        return 0;
+    }
+    const ScriptCacheStats& st = cache.stats();
+    say(io, io.out, "entries %zu/%zu bytes %zu hits %llu misses %llu\n", cache.size(), ScriptCache::kMaxEntries,
+        cache.bytes(), static_cast<unsigned long long>(st.hits), static_cast<unsigned long long>(st.misses));
+    cache.for_each([&](const ParsedScript& s) {
+        say(io, io.out, "%4llu\t%zu\t%s\n", static_cast<unsigned long long>(s.hits), s.text.size(), s.path.c_str());
+    });
+    return 0;
+}
+
+// The marker `jobs` shows after a job number: '+' for the most recent job,
+// '-' for the one before it.
+char job_marker(JobTable& jobs, const Job& job)
+{
+    int newest = 0, previous = 0;
+    jobs.for_each([&](Job& j) {
+        previous = newest;
+        newest = j.id;
+    });
+    return job.id == newest ? '+' : job.id == previous ? '-' : ' ';
+}
+
+// history [n]: the last n entries, or all of them, numbered from 1.
+int builtin_history(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    History& history = shell.history;
+    history.refresh();
+    size_t first = 0;
+    if (argc > 1) {
+        long long n;
+        if (!parse_integer(argv[1], n) || n < 0) {
+            say(io, io.err, "history: %s: numeric argument required\n", argv[1]);
+            return 2;
+        }
+        if (static_cast<size_t>(n) < history.size())
+            first = history.size() - static_cast<size_t>(n);
+    }
+    std::string out;
+    char number[32];
+    for (size_t i = first; i < history.size(); ++i) {
+        std::snprintf(number, sizeof number, "%5zu  ", i + 1);
+        out += number;
+        out += history[i];
+        out += '\n';
+        if (out.size() >= 65536) {
+            if (!emit(io, out))
+                return write_error(io, "history");
+            out.clear();
+        }
+    }
+    return emit(io, out) ? 0 : write_error(io, "history");
+}
+
+// jobs [-l|-p]
+int builtin_jobs(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    bool pids_only = false;
+    bool with_pid = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-p") == 0) {
+            pids_only = true;
+        } else if (std::strcmp(argv[i], "-l") == 0) {
+            with_pid = true;
+        } else {
+            say(io, io.err, "jobs: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+    }
+    JobTable& jobs = shell.jobs;
+    jobs.poll();
+    std::string out;
+    char line[128];
+    jobs.for_each([&](Job& job) {
+        if (pids_only) {
+            std::snprintf(line, sizeof line, "%ld\n", static_cast<long>(job.pid));
+            out += line;
+            return;
+        }
+        std::snprintf(line, sizeof line, "[%d]%c  ", job.id, job_marker(jobs, job));
+        out += line;
+        if (with_pid) {
+            std::snprintf(line, sizeof line, "%ld ", static_cast<long>(job.pid));
+            out += line;
+        }
+        std::snprintf(line, sizeof line, "%-24s", JobTable::describe(job).c_str());
+        out += line;
+        out += job.command;
+        out += '\n';
+        job.notified = job.done;
+    });
+    jobs.prune();
+    return emit(io, out) ? 0 : write_error(io, "jobs");
+}
+
+// Parses a cpulist as taskset -c and /sys/devices/system/node take it:
+// "0-3,8,10-11".
+bool parse_cpu_list(std::string_view text, cpu_set_t& cpus)
+{
+    CPU_ZERO(&cpus);
+    if (text.empty())
+        return false;
+    for (size_t start = 0; start <= text.size();) {
+        size_t comma = text.find(',', start);
+        if (comma == std::string_view::npos)
+            comma = text.size();
+        std::string_view range = text.substr(start, comma - start);
+        start = comma + 1;
+        size_t dash = range.find('-');
+        long long lo, hi;
+        if (!parse_integer(range.substr(0, dash), lo))
+            return false;
+        hi = lo;
+        if (dash != std::string_view::npos && !parse_integer(range.substr(dash + 1), hi))
+            return false;
+        if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+            return false;
+        for (long long cpu = lo; cpu <= hi; ++cpu)
+            CPU_SET(static_cast<int>(cpu), &cpus);
+    }
+    return true;
+}
+
+// The CPUs of NUMA node, from sysfs.
+bool node_cpus(int node, cpu_set_t& cpus)
+{
+    char path[64];
+    std::snprintf(path, sizeof path, "/sys/devices/system/node/node%d/cpulist", node);
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    char buf[4096];
+    ssize_t n = ::read(fd, buf, sizeof buf);
+    ::close(fd);
+    if (n <= 0)
+        return false;
+    std::string_view list(buf, static_cast<size_t>(n));
+    while (!list.empty() && list.back() == '\n')
+        list.remove_suffix(1);
+    return parse_cpu_list(list, cpus);
+}
+
+std::string describe_placement(const JobPlacement& placement)
+{
+    std::string out = "jobopts";
+    char buf[64];
+    if (!placement.cgroup.empty())
+        out += " cgroup=" + placement.cgroup;
+    if (!placement.cpu_list.empty())
+        out += " cpus=" + placement.cpu_list;
+    if (placement.node >= 0) {
+        std::snprintf(buf, sizeof buf, " node=%d", placement.node);
+        out += buf;
+    }
+    if (placement.nice) {
+        std::snprintf(buf, sizeof buf, " nice=%d", *placement.nice);
+        out += buf;
+    }
+    if (placement.ioprio >= 0) {
+        int level = IOPRIO_PRIO_DATA(placement.ioprio);
+        switch (IOPRIO_PRIO_CLASS(placement.ioprio)) {
+        case IOPRIO_CLASS_RT:
+            std::snprintf(buf, sizeof buf, " ioprio=rt:%d", level);
+            break;
+        case IOPRIO_CLASS_BE:
+            std::snprintf(buf, sizeof buf, " ioprio=be:%d", level);
+            break;
+        default:
+            std::snprintf(buf, sizeof buf, " ioprio=idle");
+            break;
+        }
+        out += buf;
+    }
+    out += '\n';
+    return out;
+}
+
+// jobopts [-r] [cgroup=DIR] [cpus=LIST] [node=N] [nice=N] [ioprio=CLASS[:LEVEL]]
+//
+// Sets where background jobs and parallel's workers run: the cgroup v2
+// directory they join, the CPUs they may use, the NUMA node whose memory
+// they prefer (and, without cpus=, whose CPUs they run on), their nice
+// value and their I/O class (rt, be or idle) and level. An empty value
+// clears a setting, -r clears them all, and with no arguments the current
+// settings are printed as a jobopts command. Foreground commands are not
+// affected.
+int builtin_jobopts(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    if (argc == 1)
+        return say(io, io.out, "%s", describe_placement(shell.placement).c_str()) ? 0 : write_error(io, "jobopts");
+    JobPlacement placement = shell.placement;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "-r") {
+            placement = JobPlacement();
+            continue;
+        }
+        size_t eq = arg.find('=');
+        if (eq == std::string_view::npos) {
+            say(io, io.err, "jobopts: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+        std::string_view key = arg.substr(0, eq);
+        std::string_view value = arg.substr(eq + 1);
+        long long n = 0;
+        bool ok = value.empty() || key == "cgroup" || key == "cpus" || key == "ioprio" || parse_integer(value, n);
+        if (key == "cgroup") {
+            placement.cgroup.clear();
+            if (!value.empty()) {
+                char real[PATH_MAX];
+                std::string procs = std::string(value) + "/cgroup.procs";
+                ok = ::realpath(std::string(value).c_str(), real) && ::access(procs.c_str(), W_OK) == 0;
+                if (ok)
+                    placement.cgroup = real;
+            }
+        } else if (key == "cpus") {
+            placement.cpu_list.clear();
+            if (!value.empty()) {
+                cpu_set_t cpus, allowed;
+                ok = parse_cpu_list(value, cpus);
+                // At least one of them must be a CPU the shell may use.
+                if (ok && ::sched_getaffinity(0, sizeof allowed, &allowed) == 0) {
+                    CPU_AND(&cpus, &cpus, &allowed);
+                    ok = CPU_COUNT(&cpus) > 0;
+                }
+                if (ok)
+                    placement.cpu_list = value;
+            }
+        } else if (key == "node") {
+            cpu_set_t cpus;
+            ok = ok && n >= -1 && n < 1024 && (value.empty() || node_cpus(static_cast<int>(n), cpus));
+            placement.node = value.empty() ? -1 : static_cast<int>(n);
+        } else if (key == "nice") {
+            ok = ok && n >= -20 && n <= 19;
+            placement.nice.reset();
+            if (!value.empty())
+                placement.nice = static_cast<int>(n);
+        } else if (key == "ioprio") {
+            placement.ioprio = -1;
+            std::string_view cls = value.substr(0, value.find(':'));
+            long long level = 4;
+            if (cls.size() < value.size())
+                ok = parse_integer(value.substr(cls.size() + 1), level) && level >= 0 && level <= 7 &&
+                     cls != "idle";
+            if (cls == "rt")
+                placement.ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_RT, level);
+            else if (cls == "be")
+                placement.ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, level);
+            else if (cls == "idle")
+                placement.ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0);
+            else
+                ok = ok && value.empty();
+        } else {
+            say(io, io.err, "jobopts: %s: unknown setting\n", argv[i]);
+            return 2;
+        }
+        if (!ok) {
+            say(io, io.err, "jobopts: %s: invalid value\n", argv[i]);
+            return 1;
+        }
+    }
+    // Affinity: the given CPUs, else those of the node.
+    placement.has_cpus = !placement.cpu_list.empty()  ? parse_cpu_list(placement.cpu_list, placement.cpus)
+                         : placement.node >= 0 ? node_cpus(placement.node, placement.cpus)
+                                               : false;
+    shell.placement = std::move(placement);
+    return 0;
+}
+
+// One command run by `parallel`, with its output held until every earlier
+// command's output has been written.
+struct ParallelTask {
+    size_t first = 0; // its arguments, [first, last)
+    size_t last = 0;
+    int out = -1; // memfds capturing stdout and stderr
+    int err = -1;
+    int job = 0;
+    bool done = false;
+    int status = 0;
+};
+
+// Builds the command for args [first, last): each word with {} in it is
+// repeated for every argument with {} replaced by it; without such a word
+// the arguments are appended.
+Fields parallel_argv(const std::vector<std::string>& command, const Fields& args, size_t first, size_t last)
+{
+    Fields argv;
+    bool replaced = false;
+    for (const std::string& word : command) {
+        if (word.find("{}") == std::string::npos) {
+            argv.push_back(word);
+            continue;
+        }
+        for (size_t a = first; a < last; ++a) {
+            std::string w = word;
+            for (size_t at = w.find("{}"); at != std::string::npos; at = w.find("{}", at + args[a].size()))
+                w.replace(at, 2, args[a]);
+            argv.push_back(w);
+        }
+        replaced = true;
+    }
+    if (!replaced)
+        argv.append(args, first, last);
+    return argv;
+}
+
+// What argument a adds to a command built by parallel_argv(), counted as
+// exec_size() counts.
+size_t parallel_arg_size(const std::vector<std::string>& command, std::string_view arg)
+{
+    size_t size = 0;
+    bool replaced = false;
+    for (const std::string& word : command) {
+        size_t uses = 0;
+        for (size_t at = word.find("{}"); at != std::string::npos; at = word.find("{}", at + 2))
+            ++uses;
+        if (uses) {
+            size += word.size() + uses * arg.size() - uses * 2 + 1 + sizeof(char*);
+            replaced = true;
+        }
+    }
+    return replaced ? size : arg.size() + 1 + sizeof(char*);
+}
+
+// parallel [-j N] [-k] [-X] command [arg...] [::: arg...]
+//
+// Runs command once per argument (read one per line from standard input
+// without :::), at most N at a time (default: one per online CPU), as jobs
+// of the shell's job table. With -X each job takes as many arguments as
+// one exec allows instead, the arguments shared out evenly over the N
+// slots. Each job's output is captured in memfds and written in argument
+// order. The status is the number of failed jobs, capped at 101.
+int builtin_parallel(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    flush(io);
+    long jobs_max = ::sysconf(_SC_NPROCESSORS_ONLN);
+    bool batch = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; ++i) {
+        std::string_view opt = argv[i];
+        if (opt == "--") {
+            ++i;
+            break;
+        }
+        if (opt == "-k")
+            continue; // output is always kept in order
+        if (opt == "-X") {
+            batch = true;
+            continue;
+        }
+        if (opt.starts_with("-j")) {
+            const char* value = opt.size() > 2 ? argv[i] + 2 : i + 1 < argc ? argv[++i] : "";
+            long long n;
+            if (!parse_integer(value, n) || n < 1 || n > 4096) {
+                say(io, io.err, "parallel: %s: invalid job count\n", value);
+                return 2;
+            }
+            jobs_max = static_cast<long>(n);
+            continue;
+        }
+        say(io, io.err, "parallel: %s: invalid option\n", argv[i]);
+        return 2;
+    }
+    std::vector<std::string> command;
+    for (; i < argc && std::strcmp(argv[i], ":::") != 0; ++i)
+        command.emplace_back(argv[i]);
+    if (command.empty()) {
+        say(io, io.err, "parallel: usage: parallel [-j N] [-X] command [arg...] [::: arg...]\n");
+        return 2;
+    }
+
+    Fields args;
+    if (i < argc) {
+        for (++i; i < argc; ++i)
+            args.push_back(argv[i]);
+    } else {
+        std::string input;
+        char buf[4096];
+        for (;;) {
+            ssize_t n = ::read(io.in, buf, sizeof buf);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            input.append(buf, static_cast<size_t>(n));
+        }
+        for (size_t pos = 0; pos < input.size();) {
+            size_t nl = input.find('\n', pos);
+            size_t end = nl == std::string::npos ? input.size() : nl;
+            args.push_back(std::string_view(input).substr(pos, end - pos));
+            pos = end + 1;
+        }
+    }
+
+    // Commands are built as each starts; only the ranges are kept.
+    std::vector<ParallelTask> tasks;
+    if (!batch) {
+        tasks.resize(args.size());
+        for (size_t t = 0; t < args.size(); ++t) {
+            tasks[t].first = t;
+            tasks[t].last = t + 1;
+        }
+    } else if (!args.empty()) {
+        Envp scratch;
+        LaunchSpec spec;
+        Fields bare = parallel_argv(command, args, 0, 0);
+        std::vector<char*> bare_argv = bare.argv();
+        spec.path = "";
+        spec.argv = bare_argv.data();
+        spec.envp = shell.vars.environment({}, scratch);
+        size_t fixed = exec_size(spec).total + PATH_MAX; // the resolved path is not known here
+        size_t room = exec_limit() > fixed ? exec_limit() - fixed : 0;
+        size_t share = (args.size() + jobs_max - 1) / jobs_max;
+        for (size_t a = 0; a < args.size();) {
+            ParallelTask task;
+            task.first = a;
+            size_t used = 0;
+            do
+                used += parallel_arg_size(command, args[a++]);
+            while (a < args.size() && a - task.first < share && used + parallel_arg_size(command, args[a]) <= room);
+            task.last = a;
+            tasks.push_back(task);
+        }
+    }
+
+    JobTable& jobs = shell.jobs;
+    size_t next = 0;    // first task not started
+    size_t emitted = 0; // first task whose output is not written yet
+    size_t running = 0;
+    int failures = 0;
+    while (emitted < tasks.size()) {
+        for (; running < static_cast<size_t>(jobs_max) && next < tasks.size(); ++next) {
+            ParallelTask& task = tasks[next];
+            task.out = ::memfd_create("parallel-out", MFD_CLOEXEC);
+            task.err = ::memfd_create("parallel-err", MFD_CLOEXEC);
+            Fields task_argv = parallel_argv(command, args, task.first, task.last);
+            std::string text;
+            for (size_t w = 0; w < task_argv.size(); ++w) {
+                if (w)
+                    text += ' ';
+                text += task_argv[w];
+            }
+            pid_t pid = -1;
+            if (task.out >= 0 && task.err >= 0) {
+                FdPlan fds;
+                fds.open(0, "/dev/null", O_RDONLY);
+                fds.dup(task.out, 1);
+                fds.dup(task.err, 2);
+                pid = start_command(shell, std::move(task_argv), fds, job_placement(shell));
+            } else {
+                say(io, io.err, "parallel: memfd_create: %s\n", std::strerror(errno));
+            }
+            if (pid < 0) {
+                task.done = true;
+                task.status = 127;
+                continue;
+            }
+            task.job = jobs.add(pid, std::move(text));
+            ++running;
+        }
+
+        if (running > 0 && !tasks[emitted].done) {
+            jobs.wait_any();
+            for (size_t t = emitted; t < next; ++t) {
+                ParallelTask& task = tasks[t];
+                Job* job = task.job ? jobs.find(task.job) : nullptr;
+                if (task.done || !job || !job->done)
+                    continue;
+                task.done = true;
+                task.status = JobTable::exit_status(job->wait_status);
+                jobs.remove(task.job);
+                --running;
+            }
+        }
+
+        for (; emitted < tasks.size() && tasks[emitted].done; ++emitted) {
+            ParallelTask& task = tasks[emitted];
+            for (auto [fd, to, count] : {std::tuple{task.out, io.out, io.out_pipe}, {task.err, io.err, nullptr}}) {
+                if (fd < 0)
+                    continue;
+                ::lseek(fd, 0, SEEK_SET);
+                transfer(fd, to, nullptr, count);
+                ::close(fd);
+            }
+            if (task.status != 0)
+                ++failures;
+        }
+    }
+    return std::min(failures, 101);
+}
+
+// pipestats [-r]: bytes the shell moved through pipeline pipes itself.
+int builtin_pipestats(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    PipeStats& stats = shell.pipes;
+    if (argc > 1) {
+        if (std::strcmp(argv[1], "-r") != 0) {
+            say(io, io.err, "pipestats: %s: invalid option\n", argv[1]);
+            return 2;
+        }
+        stats = PipeStats();
+        return 0;
+    }
+    say(io, io.out, "zero-copy %llu copied %llu\n", static_cast<unsigned long long>(stats.total.zero_copy),
+        static_cast<unsigned long long>(stats.total.copied));
+    for (size_t i = 0; i < stats.last.size(); ++i) {
+        say(io, io.out, "%4zu\t%llu\t%llu\n", i + 1, static_cast<unsigned long long>(stats.last[i].zero_copy),
+            static_cast<unsigned long long>(stats.last[i].copied));
+    }
+    return 0;
+}
+
+// forkstats [-r]: subshells run, and how many of them needed no fork of
+// their own. A command exec'd in place as the last of a process is not
+// counted: the process counting it is gone.
+int builtin_forkstats(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    if (argc > 1) {
+        if (std::strcmp(argv[1], "-r") != 0) {
+            say(io, io.err, "forkstats: %s: invalid option\n", argv[1]);
+            return 2;
+        }
+        shell.subshells = shell.forkless_subshells = 0;
+        return 0;
+    }
+    unsigned long long total = shell.subshells;
+    unsigned long long forkless = shell.forkless_subshells;
+    return say(io, io.out, "subshells %llu forkless %llu forked %llu\n", total, forkless, total - forkless)
+               ? 0
+               : write_error(io, "forkstats");
+}
+
+// substats [-r]: command substitutions run, and how many of them ran
+// without a fork.
+int builtin_substats(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    if (argc > 1) {
+        if (std::strcmp(argv[1], "-r") != 0) {
+            say(io, io.err, "substats: %s: invalid option\n", argv[1]);
+            return 2;
+        }
+        shell.substitutions = shell.forkless_substitutions = 0;
+        return 0;
+    }
+    unsigned long long total = shell.substitutions;
+    unsigned long long forkless = shell.forkless_substitutions;
+    return say(io, io.out, "substitutions %llu forkless %llu forked %llu\n", total, forkless, total - forkless)
+               ? 0
+               : write_error(io, "substats");
+}
+
+// test expression / [ expression ]: POSIX rules by argument count for up
+// to four arguments, with -a, -o, ! and parentheses beyond that.
+class TestExpr {
+public:
+    TestExpr(BuiltinIo& io, const char* name, char** args, int count) : io_(io), name_(name), args_(args), count_(count)
+    {
+    }
+
+    // 0 if true, 1 if false, 2 on error.
+    int run()
+    {
+        bool value = eval(0, count_);
+        if (!error_ && pos_ != count_) {
+            say(io_, io_.err, "%s: %s: unexpected argument\n", name_, args_[pos_]);
+            error_ = true;
+        }
+        return error_ ? 2 : !value;
+    }
+
+private:
+    bool eval(int start, int n)
+    {
+        pos_ = start;
+        switch (n) {
+        case 0:
+            return false;
+        case 1:
+            pos_ = start + 1;
+            return args_[start][0] != '\0';
+        case 2:
+            if (is(start, "!")) {
+                pos_ = start + 2;
+                return args_[start + 1][0] == '\0';
+            }
+            if (is_unary(args_[start])) {
+                pos_ = start + 2;
+                return unary(args_[start], args_[start + 1]);
+            }
+            break;
+        case 3:
+            if (is_binary(args_[start + 1])) {
+                pos_ = start + 3;
+                return binary(args_[start], args_[start + 1], args_[start + 2]);
+            }
+            if (is(start, "!")) {
+                bool value = !eval(start + 1, 2);
+                return value;
+            }
+            if (is(start, "(") && is(start + 2, ")")) {
+                pos_ = start + 3;
+                return args_[start + 1][0] != '\0';
+            }
+            break;
+        case 4:
+            if (is(start, "!"))
+                return !eval(start + 1, 3);
+            if (is(start, "(") && is(start + 3, ")")) {
+                bool value = eval(start + 1, 2);
+                pos_ = start + 4;
+                return value;
+            }
+            break;
+        }
+        return or_expr();
+    }
+
+    bool or_expr()
+    {
+        bool value = and_expr();
+        while (!error_ && pos_ < count_ && is(pos_, "-o")) {
+            ++pos_;
+            value = and_expr() || value;
+        }
+        return value;
+    }
+
+    bool and_expr()
+    {
+        bool value = not_expr();
+        while (!error_ && pos_ < count_ && is(pos_, "-a")) {
+            ++pos_;
+            value = not_expr() && value;
+        }
+        return value;
+    }
+
+    bool not_expr()
+    {
+        if (pos_ < count_ && is(pos_, "!")) {
+            ++pos_;
+            return !not_expr();
+        }
+        return primary();
+    }
+
+    bool primary()
+    {
+        if (pos_ >= count_) {
+            say(io_, io_.err, "%s: argument expected\n", name_);
+            error_ = true;
+            return false;
+        }
+        if (is(pos_, "(")) {
+            ++pos_;
+            bool value = or_expr();
+            if (pos_ >= count_ || !is(pos_, ")")) {
+                say(io_, io_.err, "%s: `)' expected\n", name_);
+                error_ = true;
+                return false;
+            }
+            ++pos_;
+            return value;
+        }
+        if (pos_ + 2 < count_ && is_binary(args_[pos_ + 1])) {
+            pos_ += 3;
+            return binary(args_[pos_ - 3], args_[pos_ - 2], args_[pos_ - 1]);
+        }
+        if (pos_ + 1 < count_ && is_unary(args_[pos_])) {
+            pos_ += 2;
+            return unary(args_[pos_ - 2], args_[pos_ - 1]);
+        }
+        return args_[pos_++][0] != '\0';
+    }
+
+    bool is(int i, const char* s) const { return std::strcmp(args_[i], s) == 0; }
+
+    static bool is_unary(const char* op)
+    {
+        return op[0] == '-' && op[1] && !op[2] && std::strchr("bcdefghLnprsStuwxzk", op[1]);
+    }
+
+    static bool is_binary(const char* op)
+    {
+        static constexpr const char* kOps[] = {"=",   "==",  "!=",  "<",   ">",   "-eq", "-ne", "-lt",
+                                               "-le", "-gt", "-ge", "-nt", "-ot", "-ef"};
+        for (const char* o : kOps) {
+            if (std::strcmp(op, o) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    bool unary(const char* op, const char* arg)
+    {
+        switch (op[1]) {
+        case 'n':
+            return arg[0] != '\0';
+        case 'z':
+            return arg[0] == '\0';
+        case 't': {
+            long long fd;
+            return parse_integer(arg, fd) && fd >= 0 && fd <= INT_MAX && ::isatty(static_cast<int>(fd));
+        }
+        case 'r':
+            return ::access(arg, R_OK) == 0;
+        case 'w':
+            return ::access(arg, W_OK) == 0;
+        case 'x':
+            return ::access(arg, X_OK) == 0;
+        }
+
+        struct stat st;
+        if (op[1] == 'h' || op[1] == 'L')
+            return ::lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+        if (::stat(arg, &st) < 0)
+            return false;
+        switch (op[1]) {
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 'f': return S_ISREG(st.st_mode);
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 'S': return S_ISSOCK(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'g': return st.st_mode & S_ISGID;
+        case 'u': return st.st_mode & S_ISUID;
+        case 'k': return st.st_mode & S_ISVTX;
+        default: return true; // -e
+        }
+    }
+
+    bool integer(const char* arg, long long& out)
+    {
+        if (parse_integer(arg, out))
+            return true;
+        say(io_, io_.err, "%s: %s: integer expression expected\n", name_, arg);
+        error_ = true;
+        return false;
+    }
+
+    bool binary(const char* a, std::string_view op, const char* b)
+    {
+        if (op == "=" || op == "==")
+            return std::strcmp(a, b) == 0;
+        if (op == "!=")
+            return std::strcmp(a, b) != 0;
+        if (op == "<")
+            return std::strcmp(a, b) < 0;
+        if (op == ">")
+            return std::strcmp(a, b) > 0;
+        if (op == "-nt" || op == "-ot" || op == "-ef") {
+            struct stat sa, sb;
+            bool ha = ::stat(a, &sa) == 0;
+            bool hb = ::stat(b, &sb) == 0;
+            if (op == "-ef")
+                return ha && hb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+            auto newer = [](const struct stat& x, const struct stat& y) {
+                return x.st_mtim.tv_sec != y.st_mtim.tv_sec ? x.st_mtim.tv_sec > y.st_mtim.tv_sec
+                                                            : x.st_mtim.tv_nsec > y.st_mtim.tv_nsec;
+            };
+            if (op == "-nt")
+                return ha && (!hb || newer(sa, sb));
+            return hb && (!ha || newer(sb, sa));
+        }
+
+        long long x, y;
+        if (!integer(a, x) || !integer(b, y))
+            return false;
+        if (op == "-eq") return x == y;
+        if (op == "-ne") return x != y;
+        if (op == "-lt") return x < y;
+        if (op == "-le") return x <= y;
+        if (op == "-gt") return x > y;
+        return x >= y; // -ge
+    }
+
+    BuiltinIo& io_;
+    const char* name_;
+    char** args_;
+    int count_;
+    int pos_ = 0;
+    bool error_ = false;
+};
+
+int builtin_test(Shell&, BuiltinIo& io, int argc, char** argv)
+{
+    if (argv[0][0] == '[') {
+        if (argc < 2 || std::strcmp(argv[argc - 1], "]") != 0) {
+            say(io, io.err, "[: missing `]'\n");
+            return 2;
+        }
+        --argc;
+    }
+    return TestExpr(io, argv[0], argv + 1, argc - 1).run();
+}
+
+// wait [pid|%job...]
+int builtin_wait(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    flush(io);
+    JobTable& jobs = shell.jobs;
+    if (argc == 1) {
+        jobs.wait_all();
+        jobs.for_each([](Job& job) { job.notified = true; });
+        jobs.prune();
+        return 0;
+    }
+    int status = 0;
+    for (int i = 1; i < argc; ++i) {
+        const char* spec = argv[i];
+        long long n;
+        bool by_job = spec[0] == '%';
+        if (!parse_integer(spec + by_job, n) || n <= 0 || n > INT_MAX) {
+            say(io, io.err, "wait: `%s': not a pid or valid job spec\n", spec);
+            status = 2;
+            continue;
+        }
+        Job* job = by_job ? jobs.find(static_cast<int>(n)) : jobs.find_pid(static_cast<pid_t>(n));
+        if (!job || job->inherited) {
+            if (by_job)
+                say(io, io.err, "wait: %s: no such job\n", spec);
+            else
+                say(io, io.err, "wait: pid %s is not a child of this shell\n", spec);
+            status = 127;
+            continue;
+        }
+        status = jobs.wait(*job);
+        jobs.remove(job->id);
+    }
+    return status;
+}
+
+int builtin_true(Shell&, BuiltinIo&, int, char**)
+{
+    return 0;
+}
+
+// tee [file...]: operands only (kNoOptions); see transfer_tee().
+int builtin_tee(Shell&, BuiltinIo& io, int argc, char** argv)
+{
+    flush(io);
+    int status = 0;
+    std::vector<int> files;
+    for (int i = 1; i < argc; ++i) {
+        int fd = ::open(argv[i], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            say(io, io.err, "tee: %s: %s\n", argv[i], std::strerror(errno));
+            status = 1;
+            continue;
+        }
+        files.push_back(fd);
+    }
+    if (!transfer_tee(io.in, io.out, files, io.in_pipe, io.out_pipe))
+        status = write_error(io, "tee");
+    for (int fd : files)
+        ::close(fd);
+    return status;
+}
+
+// unset [-f|-v] name...
+int builtin_unset(Shell& shell, BuiltinIo& io, int argc, char** argv)
+{
+    bool functions = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; ++i) {
+        std::string_view opt = argv[i];
+        if (opt == "--") {
+            ++i;
+            break;
+        }
+        if (opt == "-f") {
+            functions = true;
+        } else if (opt != "-v") {
+            say(io, io.err, "unset: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+    }
+    int status = 0;
+    for (; i < argc; ++i) {
+        if (functions) {
+            shell.functions.erase(argv[i]);
+        } else if (is_name(argv[i])) {
+            shell.vars.unset(argv[i]);
+        } else {
+            say(io, io.err, "unset: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// Sorted by name for find_builtin().
+constexpr Builtin kBuiltins[] = {
+    {".", builtin_source, 0},
+    {":", builtin_colon, kThreadSafe},
+    {"[", builtin_test, kThreadSafe},
+    {"break", builtin_break, 0},
+    {"bytecode", builtin_bytecode, 0},
+    {"cat", builtin_cat, kThreadSafe | kNoOptions},
+    {"cd", builtin_cd, 0},
+    {"continue", builtin_continue, 0},
+    {"echo", builtin_echo, kThreadSafe},
+    {"exit", builtin_exit, 0},
+    {"export", builtin_export, 0},
+    {"false", builtin_false, kThreadSafe},
+    {"forkstats", builtin_forkstats, 0},
+    {"hash", builtin_hash, 0},
+    {"history", builtin_history, 0},
+    {"jobopts", builtin_jobopts, 0},
+    {"jobs", builtin_jobs, 0},
+    {"local", builtin_local, 0},
+    {"mapfile", builtin_mapfile, 0},
+    {"parallel", builtin_parallel, 0},
+    {"pipestats", builtin_pipestats, 0},
+    {"printf", builtin_printf, kThreadSafe},
+    {"pwd", builtin_pwd, kThreadSafe},
+    {"read", builtin_read, 0},
+    {"readarray", builtin_mapfile, 0},
+    {"return", builtin_return, 0},
+    {"scriptcache", builtin_scriptcache, 0},
+    {"set", builtin_set, 0},
+    {"source", builtin_source, 0},
+    {"substats", builtin_substats, 0},
+    {"tee", builtin_tee, kThreadSafe | kNoOptions},
+    {"test", builtin_test, kThreadSafe},
+    {"true", builtin_true, kThreadSafe},
+    {"unset", builtin_unset, 0},
+    {"wait", builtin_wait, 0},
+};
+
+constexpr bool by_name(const Builtin& a, const Builtin& b)
+{
+    return a.name < b.name;
+}
+
+static_assert(std::is_sorted(std::begin(kBuiltins), std::end(kBuiltins), by_name));
+
+} // namespace
+
+bool flush_output()
+{
+    return output.flush();
+}
+
+std::span<const Builtin> all_builtins()
+{
+    return kBuiltins;
+}
+
+const Builtin* find_builtin(std::string_view name)
+{
+    const Builtin* it = std::lower_bound(std::begin(kBuiltins), std::end(kBuiltins), name,
+                                         [](const Builtin& b, std::string_view n) { return b.name < n; });
+    return it != std::end(kBuiltins) && it->name == name ? it : nullptr;
+}
+
+const Builtin* find_builtin(const Fields& fields)
+{
+    const Builtin* builtin = find_builtin(fields[0]);
+    if (builtin && (builtin->flags & kNoOptions)) {
+        for (size_t i = 1; i < fields.size(); ++i) {
+            if (fields[i].size() > 1 && fields[i][0] == '-')
+                return nullptr;
+        }
+    }
+    return builtin;
+}
+
+} // namespace sh
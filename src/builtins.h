@@ -0,0 +1,66 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sh {
+
+class Fields;
+struct PipeCounter;
+struct Shell;
+
+// The descriptors a builtin reads and writes. A builtin the shell runs
+// itself gets 0, 1 and 2 with the command's redirections already applied;
+// one running on a pipeline thread gets that stage's pipe ends instead.
+struct BuiltinIo {
+    int in = 0;
+    int out = 1;
+    int err = 2;
+    // Counters of the pipeline pipes behind in and out, if they are pipes
+    // (see PipeStats); null otherwise.
+    PipeCounter* in_pipe = nullptr;
+    PipeCounter* out_pipe = nullptr;
+    // Set for a builtin the shell runs itself: what it writes to out is
+    // held in the shell's output buffer (see flush_output()) rather than
+    // written with one write(2) per call.
+    bool buffered = false;
+};
+
+// A builtin receives a null-terminated argv (argv[0] is its own name) and
+// returns its exit status.
+using BuiltinFn = int (*)(Shell& shell, BuiltinIo& io, int argc, char** argv);
+
+enum BuiltinFlags : unsigned {
+    // Reads and writes only through BuiltinIo and never touches shell state,
+    // so a pipeline stage may run it on a thread instead of a forked child.
+    kThreadSafe = 1u << 0,
+    // Covers only calls without options; a call with any option runs the
+    // external utility of the same name instead.
+    kNoOptions = 1u << 1,
+};
+
+struct Builtin {
+    std::string_view name;
+    BuiltinFn fn;
+    unsigned flags;
+};
+
+// Writes out what builtins have buffered. Called wherever something else
+// may write to, or rearrange, the shell's descriptors: before a fork, a
+// launch, a redirection, a blocking read or wait, and at the end of each
+// command list. Returns false with errno set if the write failed.
+bool flush_output();
+
+// Every builtin, sorted by name.
+std::span<const Builtin> all_builtins();
+
+// Returns the builtin registered under name, or nullptr.
+const Builtin* find_builtin(std::string_view name);
+
+// Returns the builtin that runs the expanded command fields, or nullptr if
+// they name an external command (taking kNoOptions into account).
+const Builtin* find_builtin(const Fields& fields);
+
+} // namespace sh
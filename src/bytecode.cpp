@@ -0,0 +1,247 @@
+#include "bytecode.h"
+
+#include <cstdio>
+
+namespace sh {
+
+namespace {
+
+using Op = Insn::Op;
+
+class Compiler {
+public:
+    Program program;
+
+    void node(const Node* n)
+    {
+        if (n->async) {
+            run(n); // exec_node forks it off as a job
+            return;
+        }
+        switch (n->kind) {
+        case NodeKind::Sequence:
+            if (!n->redirs.empty())
+                break;
+            for (const Node* item : static_cast<const Sequence*>(n)->items)
+                node(item);
+            if (static_cast<const Sequence*>(n)->items.empty())
+                emit(Op::SetStatus);
+            return;
+        case NodeKind::AndOr: {
+            auto* andor = static_cast<const AndOr*>(n);
+            node(andor->left);
+            uint32_t skip = emit(andor->is_and ? Op::JumpIfFalse : Op::JumpIfTrue);
+            node(andor->right);
+            patch(skip);
+            return;
+        }
+        case NodeKind::Group:
+        case NodeKind::If:
+        case NodeKind::Loop:
+        case NodeKind::For:
+        case NodeKind::Case:
+            with_redirections(n);
+            return;
+        default:
+            break;
+        }
+        run(n);
+    }
+
+private:
+    uint32_t here() const { return static_cast<uint32_t>(program.code.size()); }
+
+    uint32_t emit(Op op, const Node* n = nullptr)
+    {
+        Insn insn{op};
+        insn.node = n;
+        program.code.push_back(insn);
+        return here() - 1;
+    }
+
+    void run(const Node* n) { emit(Op::Run, n); }
+
+    // Points the jump at `at` to the next instruction.
+    void patch(uint32_t at) { program.code[at].target = here(); }
+
+    void with_redirections(const Node* n)
+    {
+        if (n->redirs.empty()) {
+            compound(n);
+            return;
+        }
+        uint32_t push = emit(Op::PushRedir, n);
+        compound(n);
+        emit(Op::PopRedir);
+        patch(push);
+    }
+
+    void compound(const Node* n)
+    {
+        switch (n->kind) {
+        case NodeKind::Group:
+            node(static_cast<const Group*>(n)->body);
+            break;
+        case NodeKind::If: {
+            auto* branch = static_cast<const If*>(n);
+            node(branch->cond);
+            uint32_t to_else = emit(Op::JumpIfFalse);
+            node(branch->then_part);
+            uint32_t to_end = emit(Op::Jump);
+            patch(to_else);
+            if (branch->else_part)
+                node(branch->else_part);
+            else
+                emit(Op::SetStatus);
+            patch(to_end);
+            break;
+        }
+        case NodeKind::Loop: {
+            auto* loop = static_cast<const Loop*>(n);
+            uint32_t begin = emit(Op::LoopBegin);
+            program.code[begin].resume = here();
+            node(loop->cond);
+            uint32_t exit = emit(loop->until ? Op::JumpIfTrue : Op::JumpIfFalse);
+            node(loop->body);
+            emit(Op::LoopSave);
+            program.code[emit(Op::Jump)].target = program.code[begin].resume;
+            patch(exit);
+            patch(begin);
+            emit(Op::LoopEnd);
+            break;
+        }
+        case NodeKind::For: {
+            uint32_t begin = emit(Op::ForBegin, n);
+            uint32_t next = emit(Op::ForNext, n);
+            program.code[begin].resume = next;
+            node(static_cast<const For*>(n)->body);
+            emit(Op::LoopSave);
+            program.code[emit(Op::Jump)].target = next;
+            patch(next);
+            patch(begin);
+            emit(Op::LoopEnd);
+            break;
+        }
+        case NodeKind::Case: {
+            auto* c = static_cast<const Case*>(n);
+            emit(Op::CaseBegin, n);
+            std::vector<uint32_t> tests; // one per item, patched to its body
+            for (const CaseItem* item : c->items) {
+                tests.push_back(here());
+                for (const Word* pattern : item->patterns)
+                    program.code[emit(Op::CaseTest)].word = pattern;
+            }
+            std::vector<uint32_t> to_end{emit(Op::CaseEnd)};
+            size_t i = 0;
+            for (const CaseItem* item : c->items) {
+                for (uint32_t t = tests[i]; t < tests[i] + item->patterns.size; ++t)
+                    program.code[t].target = here();
+                ++i;
+                if (item->body)
+                    node(item->body);
+                else
+                    emit(Op::SetStatus);
+                if (item != c->items.tail)
+                    to_end.push_back(emit(Op::Jump));
+            }
+            for (uint32_t at : to_end)
+                patch(at);
+            break;
+        }
+        default:
+            run(n);
+            break;
+        }
+    }
+};
+
+const char* op_name(Op op)
+{
+    switch (op) {
+    case Op::Run:
+        return "run";
+    case Op::Jump:
+        return "jump";
+    case Op::JumpIfTrue:
+        return "jump-if-true";
+    case Op::JumpIfFalse:
+        return "jump-if-false";
+    case Op::SetStatus:
+        return "set-status";
+    case Op::PushRedir:
+        return "push-redir";
+    case Op::PopRedir:
+        return "pop-redir";
+    case Op::LoopBegin:
+        return "loop-begin";
+    case Op::LoopSave:
+        return "loop-save";
+    case Op::LoopEnd:
+        return "loop-end";
+    case Op::ForBegin:
+        return "for-begin";
+    case Op::ForNext:
+        return "for-next";
+    case Op::CaseBegin:
+        return "case-begin";
+    case Op::CaseTest:
+        return "case-test";
+    case Op::CaseEnd:
+        return "case-end";
+    }
+    return "?";
+}
+
+} // namespace
+
+Program compile(const Node* node)
+{
+    Compiler compiler;
+    compiler.node(node);
+    return std::move(compiler.program);
+}
+
+std::string dump(const Program& program)
+{
+    std::string out;
+    char line[64];
+    for (size_t pc = 0; pc < program.code.size(); ++pc) {
+        const Insn& insn = program.code[pc];
+        std::snprintf(line, sizeof line, "%5zu  %-14s", pc, op_name(insn.op));
+        out += line;
+        switch (insn.op) {
+        case Op::Run:
+            out += command_text(insn.node);
+            break;
+        case Op::Jump:
+        case Op::JumpIfTrue:
+        case Op::JumpIfFalse:
+        case Op::PushRedir:
+        case Op::ForNext:
+        case Op::CaseEnd:
+            out += "-> " + std::to_string(insn.target);
+            break;
+        case Op::LoopBegin:
+            out += "-> " + std::to_string(insn.target) + " continue " + std::to_string(insn.resume);
+            break;
+        case Op::ForBegin:
+            out += std::string(static_cast<const For*>(insn.node)->var) + " -> " + std::to_string(insn.target) +
+                   " continue " + std::to_string(insn.resume);
+            break;
+        case Op::CaseBegin:
+            out += std::string(static_cast<const Case*>(insn.node)->subject->raw);
+            break;
+        case Op::CaseTest:
+            out += std::string(insn.word->raw) + " -> " + std::to_string(insn.target);
+            break;
+        default:
+            break;
+        }
+        while (!out.empty() && out.back() == ' ')
+            out.pop_back();
+        out += '\n';
+    }
+    return out;
+}
+
+} // namespace sh
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "ast.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace sh {
+
+// Loops, case commands and function bodies are lowered from the tree into
+// a flat instruction list that the executor runs in one loop, so an
+// iteration costs a few array steps rather than a recursive walk through
+// every compound node of the body. Simple commands, pipelines, subshells
+// and anything run in the background stay tree nodes, run by one Run
+// instruction each; the instructions only encode the control flow around
+// them. A program points into the tree it was compiled from.
+struct Insn {
+    enum class Op : uint8_t {
+        Run,          // exec node; status := its status
+        Jump,         // goto target
+        JumpIfTrue,   // goto target if status is 0
+        JumpIfFalse,  // goto target if status is not 0
+        SetStatus,    // status := 0
+        PushRedir,    // apply node's redirections; on failure status := 1, goto target
+        PopRedir,     // undo the latest PushRedir
+        LoopBegin,    // enter a while/until loop ending at target, continuing at resume
+        LoopSave,     // remember status as the loop's status
+        LoopEnd,      // leave the loop; status := the loop's status
+        ForBegin,     // expand node's items and enter a loop ending at target
+        ForNext,      // assign the next item, or goto target when none is left
+        CaseBegin,    // expand node's subject
+        CaseTest,     // if pattern matches the subject: drop it, goto target
+        CaseEnd,      // no pattern matched: drop the subject, status := 0, goto target
+    };
+
+    Op op;
+    uint32_t target = 0;
+    uint32_t resume = 0;         // LoopBegin, ForBegin: where continue goes
+    const Node* node = nullptr;  // Run, PushRedir, ForBegin, ForNext, CaseBegin
+    const Word* word = nullptr;  // CaseTest
+};
+
+struct Program {
+    std::vector<Insn> code;
+};
+
+// Lowers node, which must outlive the result.
+Program compile(const Node* node);
+
+// One line per instruction, for the bytecode builtin.
+std::string dump(const Program& program);
+
+} // namespace sh
@@ -0,0 +1,199 @@
+#include "complete.h"
+
+#include "pathglob.h"
+
+#include <dirent.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string_view>
+#include <unordered_set>
+
+namespace sh {
+
+namespace {
+
+bool is_dir(const std::string& path, const DirCache::Entry& e)
+{
+    if (e.type == DT_DIR)
+        return true;
+    if (e.type != DT_LNK && e.type != DT_UNKNOWN)
+        return false;
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+} // namespace
+
+Completer::~Completer()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+        ++generation_;
+    }
+    wake_.notify_one();
+    if (thread_.joinable())
+        thread_.join();
+    if (event_fd_ >= 0)
+        ::close(event_fd_);
+}
+
+void Completer::start(Request request)
+{
+    notify_fd();
+    {
+        std::lock_guard lock(mutex_);
+        ++generation_;
+        next_ = std::move(request);
+        found_.clear();
+        done_ = false;
+        if (!thread_.joinable())
+            thread_ = std::thread(&Completer::run, this);
+    }
+    wake_.notify_one();
+}
+
+void Completer::cancel()
+{
+    std::lock_guard lock(mutex_);
+    ++generation_;
+    next_.reset();
+    found_.clear();
+    done_ = true;
+}
+
+int Completer::notify_fd()
+{
+    if (event_fd_ < 0)
+        event_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    return event_fd_;
+}
+
+bool Completer::take(std::vector<std::string>& out)
+{
+    uint64_t count;
+    if (event_fd_ >= 0)
+        (void)!::read(event_fd_, &count, sizeof count);
+    std::lock_guard lock(mutex_);
+    for (std::string& s : found_)
+        out.push_back(std::move(s));
+    found_.clear();
+    return done_;
+}
+
+void Completer::run()
+{
+    DirCache dirs(true);
+    for (;;) {
+        Request request;
+        uint64_t generation;
+        {
+            std::unique_lock lock(mutex_);
+            wake_.wait(lock, [this] { return stopping_ || next_; });
+            if (stopping_)
+                return;
+            request = std::move(*next_);
+            next_.reset();
+            generation = generation_;
+        }
+        search(dirs, request, generation);
+        std::lock_guard lock(mutex_);
+        if (generation_ == generation) {
+            done_ = true;
+            signal();
+        }
+    }
+}
+
+void Completer::search(DirCache& dirs, const Request& request, uint64_t generation)
+{
+    std::unordered_set<std::string> seen;
+    std::vector<std::string> batch;
+    const std::string& word = request.word;
+    auto flush = [&] {
+        bool current = add(batch, generation);
+        batch.clear();
+        return current;
+    };
+
+    if (request.command && word.find('/') == std::string::npos) {
+        for (const std::string& name : request.names) {
+            if (name.starts_with(word) && seen.insert(name).second)
+                batch.push_back(name);
+        }
+        if (!flush())
+            return;
+        std::string_view path = request.path;
+        for (size_t start = 0; start <= path.size();) {
+            size_t colon = path.find(':', start);
+            if (colon == std::string_view::npos)
+                colon = path.size();
+            std::string dir(path.substr(start, colon - start));
+            start = colon + 1;
+            if (!dir.empty() && !dir.ends_with('/'))
+                dir += '/';
+            dirs.list(dir, [&](std::span<const DirCache::Entry> entries) {
+                for (const DirCache::Entry& e : entries) {
+                    if (!e.name.starts_with(word) || e.type == DT_DIR || e.name[0] == '.')
+                        continue;
+                    std::string name(e.name);
+                    if (seen.contains(name))
+                        continue;
+                    std::string full = dir + name;
+                    if (::access(full.empty() ? "." : full.c_str(), X_OK) == 0 && !is_dir(full, e)) {
+                        seen.insert(name);
+                        batch.push_back(std::move(name));
+                    }
+                }
+                return flush();
+            });
+            if (generation_ != generation)
+                return;
+        }
+        return;
+    }
+
+    // Candidates keep the directory as typed; only the lookup sees ~ expanded.
+    std::string real = word.starts_with("~/") && !request.home.empty() ? request.home + word.substr(1) : word;
+    size_t slash = word.rfind('/');
+    std::string typed_dir = slash == std::string::npos ? std::string() : word.substr(0, slash + 1);
+    std::string base = slash == std::string::npos ? word : word.substr(slash + 1);
+    size_t real_slash = real.rfind('/');
+    std::string real_dir = real_slash == std::string::npos ? std::string() : real.substr(0, real_slash + 1);
+    dirs.list(real_dir, [&](std::span<const DirCache::Entry> entries) {
+        for (const DirCache::Entry& e : entries) {
+            if (e.name == "." || e.name == ".." || !e.name.starts_with(base))
+                continue;
+            if (e.name[0] == '.' && !base.starts_with('.'))
+                continue;
+            std::string candidate = typed_dir;
+            candidate += e.name;
+            if (is_dir(real_dir + std::string(e.name), e))
+                candidate += '/';
+            batch.push_back(std::move(candidate));
+        }
+        return flush();
+    });
+}
+
+bool Completer::add(const std::vector<std::string>& found, uint64_t generation)
+{
+    std::lock_guard lock(mutex_);
+    if (generation_ != generation)
+        return false;
+    if (!found.empty()) {
+        found_.insert(found_.end(), found.begin(), found.end());
+        signal();
+    }
+    return true;
+}
+
+void Completer::signal()
+{
+    uint64_t one = 1;
+    (void)!::write(event_fd_, &one, sizeof one);
+}
+
+} // namespace sh
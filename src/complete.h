@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sh {
+
+class DirCache;
+
+// Tab completion, searched on a thread of its own so that a huge or slow
+// directory (100k entries over NFS) never blocks the line editor. Only one
+// search runs at a time; starting another or cancelling abandons it as
+// soon as its current directory batch is done. Candidates are collected as
+// they are found, and notify_fd() becomes readable whenever there are new
+// ones, so the editor can show them while the search goes on.
+//
+// Directory listings stay in a DirCache between searches and are reread
+// only once a directory's mtime moves, so pressing tab again, or after
+// typing one more character, does not read the directory again.
+class Completer {
+public:
+    struct Request {
+        std::string word;                 // the text to complete, unquoted
+        bool command = false;             // in command position
+        std::vector<std::string> names;   // builtins, functions and hashed commands
+        std::string path;                 // $PATH, searched for commands
+        std::string home;                 // $HOME, for ~/
+    };
+
+    Completer() = default;
+    ~Completer();
+
+    Completer(const Completer&) = delete;
+    Completer& operator=(const Completer&) = delete;
+
+    // Starts searching for request, abandoning any search still running.
+    void start(Request request);
+    void cancel();
+
+    // Readable when candidates were added or the search finished.
+    int notify_fd();
+
+    // Moves the candidates found since the last call into out (unsorted)
+    // and returns whether the search has finished.
+    bool take(std::vector<std::string>& out);
+
+private:
+    void run();
+    void search(DirCache& dirs, const Request& request, uint64_t generation);
+    bool add(const std::vector<std::string>& found, uint64_t generation);
+    void signal();
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::optional<Request> next_;
+    std::atomic<uint64_t> generation_ = 0; // of the latest start() or cancel()
+    std::vector<std::string> found_;
+    bool done_ = true;
+    bool stopping_ = false;
+    int event_fd_ = -1;
+    std::thread thread_;
+};
+
+} // namespace sh
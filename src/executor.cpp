@@ -0,0 +1,1483 @@
+#include "executor.h"
+
+#include "arith.h"
+#include "builtins.h"
+#include "expand.h"
+#include "fdplan.h"
+#include "launch.h"
+#include "parser.h"
+#include "redirect.h"
+#include "shell.h"
+#include "trace.h"
+#include "transfer.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace sh {
+
+namespace {
+
+// tail: the node is the last thing this process runs, so its command may
+// take over the process rather than run in a child.
+int exec_node(Shell& shell, const Node* node, bool tail = false);
+int exec_command(Shell& shell, const Node* node, bool tail = false);
+int run_program(Shell& shell, const Program& program);
+bool expands_in_parent(const Node* node);
+
+// A simple command after expansion.
+struct Prepared {
+    Fields fields;
+    std::vector<std::string> assigns; // "name=value"
+    std::pair<size_t, size_t> widest; // fields of the word yielding the most
+};
+
+// Forks a child that continues running shell code. The child never returns
+// into the caller's frames: run it through child_main().
+pid_t fork_shell(Shell& shell)
+{
+    flush_output();
+    std::fflush(stdout);
+    std::fflush(stderr);
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        if (shell.interactive) {
+            ::signal(SIGINT, SIG_DFL);
+            ::signal(SIGQUIT, SIG_DFL);
+        }
+        shell.interactive = false;
+        shell.subshell = true;
+        shell.jobs.reset_in_child();
+    } else if (pid < 0) {
+        warn(shell, "fork: %s", std::strerror(errno));
+    }
+    return pid;
+}
+
+template <typename F>
+[[noreturn]] void child_main(Shell& shell, F&& body)
+{
+    int status;
+    try {
+        status = body();
+    } catch (const ExpansionError& e) {
+        warn(shell, "%s", e.what());
+        status = 1;
+    } catch (const std::exception& e) {
+        warn(shell, "%s", e.what());
+        status = 2;
+    }
+    flush_output();
+    std::fflush(stdout);
+    std::fflush(stderr);
+    ::_exit(status & 0xff);
+}
+
+void prepare(Shell& shell, const SimpleCommand* cmd, Prepared& out)
+{
+    expand_words(shell, cmd->words, out.fields, &out.widest);
+    for (const Assign* a : cmd->assigns) {
+        std::string value = expand_string(shell, a->value);
+        out.assigns.push_back(std::string(a->name) + "=" + value);
+    }
+}
+
+// Variable assignments prefixed to a builtin or function call: visible for
+// the duration of the call, then reverted.
+class TempAssignments {
+public:
+    TempAssignments(Shell& shell, const std::vector<std::string>& assigns) : shell_(shell)
+    {
+        for (const std::string& a : assigns) {
+            size_t eq = a.find('=');
+            std::string name = a.substr(0, eq);
+            const std::string* old = shell.vars.get(name);
+            saved_.push_back({name, old ? std::optional<std::string>(*old) : std::nullopt,
+                              shell.vars.is_exported(name)});
+            shell.vars.set(name, std::string_view(a).substr(eq + 1));
+            shell.vars.set_exported(name);
+        }
+    }
+
+    ~TempAssignments()
+    {
+        for (auto it = saved_.rbegin(); it != saved_.rend(); ++it) {
+            if (it->value) {
+                shell_.vars.set(it->name, *it->value);
+                shell_.vars.set_exported(it->name, it->exported);
+            } else {
+                shell_.vars.unset(it->name);
+            }
+        }
+    }
+
+private:
+    struct Saved {
+        std::string name;
+        std::optional<std::string> value;
+        bool exported;
+    };
+
+    Shell& shell_;
+    std::vector<Saved> saved_;
+};
+
+// Resolves the program for an external command; nullptr if not found.
+const char* resolve(Shell& shell, const char* name)
+{
+    if (std::strchr(name, '/'))
+        return name;
+    const std::string* path = shell.commands.find(name, search_path(shell));
+    return path ? path->c_str() : nullptr;
+}
+
+// The command line of a simple command, for trace output.
+std::string join_fields(const Fields& fields)
+{
+    std::string line;
+    for (size_t i = 0; i < fields.size(); ++i) {
+        if (i)
+            line += ' ';
+        line += fields[i];
+    }
+    return line;
+}
+
+// Prints "name: message" where a command set up by plan has its standard
+// error, as warn() does for the shell's own: `cmd 2>/dev/null` silences
+// the shell's complaints about cmd too, as in other shells.
+void warn_through(const Shell& shell, const FdPlan& plan, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+void warn_through(const Shell& shell, const FdPlan& plan, const char* fmt, ...)
+{
+    const FdAction* opened;
+    int fd = plan.source(2, &opened);
+    std::string text = shell.name + ": ";
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    std::vsnprintf(buf, sizeof buf, fmt, ap);
+    va_end(ap);
+    text += buf;
+    text += '\n';
+    flush_output();
+    std::fflush(stdout);
+    std::fflush(stderr);
+    int owned = -1;
+    if (opened)
+        fd = owned = ::open(opened->path.c_str(), opened->flags | O_CLOEXEC, opened->mode);
+    if (fd >= 0)
+        (void)!::write(fd, text.data(), text.size());
+    if (owned >= 0)
+        ::close(owned);
+}
+
+// Starts an external command without waiting for it. base, if given, is
+// applied before the command's own redirections. Returns the pid, or -1
+// after printing a diagnostic (status then holds the exit status to use).
+// launch_us, if given, receives the time launch() took. With in_place the
+// command replaces the shell instead, and the call returns only if it
+// could not start. placement, if given, is applied to the new process.
+pid_t spawn_external(Shell& shell, Prepared& cmd, const List<Redir>& redirs, const FdPlan* base, int& status,
+                     int64_t* launch_us = nullptr, bool in_place = false, const JobPlacement* placement = nullptr)
+{
+    Redirection redir;
+    if (!redir.open(shell, redirs)) {
+        status = 1;
+        return -1;
+    }
+    FdPlan plan;
+    if (base)
+        plan.append(*base);
+    plan.append(redir.plan());
+
+    const char* path = resolve(shell, cmd.fields.c_str(0));
+    if (!path) {
+        warn_through(shell, plan, "%s: command not found", cmd.fields.c_str(0));
+        status = 127;
+        return -1;
+    }
+
+    std::vector<char*> argv = cmd.fields.argv();
+    Envp scratch;
+    LaunchSpec spec;
+    spec.path = path;
+    spec.argv = argv.data();
+    spec.envp = shell.vars.environment(cmd.assigns, scratch);
+    spec.fds = &plan;
+    spec.placement = placement;
+    // Known before anything is started, so the failure says how far over
+    // the command is rather than only that exec refused it.
+    ExecSize size = exec_size(spec);
+    if (size.total > exec_limit() || size.longest > exec_string_limit()) {
+        if (size.total > exec_limit())
+            warn_through(shell, plan,
+                         "%s: argument list too long: %zu bytes in %zu arguments and the environment, limit %zu",
+                         cmd.fields.c_str(0), size.total, cmd.fields.size(), exec_limit());
+        else
+            warn_through(shell, plan, "%s: argument too long: %zu bytes, limit %zu", cmd.fields.c_str(0),
+                         size.longest, exec_string_limit());
+        status = 126;
+        errno = E2BIG;
+        return -1;
+    }
+    flush_output();
+    if (in_place) {
+        std::fflush(stdout);
+        std::fflush(stderr);
+    }
+    auto start_spec = [&] { return in_place ? exec_in_place(spec) : launch(spec, shell.launcher); };
+    int64_t start = launch_us ? monotonic_us() : 0;
+    pid_t pid = start_spec();
+    if (pid < 0 && errno == ENOENT && !std::strchr(cmd.fields.c_str(0), '/')) {
+        // The hashed program went away before its directory was rechecked.
+        shell.commands.forget(cmd.fields[0]);
+        if ((path = resolve(shell, cmd.fields.c_str(0)))) {
+            spec.path = path;
+            pid = start_spec();
+        } else {
+            errno = ENOENT;
+        }
+    }
+    if (pid < 0 && errno == ENOEXEC) {
+        // No #! line: run it as a script in a fresh copy of this shell.
+        std::string script = path;
+        std::vector<char*> sh_argv;
+        sh_argv.push_back(shell.name.data());
+        sh_argv.push_back(script.data());
+        for (size_t i = 1; i + 1 < argv.size(); ++i)
+            sh_argv.push_back(argv[i]);
+        sh_argv.push_back(nullptr);
+        spec.path = "/proc/self/exe";
+        spec.argv = sh_argv.data();
+        pid = start_spec();
+    }
+    if (launch_us)
+        *launch_us = monotonic_us() - start;
+    if (pid < 0) {
+        int err = errno;
+        warn_through(shell, plan, "%s: %s", cmd.fields.c_str(0), std::strerror(err));
+        status = err == ENOENT ? 127 : 126;
+    }
+    return pid;
+}
+
+// Whether cmd, an external command, is too big for one exec and is to be
+// run in batches under set -o autobatch. Only the fields of its widest word
+// are split, and only if that is not the command name.
+bool needs_batches(Shell& shell, Prepared& cmd)
+{
+    auto [first, last] = cmd.widest;
+    if (!shell.autobatch || first == 0 || last - first < 2)
+        return false;
+    const char* path = resolve(shell, cmd.fields.c_str(0));
+    if (!path)
+        return false;
+    std::vector<char*> argv = cmd.fields.argv();
+    Envp scratch;
+    LaunchSpec spec;
+    spec.path = path;
+    spec.argv = argv.data();
+    spec.envp = shell.vars.environment(cmd.assigns, scratch);
+    return exec_size(spec).total > exec_limit();
+}
+
+// Runs cmd as xargs would: the fields of its widest word are split into
+// batches that fit one exec, each run with the fields before and after
+// them, one after another. The redirections are opened once for all of
+// them. Returns the status of the last batch that failed, or 0; a batch
+// killed by a signal ends the run.
+int run_batched(Shell& shell, Prepared& cmd, const List<Redir>& redirs)
+{
+    Redirection redir;
+    if (!redir.open(shell, redirs))
+        return 1;
+    auto [first, last] = cmd.widest;
+    Prepared batch;
+    batch.assigns = cmd.assigns;
+    batch.fields.append(cmd.fields, 0, first);
+    batch.fields.append(cmd.fields, last, cmd.fields.size());
+    std::vector<char*> argv = batch.fields.argv();
+    Envp scratch;
+    LaunchSpec spec;
+    spec.path = resolve(shell, cmd.fields.c_str(0));
+    spec.argv = argv.data();
+    spec.envp = shell.vars.environment(cmd.assigns, scratch);
+    size_t fixed = exec_size(spec).total;
+    size_t limit = exec_limit();
+    auto cost = [&](size_t i) { return cmd.fields.bytes(i, i + 1) + sizeof(char*); };
+
+    int status = 0;
+    for (size_t i = first; i < last;) {
+        size_t end = i;
+        size_t used = fixed;
+        do
+            used += cost(end++);
+        while (end < last && used + cost(end) <= limit);
+        batch.fields.clear();
+        batch.fields.append(cmd.fields, 0, first);
+        batch.fields.append(cmd.fields, i, end);
+        batch.fields.append(cmd.fields, last, cmd.fields.size());
+        int failed = 0;
+        pid_t pid = spawn_external(shell, batch, List<Redir>(), &redir.plan(), failed);
+        if (pid < 0)
+            return failed;
+        int s = wait_for(pid);
+        if (s > 128)
+            return s;
+        if (s)
+            status = s;
+        i = end;
+    }
+    return status;
+}
+
+int call_function(Shell& shell, const std::shared_ptr<Function>& fn, Prepared& cmd)
+{
+    std::shared_ptr<Function> keep = fn; // the body may redefine itself
+    std::vector<std::string> saved = cmd.fields.slice(1, cmd.fields.size());
+    std::swap(saved, shell.positional);
+    ++shell.function_depth;
+    shell.vars.push_scope();
+    int status = run_program(shell, keep->code);
+    shell.vars.pop_scope();
+    --shell.function_depth;
+    std::swap(saved, shell.positional);
+    if (shell.flow == Flow::Return)
+        shell.flow = Flow::Normal;
+    return status;
+}
+
+// Runs an expanded simple command in the current process (builtins and
+// functions) or as a child it waits for (external commands). As the tail of
+// the process an external command is exec'd in place, unless its timing is
+// to be traced.
+int run_prepared(Shell& shell, Prepared& cmd, const List<Redir>& redirs, bool tail = false)
+{
+    auto fn = shell.functions.find(std::string(cmd.fields[0]));
+    const Builtin* builtin = fn == shell.functions.end() ? find_builtin(cmd.fields) : nullptr;
+    if (fn == shell.functions.end() && !builtin) {
+        if (needs_batches(shell, cmd))
+            return run_batched(shell, cmd, redirs);
+        int status = 0;
+        if (!shell.trace_timing) {
+            pid_t pid = spawn_external(shell, cmd, redirs, nullptr, status, nullptr, tail);
+            return pid < 0 ? status : wait_for(pid);
+        }
+        TraceEvent ev;
+        int64_t start = monotonic_us();
+        pid_t pid = spawn_external(shell, cmd, redirs, nullptr, status, &ev.launch_us);
+        if (pid < 0)
+            return status;
+        struct rusage usage;
+        ev.kind = "external";
+        ev.command = join_fields(cmd.fields);
+        ev.pid = pid;
+        ev.status = wait_for(pid, &usage);
+        ev.wall_us = monotonic_us() - start;
+        ev.set_usage(usage);
+        emit_trace(shell, ev);
+        return ev.status;
+    }
+
+    std::optional<UsageMeter> meter;
+    CpuTime jobs_before;
+    if (shell.trace_timing) {
+        meter.emplace();
+        jobs_before = shell.jobs.reaped_cpu();
+    }
+    Redirection redir;
+    if (!redir.open(shell, redirs) || !redir.apply_in_shell(shell))
+        return 1;
+    int status;
+    {
+        TempAssignments temp(shell, cmd.assigns);
+        if (fn != shell.functions.end()) {
+            status = call_function(shell, fn->second, cmd);
+        } else {
+            std::vector<char*> argv = cmd.fields.argv();
+            BuiltinIo io;
+            io.buffered = true;
+            status = builtin->fn(shell, io, static_cast<int>(argv.size() - 1), argv.data());
+            // Output into the command's own redirections fails or succeeds
+            // with the builtin, not at some later flush.
+            if (!redirs.empty() && !flush_output() && status == 0) {
+                warn(shell, "%s: write error: %s", cmd.fields.c_str(0), std::strerror(errno));
+                status = 1;
+            }
+        }
+    }
+    if (meter) {
+        TraceEvent ev;
+        ev.kind = builtin ? "builtin" : "function";
+        ev.command = join_fields(cmd.fields);
+        ev.pid = ::getpid();
+        ev.status = status;
+        meter->finish(ev);
+        // Background jobs reaped meanwhile, as by `wait`, have lines of their own.
+        CpuTime jobs_after = shell.jobs.reaped_cpu();
+        ev.user_us -= jobs_after.user_us - jobs_before.user_us;
+        ev.sys_us -= jobs_after.sys_us - jobs_before.sys_us;
+        redir.restore(); // the trace descriptor may have been redirected
+        emit_trace(shell, ev);
+    }
+    return status;
+}
+
+int exec_simple(Shell& shell, const SimpleCommand* cmd, bool tail)
+{
+    uint64_t substitutions = shell.substitutions;
+    Prepared prepared;
+    prepare(shell, cmd, prepared);
+    if (!prepared.fields.empty())
+        return run_prepared(shell, prepared, cmd->redirs, tail);
+
+    // Assignments and redirections only.
+    for (const std::string& a : prepared.assigns) {
+        size_t eq = a.find('=');
+        shell.vars.set(std::string_view(a).substr(0, eq), std::string_view(a).substr(eq + 1));
+    }
+    Redirection redir;
+    if (!redir.open(shell, cmd->redirs))
+        return 1;
+    return shell.substitutions != substitutions ? shell.last_status : 0;
+}
+
+// A stand-in child for a stage that failed before it could start, so the
+// pipeline still has a pid and exit status for it.
+pid_t failed_stage(Shell& shell, int status)
+{
+    pid_t pid = fork_shell(shell);
+    if (pid == 0)
+        ::_exit(status);
+    return pid;
+}
+
+// Expands a simple-command stage in the parent when that is invisible
+// (see expands_in_parent()), so that the stage can be launched directly or
+// run on a thread; otherwise out stays empty and the stage is expanded in
+// its own child. Returns false after reporting an expansion error.
+bool prepare_stage(Shell& shell, const Node* stage, std::optional<Prepared>& out)
+{
+    if (stage->kind != NodeKind::Simple || !expands_in_parent(stage))
+        return true;
+    try {
+        prepare(shell, static_cast<const SimpleCommand*>(stage), out.emplace());
+    } catch (const ExpansionError& e) {
+        warn(shell, "%s", e.what());
+        return false;
+    }
+    return true;
+}
+
+// Starts one pipeline stage (or background job) with base applied first.
+// prepared holds the stage's expansion if prepare_stage() made one. External
+// commands are launched directly (and launch_us, if given, receives the
+// launch time), or with in_place exec'd in place of the shell; anything
+// that needs the shell runs in a forked copy of it. placement, if given,
+// applies to either.
+pid_t start_stage(Shell& shell, const Node* stage, std::optional<Prepared>& prepared, const FdPlan& base,
+                  int64_t* launch_us = nullptr, bool in_place = false, const JobPlacement* placement = nullptr)
+{
+    const SimpleCommand* cmd = nullptr;
+    if (prepared) {
+        cmd = static_cast<const SimpleCommand*>(stage);
+        if (!prepared->fields.empty()) {
+            // A command to run in batches waits for each; that takes a shell.
+            if (!shell.functions.contains(std::string(prepared->fields[0])) && !find_builtin(prepared->fields) &&
+                !needs_batches(shell, *prepared)) {
+                int status = 0;
+                pid_t pid =
+                    spawn_external(shell, *prepared, cmd->redirs, &base, status, launch_us, in_place, placement);
+                return pid >= 0 ? pid : failed_stage(shell, status);
+            }
+        }
+    }
+
+    pid_t pid = fork_shell(shell);
+    if (pid == 0) {
+        child_main(shell, [&] {
+            if (int err = base.apply_in_child(false)) {
+                warn(shell, "%s", std::strerror(err));
+                return 1;
+            }
+            if (placement) {
+                if (int err = apply_placement(*placement)) {
+                    warn(shell, "jobopts: %s", std::strerror(err));
+                    return 1;
+                }
+            }
+            if (!cmd)
+                return exec_command(shell, stage, true);
+            if (prepared->fields.empty()) {
+                Redirection redir;
+                return redir.open(shell, cmd->redirs) ? 0 : 1;
+            }
+            return run_prepared(shell, *prepared, cmd->redirs, true);
+        });
+    }
+    return pid;
+}
+
+// The builtin a pipeline stage can run on a thread, or nullptr if it needs
+// a process of its own: the stage must have been expanded in the shell,
+// the builtin must be thread-safe and the stage must have no assignments,
+// which would change the shell's variables.
+const Builtin* thread_builtin(Shell& shell, const std::optional<Prepared>& prepared)
+{
+    if (!prepared || prepared->fields.empty() || !prepared->assigns.empty() ||
+        shell.functions.contains(std::string(prepared->fields[0])))
+        return nullptr;
+    const Builtin* builtin = find_builtin(prepared->fields);
+    return builtin && (builtin->flags & kThreadSafe) ? builtin : nullptr;
+}
+
+// Points io at a thread stage's redirections instead of applying them to
+// the shell's shared descriptor table. Only dups onto 0, 1 and 2 can be
+// expressed this way.
+bool redirect_io(const FdPlan& plan, BuiltinIo& io)
+{
+    auto slot = [&io](int fd) -> int& { return fd == 0 ? io.in : fd == 1 ? io.out : io.err; };
+    for (const FdAction& a : plan.actions()) {
+        if (a.kind != FdAction::Kind::Dup || a.fd > 2)
+            return false;
+        int src = a.src <= 2 ? slot(a.src) : a.src;
+        slot(a.fd) = src;
+        if (a.fd == 0)
+            io.in_pipe = nullptr;
+        else if (a.fd == 1)
+            io.out_pipe = nullptr;
+    }
+    return true;
+}
+
+// Pipe ends held by builtin threads of one pipeline. Stages forked while a
+// thread runs must close them, or a reader would never see end-of-file; the
+// lock keeps a thread from closing (and the number being reused) between
+// the plan naming the descriptor and the fork that inherits it.
+struct ThreadFds {
+    std::mutex lock;
+    std::vector<int> open;
+
+    void release(int fd)
+    {
+        if (fd < 0)
+            return;
+        std::lock_guard<std::mutex> guard(lock);
+        ::close(fd);
+        open.erase(std::find(open.begin(), open.end(), fd));
+    }
+};
+
+// A started pipeline stage: a child process, or a builtin on a thread.
+struct Stage {
+    pid_t pid = -1;
+    std::thread thread;
+    std::unique_ptr<Redirection> redir; // files the thread reads or writes
+    int status = 0;                      // set by the thread
+    int64_t start_us = 0;                // trace-timing only
+    TraceEvent trace;                    // trace-timing only; the thread fills its usage
+};
+
+// Runs builtin on a thread of its own with io. The thread owns the pipe
+// ends in and out (-1 for none), which io may or may not still refer to.
+void start_thread(Shell& shell, Stage& stage, const Builtin* builtin, Prepared& prepared, BuiltinIo io, int in,
+                  int out, ThreadFds& fds)
+{
+    stage.thread = std::thread([&shell, &stage, &fds, fn = builtin->fn, fields = std::move(prepared.fields), io,
+                                in, out]() mutable {
+        // A write to a closed pipe must fail with EPIPE here rather than
+        // raise SIGPIPE and kill the whole shell.
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGPIPE);
+        ::pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+        std::optional<UsageMeter> meter;
+        if (shell.trace_timing)
+            meter.emplace(false);
+        std::vector<char*> argv = fields.argv();
+        stage.status = fn(shell, io, static_cast<int>(argv.size() - 1), argv.data());
+        if (meter)
+            meter->finish(stage.trace);
+        fds.release(in);
+        fds.release(out);
+    });
+}
+
+int exec_pipeline(Shell& shell, const Pipeline* pipe, bool tail)
+{
+    if (pipe->stages.size == 1) {
+        int status = exec_node(shell, pipe->stages.head, tail && !pipe->negate);
+        return pipe->negate ? !status : status;
+    }
+
+    flush_output(); // builtin threads write to the shell's descriptors directly
+    bool trace = shell.trace_timing;
+    std::deque<Stage> stages;         // stable addresses for the threads
+    std::deque<PipeCounter> counters; // one per pipe
+    bool shell_side = false;          // some stage runs on a thread
+    ThreadFds thread_fds;
+    int prev_read = -1;
+    for (const Node* node : pipe->stages) {
+        int fds[2] = {-1, -1};
+        if (node->next && ::pipe2(fds, O_CLOEXEC) < 0) {
+            warn(shell, "pipe: %s", std::strerror(errno));
+            break;
+        }
+        PipeCounter* in_pipe = counters.empty() ? nullptr : &counters.back();
+        PipeCounter* out_pipe = fds[1] >= 0 ? &counters.emplace_back() : nullptr;
+
+        Stage& stage = stages.emplace_back();
+        stage.start_us = trace ? monotonic_us() : 0;
+        std::optional<Prepared> prepared;
+        const Builtin* builtin = nullptr;
+        BuiltinIo io;
+        if (!prepare_stage(shell, node, prepared)) {
+            stage.pid = failed_stage(shell, 1);
+        } else if ((builtin = thread_builtin(shell, prepared))) {
+            if (prev_read >= 0) {
+                io.in = prev_read;
+                io.in_pipe = in_pipe;
+            }
+            if (fds[1] >= 0) {
+                io.out = fds[1];
+                io.out_pipe = out_pipe;
+            }
+            if (!node->redirs.empty()) {
+                stage.redir = std::make_unique<Redirection>();
+                if (!stage.redir->open(shell, node->redirs)) {
+                    stage.pid = failed_stage(shell, 1);
+                    builtin = nullptr;
+                } else if (!redirect_io(stage.redir->plan(), io)) {
+                    stage.redir.reset();
+                    builtin = nullptr;
+                }
+            }
+        }
+
+        if (trace) {
+            // A stage left to its child to expand shows its unexpanded words.
+            if (prepared && !prepared->fields.empty())
+                stage.trace.command = join_fields(prepared->fields);
+            else
+                stage.trace.command = node->kind == NodeKind::Simple ? command_text(node) : node_label(node);
+        }
+        if (builtin) {
+            shell_side = true;
+            stage.trace.kind = "builtin";
+            std::lock_guard<std::mutex> guard(thread_fds.lock);
+            for (int fd : {prev_read, fds[1]}) {
+                if (fd >= 0)
+                    thread_fds.open.push_back(fd);
+            }
+            start_thread(shell, stage, builtin, *prepared, io, prev_read, fds[1], thread_fds);
+            prev_read = fds[0];
+            continue;
+        }
+        if (stage.pid < 0) {
+            FdPlan base;
+            if (prev_read >= 0) {
+                base.dup(prev_read, 0);
+                base.drop(prev_read);
+            }
+            if (fds[1] >= 0) {
+                base.dup(fds[1], 1);
+                base.drop(fds[1]);
+                base.drop(fds[0]);
+            }
+            std::lock_guard<std::mutex> guard(thread_fds.lock);
+            for (int fd : thread_fds.open)
+                base.drop(fd);
+            // As the tail, the last stage can be exec'd in place of the
+            // shell, which has nothing left to do but wait for it, as
+            // long as no stage needs the shell's threads or its status
+            // inverted.
+            bool in_place = tail && !node->next && !shell_side && !pipe->negate && !trace;
+            stage.pid = start_stage(shell, node, prepared, base, trace ? &stage.trace.launch_us : nullptr, in_place);
+        }
+        if (prev_read >= 0)
+            ::close(prev_read);
+        if (fds[1] >= 0)
+            ::close(fds[1]);
+        prev_read = fds[0];
+    }
+    if (prev_read >= 0)
+        ::close(prev_read);
+
+    int status = 0;
+    for (Stage& stage : stages) {
+        struct rusage usage;
+        if (stage.thread.joinable()) {
+            stage.thread.join();
+            status = stage.status;
+            stage.trace.pid = ::getpid();
+        } else {
+            status = stage.pid > 0 ? wait_for(stage.pid, trace ? &usage : nullptr) : 1;
+            if (trace && stage.pid > 0) {
+                stage.trace.kind = stage.trace.launch_us >= 0 ? "external" : "subshell";
+                stage.trace.pid = stage.pid;
+                stage.trace.wall_us = monotonic_us() - stage.start_us;
+                stage.trace.set_usage(usage);
+            }
+        }
+        stage.trace.status = status;
+    }
+    if (trace) {
+        int index = 0;
+        for (Stage& stage : stages) {
+            ++index;
+            if (!*stage.trace.kind)
+                continue; // failed before it started
+            stage.trace.stage = index;
+            stage.trace.stages = static_cast<int>(stages.size());
+            emit_trace(shell, stage.trace);
+        }
+    }
+
+    if (shell_side) {
+        shell.pipes.last.clear();
+        for (const PipeCounter& c : counters) {
+            PipeTotals t{c.zero_copy.load(), c.copied.load()};
+            shell.pipes.total.zero_copy += t.zero_copy;
+            shell.pipes.total.copied += t.copied;
+            shell.pipes.last.push_back(t);
+        }
+    }
+    return pipe->negate ? !status : status;
+}
+
+int exec_async(Shell& shell, const Node* node)
+{
+    FdPlan base;
+    if (!shell.interactive)
+        base.open(0, "/dev/null", O_RDONLY);
+
+    std::optional<Prepared> prepared;
+    pid_t pid = prepare_stage(shell, node, prepared)
+                    ? start_stage(shell, node, prepared, base, nullptr, false, job_placement(shell))
+                    : failed_stage(shell, 1);
+    if (pid > 0) {
+        shell.last_bg = pid;
+        int id = shell.jobs.add(pid, command_text(node));
+        if (shell.interactive)
+            std::fprintf(stderr, "[%d] %ld\n", id, static_cast<long>(pid));
+    }
+    return 0;
+}
+
+// Runs body with node's redirections applied to the shell.
+template <typename F>
+int with_redirections(Shell& shell, const Node* node, F&& body)
+{
+    if (node->redirs.empty())
+        return body();
+    Redirection redir;
+    if (!redir.open(shell, node->redirs) || !redir.apply_in_shell(shell))
+        return 1;
+    return body();
+}
+
+// Runtime state of a loop entered by LoopBegin or ForBegin.
+struct LoopFrame {
+    LoopFrame(uint32_t end, uint32_t resume, size_t redirs) : end(end), resume(resume), redirs(redirs) {}
+
+    uint32_t end;    // its LoopEnd instruction
+    uint32_t resume; // where continue goes
+    size_t redirs;   // redirections already applied when it was entered
+    int status = 0;
+    Fields items; // for loops
+    size_t next = 0;
+};
+
+// Redirections applied by PushRedir, undone innermost first.
+using RedirStack = std::vector<std::unique_ptr<Redirection>>;
+
+// Handles the break or continue the last command requested: unwinds the
+// loops it leaves and sets pc to where execution resumes. Returns false if
+// control leaves the program instead (return, exit, or a break or continue
+// of a loop outside it).
+bool unwind_flow(Shell& shell, std::vector<LoopFrame>& loops, RedirStack& redirs, int status, uint32_t& pc)
+{
+    while (!loops.empty()) {
+        LoopFrame& frame = loops.back();
+        while (redirs.size() > frame.redirs)
+            redirs.pop_back();
+        frame.status = status;
+        if (shell.flow != Flow::Break && shell.flow != Flow::Continue)
+            return false;
+        if (--shell.flow_levels == 0) {
+            pc = shell.flow == Flow::Break ? frame.end : frame.resume;
+            shell.flow = Flow::Normal;
+            return true;
+        }
+        loops.pop_back();
+        --shell.loop_depth;
+    }
+    return false;
+}
+
+int run_program(Shell& shell, const Program& program)
+{
+    using Op = Insn::Op;
+    const std::vector<Insn>& code = program.code;
+    std::vector<LoopFrame> loops;
+    RedirStack redirs;
+    std::vector<std::string> subjects; // of the case commands being matched
+
+    // Leaving early (return, exit, an expansion error) must still undo the
+    // loops and redirections entered so far.
+    struct Cleanup {
+        Shell& shell;
+        std::vector<LoopFrame>& loops;
+        RedirStack& redirs;
+        ~Cleanup()
+        {
+            shell.loop_depth -= static_cast<int>(loops.size());
+            while (!redirs.empty())
+                redirs.pop_back();
+        }
+    } cleanup{shell, loops, redirs};
+
+    int status = 0;
+    uint32_t pc = 0;
+    while (pc < code.size()) {
+        const Insn& insn = code[pc++];
+        switch (insn.op) {
+        case Op::Run:
+            status = exec_node(shell, insn.node);
+            if (shell.flow != Flow::Normal && !unwind_flow(shell, loops, redirs, status, pc))
+                return status;
+            break;
+        case Op::Jump:
+            pc = insn.target;
+            break;
+        case Op::JumpIfTrue:
+            if (status == 0)
+                pc = insn.target;
+            break;
+        case Op::JumpIfFalse:
+            if (status != 0)
+                pc = insn.target;
+            break;
+        case Op::SetStatus:
+            status = shell.last_status = 0;
+            break;
+        case Op::PushRedir: {
+            auto redir = std::make_unique<Redirection>();
+            if (!redir->open(shell, insn.node->redirs) || !redir->apply_in_shell(shell)) {
+                status = shell.last_status = 1;
+                pc = insn.target;
+                break;
+            }
+            redirs.push_back(std::move(redir));
+            break;
+        }
+        case Op::PopRedir:
+            redirs.pop_back();
+            break;
+        case Op::LoopBegin:
+            loops.emplace_back(insn.target, insn.resume, redirs.size());
+            ++shell.loop_depth;
+            break;
+        case Op::LoopSave:
+            loops.back().status = status;
+            break;
+        case Op::LoopEnd:
+            status = shell.last_status = loops.back().status;
+            loops.pop_back();
+            --shell.loop_depth;
+            break;
+        case Op::ForBegin: {
+            auto* loop = static_cast<const For*>(insn.node);
+            LoopFrame frame(insn.target, insn.resume, redirs.size());
+            if (loop->has_list)
+                expand_words(shell, loop->items, frame.items);
+            else
+                frame.items = Fields(shell.positional);
+            loops.push_back(std::move(frame));
+            ++shell.loop_depth;
+            break;
+        }
+        case Op::ForNext: {
+            LoopFrame& frame = loops.back();
+            if (frame.next == frame.items.size())
+                pc = insn.target;
+            else
+                shell.vars.set(static_cast<const For*>(insn.node)->var, frame.items[frame.next++]);
+            break;
+        }
+        case Op::CaseBegin:
+            subjects.push_back(expand_string(shell, static_cast<const Case*>(insn.node)->subject));
+            break;
+        case Op::CaseTest:
+            if (pattern_match(expand_pattern(shell, insn.word), subjects.back())) {
+                subjects.pop_back();
+                pc = insn.target;
+            }
+            break;
+        case Op::CaseEnd:
+            subjects.pop_back();
+            status = shell.last_status = 0;
+            pc = insn.target;
+            break;
+        }
+    }
+    return status;
+}
+
+// Whether expanding w leaves the shell's variables alone: no ${x=...} and
+// no arithmetic, which may assign, including a substring's offset and
+// length. Nested substitutions are checked when they run.
+bool expansion_is_pure(const Word* w)
+{
+    if (!w)
+        return true;
+    for (const WordPart* p : w->parts) {
+        if (p->kind == WordPart::Kind::Arith)
+            return false;
+        if (p->kind == WordPart::Kind::Param &&
+            (p->param->op == ParamExp::Op::Assign || p->param->op == ParamExp::Op::Substring ||
+             !expansion_is_pure(p->param->arg) || !expansion_is_pure(p->param->arg2)))
+            return false;
+    }
+    return true;
+}
+
+// Whether w runs a command substitution.
+bool has_substitution(const Word* w)
+{
+    if (!w)
+        return false;
+    for (const WordPart* p : w->parts) {
+        if (p->kind == WordPart::Kind::Command)
+            return true;
+        if (p->kind == WordPart::Kind::Param && (has_substitution(p->param->arg) || has_substitution(p->param->arg2)))
+            return true;
+    }
+    return false;
+}
+
+// Whether pred holds for every word node expands: its redirection targets
+// and, for a simple command, its words and prefixed assignments.
+template <typename Pred>
+bool every_word(const Node* node, Pred&& pred)
+{
+    for (const Redir* r : node->redirs) {
+        if (!pred(r->target))
+            return false;
+    }
+    if (node->kind != NodeKind::Simple)
+        return true;
+    auto* cmd = static_cast<const SimpleCommand*>(node);
+    for (const Word* w : cmd->words) {
+        if (!pred(w))
+            return false;
+    }
+    for (const Assign* a : cmd->assigns) {
+        if (!pred(a->value))
+            return false;
+    }
+    return true;
+}
+
+// expansion_is_pure() for every word node expands.
+bool expands_purely(const Node* node)
+{
+    return every_word(node, expansion_is_pure);
+}
+
+// Whether a pipeline stage or background command can be expanded by the
+// shell before its process starts with no visible difference: purely, and
+// with no command substitution, which would run before the stage's input
+// is connected.
+bool expands_in_parent(const Node* node)
+{
+    return every_word(node, [](const Word* w) { return expansion_is_pure(w) && !has_substitution(w); });
+}
+
+// A subshell with nothing to run after it needs no process of its own: its
+// changes to the shell die with the process anyway.
+//
+// Otherwise, when it is one simple command for an external program, the
+// command is expanded here (pure expansions only, so the shell is left as
+// the subshell would have left it) and launched directly, saving the fork
+// of a shell that would only have started it. A builtin or function still
+// runs in a forked child, with the fields expanded here. Either way the
+// subshell's own redirections are applied first, as in a child, so that
+// expansion errors and the stderr of substitutions go through them.
+int exec_subshell(Shell& shell, const Subshell* node, bool tail)
+{
+    ++shell.subshells;
+    if (tail && !shell.trace_timing) {
+        ++shell.forkless_subshells;
+        return with_redirections(shell, node, [&] { return exec_node(shell, node->body, true); });
+    }
+
+    std::optional<Prepared> prepared;
+    Redirection outer; // node's redirections, applied here with prepared
+    const Node* body = node->body;
+    while (body && body->kind == NodeKind::Sequence && body->redirs.empty() &&
+           static_cast<const Sequence*>(body)->items.size == 1)
+        body = static_cast<const Sequence*>(body)->items.head;
+    const SimpleCommand* cmd = nullptr;
+    if (body && body->kind == NodeKind::Simple && !body->async && expands_purely(node) && expands_purely(body)) {
+        cmd = static_cast<const SimpleCommand*>(body);
+        if (!node->redirs.empty() && (!outer.open(shell, node->redirs) || !outer.apply_in_shell(shell)))
+            return 1;
+        uint64_t substitutions = shell.substitutions;
+        prepared.emplace();
+        try {
+            prepare(shell, cmd, *prepared);
+        } catch (const ExpansionError& e) {
+            // As in a child: reported, and the subshell fails.
+            warn(shell, "%s", e.what());
+            return 1;
+        }
+        if (prepared->fields.empty()) {
+            ++shell.forkless_subshells;
+            Redirection redir;
+            if (!redir.open(shell, cmd->redirs))
+                return 1;
+            return shell.substitutions != substitutions ? shell.last_status : 0;
+        }
+        if (!shell.functions.contains(std::string(prepared->fields[0])) && !find_builtin(prepared->fields)) {
+            ++shell.forkless_subshells;
+            return run_prepared(shell, *prepared, cmd->redirs);
+        }
+    }
+
+    pid_t pid = fork_shell(shell);
+    if (pid < 0)
+        return 1;
+    if (pid == 0) {
+        child_main(shell, [&] {
+            // With prepared, outer is already in place.
+            if (prepared)
+                return run_prepared(shell, *prepared, cmd->redirs, true);
+            return with_redirections(shell, node, [&] { return exec_node(shell, node->body, true); });
+        });
+    }
+    if (!shell.trace_timing)
+        return wait_for(pid);
+    TraceEvent ev;
+    int64_t start = monotonic_us();
+    struct rusage usage;
+    ev.kind = "subshell";
+    ev.command = node_label(node);
+    ev.pid = pid;
+    ev.status = wait_for(pid, &usage);
+    ev.wall_us = monotonic_us() - start;
+    ev.set_usage(usage);
+    outer.restore(); // the trace descriptor may have been redirected
+    emit_trace(shell, ev);
+    return ev.status;
+}
+
+int define_function(Shell& shell, const FuncDef* def)
+{
+    auto fn = std::make_shared<Function>();
+    fn->body = clone_tree(def->body, fn->arena);
+    fn->code = compile(fn->body);
+    shell.functions[std::string(def->name)] = std::move(fn);
+    return 0;
+}
+
+// Runs node in the foreground, ignoring its async flag. The tail is passed
+// on to whichever part of node runs last.
+int exec_command(Shell& shell, const Node* node, bool tail)
+{
+    switch (node->kind) {
+    case NodeKind::Simple:
+        return exec_simple(shell, static_cast<const SimpleCommand*>(node), tail);
+    case NodeKind::Pipeline:
+        return exec_pipeline(shell, static_cast<const Pipeline*>(node), tail);
+    case NodeKind::AndOr: {
+        auto* andor = static_cast<const AndOr*>(node);
+        int status = exec_node(shell, andor->left);
+        if (shell.flow != Flow::Normal)
+            return status;
+        if ((status == 0) == andor->is_and)
+            status = exec_node(shell, andor->right, tail);
+        return status;
+    }
+    case NodeKind::Sequence: {
+        int status = 0;
+        for (const Node* item : static_cast<const Sequence*>(node)->items) {
+            status = exec_node(shell, item, tail && !item->next);
+            if (shell.flow != Flow::Normal)
+                break;
+        }
+        return status;
+    }
+    case NodeKind::Subshell:
+        return exec_subshell(shell, static_cast<const Subshell*>(node), tail);
+    case NodeKind::Group:
+        return with_redirections(shell, node,
+                                 [&] { return exec_node(shell, static_cast<const Group*>(node)->body, tail); });
+    case NodeKind::If: {
+        auto* n = static_cast<const If*>(node);
+        return with_redirections(shell, node, [&] {
+            int cond = exec_node(shell, n->cond);
+            if (shell.flow != Flow::Normal)
+                return cond;
+            if (cond == 0)
+                return exec_node(shell, n->then_part, tail);
+            return n->else_part ? exec_node(shell, n->else_part, tail) : 0;
+        });
+    }
+    case NodeKind::Loop:
+    case NodeKind::For:
+    case NodeKind::Case:
+        // Compiled on every entry: the tree may be a one-off line, and
+        // lowering is linear in its size while the loop may run forever.
+        return run_program(shell, compile(node));
+    case NodeKind::FuncDef:
+        return define_function(shell, static_cast<const FuncDef*>(node));
+    case NodeKind::Arith: {
+        auto* n = static_cast<const ArithCommand*>(node);
+        // A failed evaluation is this command's status, as in bash, rather
+        // than an expansion error that ends the whole tree.
+        return with_redirections(shell, node, [&] {
+            try {
+                long long v = n->compiled ? eval_arith(shell, *n->compiled) : eval_arith(shell, expand_string(shell, n->expr));
+                return v != 0 ? 0 : 1;
+            } catch (const ExpansionError& e) {
+                warn(shell, "%s", e.what());
+                return 1;
+            }
+        });
+    }
+    }
+    return 0;
+}
+
+int exec_node(Shell& shell, const Node* node, bool tail)
+{
+    int status = node->async ? exec_async(shell, node) : exec_command(shell, node, tail);
+    shell.last_status = status;
+    return status;
+}
+
+// Reads all of fd into out. Reads go through a scratch buffer, so out
+// holds only what was produced: a short $(pwd) keeps a short string.
+void read_all(int fd, std::string& out)
+{
+    char buf[65536];
+    for (;;) {
+        ssize_t n = ::read(fd, buf, sizeof buf);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        out.append(buf, static_cast<size_t>(n));
+    }
+}
+
+// The text of a word with no expansions or quotes in it.
+std::optional<std::string_view> plain_word(const Word* w)
+{
+    if (!w || !w->parts.head || w->parts.head->next || w->parts.head->kind != WordPart::Kind::Literal ||
+        w->parts.head->quoted)
+        return std::nullopt;
+    return w->parts.head->text;
+}
+
+// Collects the commands of a function body that capture_in_process() can
+// run one after another: simple commands, in braces or lists, each naming
+// a thread-safe builtin outright, with pure expansions and no assignments
+// or redirections. False if any command needs a child.
+bool collect_in_process(const Shell& shell, const Node* node, std::vector<const SimpleCommand*>& out)
+{
+    if (!node)
+        return true;
+    if (node->async || !node->redirs.empty())
+        return false;
+    switch (node->kind) {
+    case NodeKind::Group:
+        return collect_in_process(shell, static_cast<const Group*>(node)->body, out);
+    case NodeKind::Sequence:
+        for (const Node* item : static_cast<const Sequence*>(node)->items) {
+            if (!collect_in_process(shell, item, out))
+                return false;
+        }
+        return true;
+    case NodeKind::Simple: {
+        auto* cmd = static_cast<const SimpleCommand*>(node);
+        std::optional<std::string_view> name = plain_word(cmd->words.head);
+        if (!name || !cmd->assigns.empty() || shell.functions.contains(std::string(*name)))
+            return false;
+        const Builtin* builtin = find_builtin(*name);
+        if (!builtin || !(builtin->flags & kThreadSafe) || (builtin->flags & kNoOptions))
+            return false;
+        for (const Word* w : cmd->words) {
+            if (!expansion_is_pure(w))
+                return false;
+        }
+        out.push_back(cmd);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// Runs the function call in prepared from a substitution as a forked child
+// would, without the fork, given commands from collect_in_process(). Output
+// goes to io. Returns the status of the last command, or 1 after an
+// expansion error, which ends a child too.
+int call_in_process(Shell& shell, Prepared& prepared, const std::vector<const SimpleCommand*>& commands,
+                    BuiltinIo io)
+{
+    std::vector<std::string> saved = prepared.fields.slice(1, prepared.fields.size());
+    std::swap(saved, shell.positional);
+    int status = 0;
+    for (const SimpleCommand* cmd : commands) {
+        Prepared inner;
+        try {
+            prepare(shell, cmd, inner);
+        } catch (const ExpansionError& e) {
+            warn(shell, "%s", e.what());
+            status = 1;
+            break;
+        }
+        std::vector<char*> argv = inner.fields.argv();
+        status = find_builtin(inner.fields[0])->fn(shell, io, static_cast<int>(argv.size() - 1), argv.data());
+    }
+    std::swap(saved, shell.positional);
+    return status;
+}
+
+// Runs a substitution without forking when it is one simple command for a
+// builtin that touches nothing but its descriptors (the kind a pipeline
+// runs on a thread), with no assignments, redirections or expansions that
+// could change the shell, or for a function whose body is only such
+// commands. Its output goes to a memfd. Returns false if the command must
+// run in a child; prepared then holds its fields if they were already
+// expanded, so that nothing in them runs twice.
+bool capture_in_process(Shell& shell, const Node* body, std::optional<Prepared>& prepared, std::string& out)
+{
+    while (body && body->kind == NodeKind::Sequence && body->redirs.empty() &&
+           static_cast<const Sequence*>(body)->items.size == 1)
+        body = static_cast<const Sequence*>(body)->items.head;
+    if (!body || body->kind != NodeKind::Simple || body->async || !body->redirs.empty())
+        return false;
+    auto* cmd = static_cast<const SimpleCommand*>(body);
+    if (!cmd->assigns.empty())
+        return false;
+    for (const Word* w : cmd->words) {
+        if (!expansion_is_pure(w))
+            return false;
+    }
+    uint64_t substitutions = shell.substitutions;
+    prepared.emplace();
+    try {
+        prepare(shell, cmd, *prepared);
+    } catch (const ExpansionError& e) {
+        // As in a child: reported, and the substitution fails.
+        warn(shell, "%s", e.what());
+        shell.last_status = 1;
+        return true;
+    }
+    if (prepared->fields.empty()) {
+        shell.last_status = shell.substitutions != substitutions ? shell.last_status : 0;
+        return true;
+    }
+    const Builtin* builtin = thread_builtin(shell, prepared);
+    std::vector<const SimpleCommand*> commands;
+    if (!builtin) {
+        auto fn = shell.functions.find(std::string(prepared->fields[0]));
+        if (fn == shell.functions.end() || !collect_in_process(shell, fn->second->body, commands))
+            return false;
+    }
+    int fd = ::memfd_create("sh-subst", MFD_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    std::optional<UsageMeter> meter;
+    if (shell.trace_timing)
+        meter.emplace(false);
+    flush_output();
+    BuiltinIo io;
+    io.out = fd;
+    int status;
+    if (builtin) {
+        std::vector<char*> argv = prepared->fields.argv();
+        status = builtin->fn(shell, io, static_cast<int>(argv.size() - 1), argv.data());
+    } else {
+        status = call_in_process(shell, *prepared, commands, io);
+    }
+    ::lseek(fd, 0, SEEK_SET);
+    read_all(fd, out);
+    ::close(fd);
+    shell.last_status = status;
+    ++shell.forkless_substitutions;
+    if (meter) {
+        TraceEvent ev;
+        ev.kind = "substitution";
+        ev.command = join_fields(prepared->fields);
+        ev.pid = ::getpid();
+        ev.status = status;
+        meter->finish(ev);
+        emit_trace(shell, ev);
+    }
+    return true;
+}
+
+// Runs body, or the command already expanded from it, in a forked child
+// whose standard output is a pipe into out.
+void capture_in_child(Shell& shell, const Node* body, std::optional<Prepared>& prepared, std::string& out)
+{
+    int fds[2];
+    if (::pipe2(fds, O_CLOEXEC) < 0) {
+        warn(shell, "pipe: %s", std::strerror(errno));
+        return;
+    }
+    int64_t start = shell.trace_timing ? monotonic_us() : 0;
+    pid_t pid = fork_shell(shell);
+    if (pid == 0) {
+        ::dup2(fds[1], 1);
+        ::close(fds[0]);
+        ::close(fds[1]);
+        child_main(shell, [&] { return prepared ? run_prepared(shell, *prepared, {}, true) : exec_node(shell, body, true); });
+    }
+    ::close(fds[1]);
+    read_all(fds[0], out);
+    ::close(fds[0]);
+    if (pid > 0 && shell.trace_timing) {
+        TraceEvent ev;
+        struct rusage usage;
+        ev.kind = "substitution";
+        ev.command = node_label(body);
+        ev.pid = pid;
+        ev.status = shell.last_status = wait_for(pid, &usage);
+        ev.wall_us = monotonic_us() - start;
+        ev.set_usage(usage);
+        emit_trace(shell, ev);
+    } else if (pid > 0) {
+        shell.last_status = wait_for(pid);
+    }
+}
+
+} // namespace
+
+int wait_for(pid_t pid, struct rusage* usage)
+{
+    int status;
+    while (::wait4(pid, &status, 0, usage) < 0) {
+        if (errno != EINTR)
+            return 127;
+    }
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return 1;
+}
+
+pid_t start_capture(Shell& shell, std::string_view text, int& fd)
+{
+    int fds[2];
+    if (::pipe2(fds, O_CLOEXEC) < 0) {
+        warn(shell, "pipe: %s", std::strerror(errno));
+        return -1;
+    }
+    pid_t pid = fork_shell(shell);
+    if (pid == 0) {
+        int null = ::open("/dev/null", O_RDWR);
+        if (null >= 0) {
+            ::dup2(null, 0);
+            ::dup2(null, 2);
+            if (null > 2)
+                ::close(null);
+        }
+        ::dup2(fds[1], 1);
+        ::close(fds[0]);
+        ::close(fds[1]);
+        child_main(shell, [&] { return run_source(shell, text, true); });
+    }
+    ::close(fds[1]);
+    if (pid < 0) {
+        ::close(fds[0]);
+        return -1;
+    }
+    fd = fds[0];
+    return pid;
+}
+
+pid_t start_command(Shell& shell, Fields argv, const FdPlan& fds, const JobPlacement* placement)
+{
+    static const SimpleCommand bare;
+    std::optional<Prepared> prepared(std::in_place);
+    prepared->fields = std::move(argv);
+    return start_stage(shell, &bare, prepared, fds, nullptr, false, placement);
+}
+
+int execute(Shell& shell, const Node* node, bool last)
+{
+    int status;
+    try {
+        status = exec_node(shell, node, last);
+    } catch (const ExpansionError& e) {
+        warn(shell, "%s", e.what());
+        shell.flow = Flow::Normal;
+        status = shell.last_status = 1;
+    }
+    if (!flush_output() && errno != EPIPE)
+        warn(shell, "write error: %s", std::strerror(errno));
+    return status;
+}
+
+int run_source(Shell& shell, std::string_view text, bool last)
+{
+    Arena arena;
+    ParseResult result = parse(text, arena);
+    return run_parsed(shell, text, result, {}, last);
+}
+
+int run_parsed(Shell& shell, std::string_view text, const ParseResult& result, std::string_view origin, bool last)
+{
+    // A syntax error is still to be reported after the last command.
+    execute(shell, result.program, last && result.status == ParseResult::Status::Ok);
+    if (result.status != ParseResult::Status::Ok && !shell.exiting()) {
+        std::string message = describe_error(text, result);
+        if (origin.empty())
+            warn(shell, "%s", message.c_str());
+        else
+            warn(shell, "%.*s: %s", static_cast<int>(origin.size()), origin.data(), message.c_str());
+        shell.last_status = 2;
+    }
+    return shell.last_status;
+}
+
+std::string capture_output(Shell& shell, const Node* body)
+{
+    ++shell.substitutions;
+    std::string out;
+    std::optional<Prepared> prepared;
+    if (!capture_in_process(shell, body, prepared, out))
+        capture_in_child(shell, body, prepared, out);
+    out.resize(out.find_last_not_of('\n') + 1); // npos + 1 == 0
+    return out;
+}
+
+} // namespace sh
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "ast.h"
+#include "fields.h"
+#include "parser.h"
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sh {
+
+class FdPlan;
+struct JobPlacement;
+struct Shell;
+
+// Runs a parsed tree and returns its exit status, which is also stored in
+// shell.last_status. Expansion errors abort the tree with status 1. last
+// says the process exits once the tree is done: its final external command
+// is then exec'd in place of the shell, and a final subshell runs in the
+// shell itself, saving a process each.
+int execute(Shell& shell, const Node* node, bool last = false);
+
+// Parses and runs a complete program text (a script or a -c string).
+// Commands before a syntax error still run; the error then sets status 2.
+int run_source(Shell& shell, std::string_view text, bool last = false);
+
+// Runs an already parsed program, reporting its syntax error (if any) the
+// same way run_source() does. origin names the file in diagnostics.
+int run_parsed(Shell& shell, std::string_view text, const ParseResult& result, std::string_view origin = {},
+               bool last = false);
+
+// Runs body with its standard output captured, as $(...) does. Trailing
+// newlines are removed; shell.last_status becomes the body's status.
+std::string capture_output(Shell& shell, const Node* body);
+
+// Starts text running in a forked shell without waiting for it, as a
+// $(...) that is read later: its standard output is a pipe whose read end
+// is returned in fd, and its standard input and error are /dev/null.
+// Returns the pid, or -1 if the pipe or the fork failed. The caller reads
+// fd to its end and reaps the pid with wait_for().
+pid_t start_capture(Shell& shell, std::string_view text, int& fd);
+
+// Starts argv as a command of its own without waiting for it: an external
+// program is launched directly, a builtin or function runs in a forked
+// shell. fds is applied first. Returns the pid (a stand-in exiting with the
+// failure status if the command cannot start), or -1 if fork failed.
+// placement, if given, is applied to the command's process.
+pid_t start_command(Shell& shell, Fields argv, const FdPlan& fds,
+                    const JobPlacement* placement = nullptr);
+
+// Waits for pid and converts its wait status into a shell exit status.
+// usage, if given, receives the child's resource usage from wait4(2).
+int wait_for(pid_t pid, struct rusage* usage = nullptr);
+
+} // namespace sh
@@ -0,0 +1,561 @@
+#include "expand.h"
+
+#include "arith.h"
+#include "executor.h"
+#include "lexer.h"
+#include "pathglob.h"
+#include "shell.h"
+
+#include <fnmatch.h>
+#include <pwd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <optional>
+#include <span>
+#include <string_view>
+
+namespace sh {
+
+namespace {
+
+constexpr std::string_view kDefaultIfs = " \t\n";
+
+bool is_glob_meta(char c)
+{
+    return c == '*' || c == '?' || c == '[' || c == ']' || c == '\\';
+}
+
+bool is_ifs_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+class Expander {
+public:
+    enum class Target {
+        Fields,  // split and glob into separate fields
+        String,  // one string, quotes removed
+        Pattern, // one string, quoted metacharacters escaped
+    };
+
+    Expander(Shell& shell, Target target, Fields* fields = nullptr)
+        : shell_(shell), target_(target), fields_(fields)
+    {
+    }
+
+    void word(const Word* w)
+    {
+        if (!w)
+            return;
+        for (const WordPart* p : w->parts)
+            part(p);
+        if (target_ == Target::Fields && active_)
+            end_field();
+    }
+
+    std::string take() { return target_ == Target::Pattern ? std::move(pat_) : std::move(cur_); }
+
+private:
+    void part(const WordPart* p);
+    void param(const WordPart* p);
+    void positional(const WordPart* p, bool star, std::span<const std::string> args);
+    void add_expansion(std::string_view text, bool quoted);
+    void append(std::string_view text, bool quoted);
+    void split(std::string_view text);
+    void end_field();
+
+    void trim(const WordPart* p);
+    void replace(const WordPart* p);
+    void substring(const WordPart* p);
+    std::optional<std::string_view> value_of(std::string_view name, std::string& scratch) const;
+    std::string ifs() const
+    {
+        const std::string* v = shell_.vars.get("IFS");
+        return v ? *v : std::string(kDefaultIfs);
+    }
+
+    Shell& shell_;
+    Target target_;
+    Fields* fields_;
+    std::string cur_;     // current field with quotes removed
+    std::string pat_;     // current field as a glob pattern
+    bool active_ = false; // current field exists, even if empty
+    bool glob_ = false;   // current field has an unquoted glob character
+    DirCache dirs_;       // directories read for this command's fields
+};
+
+// The value of a parameter, or nullopt if it is unset. A variable's is a
+// view of its stored value, good until the variable is next assigned;
+// special parameters are formatted into scratch.
+std::optional<std::string_view> Expander::value_of(std::string_view name, std::string& scratch) const
+{
+    if (name.size() == 1) {
+        switch (name[0]) {
+        case '?':
+            return scratch = std::to_string(shell_.last_status);
+        case '$':
+            return scratch = std::to_string(shell_.pid);
+        case '!':
+            if (shell_.last_bg == 0)
+                return std::nullopt;
+            return scratch = std::to_string(shell_.last_bg);
+        case '#':
+            return scratch = std::to_string(shell_.positional.size());
+        case '-':
+            return std::string_view(shell_.interactive ? "i" : "");
+        case '0':
+            return shell_.name;
+        default:
+            break;
+        }
+    }
+    if (name[0] >= '0' && name[0] <= '9') {
+        // A position too large to parse names no parameter, as in bash.
+        size_t n = 0;
+        auto [end, ec] = std::from_chars(name.data(), name.data() + name.size(), n);
+        if (ec != std::errc() || end != name.data() + name.size())
+            return std::nullopt;
+        if (n == 0)
+            return shell_.name;
+        if (n > shell_.positional.size())
+            return std::nullopt;
+        return shell_.positional[n - 1];
+    }
+    if (name == "@" || name == "*") {
+        std::string sep = ifs().substr(0, 1);
+        for (size_t i = 0; i < shell_.positional.size(); ++i) {
+            if (i)
+                scratch += name == "*" ? sep : " ";
+            scratch += shell_.positional[i];
+        }
+        return scratch;
+    }
+    const std::string* v = shell_.vars.get(name);
+    if (!v)
+        return std::nullopt;
+    return *v;
+}
+
+void Expander::append(std::string_view text, bool quoted)
+{
+    cur_ += text;
+    if (quoted || !text.empty())
+        active_ = true;
+    if (target_ == Target::String)
+        return;
+    for (char c : text) {
+        if (quoted && is_glob_meta(c))
+            pat_ += '\\';
+        else if (!quoted && (c == '*' || c == '?' || c == '['))
+            glob_ = true;
+        pat_ += c;
+    }
+}
+
+void Expander::end_field()
+{
+    if (glob_ && expand_glob(pat_, dirs_, *fields_)) {
+        cur_.clear();
+        pat_.clear();
+        active_ = glob_ = false;
+        return;
+    }
+    fields_->push_back(cur_);
+    cur_.clear();
+    pat_.clear();
+    active_ = glob_ = false;
+}
+
+void Expander::split(std::string_view text)
+{
+    std::string sep = ifs();
+    if (sep.empty()) {
+        append(text, false);
+        return;
+    }
+    bool after_space = false;
+    size_t run = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (sep.find(c) == std::string::npos)
+            continue;
+        append(text.substr(run, i - run), false);
+        run = i + 1;
+        if (is_ifs_space(c)) {
+            if (active_) {
+                end_field();
+                after_space = true;
+            }
+            continue;
+        }
+        if (active_)
+            end_field();
+        else if (!after_space)
+            fields_->push_back({});
+        after_space = false;
+    }
+    append(text.substr(run), false);
+}
+
+void Expander::add_expansion(std::string_view text, bool quoted)
+{
+    if (target_ == Target::Fields && !quoted)
+        split(text);
+    else
+        append(text, quoted);
+}
+
+void Expander::positional(const WordPart* p, bool star, std::span<const std::string> args)
+{
+    if (p->quoted && star) {
+        std::string sep = ifs().substr(0, 1);
+        std::string joined;
+        for (size_t i = 0; i < args.size(); ++i) {
+            if (i)
+                joined += sep;
+            joined += args[i];
+        }
+        append(joined, true);
+        return;
+    }
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (i > 0) {
+            if (target_ == Target::Fields) {
+                if (p->quoted || active_)
+                    end_field();
+            } else {
+                append(" ", p->quoted);
+            }
+        }
+        add_expansion(args[i], p->quoted);
+    }
+}
+
+// What a trim operator leaves of value.
+std::string_view trimmed(std::string_view value, const PatternView& pattern, ParamExp::Op op)
+{
+    size_t n = value.size();
+    // A pattern without a star has only one length to try.
+    size_t fixed = pattern.fixed_length();
+    size_t lo = fixed == std::string_view::npos ? 0 : fixed;
+    size_t hi = fixed == std::string_view::npos ? n : fixed;
+    if (lo > n)
+        return value;
+    switch (op) {
+    case ParamExp::Op::TrimSmallPrefix:
+        for (size_t k = lo; k <= hi; ++k) {
+            if (pattern.match(value.substr(0, k)))
+                return value.substr(k);
+        }
+        break;
+    case ParamExp::Op::TrimLargePrefix:
+        for (size_t k = hi + 1; k-- > lo;) {
+            if (pattern.match(value.substr(0, k)))
+                return value.substr(k);
+        }
+        break;
+    case ParamExp::Op::TrimSmallSuffix:
+        for (size_t k = n - lo + 1; k-- > n - hi;) {
+            if (pattern.match(value.substr(k)))
+                return value.substr(0, k);
+        }
+        break;
+    case ParamExp::Op::TrimLargeSuffix:
+        for (size_t k = n - hi; k <= n - lo; ++k) {
+            if (pattern.match(value.substr(k)))
+                return value.substr(0, k);
+        }
+        break;
+    default:
+        break;
+    }
+    return value;
+}
+
+// Passes value to out in pieces, with the matches of pattern replaced.
+template <typename Out>
+void replaced(std::string_view value, const PatternView& pattern, std::string_view with, ParamExp::Op op, Out&& out)
+{
+    // An empty pattern matches nowhere, except that /# and /% anchor it.
+    if (pattern.empty() && op != ParamExp::Op::ReplacePrefix && op != ParamExp::Op::ReplaceSuffix) {
+        out(value);
+        return;
+    }
+    size_t n = value.size();
+    size_t fixed = pattern.fixed_length();
+    size_t kept = 0; // start of the text not yet passed to out
+    for (size_t i = 0; i <= n; ++i) {
+        if (op == ParamExp::Op::ReplacePrefix && i > 0)
+            break;
+        size_t match = std::string_view::npos;
+        if (op == ParamExp::Op::ReplaceSuffix) {
+            if ((fixed == std::string_view::npos || i + fixed == n) && pattern.match(value.substr(i)))
+                match = n - i;
+        } else if (fixed != std::string_view::npos) {
+            if (i + fixed <= n && pattern.match(value.substr(i, fixed)))
+                match = fixed;
+        } else {
+            for (size_t len = n - i + 1; len-- > 0;) {
+                if (pattern.match(value.substr(i, len))) {
+                    match = len;
+                    break;
+                }
+            }
+        }
+        if (match == std::string_view::npos ||
+            (match == 0 && op != ParamExp::Op::ReplacePrefix && op != ParamExp::Op::ReplaceSuffix))
+            continue;
+        out(value.substr(kept, i - kept));
+        out(with);
+        kept = i + match;
+        if (op != ParamExp::Op::ReplaceAll)
+            break;
+        i = kept - 1;
+    }
+    out(value.substr(std::min(kept, n)));
+}
+
+// The text of a word that is a single literal, which then needs no
+// expansion; nullopt for any other.
+std::optional<std::string_view> literal_text(const Word* w)
+{
+    if (!w || w->parts.size == 0)
+        return std::string_view();
+    if (w->parts.size == 1 && w->parts.head->kind == WordPart::Kind::Literal)
+        return w->parts.head->text;
+    return std::nullopt;
+}
+
+void Expander::trim(const WordPart* p)
+{
+    const ParamExp* pe = p->param;
+    std::optional<Pattern> pattern;
+    if (!pe->pattern)
+        pattern.emplace(expand_pattern(shell_, pe->arg));
+    // Fetched only now: expanding the pattern may assign the variable.
+    std::string scratch;
+    std::string_view value = value_of(pe->name, scratch).value_or("");
+    add_expansion(trimmed(value, pe->pattern ? *pe->pattern : pattern->view(), pe->op), p->quoted);
+}
+
+void Expander::replace(const WordPart* p)
+{
+    const ParamExp* pe = p->param;
+    std::optional<Pattern> pattern;
+    if (!pe->pattern)
+        pattern.emplace(expand_pattern(shell_, pe->arg));
+    std::string with_storage;
+    std::optional<std::string_view> with = literal_text(pe->arg2);
+    if (!with)
+        with = with_storage = expand_string(shell_, pe->arg2);
+    std::string scratch;
+    std::string_view value = value_of(pe->name, scratch).value_or("");
+    PatternView view = pe->pattern ? *pe->pattern : pattern->view();
+    if (target_ == Target::Fields && !p->quoted) {
+        // Split as one piece: IFS characters either side of a piece
+        // boundary delimit fields as they would anywhere else.
+        std::string joined;
+        replaced(value, view, *with, pe->op, [&](std::string_view s) { joined += s; });
+        split(joined);
+        return;
+    }
+    if (p->quoted)
+        append({}, true);
+    replaced(value, view, *with, pe->op, [&](std::string_view s) { append(s, p->quoted); });
+}
+
+void Expander::substring(const WordPart* p)
+{
+    const ParamExp* pe = p->param;
+    long long off = pe->offset ? eval_arith(shell_, *pe->offset) : eval_arith(shell_, expand_string(shell_, pe->arg));
+    std::optional<long long> count;
+    if (pe->arg2)
+        count = pe->length ? eval_arith(shell_, *pe->length) : eval_arith(shell_, expand_string(shell_, pe->arg2));
+    if (pe->name == "@" || pe->name == "*") {
+        // A slice of $0 $1 ...: offset 0 is $0.
+        std::vector<std::string> args;
+        args.reserve(shell_.positional.size() + 1);
+        args.push_back(shell_.name);
+        args.insert(args.end(), shell_.positional.begin(), shell_.positional.end());
+        long long len = static_cast<long long>(args.size());
+        if (off < 0)
+            off = len + off;
+        if (off < 0 || (count && *count < 0))
+            return; // bash: out of range, or a negative count is an error
+        off = std::min(off, len);
+        long long n = count ? std::min(*count, len - off) : len - off;
+        std::span<const std::string> slice(args);
+        positional(p, pe->name == "*", slice.subspan(static_cast<size_t>(off), static_cast<size_t>(n)));
+        return;
+    }
+    std::string scratch;
+    std::string_view value = value_of(pe->name, scratch).value_or("");
+    long long len = static_cast<long long>(value.size());
+    if (off < 0)
+        off = std::max(0LL, len + off);
+    off = std::min(off, len);
+    long long n = len - off;
+    if (count) {
+        n = *count;
+        if (n < 0)
+            n = std::max(0LL, len + n - off);
+        n = std::min(n, len - off);
+    }
+    add_expansion(value.substr(static_cast<size_t>(off), static_cast<size_t>(n)), p->quoted);
+}
+
+void Expander::param(const WordPart* p)
+{
+    const ParamExp* pe = p->param;
+    std::string_view name = pe->name;
+    if (pe->op == ParamExp::Op::Plain && (name == "@" || name == "*")) {
+        positional(p, name == "*", shell_.positional);
+        return;
+    }
+
+    switch (pe->op) {
+    case ParamExp::Op::TrimSmallSuffix:
+    case ParamExp::Op::TrimLargeSuffix:
+    case ParamExp::Op::TrimSmallPrefix:
+    case ParamExp::Op::TrimLargePrefix:
+        trim(p);
+        return;
+    case ParamExp::Op::Replace:
+    case ParamExp::Op::ReplaceAll:
+    case ParamExp::Op::ReplacePrefix:
+    case ParamExp::Op::ReplaceSuffix:
+        replace(p);
+        return;
+    case ParamExp::Op::Substring:
+        substring(p);
+        return;
+    default:
+        break;
+    }
+
+    std::string scratch;
+    std::optional<std::string_view> value = value_of(name, scratch);
+    bool unset = !value || (pe->colon && value->empty());
+    switch (pe->op) {
+    case ParamExp::Op::Plain:
+        if (value)
+            add_expansion(*value, p->quoted);
+        else if (p->quoted)
+            append({}, true);
+        return;
+    case ParamExp::Op::Length: {
+        size_t len = name == "@" || name == "*" ? shell_.positional.size() : value ? value->size() : 0;
+        char buf[24];
+        add_expansion(std::string_view(buf, std::to_chars(buf, buf + sizeof buf, len).ptr), p->quoted);
+        return;
+    }
+    case ParamExp::Op::Default:
+        if (unset) {
+            for (const WordPart* q : pe->arg->parts)
+                part(q);
+            if (p->quoted)
+                append({}, true);
+        } else {
+            add_expansion(*value, p->quoted);
+        }
+        return;
+    case ParamExp::Op::Assign:
+        if (unset) {
+            if (!is_name(name))
+                throw ExpansionError(std::string(name) + ": cannot assign in this way");
+            scratch = expand_string(shell_, pe->arg);
+            shell_.vars.set(name, scratch);
+            value = scratch;
+        }
+        add_expansion(*value, p->quoted);
+        return;
+    case ParamExp::Op::Error:
+        if (unset) {
+            std::string msg = pe->arg && !pe->arg->parts.empty() ? expand_string(shell_, pe->arg)
+                                                                 : "parameter null or not set";
+            throw ExpansionError(std::string(name) + ": " + msg);
+        }
+        add_expansion(*value, p->quoted);
+        return;
+    case ParamExp::Op::Alternate:
+        if (!unset) {
+            for (const WordPart* q : pe->arg->parts)
+                part(q);
+        }
+        if (p->quoted)
+            append({}, true);
+        return;
+    default:
+        return;
+    }
+}
+
+void Expander::part(const WordPart* p)
+{
+    switch (p->kind) {
+    case WordPart::Kind::Literal:
+        append(p->text, p->quoted);
+        return;
+    case WordPart::Kind::Tilde: {
+        std::string home;
+        if (p->text.empty()) {
+            const std::string* h = shell_.vars.get("HOME");
+            home = h ? *h : std::string();
+        } else if (struct passwd* pw = ::getpwnam(std::string(p->text).c_str())) {
+            home = pw->pw_dir;
+        } else {
+            home.push_back('~');
+            home.append(p->text);
+        }
+        append(home, true);
+        return;
+    }
+    case WordPart::Kind::Param:
+        param(p);
+        return;
+    case WordPart::Kind::Command:
+        add_expansion(capture_output(shell_, p->command), p->quoted);
+        return;
+    case WordPart::Kind::Arith: {
+        long long v = p->arith ? eval_arith(shell_, *p->arith) : eval_arith(shell_, expand_string(shell_, p->expr));
+        add_expansion(std::to_string(v), p->quoted);
+        return;
+    }
+    }
+}
+
+} // namespace
+
+void expand_words(Shell& shell, const List<Word>& words, Fields& out, std::pair<size_t, size_t>* widest)
+{
+    Expander ex(shell, Expander::Target::Fields, &out);
+    for (const Word* w : words) {
+        size_t first = out.size();
+        ex.word(w);
+        if (widest && out.size() - first > widest->second - widest->first)
+            *widest = {first, out.size()};
+    }
+}
+
+std::string expand_string(Shell& shell, const Word* word)
+{
+    Expander ex(shell, Expander::Target::String);
+    ex.word(word);
+    return ex.take();
+}
+
+std::string expand_pattern(Shell& shell, const Word* word)
+{
+    Expander ex(shell, Expander::Target::Pattern);
+    ex.word(word);
+    return ex.take();
+}
+
+bool pattern_match(const std::string& pattern, const std::string& text)
+{
+    return ::fnmatch(pattern.c_str(), text.c_str(), 0) == 0;
+}
+
+} // namespace sh
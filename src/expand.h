@@ -0,0 +1,41 @@
+#pragma once
+
+#include "ast.h"
+#include "fields.h"
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace sh {
+
+struct Shell;
+
+// Raised for expansion failures such as ${x?} on an unset variable or a
+// bad arithmetic expression. The message is ready to print.
+class ExpansionError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Full expansion of command words: tilde, parameter, command and
+// arithmetic expansion, then field splitting, pathname expansion and quote
+// removal. Appends the resulting fields to out. widest, if given, receives
+// the range of fields that came from the single word yielding the most:
+// the part of a command that can be split into batches.
+void expand_words(Shell& shell, const List<Word>& words, Fields& out,
+                  std::pair<size_t, size_t>* widest = nullptr);
+
+// Expansion without field splitting or pathname expansion, as used for
+// assignments, redirection targets, here-document bodies and case subjects.
+std::string expand_string(Shell& shell, const Word* word);
+
+// Like expand_string, but quoted characters come back backslash-escaped so
+// the result can be matched with pattern_match().
+std::string expand_pattern(Shell& shell, const Word* word);
+
+// Shell pattern matching (fnmatch(3) semantics) of a whole string.
+bool pattern_match(const std::string& pattern, const std::string& text);
+
+} // namespace sh
@@ -0,0 +1,106 @@
+#include "fdplan.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+namespace sh {
+
+void FdPlan::open(int fd, std::string path, int flags, mode_t mode)
+{
+    actions_.push_back({FdAction::Kind::Open, fd, -1, std::move(path), flags, mode});
+}
+
+void FdPlan::dup(int src, int fd)
+{
+    actions_.push_back({FdAction::Kind::Dup, fd, src, {}, 0, 0});
+}
+
+void FdPlan::close(int fd)
+{
+    actions_.push_back({FdAction::Kind::Close, fd, -1, {}, 0, 0});
+}
+
+void FdPlan::drop(int fd)
+{
+    if (!actions_.empty()) {
+        FdAction& last = actions_.back();
+        if (last.kind == FdAction::Kind::Drop && (fd == last.fd - 1 || fd == last.src + 1)) {
+            last.fd = std::min(last.fd, fd);
+            last.src = std::max(last.src, fd);
+            return;
+        }
+    }
+    actions_.push_back({FdAction::Kind::Drop, fd, fd, {}, 0, 0});
+}
+
+void FdPlan::append(const FdPlan& other)
+{
+    actions_.insert(actions_.end(), other.actions_.begin(), other.actions_.end());
+}
+
+int FdPlan::source(int fd, const FdAction** opened) const
+{
+    if (opened)
+        *opened = nullptr;
+    // Back from the last step: the latest one to touch fd decides.
+    for (auto it = actions_.rbegin(); it != actions_.rend(); ++it) {
+        const FdAction& a = *it;
+        if (a.kind == FdAction::Kind::Drop) {
+            if (fd >= a.fd && fd <= a.src)
+                return -1;
+            continue;
+        }
+        if (a.fd != fd)
+            continue;
+        switch (a.kind) {
+        case FdAction::Kind::Dup:
+            fd = a.src;
+            break;
+        case FdAction::Kind::Open:
+            if (opened)
+                *opened = &a;
+            return -1;
+        default:
+            return -1;
+        }
+    }
+    return fd;
+}
+
+int FdPlan::apply_in_child(bool exec) const noexcept
+{
+    for (const FdAction& a : actions_) {
+        switch (a.kind) {
+        case FdAction::Kind::Open: {
+            int fd = ::open(a.path.c_str(), a.flags, a.mode);
+            if (fd < 0)
+                return errno;
+            if (fd != a.fd) {
+                if (::dup3(fd, a.fd, 0) < 0)
+                    return errno;
+                ::close(fd);
+            }
+            break;
+        }
+        case FdAction::Kind::Dup:
+            // The shell's descriptors are close-on-exec; one already in
+            // place must have the flag cleared to survive the exec.
+            if ((a.src == a.fd ? ::fcntl(a.fd, F_SETFD, 0) : ::dup3(a.src, a.fd, 0)) < 0)
+                return errno;
+            break;
+        case FdAction::Kind::Close:
+            ::close(a.fd);
+            break;
+        case FdAction::Kind::Drop:
+            if (!exec)
+                ::close_range(static_cast<unsigned>(a.fd), static_cast<unsigned>(a.src), 0);
+            break;
+        }
+    }
+    return 0;
+}
+
+} // namespace sh
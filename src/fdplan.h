@@ -0,0 +1,60 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+namespace sh {
+
+// One step of a child's descriptor setup, applied in order.
+struct FdAction {
+    enum class Kind {
+        Open,
+        Dup,
+        Close,
+        Drop, // close fd through last, all close-on-exec; see FdPlan::drop()
+    };
+
+    Kind kind;
+    int fd;             // descriptor being set up
+    int src = -1;       // Dup: descriptor copied onto fd; Drop: last of the range
+    std::string path;   // Open: file to open onto fd
+    int flags = 0;      // Open: open(2) flags
+    mode_t mode = 0666; // Open: creation mode
+};
+
+// Ordered list of descriptor operations describing how a child's fd table
+// differs from the shell's. The redirection engine builds one per command
+// and the launcher translates it for whichever backend is in use.
+class FdPlan {
+public:
+    void open(int fd, std::string path, int flags, mode_t mode = 0666);
+    void dup(int src, int fd);
+    void close(int fd);
+    // Closes one of the shell's own descriptors, which are all opened
+    // close-on-exec: a child that execs loses it with no step at all, so
+    // only a forked shell closes it. Drops of adjacent descriptors merge
+    // into one range, closed with a single close_range(2).
+    void drop(int fd);
+    void append(const FdPlan& other);
+
+    const std::vector<FdAction>& actions() const { return actions_; }
+
+    // Where a child set up by this plan gets fd from: the shell's
+    // descriptor that ends up copied onto it, or -1 if the plan closes it
+    // or opens a file onto it (then *opened, if given, is that step).
+    int source(int fd, const FdAction** opened = nullptr) const;
+    bool empty() const { return actions_.empty(); }
+
+    // Applies the plan to the calling process. Only async-signal-safe calls
+    // are made, so this is usable between vfork()/fork() and exec; with
+    // exec set, drops are left to close-on-exec. Returns 0 or the errno of
+    // the first failing step.
+    int apply_in_child(bool exec) const noexcept;
+
+private:
+    std::vector<FdAction> actions_;
+};
+
+} // namespace sh
@@ -0,0 +1,93 @@
+#include "fields.h"
+
+#include <algorithm>
+
+namespace sh {
+
+Fields::Fields(const std::vector<std::string>& items)
+{
+    size_t total = 0;
+    for (const std::string& s : items)
+        total += s.size() + 1;
+    data_.reserve(total);
+    ends_.reserve(items.size());
+    for (const std::string& s : items)
+        push_back(s);
+}
+
+void Fields::push_back(std::string_view field)
+{
+    data_.insert(data_.end(), field.begin(), field.end());
+    data_.push_back('\0');
+    ends_.push_back(data_.size());
+}
+
+void Fields::push_joined(std::string_view head, std::string_view tail)
+{
+    data_.insert(data_.end(), head.begin(), head.end());
+    data_.insert(data_.end(), tail.begin(), tail.end());
+    data_.push_back('\0');
+    ends_.push_back(data_.size());
+}
+
+void Fields::append(const Fields& other, size_t first, size_t last)
+{
+    if (first >= last)
+        return;
+    size_t base = data_.size() - other.start(first);
+    data_.insert(data_.end(), other.data_.begin() + static_cast<ptrdiff_t>(other.start(first)),
+                 other.data_.begin() + static_cast<ptrdiff_t>(other.ends_[last - 1]));
+    for (size_t i = first; i < last; ++i)
+        ends_.push_back(other.ends_[i] + base);
+}
+
+void Fields::clear()
+{
+    data_.clear();
+    ends_.clear();
+}
+
+void Fields::sort_from(size_t first)
+{
+    if (size() - first < 2)
+        return;
+    std::vector<std::string_view> items;
+    items.reserve(size() - first);
+    for (size_t i = first; i < size(); ++i)
+        items.push_back((*this)[i]);
+    std::sort(items.begin(), items.end());
+    // The views point into data_, so the sorted copy is built beside it.
+    std::vector<char> sorted;
+    sorted.reserve(bytes(first, size()));
+    for (std::string_view s : items) {
+        sorted.insert(sorted.end(), s.begin(), s.end());
+        sorted.push_back('\0');
+    }
+    size_t at = start(first);
+    std::copy(sorted.begin(), sorted.end(), data_.begin() + static_cast<ptrdiff_t>(at));
+    for (size_t i = first; i < size(); ++i) {
+        at += items[i - first].size() + 1;
+        ends_[i] = at;
+    }
+}
+
+std::vector<std::string> Fields::slice(size_t first, size_t last) const
+{
+    std::vector<std::string> out;
+    out.reserve(last > first ? last - first : 0);
+    for (size_t i = first; i < last; ++i)
+        out.emplace_back((*this)[i]);
+    return out;
+}
+
+std::vector<char*> Fields::argv()
+{
+    std::vector<char*> argv;
+    argv.reserve(size() + 1);
+    for (size_t i = 0; i < size(); ++i)
+        argv.push_back(data_.data() + start(i));
+    argv.push_back(nullptr);
+    return argv;
+}
+
+} // namespace sh
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sh {
+
+// The fields of an expanded command, kept one after another in a single
+// block with a NUL after each, the way execve(2) is going to copy them.
+// A field costs its bytes and one offset rather than a std::string and a
+// heap block of its own, and argv() is just pointers into the block, so the
+// two million names of `rm *` take little more memory than the names do.
+class Fields {
+public:
+    Fields() = default;
+    explicit Fields(const std::vector<std::string>& items);
+
+    size_t size() const { return ends_.size(); }
+    bool empty() const { return ends_.empty(); }
+    std::string_view operator[](size_t i) const { return {data_.data() + start(i), ends_[i] - start(i) - 1}; }
+    const char* c_str(size_t i) const { return data_.data() + start(i); }
+    std::string_view back() const { return (*this)[size() - 1]; }
+
+    void push_back(std::string_view field);
+    void push_joined(std::string_view head, std::string_view tail); // one field
+    void append(const Fields& other, size_t first, size_t last);
+    void clear();
+
+    // Sorts the fields from first on bytewise, as pathname expansion
+    // orders its matches.
+    void sort_from(size_t first);
+
+    // Fields [first, last) as strings, as positional parameters are kept.
+    std::vector<std::string> slice(size_t first, size_t last) const;
+
+    // Null-terminated pointers to the fields, valid until the next change.
+    std::vector<char*> argv();
+
+    // Bytes of fields [first, last), each with its NUL, and of all of them.
+    size_t bytes(size_t first, size_t last) const { return (last ? ends_[last - 1] : 0) - start(first); }
+    size_t bytes() const { return data_.size(); }
+
+private:
+    size_t start(size_t i) const { return i ? ends_[i - 1] : 0; }
+
+    std::vector<char> data_;
+    std::vector<size_t> ends_; // one past each field's NUL
+};
+
+} // namespace sh
@@ -0,0 +1,158 @@
+#include "history.h"
+
+#include "transfer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace sh {
+
+namespace {
+
+std::string_view first_word(std::string_view line)
+{
+    return line.substr(0, line.find_first_of(" \t"));
+}
+
+} // namespace
+
+History::~History()
+{
+    if (data_)
+        ::munmap(const_cast<char*>(data_), mapped_);
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+bool History::open()
+{
+    if (path_.empty())
+        return fd_ >= 0;
+    fd_ = ::open(path_.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    path_.clear();
+    return fd_ >= 0;
+}
+
+void History::map(size_t length)
+{
+    if (data_)
+        ::munmap(const_cast<char*>(data_), mapped_);
+    data_ = nullptr;
+    mapped_ = 0;
+    void* p = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED)
+        return;
+    data_ = static_cast<const char*>(p);
+    mapped_ = length;
+}
+
+void History::reset()
+{
+    starts_.clear();
+    by_word_.clear();
+    indexed_ = 0;
+}
+
+void History::index(size_t i)
+{
+    std::string_view word = first_word((*this)[i]);
+    auto it = by_word_.find(word);
+    if (it == by_word_.end())
+        it = by_word_.emplace(std::string(word), std::vector<uint32_t>()).first;
+    it->second.push_back(static_cast<uint32_t>(i));
+}
+
+void History::refresh()
+{
+    if (!open())
+        return;
+    struct stat st;
+    if (::fstat(fd_, &st) < 0)
+        return;
+    auto size = static_cast<size_t>(st.st_size);
+    if (size < indexed_) {
+        // Truncated or replaced behind our back: start over.
+        reset();
+    }
+    if (size == mapped_ && data_)
+        return;
+    if (size == 0)
+        return;
+    map(size);
+    if (!data_) {
+        reset();
+        return;
+    }
+    // A line without its newline yet is another shell mid-write; it is
+    // picked up once complete.
+    for (size_t at = indexed_; at < size;) {
+        const void* nl = std::memchr(data_ + at, '\n', size - at);
+        if (!nl)
+            break;
+        size_t end = static_cast<size_t>(static_cast<const char*>(nl) - data_);
+        starts_.push_back(at);
+        at = indexed_ = end + 1;
+        index(starts_.size() - 1);
+    }
+}
+
+void History::add(std::string_view line)
+{
+    if (!open()) {
+        session_.emplace_back(line);
+        index(size() - 1);
+        return;
+    }
+    // Indexed at the next refresh(), along with whatever other shells
+    // appended meanwhile.
+    std::string record(line);
+    record += '\n';
+    write_all(fd_, record);
+}
+
+std::string_view History::operator[](size_t i) const
+{
+    if (i >= starts_.size())
+        return session_[i - starts_.size()];
+    size_t end = i + 1 < starts_.size() ? starts_[i + 1] : indexed_;
+    return std::string_view(data_ + starts_[i], end - 1 - starts_[i]);
+}
+
+std::optional<std::string_view> History::find_prefix(std::string_view prefix) const
+{
+    if (size() == 0)
+        return std::nullopt;
+    if (prefix.empty())
+        return (*this)[size() - 1];
+    std::string_view word = first_word(prefix);
+    if (word.size() < prefix.size()) {
+        // The prefix spells out the whole first word: only its entries
+        // can match, and the latest one that does wins.
+        auto it = by_word_.find(word);
+        if (it == by_word_.end())
+            return std::nullopt;
+        for (size_t n = it->second.size(); n-- > 0;) {
+            std::string_view entry = (*this)[it->second[n]];
+            if (entry.starts_with(prefix))
+                return entry;
+        }
+        return std::nullopt;
+    }
+    // Otherwise every entry whose first word starts with the prefix
+    // matches; take the latest over that range of words.
+    std::optional<uint32_t> best;
+    for (auto it = by_word_.lower_bound(prefix);
+         it != by_word_.end() && it->first.starts_with(prefix); ++it) {
+        if (!best || it->second.back() > *best)
+            best = it->second.back();
+    }
+    if (!best)
+        return std::nullopt;
+    return (*this)[*best];
+}
+
+} // namespace sh
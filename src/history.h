@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace sh {
+
+// Interactive command history, one entry per line of an append-only file
+// that every interactive shell of the user shares. The file is mapped
+// rather than read, and only the offsets of its lines are kept, so startup
+// and searches cost a scan of the mapping, not a string per entry. Each
+// entry is appended with a single O_APPEND write, which concurrent shells
+// cannot interleave; what they append shows up at the next refresh().
+class History {
+public:
+    History() = default;
+    ~History();
+
+    History(const History&) = delete;
+    History& operator=(const History&) = delete;
+
+    // Names the file. It is opened (and created if need be), mapped and
+    // indexed on first use, so a session that never reaches the history
+    // never pays for it. Without a file, or if it cannot be opened,
+    // entries are kept in memory for this session.
+    void set_file(std::string path) { path_ = std::move(path); }
+
+    // Appends line, which must not contain a newline.
+    void add(std::string_view line);
+
+    // Maps and indexes whatever was appended to the file since.
+    void refresh();
+
+    size_t size() const { return starts_.size() + session_.size(); }
+    std::string_view operator[](size_t i) const;
+
+    // The most recent entry starting with prefix, for !prefix.
+    std::optional<std::string_view> find_prefix(std::string_view prefix) const;
+
+private:
+    bool open();
+    void map(size_t length);
+    void index(size_t i);
+    void reset();
+
+    std::string path_; // not opened yet, if non-empty
+    int fd_ = -1;
+    const char* data_ = nullptr;
+    size_t mapped_ = 0;
+    size_t indexed_ = 0;          // bytes up to the last complete line
+    std::vector<uint64_t> starts_; // offset of each complete line
+    std::vector<std::string> session_; // only when there is no file
+    // Entry numbers, oldest first, by the entry's first blank-delimited
+    // word. Sorted, so the words a prefix can match are one range.
+    std::map<std::string, std::vector<uint32_t>, std::less<>> by_word_;
+};
+
+} // namespace sh
@@ -0,0 +1,265 @@
+#include "jobs.h"
+
+#include "trace.h"
+
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace sh {
+
+namespace {
+
+int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return static_cast<int>(::syscall(SYS_pidfd_open, pid, 0)); // close-on-exec by default
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+} // namespace
+
+JobTable::~JobTable()
+{
+    for (auto& [id, job] : jobs_) {
+        if (job.pidfd >= 0)
+            ::close(job.pidfd);
+    }
+    if (epoll_ >= 0)
+        ::close(epoll_);
+}
+
+int JobTable::add(pid_t pid, std::string command)
+{
+    poll();
+    trim();
+
+    int id = jobs_.empty() ? 1 : jobs_.rbegin()->first + 1;
+    Job& job = jobs_[id];
+    job.id = id;
+    job.pid = pid;
+    job.command = std::move(command);
+    job.start_us = monotonic_us();
+    by_pid_[pid] = id;
+    ++running_;
+
+    if (epoll_ < 0)
+        epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+    // A child that already exited is still a zombie here, so its pidfd is
+    // simply readable at once.
+    int fd = epoll_ >= 0 ? open_pidfd(pid) : -1;
+    if (fd >= 0) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = static_cast<uint64_t>(pid);
+        if (::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev) == 0) {
+            job.pidfd = fd;
+        } else {
+            ::close(fd);
+        }
+    }
+    if (job.pidfd < 0)
+        ++unwatched_;
+    return id;
+}
+
+void JobTable::poll(int timeout_ms)
+{
+    if (unwatched_ > 0) {
+        for (auto& [id, job] : jobs_) {
+            if (!job.done && !job.inherited && job.pidfd < 0)
+                reap(job, WNOHANG);
+        }
+    }
+    if (epoll_ < 0 || running_ == unwatched_)
+        return;
+
+    epoll_event events[64];
+    for (;;) {
+        int n = ::epoll_wait(epoll_, events, 64, timeout_ms);
+        if (n <= 0)
+            return;
+        for (int i = 0; i < n; ++i) {
+            if (Job* job = find_pid(static_cast<pid_t>(events[i].data.u64)); job && !job->done)
+                reap(*job, WNOHANG);
+        }
+        if (n < 64)
+            return;
+        timeout_ms = 0; // drain the rest without blocking
+    }
+}
+
+int JobTable::wait(Job& job)
+{
+    if (job.inherited)
+        return 127;
+    while (!job.done) {
+        if (job.pidfd >= 0)
+            poll(-1);
+        else
+            reap(job, 0);
+    }
+    return exit_status(job.wait_status);
+}
+
+void JobTable::wait_all()
+{
+    for (auto& [id, job] : jobs_)
+        wait(job);
+}
+
+void JobTable::wait_any()
+{
+    size_t before = running_;
+    while (running_ == before && running_ > 0)
+        poll(unwatched_ > 0 ? 10 : -1); // unwatched jobs need polling
+}
+
+Job* JobTable::find(int id)
+{
+    auto it = jobs_.find(id);
+    return it == jobs_.end() ? nullptr : &it->second;
+}
+
+Job* JobTable::find_pid(pid_t pid)
+{
+    auto it = by_pid_.find(pid);
+    return it == by_pid_.end() ? nullptr : find(it->second);
+}
+
+void JobTable::remove(int id)
+{
+    auto it = jobs_.find(id);
+    if (it == jobs_.end())
+        return;
+    Job& job = it->second;
+    if (job.done) {
+        --finished_;
+    } else if (!job.inherited) {
+        // Forgotten while still running: nothing reaps it from now on.
+        if (job.pidfd >= 0)
+            ::close(job.pidfd);
+        else
+            --unwatched_;
+        --running_;
+    }
+    by_pid_.erase(job.pid);
+    jobs_.erase(it);
+}
+
+void JobTable::prune()
+{
+    for (auto it = jobs_.begin(); it != jobs_.end();) {
+        if (it->second.done && it->second.notified) {
+            by_pid_.erase(it->second.pid);
+            it = jobs_.erase(it);
+            --finished_;
+        } else {
+            ++it;
+        }
+    }
+}
+
+void JobTable::for_each(const std::function<void(Job&)>& fn)
+{
+    for (auto& [id, job] : jobs_)
+        fn(job);
+}
+
+void JobTable::reset_in_child()
+{
+    for (auto& [id, job] : jobs_) {
+        if (job.pidfd >= 0)
+            ::close(job.pidfd);
+        job.pidfd = -1;
+        job.inherited = true;
+    }
+    if (epoll_ >= 0)
+        ::close(epoll_);
+    epoll_ = -1;
+    running_ = 0;
+    unwatched_ = 0;
+}
+
+int JobTable::exit_status(int wait_status)
+{
+    if (WIFEXITED(wait_status))
+        return WEXITSTATUS(wait_status);
+    if (WIFSIGNALED(wait_status))
+        return 128 + WTERMSIG(wait_status);
+    return 1;
+}
+
+std::string JobTable::describe(const Job& job)
+{
+    if (!job.done)
+        return "Running";
+    int st = job.wait_status;
+    if (WIFSIGNALED(st)) {
+        std::string text = ::strsignal(WTERMSIG(st));
+        if (WCOREDUMP(st))
+            text += " (core dumped)";
+        return text;
+    }
+    int code = exit_status(st);
+    return code == 0 ? "Done" : "Done(" + std::to_string(code) + ")";
+}
+
+void JobTable::reap(Job& job, int flags)
+{
+    int st;
+    struct rusage usage;
+    pid_t r;
+    do {
+        r = ::wait4(job.pid, &st, flags, &usage);
+    } while (r < 0 && errno == EINTR);
+    if (r == job.pid)
+        finish(job, st, &usage);
+    else if (r < 0)
+        finish(job, 127 << 8, nullptr); // not our child after all
+}
+
+void JobTable::finish(Job& job, int wait_status, const struct rusage* usage)
+{
+    job.done = true;
+    job.wait_status = wait_status;
+    if (usage) {
+        job.usage = *usage;
+        reaped_cpu_.user_us += static_cast<int64_t>(usage->ru_utime.tv_sec) * 1000000 + usage->ru_utime.tv_usec;
+        reaped_cpu_.sys_us += static_cast<int64_t>(usage->ru_stime.tv_sec) * 1000000 + usage->ru_stime.tv_usec;
+    }
+    --running_;
+    ++finished_;
+    if (job.pidfd >= 0) {
+        ::epoll_ctl(epoll_, EPOLL_CTL_DEL, job.pidfd, nullptr);
+        ::close(job.pidfd);
+        job.pidfd = -1;
+    } else {
+        --unwatched_;
+    }
+    if (usage && reap_hook_)
+        reap_hook_(job);
+}
+
+void JobTable::trim()
+{
+    for (auto it = jobs_.begin(); finished_ > kMaxFinished && it != jobs_.end();) {
+        if (it->second.done) {
+            by_pid_.erase(it->second.pid);
+            it = jobs_.erase(it);
+            --finished_;
+        } else {
+            ++it;
+        }
+    }
+}
+
+} // namespace sh
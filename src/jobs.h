@@ -0,0 +1,113 @@
+#pragma once
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include <cstdint>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+namespace sh {
+
+// A background command (`cmd &`). Each job is one process: an async list
+// runs in a single forked shell, which waits for its own pipeline.
+struct Job {
+    int id = 0;
+    pid_t pid = 0;
+    std::string command;
+    bool done = false;
+    int wait_status = 0; // raw waitpid() status once done
+    struct rusage usage{}; // as wait4() reported it once done
+    int64_t start_us = 0;  // monotonic_us() when added
+    bool notified = false;
+    bool inherited = false; // the parent's job, seen from a forked subshell
+    int pidfd = -1;         // -1 once reaped, or if pidfd_open(2) is unavailable
+};
+
+// CPU time in microseconds.
+struct CpuTime {
+    int64_t user_us = 0;
+    int64_t sys_us = 0;
+};
+
+// The shell's background jobs, driven by one event loop: every job has a
+// pidfd registered with a single epoll instance, and a job is reaped only
+// when its pidfd reports the exit. No SIGCHLD handler is involved, so a
+// fan-out of hundreds of jobs costs one wakeup per exit rather than a
+// handler storm polling waitpid(). `wait`, `jobs` and the interactive
+// prompt's notifications all read from this table.
+class JobTable {
+public:
+    JobTable() = default;
+    ~JobTable();
+
+    // Exit statuses kept for `wait` once jobs are done, like bash's
+    // CHILD_MAX; the oldest are forgotten first.
+    static constexpr size_t kMaxFinished = 4096;
+
+    JobTable(const JobTable&) = delete;
+    JobTable& operator=(const JobTable&) = delete;
+
+    // Starts tracking pid and returns its job number. Jobs that have exited
+    // are reaped first, so a shell that never reaches a prompt or `wait`
+    // holds no zombies or pidfds for them.
+    int add(pid_t pid, std::string command);
+
+    // Reaps every job that has exited. timeout_ms > 0 (or -1 for no limit)
+    // first waits that long for at least one exit.
+    void poll(int timeout_ms = 0);
+
+    // Blocks until job is done and returns its exit status (127 for an
+    // inherited job, which only the parent can wait for).
+    int wait(Job& job);
+    // Blocks until every job is done.
+    void wait_all();
+    // Blocks until at least one running job is done.
+    void wait_any();
+
+    Job* find(int id);
+    Job* find_pid(pid_t pid);
+    void remove(int id);
+    // Drops the jobs that are done and have been reported.
+    void prune();
+
+    // Called with each job this table reaps, once its status and usage are
+    // set; `set -o trace-timing` reports jobs through it.
+    void set_reap_hook(std::function<void(const Job&)> hook) { reap_hook_ = std::move(hook); }
+    // The CPU time of every job reaped so far, for meters of the shell's
+    // children to leave out.
+    CpuTime reaped_cpu() const { return reaped_cpu_; }
+
+    size_t size() const { return jobs_.size(); }
+    size_t running() const { return running_; }
+    void for_each(const std::function<void(Job&)>& fn);
+
+    // In a forked child: the jobs belong to the parent, so they are kept
+    // only for `jobs` to list, and the descriptors watching them are closed.
+    void reset_in_child();
+
+    // Converts a raw wait status into a shell exit status.
+    static int exit_status(int wait_status);
+    // "Running", "Done", "Done(3)", "Killed", ... as `jobs` prints it.
+    static std::string describe(const Job& job);
+
+private:
+    void reap(Job& job, int flags);
+    void finish(Job& job, int wait_status, const struct rusage* usage);
+    // Forgets the oldest done jobs beyond kMaxFinished.
+    void trim();
+
+    std::map<int, Job> jobs_; // by job number, for listing in order
+    std::unordered_map<pid_t, int> by_pid_;
+    int epoll_ = -1;
+    size_t running_ = 0;
+    size_t finished_ = 0;  // done jobs still in jobs_
+    size_t unwatched_ = 0; // running jobs without a pidfd, polled with WNOHANG
+    std::function<void(const Job&)> reap_hook_;
+    CpuTime reaped_cpu_;
+};
+
+} // namespace sh
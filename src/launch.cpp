@@ -0,0 +1,299 @@
+#include "launch.h"
+
+#include "fdplan.h"
+
+#include <fcntl.h>
+#include <linux/ioprio.h>
+#include <linux/mempolicy.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+namespace sh {
+
+namespace {
+
+// Puts the child into the state every backend promises: default signal
+// dispositions, an empty signal mask, the requested process group and the
+// fd plan. Runs between vfork()/fork() and exec, so only async-signal-safe
+// calls are allowed. Returns 0 or an errno value.
+int prepare_child(const LaunchSpec& spec) noexcept
+{
+    struct sigaction dfl = {};
+    dfl.sa_handler = SIG_DFL;
+    for (int sig = 1; sig < NSIG; ++sig) {
+        if (sig != SIGKILL && sig != SIGSTOP)
+            ::sigaction(sig, &dfl, nullptr);
+    }
+    if (spec.pgid >= 0 && ::setpgid(0, spec.pgid) < 0)
+        return errno;
+    if (spec.placement) {
+        if (int err = apply_placement(*spec.placement))
+            return err;
+    }
+    if (spec.fds) {
+        if (int err = spec.fds->apply_in_child(true))
+            return err;
+    }
+    sigset_t none;
+    sigemptyset(&none);
+    ::sigprocmask(SIG_SETMASK, &none, nullptr);
+    return 0;
+}
+
+pid_t reap_failed(pid_t pid, int err)
+{
+    int status;
+    while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    errno = err;
+    return -1;
+}
+
+pid_t launch_spawn(const LaunchSpec& spec)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (spec.fds) {
+        for (const FdAction& a : spec.fds->actions()) {
+            switch (a.kind) {
+            case FdAction::Kind::Open:
+                posix_spawn_file_actions_addopen(&actions, a.fd, a.path.c_str(), a.flags, a.mode);
+                break;
+            case FdAction::Kind::Dup:
+                posix_spawn_file_actions_adddup2(&actions, a.src, a.fd);
+                break;
+            case FdAction::Kind::Close:
+                posix_spawn_file_actions_addclose(&actions, a.fd);
+                break;
+            case FdAction::Kind::Drop:
+                break; // close-on-exec
+            }
+        }
+    }
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    sigset_t all, none;
+    sigfillset(&all);
+    sigemptyset(&none);
+    posix_spawnattr_setsigdefault(&attr, &all);
+    posix_spawnattr_setsigmask(&attr, &none);
+    if (spec.pgid >= 0) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, spec.pgid);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    pid_t pid = -1;
+    int rc = ::posix_spawn(&pid, spec.path, &actions, &attr, spec.argv, spec.envp);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+    return pid;
+}
+
+pid_t launch_vfork(const LaunchSpec& spec)
+{
+    // Block everything so no handler of ours runs on the shared stack while
+    // the child still borrows it; the child installs its own mask.
+    sigset_t all, saved;
+    sigfillset(&all);
+    ::pthread_sigmask(SIG_SETMASK, &all, &saved);
+
+    volatile int child_err = 0;
+    pid_t pid = ::vfork();
+    if (pid == 0) {
+        int err = prepare_child(spec);
+        if (err == 0) {
+            ::execve(spec.path, spec.argv, spec.envp);
+            err = errno;
+        }
+        child_err = err;
+        ::_exit(127);
+    }
+    int fork_err = errno;
+    ::pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+
+    if (pid < 0) {
+        errno = fork_err;
+        return -1;
+    }
+    if (child_err != 0)
+        return reap_failed(pid, child_err);
+    return pid;
+}
+
+pid_t launch_fork(const LaunchSpec& spec)
+{
+    int report[2];
+    if (::pipe2(report, O_CLOEXEC) < 0)
+        return -1;
+
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        ::close(report[0]);
+        int err = prepare_child(spec);
+        if (err == 0) {
+            ::execve(spec.path, spec.argv, spec.envp);
+            err = errno;
+        }
+        ssize_t n = ::write(report[1], &err, sizeof err);
+        (void)n;
+        ::_exit(127);
+    }
+    int fork_err = errno;
+    ::close(report[1]);
+    if (pid < 0) {
+        ::close(report[0]);
+        errno = fork_err;
+        return -1;
+    }
+    if (spec.pgid >= 0)
+        ::setpgid(pid, spec.pgid == 0 ? pid : spec.pgid);
+
+    int child_err = 0;
+    ssize_t n;
+    while ((n = ::read(report[0], &child_err, sizeof child_err)) < 0 && errno == EINTR) {
+    }
+    ::close(report[0]);
+    if (n == sizeof child_err)
+        return reap_failed(pid, child_err);
+    return pid;
+}
+
+} // namespace
+
+int apply_placement(const JobPlacement& placement) noexcept
+{
+    if (!placement.cgroup.empty()) {
+        // Writing 0 to cgroup.procs moves the writer itself.
+        char path[PATH_MAX];
+        size_t n = placement.cgroup.size();
+        if (n + sizeof "/cgroup.procs" > sizeof path)
+            return ENAMETOOLONG;
+        __builtin_memcpy(path, placement.cgroup.data(), n);
+        __builtin_memcpy(path + n, "/cgroup.procs", sizeof "/cgroup.procs");
+        int fd = ::open(path, O_WRONLY | O_CLOEXEC);
+        if (fd < 0)
+            return errno;
+        int err = ::write(fd, "0", 1) == 1 ? 0 : errno;
+        ::close(fd);
+        if (err)
+            return err;
+    }
+    if (placement.node >= 0) {
+        unsigned long mask[16] = {};
+        constexpr int kBits = 8 * sizeof(unsigned long);
+        if (placement.node >= static_cast<int>(sizeof mask * 8))
+            return EINVAL;
+        mask[placement.node / kBits] = 1UL << (placement.node % kBits);
+        if (::syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, sizeof mask * 8 + 1) < 0)
+            return errno;
+    }
+    if (placement.has_cpus && ::sched_setaffinity(0, sizeof placement.cpus, &placement.cpus) < 0)
+        return errno;
+    if (placement.nice && ::setpriority(PRIO_PROCESS, 0, *placement.nice) < 0)
+        return errno;
+    if (placement.ioprio >= 0 && ::syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, placement.ioprio) < 0)
+        return errno;
+    return 0;
+}
+
+pid_t launch(const LaunchSpec& spec, LaunchBackend backend)
+{
+    if (spec.placement && backend == LaunchBackend::Spawn)
+        backend = LaunchBackend::Vfork;
+    switch (backend) {
+    case LaunchBackend::Spawn:
+        return launch_spawn(spec);
+    case LaunchBackend::Vfork:
+        return launch_vfork(spec);
+    case LaunchBackend::Fork:
+        break;
+    }
+    return launch_fork(spec);
+}
+
+ExecSize exec_size(const LaunchSpec& spec)
+{
+    ExecSize size;
+    auto add = [&](const char* s) {
+        size_t n = std::strlen(s) + 1;
+        size.total += n;
+        size.longest = std::max(size.longest, n);
+    };
+    add(spec.path);
+    for (char* const* list : {spec.argv, spec.envp}) {
+        for (char* const* p = list; p && *p; ++p) {
+            add(*p);
+            size.total += sizeof(char*);
+        }
+    }
+    return size;
+}
+
+size_t exec_limit()
+{
+    constexpr size_t kFloor = 128 * 1024;                 // ARG_MAX
+    constexpr size_t kCeiling = 8 * 1024 * 1024 / 4 * 3; // _STK_LIM / 4 * 3
+    struct rlimit stack;
+    size_t limit = kCeiling;
+    if (::getrlimit(RLIMIT_STACK, &stack) == 0 && stack.rlim_cur != RLIM_INFINITY)
+        limit = std::min<size_t>(limit, stack.rlim_cur / 4);
+    return std::max(limit, kFloor);
+}
+
+size_t exec_string_limit()
+{
+    return 32 * static_cast<size_t>(::sysconf(_SC_PAGESIZE)); // MAX_ARG_STRLEN
+}
+
+int exec_in_place(const LaunchSpec& spec)
+{
+    int err = prepare_child(spec);
+    if (err == 0) {
+        ::execve(spec.path, spec.argv, spec.envp);
+        err = errno;
+    }
+    errno = err;
+    return -1;
+}
+
+std::optional<LaunchBackend> parse_backend(std::string_view name)
+{
+    if (name == "spawn")
+        return LaunchBackend::Spawn;
+    if (name == "vfork")
+        return LaunchBackend::Vfork;
+    if (name == "fork")
+        return LaunchBackend::Fork;
+    return std::nullopt;
+}
+
+const char* backend_name(LaunchBackend backend)
+{
+    switch (backend) {
+    case LaunchBackend::Spawn:
+        return "spawn";
+    case LaunchBackend::Vfork:
+        return "vfork";
+    case LaunchBackend::Fork:
+        break;
+    }
+    return "fork";
+}
+
+} // namespace sh
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <sched.h>
+#include <sys/types.h>
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace sh {
+
+class FdPlan;
+
+// Process-creation strategy used by launch(). Spawn and Vfork share the
+// parent's address space until exec, so their cost does not grow with the
+// shell's resident set; Fork copies page tables and is kept as a fallback
+// and for benchmarking.
+enum class LaunchBackend {
+    Spawn, // posix_spawn(3), fd plan translated to file actions
+    Vfork, // vfork(2) + execve(2), fd plan applied in the child
+    Fork,  // fork(2) + execve(2)
+};
+
+// Where and how a background job runs: set with the jobopts builtin and
+// applied to the job's process itself as it starts, so that no taskset,
+// nice or ionice wrapper is needed. Everything set here is inherited by the
+// job's own children.
+struct JobPlacement {
+    std::string cgroup;       // cgroup v2 directory to join; empty to stay
+    std::string cpu_list;     // as given, for display
+    cpu_set_t cpus;           // affinity, when has_cpus
+    bool has_cpus = false;
+    int node = -1;            // NUMA node to take memory from first, or -1
+    std::optional<int> nice;  // setpriority(2) value
+    int ioprio = -1;          // ioprio_set(2) value, or -1
+
+    bool empty() const { return cgroup.empty() && !has_cpus && node < 0 && !nice && ioprio < 0; }
+};
+
+// Applies placement to the calling process. Only async-signal-safe calls
+// are made. Returns 0 or the errno of the first failing step.
+int apply_placement(const JobPlacement& placement) noexcept;
+
+// Everything needed to start one external program.
+struct LaunchSpec {
+    const char* path = nullptr;   // resolved executable
+    char* const* argv = nullptr;  // null-terminated
+    char* const* envp = nullptr;  // null-terminated
+    const FdPlan* fds = nullptr;  // optional descriptor setup
+    pid_t pgid = -1;              // -1 inherit, 0 new group led by the child
+    const JobPlacement* placement = nullptr; // optional; rules out posix_spawn
+};
+
+// Starts spec.path in a new process using the given backend. Returns the
+// child's pid, or -1 with errno set when the process could not be created
+// or the exec itself failed (all backends report exec errors
+// synchronously). Signal dispositions are reset to default in the child.
+// posix_spawn has no way to apply a placement, so Spawn then uses vfork.
+pid_t launch(const LaunchSpec& spec, LaunchBackend backend);
+
+// What execve(2) copies for spec onto the new program's stack: each
+// argument and environment string (and the path) with its NUL, plus a
+// pointer per argument and variable. Past exec_limit() in total, or with one
+// string past exec_string_limit(), the exec fails with E2BIG.
+struct ExecSize {
+    size_t total = 0;
+    size_t longest = 0;
+};
+ExecSize exec_size(const LaunchSpec& spec);
+
+// Linux's limit: a quarter of the stack rlimit, at most 6 MiB and at least
+// 128 KiB.
+size_t exec_limit();
+size_t exec_string_limit();
+
+// Replaces the calling process with spec.path, set up as launch() sets up
+// a child. For a command that is the last thing a shell runs. Returns only
+// if the exec failed: -1 with errno set, and the process left in whatever
+// state the setup reached.
+int exec_in_place(const LaunchSpec& spec);
+
+std::optional<LaunchBackend> parse_backend(std::string_view name);
+const char* backend_name(LaunchBackend backend);
+
+} // namespace sh
@@ -0,0 +1,427 @@
+#include "lexer.h"
+
+namespace sh {
+
+namespace {
+
+constexpr size_t npos = std::string_view::npos;
+
+bool is_meta(char c)
+{
+    switch (c) {
+    case ' ':
+    case '\t':
+    case '\n':
+    case ';':
+    case '&':
+    case '|':
+    case '(':
+    case ')':
+    case '<':
+    case '>':
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Index just past the word starting at pos, or npos if a quote or
+// expansion inside it is unterminated.
+size_t scan_word(std::string_view s, size_t pos)
+{
+    size_t i = pos;
+    while (i < s.size() && !is_meta(s[i])) {
+        size_t e;
+        switch (s[i]) {
+        case '\\':
+            if (i + 1 >= s.size())
+                return npos;
+            i += 2;
+            continue;
+        case '\'':
+            e = find_quote_end(s, i + 1);
+            break;
+        case '"':
+            e = find_dquote_end(s, i + 1);
+            break;
+        case '`':
+            e = find_backquote_end(s, i + 1);
+            break;
+        case '$':
+            e = skip_dollar(s, i);
+            if (e == npos)
+                return npos;
+            i = e;
+            continue;
+        default:
+            ++i;
+            continue;
+        }
+        if (e == npos)
+            return npos;
+        i = e + 1;
+    }
+    return i;
+}
+
+} // namespace
+
+bool is_redirection(TokenKind kind)
+{
+    switch (kind) {
+    case TokenKind::Less:
+    case TokenKind::Great:
+    case TokenKind::DGreat:
+    case TokenKind::Clobber:
+    case TokenKind::LessAnd:
+    case TokenKind::GreatAnd:
+    case TokenKind::LessGreat:
+    case TokenKind::DLess:
+    case TokenKind::DLessDash:
+    case TokenKind::TLess:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool is_name_start(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+bool is_name_char(char c)
+{
+    return is_name_start(c) || is_digit(c);
+}
+
+bool is_name(std::string_view s)
+{
+    if (s.empty() || !is_name_start(s[0]))
+        return false;
+    for (char c : s) {
+        if (!is_name_char(c))
+            return false;
+    }
+    return true;
+}
+
+size_t find_quote_end(std::string_view s, size_t pos)
+{
+    return s.find('\'', pos);
+}
+
+size_t find_dquote_end(std::string_view s, size_t pos)
+{
+    for (size_t i = pos; i < s.size();) {
+        switch (s[i]) {
+        case '\\':
+            i += 2;
+            break;
+        case '"':
+            return i;
+        case '$':
+            i = skip_dollar(s, i);
+            if (i == npos)
+                return npos;
+            break;
+        case '`':
+            i = find_backquote_end(s, i + 1);
+            if (i == npos)
+                return npos;
+            ++i;
+            break;
+        default:
+            ++i;
+        }
+    }
+    return npos;
+}
+
+size_t find_backquote_end(std::string_view s, size_t pos)
+{
+    for (size_t i = pos; i < s.size(); ++i) {
+        if (s[i] == '\\')
+            ++i;
+        else if (s[i] == '`')
+            return i;
+    }
+    return npos;
+}
+
+size_t find_brace_end(std::string_view s, size_t pos)
+{
+    for (size_t i = pos; i < s.size();) {
+        size_t e;
+        switch (s[i]) {
+        case '\\':
+            i += 2;
+            continue;
+        case '}':
+            return i;
+        case '\'':
+            e = find_quote_end(s, i + 1);
+            break;
+        case '"':
+            e = find_dquote_end(s, i + 1);
+            break;
+        case '`':
+            e = find_backquote_end(s, i + 1);
+            break;
+        case '$':
+            i = skip_dollar(s, i);
+            if (i == npos)
+                return npos;
+            continue;
+        default:
+            ++i;
+            continue;
+        }
+        if (e == npos)
+            return npos;
+        i = e + 1;
+    }
+    return npos;
+}
+
+size_t find_arith_end(std::string_view s, size_t pos)
+{
+    int depth = 0;
+    for (size_t i = pos; i < s.size();) {
+        size_t e;
+        switch (s[i]) {
+        case '(':
+            ++depth;
+            ++i;
+            continue;
+        case ')':
+            if (depth == 0)
+                return i + 1 < s.size() && s[i + 1] == ')' ? i : kNotArith;
+            --depth;
+            ++i;
+            continue;
+        case '\\':
+            i += 2;
+            continue;
+        case '\'':
+            e = find_quote_end(s, i + 1);
+            break;
+        case '"':
+            e = find_dquote_end(s, i + 1);
+            break;
+        case '`':
+            e = find_backquote_end(s, i + 1);
+            break;
+        case '$':
+            i = skip_dollar(s, i);
+            if (i == npos)
+                return npos;
+            continue;
+        default:
+            ++i;
+            continue;
+        }
+        if (e == npos)
+            return npos;
+        i = e + 1;
+    }
+    return npos;
+}
+
+size_t find_paren_end(std::string_view s, size_t pos)
+{
+    // Lex the body so quotes, nested substitutions and comments are skipped
+    // exactly as they will be when it is parsed. Inside a case statement a
+    // ')' closes a pattern, not the substitution.
+    Lexer lex(s, pos);
+    int depth = 0;
+    int cases = 0;
+    bool command_start = true;
+    for (;;) {
+        Token t = lex.next();
+        switch (t.kind) {
+        case TokenKind::End:
+        case TokenKind::Error:
+            return npos;
+        case TokenKind::LParen:
+            ++depth;
+            break;
+        case TokenKind::RParen:
+            if (depth == 0 && cases == 0)
+                return t.offset;
+            if (depth > 0)
+                --depth;
+            break;
+        case TokenKind::Word:
+            if (command_start && t.text == "case")
+                ++cases;
+            else if (command_start && t.text == "esac" && cases > 0)
+                --cases;
+            break;
+        default:
+            break;
+        }
+        command_start = t.kind != TokenKind::Word || t.text == "do" || t.text == "then" || t.text == "else" ||
+                        t.text == "{" || t.text == "!";
+        if (t.kind == TokenKind::RParen && cases > 0)
+            command_start = true;
+    }
+}
+
+size_t skip_dollar(std::string_view s, size_t pos)
+{
+    size_t i = pos + 1;
+    if (i >= s.size())
+        return i;
+    if (s[i] == '(') {
+        if (i + 1 < s.size() && s[i + 1] == '(') {
+            size_t e = find_arith_end(s, i + 2);
+            if (e == npos)
+                return npos;
+            if (e != kNotArith)
+                return e + 2;
+        }
+        size_t e = find_paren_end(s, i + 1);
+        return e == npos ? npos : e + 1;
+    }
+    if (s[i] == '{') {
+        size_t e = find_brace_end(s, i + 1);
+        return e == npos ? npos : e + 1;
+    }
+    return i;
+}
+
+Token Lexer::fail(const char* message, bool incomplete)
+{
+    error_ = message;
+    incomplete_ = incomplete;
+    Token t;
+    t.kind = TokenKind::Error;
+    t.offset = pos_;
+    return t;
+}
+
+Token Lexer::op(TokenKind kind, size_t len, int io_number)
+{
+    Token t;
+    t.kind = kind;
+    t.io_number = io_number;
+    t.offset = pos_;
+    t.text = src_.substr(pos_, len);
+    pos_ += len;
+    return t;
+}
+
+Token Lexer::next()
+{
+    for (;;) {
+        while (pos_ < src_.size() && (src_[pos_] == ' ' || src_[pos_] == '\t'))
+            ++pos_;
+        if (pos_ + 1 < src_.size() && src_[pos_] == '\\' && src_[pos_ + 1] == '\n') {
+            pos_ += 2;
+            continue;
+        }
+        if (pos_ < src_.size() && src_[pos_] == '#') {
+            while (pos_ < src_.size() && src_[pos_] != '\n')
+                ++pos_;
+        }
+        break;
+    }
+    if (pos_ >= src_.size()) {
+        Token t;
+        t.offset = src_.size();
+        return t;
+    }
+
+    int io_number = -1;
+    size_t start = pos_;
+    size_t digits = start;
+    while (digits < src_.size() && is_digit(src_[digits]))
+        ++digits;
+    if (digits > start && digits < src_.size() && (src_[digits] == '<' || src_[digits] == '>') && digits - start < 5) {
+        io_number = 0;
+        for (size_t i = start; i < digits; ++i)
+            io_number = io_number * 10 + (src_[i] - '0');
+        pos_ = digits;
+    }
+
+    auto at = [this](size_t k) { return pos_ + k < src_.size() ? src_[pos_ + k] : '\0'; };
+    switch (at(0)) {
+    case '\n':
+        return op(TokenKind::Newline, 1, -1);
+    case ';':
+        return at(1) == ';' ? op(TokenKind::DSemi, 2, -1) : op(TokenKind::Semi, 1, -1);
+    case '&':
+        return at(1) == '&' ? op(TokenKind::AndIf, 2, -1) : op(TokenKind::Amp, 1, -1);
+    case '|':
+        return at(1) == '|' ? op(TokenKind::OrIf, 2, -1) : op(TokenKind::Pipe, 1, -1);
+    case '(':
+        return op(TokenKind::LParen, 1, -1);
+    case ')':
+        return op(TokenKind::RParen, 1, -1);
+    case '<':
+        if (at(1) == '<') {
+            if (at(2) == '-')
+                return op(TokenKind::DLessDash, 3, io_number);
+            if (at(2) == '<')
+                return op(TokenKind::TLess, 3, io_number);
+            return op(TokenKind::DLess, 2, io_number);
+        }
+        if (at(1) == '&')
+            return op(TokenKind::LessAnd, 2, io_number);
+        if (at(1) == '>')
+            return op(TokenKind::LessGreat, 2, io_number);
+        return op(TokenKind::Less, 1, io_number);
+    case '>':
+        if (at(1) == '>')
+            return op(TokenKind::DGreat, 2, io_number);
+        if (at(1) == '&')
+            return op(TokenKind::GreatAnd, 2, io_number);
+        if (at(1) == '|')
+            return op(TokenKind::Clobber, 2, io_number);
+        return op(TokenKind::Great, 1, io_number);
+    default:
+        break;
+    }
+
+    size_t end = scan_word(src_, pos_);
+    if (end == npos)
+        return fail("unterminated quote or expansion", true);
+    Token t;
+    t.kind = TokenKind::Word;
+    t.offset = pos_;
+    t.text = src_.substr(pos_, end - pos_);
+    pos_ = end;
+    return t;
+}
+
+bool Lexer::read_heredoc(std::string_view delim, bool strip_tabs, std::string_view& body)
+{
+    size_t start = pos_;
+    size_t line = pos_;
+    while (line < src_.size()) {
+        size_t nl = src_.find('\n', line);
+        size_t line_end = nl == npos ? src_.size() : nl;
+        size_t text = line;
+        if (strip_tabs) {
+            while (text < line_end && src_[text] == '\t')
+                ++text;
+        }
+        if (src_.substr(text, line_end - text) == delim) {
+            body = src_.substr(start, line - start);
+            pos_ = nl == npos ? src_.size() : nl + 1;
+            return true;
+        }
+        if (nl == npos)
+            break;
+        line = nl + 1;
+    }
+    return false;
+}
+
+} // namespace sh
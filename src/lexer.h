@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace sh {
+
+enum class TokenKind : uint8_t {
+    End,
+    Newline,
+    Word,
+    Semi,      // ;
+    DSemi,     // ;;
+    Amp,       // &
+    AndIf,     // &&
+    Pipe,      // |
+    OrIf,      // ||
+    LParen,    // (
+    RParen,    // )
+    Less,      // <
+    Great,     // >
+    DGreat,    // >>
+    Clobber,   // >|
+    LessAnd,   // <&
+    GreatAnd,  // >&
+    LessGreat, // <>
+    DLess,     // <<
+    DLessDash, // <<-
+    TLess,     // <<<
+    Error,
+};
+
+// A token is a view into the source; nothing is copied.
+struct Token {
+    TokenKind kind = TokenKind::End;
+    int io_number = -1; // redirection operators: explicit fd prefix, e.g. 2>
+    size_t offset = 0;  // position of text in the source
+    std::string_view text;
+};
+
+bool is_redirection(TokenKind kind);
+
+// Splits shell input into tokens. Words are returned whole, quotes and
+// nested expansions included; the parser breaks them into parts. The lexer
+// holds no state besides its position, so it can be restarted anywhere a
+// token may begin.
+class Lexer {
+public:
+    explicit Lexer(std::string_view src, size_t pos = 0) : src_(src), pos_(pos) {}
+
+    Token next();
+
+    size_t position() const { return pos_; }
+    std::string_view source() const { return src_; }
+
+    // Reads a here-document body starting at the current position, which
+    // must be the start of the line after the operator. On success body
+    // holds the text before the delimiter line and the lexer moves past it.
+    bool read_heredoc(std::string_view delim, bool strip_tabs, std::string_view& body);
+
+    // Valid after an Error token.
+    const char* error() const { return error_; }
+    bool incomplete() const { return incomplete_; }
+
+private:
+    Token fail(const char* message, bool incomplete);
+    Token op(TokenKind kind, size_t len, int io_number);
+
+    std::string_view src_;
+    size_t pos_;
+    const char* error_ = nullptr;
+    bool incomplete_ = false;
+};
+
+// Scanning helpers shared by the lexer and the word parser. Each takes the
+// index just past an opening delimiter and returns the index of the
+// matching closing delimiter, or npos when the input ends first.
+inline constexpr size_t kNotArith = std::string_view::npos - 1;
+
+size_t find_quote_end(std::string_view s, size_t pos);     // '...'
+size_t find_dquote_end(std::string_view s, size_t pos);    // "..."
+size_t find_backquote_end(std::string_view s, size_t pos); // `...`
+size_t find_brace_end(std::string_view s, size_t pos);     // ${...}
+size_t find_paren_end(std::string_view s, size_t pos);     // $(...)
+// $((...)): index of the first ')' of the closing "))", or kNotArith when
+// the text turns out to be a command substitution starting with '('.
+size_t find_arith_end(std::string_view s, size_t pos);
+// s[pos] is '$': index just past the expansion (pos + 1 for a lone '$').
+size_t skip_dollar(std::string_view s, size_t pos);
+
+bool is_name_start(char c);
+bool is_name_char(char c);
+bool is_name(std::string_view s);
+
+} // namespace sh
@@ -0,0 +1,644 @@
+#include "lineedit.h"
+
+#include "history.h"
+#include "lexer.h"
+#include "transfer.h"
+
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace sh {
+
+namespace {
+
+bool is_continuation(char c)
+{
+    return (static_cast<unsigned char>(c) & 0xc0) == 0x80;
+}
+
+// Columns the prompt takes, skipping the escape sequences that colour it.
+size_t visible_columns(std::string_view s)
+{
+    size_t columns = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '\x1b' && i + 1 < s.size() && s[i + 1] == '[') {
+            i += 2;
+            while (i < s.size() && !(s[i] >= 0x40 && s[i] <= 0x7e))
+                ++i;
+        } else if (!is_continuation(s[i]) && s[i] != '\r' && s[i] != '\n') {
+            ++columns;
+        }
+    }
+    return columns;
+}
+
+// Words that leave the next word in command position, as after "if".
+bool is_reserved(std::string_view word)
+{
+    static constexpr std::string_view kWords[] = {
+        "!", "do", "done", "elif", "else", "esac", "fi", "if", "then", "until", "while", "{", "}",
+    };
+    return std::find(std::begin(kWords), std::end(kWords), word) != std::end(kWords);
+}
+
+bool is_assignment(std::string_view word)
+{
+    size_t eq = word.find('=');
+    return eq != std::string_view::npos && eq > 0 && is_name(word.substr(0, eq));
+}
+
+// Looks for the start of the word before the cursor, where completion
+// begins.
+bool is_word_break(char c)
+{
+    return c == ' ' || c == '\t' || c == ';' || c == '&' || c == '|' || c == '<' || c == '>' || c == '(' || c == ')';
+}
+
+// The word as the shell will see it, quotes and backslashes removed.
+std::string unquote(std::string_view word)
+{
+    std::string out;
+    for (size_t i = 0; i < word.size(); ++i) {
+        if (word[i] == '\\' && i + 1 < word.size())
+            out += word[++i];
+        else if (word[i] != '\'' && word[i] != '"')
+            out += word[i];
+    }
+    return out;
+}
+
+// A candidate as it must be typed. A leading ~ is left alone to expand.
+std::string quote(std::string_view candidate)
+{
+    std::string out;
+    for (char c : candidate) {
+        if (std::strchr(" \t\\'\"$`|&;<>()*?[]#!{}", c))
+            out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+void move_cursor(std::string& out, size_t from, size_t to)
+{
+    if (to < from)
+        out += "\x1b[" + std::to_string(from - to) + 'D';
+    else if (to > from)
+        out += "\x1b[" + std::to_string(to - from) + 'C';
+}
+
+} // namespace
+
+bool LineEditor::Cell::operator==(const Cell& other) const
+{
+    return size == other.size && style == other.style && std::memcmp(bytes, other.bytes, size) == 0;
+}
+
+bool LineEditor::usable() const
+{
+    const char* term = std::getenv("TERM");
+    struct termios t;
+    return ::isatty(in_) && ::isatty(out_) && ::tcgetattr(in_, &t) == 0 && !(term && std::strcmp(term, "dumb") == 0);
+}
+
+LineEditor::Result LineEditor::read_line(std::string_view prompt, std::string& line)
+{
+    set_prompt(std::string(prompt));
+    text_.clear();
+    cursor_ = 0;
+    spans_.clear();
+    dirty_ = 0;
+    hint_entry_.clear();
+    no_hint_for_.clear();
+    hint_.clear();
+    history_.refresh();
+    browsing_ = history_.size();
+    draft_.clear();
+    shown_.clear();
+    shown_cursor_ = 0;
+    scroll_ = 0;
+
+    struct termios saved;
+    ::tcgetattr(in_, &saved);
+    struct termios raw = saved;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    ::tcsetattr(in_, TCSADRAIN, &raw);
+
+    frame_ = prompt_;
+    Result result = Result::Line;
+    for (bool done = false; !done;) {
+        // Everything already read is applied before anything is drawn, so
+        // a paste or keys typed ahead cost one update.
+        std::string_view input = pending_;
+        while (!input.empty() && !done) {
+            size_t before = input.size();
+            done = key(input, result);
+            if (input.size() == before)
+                break; // the rest of an escape sequence is still to come
+        }
+        pending_.erase(0, pending_.size() - input.size());
+        if (done)
+            break;
+        render(false);
+        write_frame();
+
+        pollfd fds[3] = {
+            {in_, POLLIN, 0},
+            {completing_ ? completer_.notify_fd() : -1, POLLIN, 0},
+            {update_prompt_ ? prompt_fd_ : -1, POLLIN, 0},
+        };
+        if (::poll(fds, 3, -1) < 0)
+            continue;
+        if (fds[1].revents & POLLIN)
+            on_completion();
+        std::string changed;
+        if ((fds[2].revents & POLLIN) && update_prompt_(changed)) {
+            // Back to where the prompt starts, then everything anew.
+            size_t lines = static_cast<size_t>(std::count(prompt_.begin(), prompt_.end(), '\n'));
+            move_cursor(frame_, shown_cursor_, 0);
+            if (lines > 0)
+                frame_ += "\x1b[" + std::to_string(lines) + 'A';
+            frame_ += "\r\x1b[J";
+            set_prompt(std::move(changed));
+            frame_ += prompt_;
+            shown_.clear();
+            shown_cursor_ = 0;
+        }
+        if (!fds[0].revents)
+            continue;
+        char buf[4096];
+        ssize_t n = ::read(in_, buf, sizeof buf);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            result = text_.empty() ? Result::End : Result::Line;
+            break;
+        }
+        pending_.append(buf, static_cast<size_t>(n));
+    }
+
+    end_completion();
+    render(true);
+    if (result == Result::Interrupted)
+        frame_ += "^C";
+    frame_ += '\n';
+    write_frame();
+    ::tcsetattr(in_, TCSADRAIN, &saved);
+    if (result == Result::Line)
+        line = text_;
+    return result;
+}
+
+bool LineEditor::key(std::string_view& input, Result& result)
+{
+    auto next = [this](size_t pos) {
+        do
+            ++pos;
+        while (pos < text_.size() && is_continuation(text_[pos]));
+        return pos;
+    };
+    auto prev = [this](size_t pos) {
+        do
+            --pos;
+        while (pos > 0 && is_continuation(text_[pos]));
+        return pos;
+    };
+    auto right = [&] {
+        if (cursor_ < text_.size())
+            cursor_ = next(cursor_);
+        else if (!hint_.empty())
+            insert(hint_);
+    };
+
+    char c = input[0];
+    if (c != '\t')
+        end_completion();
+    if (c == '\x1b') {
+        if (input.size() < 2)
+            return false;
+        if (input[1] != '[' && input[1] != 'O') {
+            input.remove_prefix(1); // a lone escape means nothing here
+            return false;
+        }
+        size_t end = 2;
+        while (end < input.size() && !(input[end] >= 0x40 && input[end] <= 0x7e))
+            ++end;
+        if (end >= input.size())
+            return false;
+        std::string_view param = input.substr(2, end - 2);
+        char final = input[end];
+        input.remove_prefix(end + 1);
+        if (final == '~')
+            final = param == "3" ? 'X' : param == "1" || param == "7" ? 'H' : param == "4" || param == "8" ? 'F' : 0;
+        switch (final) {
+        case 'A':
+            browse(-1);
+            break;
+        case 'B':
+            browse(1);
+            break;
+        case 'C':
+            right();
+            break;
+        case 'D':
+            if (cursor_ > 0)
+                cursor_ = prev(cursor_);
+            break;
+        case 'H':
+            cursor_ = 0;
+            break;
+        case 'F':
+            cursor_ = text_.size();
+            break;
+        case 'X':
+            if (cursor_ < text_.size())
+                erase(cursor_, next(cursor_));
+            break;
+        default:
+            break;
+        }
+        return false;
+    }
+
+    if (static_cast<unsigned char>(c) >= 0x20 && c != 0x7f) {
+        size_t n = 1;
+        while (n < input.size() && static_cast<unsigned char>(input[n]) >= 0x20 && input[n] != 0x7f)
+            ++n;
+        insert(input.substr(0, n));
+        input.remove_prefix(n);
+        return false;
+    }
+
+    input.remove_prefix(1);
+    switch (c) {
+    case '\r':
+        if (!input.empty() && input[0] == '\n')
+            input.remove_prefix(1);
+        [[fallthrough]];
+    case '\n':
+        result = Result::Line;
+        return true;
+    case 0x03: // ^C
+        result = Result::Interrupted;
+        return true;
+    case 0x04: // ^D
+        if (text_.empty()) {
+            result = Result::End;
+            return true;
+        }
+        if (cursor_ < text_.size())
+            erase(cursor_, next(cursor_));
+        break;
+    case 0x01: // ^A
+        cursor_ = 0;
+        break;
+    case 0x05: // ^E
+        if (cursor_ == text_.size() && !hint_.empty())
+            insert(hint_);
+        cursor_ = text_.size();
+        break;
+    case 0x02: // ^B
+        if (cursor_ > 0)
+            cursor_ = prev(cursor_);
+        break;
+    case 0x06: // ^F
+        right();
+        break;
+    case 0x08:
+    case 0x7f:
+        if (cursor_ > 0)
+            erase(prev(cursor_), cursor_);
+        break;
+    case 0x0b: // ^K
+        erase(cursor_, text_.size());
+        break;
+    case 0x15: // ^U
+        erase(0, cursor_);
+        break;
+    case 0x17: { // ^W
+        size_t from = cursor_;
+        while (from > 0 && text_[from - 1] == ' ')
+            --from;
+        while (from > 0 && text_[from - 1] != ' ')
+            --from;
+        erase(from, cursor_);
+        break;
+    }
+    case '\t':
+        begin_completion();
+        break;
+    case 0x0c: // ^L
+        frame_ += "\x1b[H\x1b[2J";
+        frame_ += prompt_;
+        shown_.clear();
+        shown_cursor_ = 0;
+        break;
+    case 0x10: // ^P
+        browse(-1);
+        break;
+    case 0x0e: // ^N
+        browse(1);
+        break;
+    default:
+        break;
+    }
+    return false;
+}
+
+void LineEditor::insert(std::string_view text)
+{
+    text_.insert(cursor_, text);
+    dirty_ = std::min(dirty_, cursor_);
+    cursor_ += text.size();
+}
+
+void LineEditor::erase(size_t from, size_t to)
+{
+    if (from >= to)
+        return;
+    text_.erase(from, to - from);
+    dirty_ = std::min(dirty_, from);
+    cursor_ = from;
+}
+
+void LineEditor::replace(size_t from, size_t to, std::string_view text)
+{
+    text_.replace(from, to - from, text);
+    dirty_ = std::min(dirty_, from);
+    cursor_ = from + text.size();
+}
+
+void LineEditor::set_text(std::string text)
+{
+    text_ = std::move(text);
+    dirty_ = 0;
+    cursor_ = text_.size();
+}
+
+void LineEditor::browse(int direction)
+{
+    size_t size = history_.size();
+    if (direction < 0) {
+        if (browsing_ == 0)
+            return;
+        if (browsing_ == size)
+            draft_ = text_;
+        set_text(std::string(history_[--browsing_]));
+    } else {
+        if (browsing_ >= size)
+            return;
+        ++browsing_;
+        set_text(browsing_ == size ? draft_ : std::string(history_[browsing_]));
+    }
+}
+
+void LineEditor::begin_completion()
+{
+    if (!prepare_)
+        return;
+    highlight();
+    size_t begin = cursor_;
+    while (begin > 0 && !(is_word_break(text_[begin - 1]) && (begin < 2 || text_[begin - 2] != '\\')))
+        --begin;
+    bool command = true;
+    for (const Span& span : spans_) {
+        if (span.end <= begin)
+            command = span.command_next && !span.target_next;
+    }
+    Completer::Request request;
+    request.word = unquote(std::string_view(text_).substr(begin, cursor_ - begin));
+    request.command = command;
+    prepare_(request);
+    word_begin_ = begin;
+    word_ = request.word;
+    candidates_.clear();
+    completion_hint_.clear();
+    completing_ = true;
+    completer_.start(std::move(request));
+}
+
+void LineEditor::on_completion()
+{
+    bool done = completer_.take(candidates_);
+    auto names = [this](std::string& out) {
+        for (const std::string& c : candidates_) {
+            if (out.size() > 512)
+                break;
+            // Files are listed by name, as ls would.
+            size_t slash = c.rfind('/', c.size() - 2);
+            out += "  ";
+            out += slash == std::string::npos || c.size() < 2 ? c : c.substr(slash + 1);
+        }
+    };
+    if (!done) {
+        completion_hint_ = " [" + std::to_string(candidates_.size()) + " ...]";
+        names(completion_hint_);
+        return;
+    }
+    completing_ = false;
+    completion_hint_.clear();
+    std::sort(candidates_.begin(), candidates_.end());
+    candidates_.erase(std::unique(candidates_.begin(), candidates_.end()), candidates_.end());
+    if (candidates_.empty()) {
+        frame_ += '\a';
+        return;
+    }
+    if (candidates_.size() == 1) {
+        const std::string& only = candidates_[0];
+        replace(word_begin_, cursor_, quote(only) + (only.ends_with('/') ? "" : " "));
+        return;
+    }
+    // Sorted, so the first and last bound the common prefix.
+    const std::string& first = candidates_.front();
+    const std::string& last = candidates_.back();
+    size_t common = 0;
+    while (common < first.size() && common < last.size() && first[common] == last[common])
+        ++common;
+    if (common > word_.size())
+        replace(word_begin_, cursor_, quote(first.substr(0, common)));
+    names(completion_hint_);
+}
+
+void LineEditor::end_completion()
+{
+    if (completing_)
+        completer_.cancel();
+    completing_ = false;
+    completion_hint_.clear();
+}
+
+void LineEditor::highlight()
+{
+    // Tokens ending before the edit cannot have changed; the one touching
+    // it may have grown, so lexing resumes after the token before that.
+    while (!spans_.empty() && spans_.back().end >= dirty_)
+        spans_.pop_back();
+    bool command = spans_.empty() || spans_.back().command_next;
+    bool target = !spans_.empty() && spans_.back().target_next;
+    Lexer lexer(text_, spans_.empty() ? 0 : spans_.back().end);
+    for (;;) {
+        Token t = lexer.next();
+        if (t.kind == TokenKind::End)
+            break;
+        if (t.kind == TokenKind::Error) {
+            spans_.push_back({t.offset, text_.size(), Error, false, false});
+            break;
+        }
+        Span span{t.offset, t.offset + t.text.size(), Plain, command, false};
+        if (t.kind == TokenKind::Word) {
+            if (target) {
+                span.command_next = command;
+            } else if (command && !is_assignment(t.text)) {
+                span.style = Command;
+                span.command_next = is_reserved(t.text);
+            }
+        } else if (is_redirection(t.kind)) {
+            span.style = Operator;
+            span.target_next = true;
+        } else {
+            span.style = Operator;
+            span.command_next = t.kind != TokenKind::RParen;
+        }
+        command = span.command_next;
+        target = span.target_next;
+        spans_.push_back(span);
+    }
+    dirty_ = text_.size();
+
+    styles_.assign(text_.size(), Plain);
+    for (const Span& span : spans_)
+        std::fill(styles_.begin() + static_cast<ptrdiff_t>(span.begin), styles_.begin() + static_cast<ptrdiff_t>(span.end), span.style);
+}
+
+void LineEditor::update_hint()
+{
+    hint_ = completion_hint_;
+    if (completing_ || !hint_.empty())
+        return;
+    if (text_.empty() || cursor_ != text_.size() || browsing_ != history_.size())
+        return;
+    // The entry found for a shorter line still fits while the user types
+    // along it, and a line that nothing matched only gets longer.
+    if (hint_entry_.size() > text_.size() && hint_entry_.starts_with(text_)) {
+        hint_ = hint_entry_.substr(text_.size());
+        return;
+    }
+    if (!no_hint_for_.empty() && text_.starts_with(no_hint_for_))
+        return;
+    std::optional<std::string_view> entry = history_.find_prefix(text_);
+    if (!entry) {
+        no_hint_for_ = text_;
+        hint_entry_.clear();
+        return;
+    }
+    hint_entry_ = *entry;
+    hint_ = hint_entry_.substr(text_.size());
+}
+
+void LineEditor::set_prompt(std::string prompt)
+{
+    prompt_ = std::move(prompt);
+    size_t nl = prompt_.rfind('\n');
+    prompt_columns_ = visible_columns(nl == std::string::npos ? std::string_view(prompt_) : std::string_view(prompt_).substr(nl + 1));
+}
+
+void LineEditor::render(bool final)
+{
+    highlight();
+    if (final)
+        hint_.clear();
+    else
+        update_hint();
+
+    struct winsize ws;
+    size_t columns = ::ioctl(out_, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 ? ws.ws_col : 80;
+    // The last column stays empty, so writing never leaves the terminal
+    // waiting to wrap.
+    size_t width = columns > prompt_columns_ + 1 ? columns - prompt_columns_ - 1 : 1;
+
+    std::vector<Cell> cells;
+    size_t cursor_cell = 0;
+    auto add = [&cells](std::string_view s, const Style* styles, Style style) {
+        for (size_t i = 0; i < s.size();) {
+            Cell cell{{}, 0, styles ? styles[i] : style};
+            do {
+                if (cell.size < sizeof cell.bytes)
+                    cell.bytes[cell.size++] = static_cast<unsigned char>(s[i]) < 0x20 ? '?' : s[i];
+                ++i;
+            } while (i < s.size() && is_continuation(s[i]));
+            cells.push_back(cell);
+        }
+    };
+    add(std::string_view(text_).substr(0, final ? text_.size() : cursor_), styles_.data(), Plain);
+    cursor_cell = cells.size();
+    if (!final)
+        add(std::string_view(text_).substr(cursor_), styles_.data() + cursor_, Plain);
+    add(hint_, nullptr, Hint);
+
+    if (cursor_cell < scroll_)
+        scroll_ = cursor_cell;
+    else if (cursor_cell >= scroll_ + width)
+        scroll_ = cursor_cell - width + 1;
+    std::vector<Cell> want(cells.begin() + static_cast<ptrdiff_t>(std::min(scroll_, cells.size())),
+                           cells.begin() + static_cast<ptrdiff_t>(std::min(scroll_ + width, cells.size())));
+    size_t want_cursor = cursor_cell - scroll_;
+
+    size_t same = 0;
+    while (same < shown_.size() && same < want.size() && shown_[same] == want[same])
+        ++same;
+    size_t at = shown_cursor_;
+    if (same < want.size()) {
+        move_cursor(frame_, at, same);
+        static constexpr const char* kSgr[] = {"\x1b[0m", "\x1b[0;1m", "\x1b[0;36m", "\x1b[0;31m", "\x1b[0;2m"};
+        Style style = Plain;
+        for (size_t i = same; i < want.size(); ++i) {
+            // A run of cells already right is stepped over when that is
+            // shorter than writing it again.
+            size_t run = i;
+            while (run < shown_.size() && run < want.size() && shown_[run] == want[run])
+                ++run;
+            if (run - i > 4 && run < want.size()) {
+                if (style != Plain)
+                    frame_ += kSgr[Plain];
+                style = Plain;
+                move_cursor(frame_, i, run);
+                i = run;
+            }
+            if (want[i].style != style) {
+                style = want[i].style;
+                frame_ += kSgr[style];
+            }
+            frame_.append(want[i].bytes, want[i].size);
+        }
+        if (style != Plain)
+            frame_ += kSgr[Plain];
+        at = want.size();
+    }
+    if (want.size() < shown_.size()) {
+        move_cursor(frame_, at, want.size());
+        frame_ += "\x1b[K";
+        at = want.size();
+    }
+    move_cursor(frame_, at, want_cursor);
+    shown_ = std::move(want);
+    shown_cursor_ = want_cursor;
+}
+
+void LineEditor::write_frame()
+{
+    if (!frame_.empty())
+        write_all(out_, frame_);
+    frame_.clear();
+}
+
+} // namespace sh
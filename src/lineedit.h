@@ -0,0 +1,145 @@
+#pragma once
+
+#include "complete.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sh {
+
+class History;
+
+// The interactive line editor. Every batch of keys read from the terminal
+// (a keystroke, or a whole paste) is applied first and drawn after, as a
+// single write that changes only the cells that differ from what is
+// already on screen: typing at the end of a line sends the new character,
+// not the line. Over a slow link that keeps echo as cheap as the terminal's
+// own.
+//
+// The line is coloured from the lexer's tokens, kept from one redraw to the
+// next and relexed only from the last token before the edit; after the
+// cursor, in dim, it shows the rest of the latest history entry that starts
+// with the line, which right arrow or ^E accepts. A line wider than the
+// terminal scrolls sideways rather than wrapping. Characters are assumed to
+// take one column each.
+//
+// Tab completes the word before the cursor through a Completer, so typing
+// goes on while it searches; the candidates found so far take the hint's
+// place. Once the search is done a single candidate replaces the word, and
+// several extend it to their common prefix.
+class LineEditor {
+public:
+    enum class Result {
+        Line,
+        Interrupted, // ^C: the line, and any continuation, is abandoned
+        End,         // ^D on an empty line, or end of input
+    };
+
+    LineEditor(History& history, int in, int out) : history_(history), in_(in), out_(out) {}
+
+    // Fills in what a completion request needs from the shell: the command
+    // names it knows, $PATH and $HOME. Without it tab does nothing.
+    void set_completion(std::function<void(Completer::Request&)> prepare) { prepare_ = std::move(prepare); }
+
+    // While a line is edited, fd becoming readable means the prompt may
+    // have changed: update is then called and, if it returns true with a
+    // new prompt, the prompt and line are redrawn in one write.
+    void set_prompt_updates(int fd, std::function<bool(std::string&)> update)
+    {
+        prompt_fd_ = fd;
+        update_prompt_ = std::move(update);
+    }
+
+    // Whether in and out are a terminal the editor can drive; if not the
+    // caller reads lines itself.
+    bool usable() const;
+
+    // Shows prompt and edits one line, which on Result::Line holds it
+    // without its newline.
+    Result read_line(std::string_view prompt, std::string& line);
+
+private:
+    enum Style : uint8_t {
+        Plain,
+        Command,
+        Operator,
+        Error,
+        Hint,
+    };
+
+    struct Cell {
+        char bytes[4];
+        uint8_t size;
+        Style style;
+
+        bool operator==(const Cell& other) const;
+    };
+
+    struct Span {
+        size_t begin;
+        size_t end;
+        Style style;
+        bool command_next; // the next word is in command position
+        bool target_next;  // the next word is a redirection target
+    };
+
+    // One key: returns true once the line is finished, the outcome in result.
+    bool key(std::string_view& input, Result& result);
+    void insert(std::string_view text);
+    void erase(size_t from, size_t to);
+    void replace(size_t from, size_t to, std::string_view text);
+    void set_text(std::string text);
+    void browse(int direction);
+
+    void begin_completion();
+    void on_completion();
+    void end_completion();
+
+    void highlight();
+    void update_hint();
+    void set_prompt(std::string prompt);
+    void render(bool final);
+    void write_frame();
+
+    History& history_;
+    int in_;
+    int out_;
+    std::string pending_; // read but not yet consumed as keys
+
+    std::string prompt_;
+    size_t prompt_columns_ = 0;
+    int prompt_fd_ = -1;
+    std::function<bool(std::string&)> update_prompt_;
+    std::string text_;
+    size_t cursor_ = 0; // byte offset into text_
+
+    std::vector<Span> spans_; // tokens of text_ up to dirty_
+    size_t dirty_ = 0;        // first byte changed since spans_ was built
+    std::vector<Style> styles_;
+
+    std::string hint_entry_;  // history entry the hint comes from
+    std::string no_hint_for_; // a line no entry starts with, so neither does any extension
+    std::string hint_;
+
+    Completer completer_;
+    std::function<void(Completer::Request&)> prepare_;
+    bool completing_ = false;       // a search is running
+    size_t word_begin_ = 0;         // of the word being completed, which ends at the cursor
+    std::string word_;              // that word, unquoted
+    std::vector<std::string> candidates_;
+    std::string completion_hint_;   // shown instead of the history hint
+
+    size_t browsing_ = 0; // history index shown, size() for the line being typed
+    std::string draft_;
+
+    std::vector<Cell> shown_; // cells on screen after the prompt
+    size_t shown_cursor_ = 0;
+    size_t scroll_ = 0;
+    std::string frame_; // the update being assembled
+};
+
+} // namespace sh
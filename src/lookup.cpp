@@ -0,0 +1,147 @@
+#include "lookup.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sh {
+
+namespace {
+
+bool is_executable(const std::string& path)
+{
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && ::access(path.c_str(), X_OK) == 0;
+}
+
+bool same_time(const timespec& a, const timespec& b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+// A clock read through the vDSO, without entering the kernel.
+int64_t coarse_us()
+{
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+} // namespace
+
+void CommandHash::sync_path(std::string_view value)
+{
+    if (path_synced_ && value == path_value_)
+        return;
+
+    path_value_.assign(value);
+    path_synced_ = true;
+    entries_.clear();
+    dirs_.clear();
+    for (;;) {
+        size_t colon = value.find(':');
+        std::string_view dir = value.substr(0, colon);
+        dirs_.push_back({std::string(dir.empty() ? std::string_view(".") : dir), {}, false});
+        if (colon == std::string_view::npos)
+            break;
+        value.remove_prefix(colon + 1);
+    }
+}
+
+// Re-stats one PATH directory. Returns false (after refreshing the recorded
+// mtime and dropping the entries it may have affected) when it changed.
+bool CommandHash::dir_current(size_t index)
+{
+    Dir& dir = dirs_[index];
+    struct stat st;
+    timespec now{};
+    if (::stat(dir.path.c_str(), &st) == 0)
+        now = st.st_mtim;
+    dir.checked_us = coarse_us();
+    if (dir.known && same_time(dir.mtime, now))
+        return true;
+    bool was_known = dir.known;
+    dir.mtime = now;
+    dir.known = true;
+    if (was_known)
+        drop_from(index);
+    return !was_known;
+}
+
+void CommandHash::drop_from(size_t index)
+{
+    std::erase_if(entries_, [index](const auto& kv) { return kv.second.dir >= index; });
+}
+
+const std::string* CommandHash::search(std::string_view name)
+{
+    ++stats_.misses;
+    std::string candidate;
+    for (size_t i = 0; i < dirs_.size(); ++i) {
+        dir_current(i);
+        candidate.assign(dirs_[i].path);
+        candidate += '/';
+        candidate += name;
+        if (is_executable(candidate)) {
+            auto [it, inserted] = entries_.insert_or_assign(std::string(name), Entry{std::move(candidate), i, 0});
+            return &it->second.path;
+        }
+    }
+    return nullptr;
+}
+
+const std::string* CommandHash::find(std::string_view name, std::string_view path)
+{
+    if (name.empty() || name.find('/') != std::string_view::npos)
+        return nullptr;
+    sync_path(path);
+
+    auto it = entries_.find(name);
+    if (it != entries_.end()) {
+        size_t found_in = it->second.dir;
+        int64_t now = coarse_us();
+        bool valid = true;
+        for (size_t i = 0; i <= found_in && valid; ++i) {
+            if (dirs_[i].known && now - dirs_[i].checked_us < kRecheckUs)
+                continue;
+            valid = dir_current(i);
+        }
+        if (valid) {
+            ++it->second.hits;
+            ++stats_.hits;
+            return &it->second.path;
+        }
+    }
+    return search(name);
+}
+
+bool CommandHash::add(std::string_view name, std::string_view path)
+{
+    if (name.empty() || name.find('/') != std::string_view::npos)
+        return false;
+    sync_path(path);
+    return search(name) != nullptr;
+}
+
+bool CommandHash::forget(std::string_view name)
+{
+    auto it = entries_.find(name);
+    if (it == entries_.end())
+        return false;
+    entries_.erase(it);
+    return true;
+}
+
+void CommandHash::reset()
+{
+    entries_.clear();
+    for (Dir& dir : dirs_)
+        dir.known = false;
+}
+
+void CommandHash::for_each(const std::function<void(std::string_view, const Entry&)>& fn) const
+{
+    for (const auto& [name, entry] : entries_)
+        fn(name, entry);
+}
+
+} // namespace sh
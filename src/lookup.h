@@ -0,0 +1,80 @@
+#pragma once
+
+#include <time.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace sh {
+
+struct CommandHashStats {
+    uint64_t hits = 0;   // lookups answered from the table
+    uint64_t misses = 0; // lookups that searched $PATH
+};
+
+// bash-style command hash: remembers where each command name was found in
+// $PATH so repeated lookups skip the per-directory search.
+//
+// An entry stays valid while the mtime of its own directory and of every
+// directory before it in $PATH is unchanged. A hit re-stats only those
+// directories not checked in the last kRecheckUs, so a hot command costs no
+// syscalls, and a file added, removed or replaced in any of them is noticed
+// within that interval (a cached program that vanishes sooner fails to
+// exec, and the caller forgets it and searches again). When a directory's
+// mtime moves, entries found in it or in later directories are dropped. A
+// different PATH value clears the table.
+class CommandHash {
+public:
+    static constexpr int64_t kRecheckUs = 1000000;
+
+    struct Entry {
+        std::string path; // resolved absolute path
+        size_t dir;       // index into the PATH directory list
+        uint64_t hits;    // times served from the table
+    };
+
+    // Returns the executable for name when searching the colon-separated
+    // directory list path, or nullptr when none is found. Names containing
+    // '/' are not searched or cached; the caller uses them as given. The
+    // pointer is valid until the next non-const call.
+    const std::string* find(std::string_view name, std::string_view path);
+
+    // Searches path for name and records the result, as `hash name` does.
+    bool add(std::string_view name, std::string_view path);
+    bool forget(std::string_view name);
+    void reset();
+
+    const CommandHashStats& stats() const { return stats_; }
+    void for_each(const std::function<void(std::string_view, const Entry&)>& fn) const;
+
+private:
+    struct Dir {
+        std::string path;
+        timespec mtime{};
+        bool known = false;     // mtime recorded
+        int64_t checked_us = 0; // when mtime was last compared, coarse monotonic
+    };
+
+    struct NameHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+    };
+
+    void sync_path(std::string_view path);
+    bool dir_current(size_t index);
+    void drop_from(size_t index);
+    const std::string* search(std::string_view name);
+
+    std::string path_value_;
+    bool path_synced_ = false;
+    std::vector<Dir> dirs_;
+    std::unordered_map<std::string, Entry, NameHash, std::equal_to<>> entries_;
+    CommandHashStats stats_;
+};
+
+} // namespace sh
@@ -0,0 +1,303 @@
+#include "builtins.h"
+#include "executor.h"
+#include "launch.h"
+#include "lineedit.h"
+#include "parser.h"
+#include "prompt.h"
+#include "server.h"
+#include "shell.h"
+#include "trace.h"
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+extern char** environ;
+
+namespace {
+
+void usage()
+{
+    std::fprintf(stderr, "usage: shell [--launcher=spawn|vfork|fork] [--profile-startup] [--server[=socket]] [-c command [name [arg...]] | script [arg...]]\n");
+}
+
+// Reports background jobs that finished since the last prompt.
+void notify_jobs(sh::Shell& shell)
+{
+    shell.jobs.poll();
+    shell.jobs.for_each([](sh::Job& job) {
+        if (job.done && !job.notified) {
+            std::fprintf(stderr, "[%d]   %-24s%s\n", job.id, sh::JobTable::describe(job).c_str(), job.command.c_str());
+            job.notified = true;
+        }
+    });
+    shell.jobs.prune();
+}
+
+// $HISTFILE, or ~/.shell_history; empty for none.
+std::string history_path(const sh::Shell& shell)
+{
+    if (const std::string* file = shell.vars.get("HISTFILE"))
+        return *file;
+    const std::string* home = shell.vars.get("HOME");
+    return home && !home->empty() ? *home + "/.shell_history" : std::string();
+}
+
+// History expansion of a line that starts with !! (the previous entry) or
+// !prefix (the latest entry starting with prefix); the rest of the line
+// follows unchanged. Returns false, after a diagnostic, if nothing matches.
+bool expand_history(sh::Shell& shell, std::string& line)
+{
+    if (line.size() < 2 || line[0] != '!' || line[1] == ' ' || line[1] == '=' || line[1] == '(')
+        return true;
+    size_t end = line[1] == '!' ? 2 : line.find_first_of(" \t;&|", 1);
+    if (end == std::string::npos)
+        end = line.size();
+    shell.history.refresh();
+    std::string_view prefix = line[1] == '!' ? std::string_view() : std::string_view(line).substr(1, end - 1);
+    std::optional<std::string_view> entry = shell.history.find_prefix(prefix);
+    if (!entry) {
+        sh::warn(shell, "%s: event not found", line.substr(0, end).c_str());
+        return false;
+    }
+    line = std::string(*entry) + line.substr(end);
+    std::fprintf(stderr, "%s\n", line.c_str());
+    return true;
+}
+
+// --profile-startup: the time spent in each init phase, printed to stderr
+// just before the first command runs, one line per phase:
+//   startup phase=import us=38
+class StartupProfile {
+public:
+    StartupProfile() : last_us_(sh::monotonic_us()), start_us_(last_us_) {}
+
+    void enable() { enabled_ = true; }
+
+    // Ends the phase that began at the previous mark, or at startup.
+    void mark(const char* phase)
+    {
+        int64_t now = sh::monotonic_us();
+        phases_.emplace_back(phase, now - last_us_);
+        last_us_ = now;
+    }
+
+    void report() const
+    {
+        if (!enabled_)
+            return;
+        for (const auto& [phase, us] : phases_)
+            std::fprintf(stderr, "startup phase=%s us=%lld\n", phase, static_cast<long long>(us));
+        std::fprintf(stderr, "startup phase=total us=%lld\n", static_cast<long long>(last_us_ - start_us_));
+    }
+
+private:
+    bool enabled_ = false;
+    int64_t last_us_;
+    int64_t start_us_;
+    std::vector<std::pair<const char*, int64_t>> phases_;
+};
+
+// Runs the rc file of an interactive shell: $ENV, or ~/.shellrc. A missing
+// file is not an error.
+void run_rc_file(sh::Shell& shell)
+{
+    std::string path;
+    if (const std::string* env = shell.vars.get("ENV")) {
+        path = *env;
+    } else if (const std::string* home = shell.vars.get("HOME")) {
+        path = *home + "/.shellrc";
+    }
+    if (path.empty() || ::access(path.c_str(), R_OK) != 0)
+        return;
+    if (std::shared_ptr<const sh::ParsedScript> script = shell.scripts.load(path))
+        sh::run_parsed(shell, script->text, script->result, path);
+}
+
+// PS1, or PS2 for a continuation line, expanded. Only the line editor can
+// redraw a prompt, so without it command substitutions are waited for.
+std::string prompt(sh::Shell& shell, sh::PromptRenderer& renderer, bool continuation, bool background)
+{
+    const std::string* ps = shell.vars.get(continuation ? "PS2" : "PS1");
+    return ps ? renderer.expand(*ps, background) : continuation ? "> " : "$ ";
+}
+
+int interactive_loop(sh::Shell& shell)
+{
+    sh::Arena arena;
+    std::string buffer;
+    std::string line;
+    sh::LineEditor editor(shell.history, 0, 2);
+    bool editing = editor.usable();
+    sh::PromptRenderer renderer(shell);
+    editor.set_prompt_updates(renderer.fd(), [&renderer](std::string& p) { return renderer.update(p); });
+    editor.set_completion([&shell](sh::Completer::Request& request) {
+        if (request.command) {
+            for (const sh::Builtin& builtin : sh::all_builtins())
+                request.names.emplace_back(builtin.name);
+            for (const auto& [name, fn] : shell.functions)
+                request.names.push_back(name);
+            shell.commands.for_each([&](std::string_view name, const sh::CommandHash::Entry&) { request.names.emplace_back(name); });
+        }
+        request.path = sh::search_path(shell);
+        if (const std::string* home = shell.vars.get("HOME"))
+            request.home = *home;
+    });
+    for (;;) {
+        notify_jobs(shell);
+        sh::LineEditor::Result got = sh::LineEditor::Result::Line;
+        if (editing) {
+            got = editor.read_line(prompt(shell, renderer, !buffer.empty(), true), line);
+        } else {
+            std::fputs(prompt(shell, renderer, !buffer.empty(), false).c_str(), stderr);
+            std::fflush(stderr);
+            if (!std::getline(std::cin, line))
+                got = sh::LineEditor::Result::End;
+        }
+        if (got == sh::LineEditor::Result::Interrupted) {
+            buffer.clear();
+            continue;
+        }
+        if (got == sh::LineEditor::Result::End) {
+            if (!buffer.empty())
+                sh::warn(shell, "unexpected end of file");
+            break;
+        }
+        if (buffer.empty() && !expand_history(shell, line))
+            continue;
+        if (!line.empty())
+            shell.history.add(line);
+        buffer += line;
+        buffer += '\n';
+
+        sh::ParseResult result = sh::parse(buffer, arena);
+        if (result.status == sh::ParseResult::Status::Incomplete) {
+            arena.reset();
+            continue;
+        }
+        sh::execute(shell, result.program);
+        if (result.status == sh::ParseResult::Status::Error && !shell.exiting()) {
+            sh::warn(shell, "%s", sh::describe_error(buffer, result).c_str());
+            shell.last_status = 2;
+        }
+        arena.reset();
+        buffer.clear();
+        if (shell.exiting())
+            break;
+    }
+    return shell.last_status;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    StartupProfile profile;
+    sh::Shell shell;
+    shell.pid = ::getpid();
+    shell.vars.import(environ);
+    profile.mark("import");
+
+    std::optional<sh::LaunchBackend> launcher;
+    const char* command = nullptr;
+    std::optional<std::string> server;
+    int i = 1;
+    for (; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg.starts_with("--launcher=")) {
+            launcher = sh::parse_backend(arg.substr(11));
+            if (!launcher) {
+                usage();
+                return 2;
+            }
+        } else if (arg == "--profile-startup") {
+            profile.enable();
+        } else if (arg == "--server") {
+            server.emplace();
+        } else if (arg.starts_with("--server=")) {
+            server.emplace(arg.substr(9));
+        } else if (arg == "-c") {
+            if (i + 1 >= argc) {
+                usage();
+                return 2;
+            }
+            command = argv[i + 1];
+            i += 2;
+            break;
+        } else if (arg == "--") {
+            ++i;
+            break;
+        } else if (arg.starts_with("-") && arg.size() > 1) {
+            usage();
+            return 2;
+        } else {
+            break;
+        }
+    }
+    if (!launcher) {
+        if (const std::string* env = shell.vars.get("SHELL_LAUNCHER"))
+            launcher = sh::parse_backend(*env);
+    }
+    if (launcher)
+        shell.launcher = *launcher;
+    profile.mark("options");
+
+    if (server) {
+        profile.report();
+        return sh::serve(shell, *server);
+    }
+
+    // -c and scripts skip everything that only an interactive shell needs.
+    if (command) {
+        if (i < argc)
+            shell.name = argv[i];
+        for (int k = i + 1; k < argc; ++k)
+            shell.positional.emplace_back(argv[k]);
+        profile.report();
+        sh::run_source(shell, command, true);
+        return shell.last_status;
+    }
+
+    if (i < argc) {
+        std::shared_ptr<const sh::ParsedScript> script = shell.scripts.load(argv[i]);
+        if (!script) {
+            std::fprintf(stderr, "%s: %s: %s\n", shell.name.c_str(), argv[i], std::strerror(errno));
+            return 127;
+        }
+        shell.name = argv[i];
+        for (int k = i + 1; k < argc; ++k)
+            shell.positional.emplace_back(argv[k]);
+        profile.mark("script");
+        profile.report();
+        sh::run_parsed(shell, script->text, script->result, {}, true);
+        return shell.last_status;
+    }
+
+    shell.interactive = ::isatty(0) && ::isatty(2);
+    profile.mark("terminal");
+    if (shell.interactive) {
+        ::signal(SIGINT, SIG_IGN);
+        ::signal(SIGQUIT, SIG_IGN);
+        shell.history.set_file(history_path(shell));
+        run_rc_file(shell);
+        profile.mark("rc");
+        profile.report();
+        return interactive_loop(shell);
+    }
+
+    profile.report();
+    std::ostringstream text;
+    text << std::cin.rdbuf();
+    sh::run_source(shell, text.str(), true);
+    return shell.last_status;
+}
@@ -0,0 +1,975 @@
+#include "parser.h"
+
+#include "arith.h"
+#include "lexer.h"
+
+#include <algorithm>
+#include <string>
+
+namespace sh {
+
+namespace {
+
+constexpr size_t npos = std::string_view::npos;
+
+struct ParseFailure {
+    const char* message;
+    const char* where; // points into the source, or null
+    bool incomplete;
+};
+
+// How the word parser treats quote characters and backslashes.
+enum class Mode {
+    Unquoted, // ordinary word
+    DQuote,   // inside "..."; \ escapes only $ ` " \ and newline
+    HereDoc,  // unquoted here-document body; like DQuote but '"' is plain
+};
+
+bool dquote_escapable(char c, Mode mode)
+{
+    return c == '$' || c == '`' || c == '\\' || c == '\n' || (c == '"' && mode == Mode::DQuote);
+}
+
+bool is_special_param(char c)
+{
+    return c == '@' || c == '*' || c == '#' || c == '?' || c == '-' || c == '$' || c == '!' || (c >= '0' && c <= '9');
+}
+
+struct PendingHereDoc {
+    PendingHereDoc* next = nullptr;
+    Redir* redir = nullptr;
+    std::string_view delim;
+    bool strip_tabs = false;
+    bool quoted = false;
+};
+
+class Parser {
+public:
+    Parser(std::string_view src, Arena& arena) : src_(src), lex_(src), arena_(arena) {}
+
+    // Parses complete commands into out until the input ends.
+    void program(List<Node>& out);
+
+    // Body of $(...) or `...`: the whole text must be a valid program.
+    Sequence* subprogram()
+    {
+        Sequence* seq = arena_.make<Sequence>();
+        program(seq->items);
+        return seq;
+    }
+
+    // The whole text as an unquoted here-document body.
+    Word* expandable() { return word(src_, Mode::HereDoc); }
+
+private:
+    [[noreturn]] void fail(const char* message, bool incomplete = false)
+    {
+        throw ParseFailure{message, src_.data() + std::min(tok_.offset, src_.size()), incomplete};
+    }
+    [[noreturn]] void unexpected()
+    {
+        if (tok_.kind == TokenKind::End)
+            fail("unexpected end of input", true);
+        fail("syntax error near unexpected token");
+    }
+
+    void advance();
+    void read_heredocs();
+
+    bool at_word(std::string_view kw) const { return tok_.kind == TokenKind::Word && tok_.text == kw; }
+    void expect_word(std::string_view kw)
+    {
+        if (!at_word(kw))
+            unexpected();
+        advance();
+    }
+    void skip_newlines()
+    {
+        while (tok_.kind == TokenKind::Newline)
+            advance();
+    }
+    bool at_terminator() const;
+
+    void list_item(List<Node>& out);
+    Sequence* compound_list();
+    Node* and_or();
+    Node* pipeline();
+    Node* command();
+    Node* simple_command();
+    Node* function_body(std::string_view name);
+    Node* if_clause();
+    Node* loop_clause(bool until);
+    Node* for_clause();
+    Node* case_clause();
+    bool redirection(List<Redir>& out);
+
+    Word* word(std::string_view raw, Mode mode = Mode::Unquoted, bool strip_tabs = false);
+    void parts(std::string_view s, Mode mode, bool strip_tabs, List<WordPart>& out);
+    size_t dollar(std::string_view s, size_t i, bool quoted, List<WordPart>& out);
+    ParamExp* braced(std::string_view inner, bool quoted);
+    WordPart* literal(std::string_view text, bool quoted);
+    Node* substitution(std::string_view body);
+    ArithExpr* compiled(std::string_view expr);
+    PatternView* compiled_pattern(const Word* w);
+    Node* arith_command();
+
+    std::string_view src_;
+    Lexer lex_;
+    Arena& arena_;
+    Token tok_;
+    List<PendingHereDoc> heredocs_;
+};
+
+void Parser::advance()
+{
+    if (tok_.kind == TokenKind::Newline && !heredocs_.empty())
+        read_heredocs();
+    tok_ = lex_.next();
+    if (tok_.kind == TokenKind::Error)
+        fail(lex_.error(), lex_.incomplete());
+    if (tok_.kind == TokenKind::End && !heredocs_.empty())
+        fail("here-document not terminated", true);
+}
+
+void Parser::read_heredocs()
+{
+    for (PendingHereDoc* h : heredocs_) {
+        std::string_view body;
+        if (!lex_.read_heredoc(h->delim, h->strip_tabs, body))
+            fail("here-document not terminated", true);
+        if (h->quoted) {
+            Word* w = arena_.make<Word>();
+            w->raw = body;
+            if (!h->strip_tabs) {
+                w->parts.push(literal(body, true));
+            } else {
+                size_t i = 0;
+                while (i < body.size()) {
+                    while (i < body.size() && body[i] == '\t')
+                        ++i;
+                    size_t nl = body.find('\n', i);
+                    size_t end = nl == npos ? body.size() : nl + 1;
+                    w->parts.push(literal(body.substr(i, end - i), true));
+                    i = end;
+                }
+            }
+            if (w->parts.empty())
+                w->parts.push(literal({}, true));
+            h->redir->target = w;
+        } else {
+            h->redir->target = word(body, Mode::HereDoc, h->strip_tabs);
+        }
+    }
+    heredocs_ = {};
+}
+
+bool Parser::at_terminator() const
+{
+    switch (tok_.kind) {
+    case TokenKind::End:
+    case TokenKind::RParen:
+    case TokenKind::DSemi:
+        return true;
+    case TokenKind::Word:
+        return tok_.text == "then" || tok_.text == "else" || tok_.text == "elif" || tok_.text == "fi" ||
+               tok_.text == "do" || tok_.text == "done" || tok_.text == "esac" || tok_.text == "}";
+    default:
+        return false;
+    }
+}
+
+void Parser::program(List<Node>& out)
+{
+    advance();
+    for (;;) {
+        skip_newlines();
+        if (tok_.kind == TokenKind::End)
+            return;
+        // One complete command: and-or lists up to the end of the line.
+        List<Node> command;
+        for (;;) {
+            list_item(command);
+            if (tok_.kind == TokenKind::Newline || tok_.kind == TokenKind::End)
+                break;
+        }
+        out.append(command);
+    }
+}
+
+void Parser::list_item(List<Node>& out)
+{
+    Node* item = and_or();
+    if (tok_.kind == TokenKind::Amp) {
+        item->async = true;
+        advance();
+    } else if (tok_.kind == TokenKind::Semi) {
+        advance();
+    } else if (tok_.kind != TokenKind::Newline && tok_.kind != TokenKind::End) {
+        unexpected();
+    }
+    out.push(item);
+}
+
+Sequence* Parser::compound_list()
+{
+    Sequence* seq = arena_.make<Sequence>();
+    skip_newlines();
+    while (!at_terminator()) {
+        Node* item = and_or();
+        if (tok_.kind == TokenKind::Amp) {
+            item->async = true;
+            advance();
+        } else if (tok_.kind == TokenKind::Semi) {
+            advance();
+        }
+        seq->items.push(item);
+        skip_newlines();
+    }
+    if (seq->items.empty())
+        unexpected();
+    return seq;
+}
+
+Node* Parser::and_or()
+{
+    Node* left = pipeline();
+    while (tok_.kind == TokenKind::AndIf || tok_.kind == TokenKind::OrIf) {
+        AndOr* node = arena_.make<AndOr>();
+        node->is_and = tok_.kind == TokenKind::AndIf;
+        advance();
+        skip_newlines();
+        node->left = left;
+        node->right = pipeline();
+        left = node;
+    }
+    return left;
+}
+
+Node* Parser::pipeline()
+{
+    bool negate = false;
+    while (at_word("!")) {
+        negate = !negate;
+        advance();
+    }
+    Node* first = command();
+    if (tok_.kind != TokenKind::Pipe && !negate)
+        return first;
+
+    Pipeline* pipe = arena_.make<Pipeline>();
+    pipe->negate = negate;
+    pipe->stages.push(first);
+    while (tok_.kind == TokenKind::Pipe) {
+        advance();
+        skip_newlines();
+        pipe->stages.push(command());
+    }
+    return pipe;
+}
+
+Node* Parser::command()
+{
+    Node* node = nullptr;
+    if (tok_.kind == TokenKind::LParen && tok_.offset + 1 < src_.size() && src_[tok_.offset + 1] == '(' &&
+        find_arith_end(src_, tok_.offset + 2) != kNotArith) {
+        node = arith_command();
+    } else if (tok_.kind == TokenKind::LParen) {
+        advance();
+        Subshell* sub = arena_.make<Subshell>();
+        sub->body = compound_list();
+        if (tok_.kind != TokenKind::RParen)
+            unexpected();
+        advance();
+        node = sub;
+    } else if (at_word("{")) {
+        advance();
+        Group* group = arena_.make<Group>();
+        group->body = compound_list();
+        expect_word("}");
+        node = group;
+    } else if (at_word("if")) {
+        node = if_clause();
+    } else if (at_word("while") || at_word("until")) {
+        node = loop_clause(at_word("until"));
+    } else if (at_word("for")) {
+        node = for_clause();
+    } else if (at_word("case")) {
+        node = case_clause();
+    } else if (at_word("function")) {
+        advance();
+        if (tok_.kind != TokenKind::Word || !is_name(tok_.text))
+            unexpected();
+        std::string_view name = tok_.text;
+        advance();
+        if (tok_.kind == TokenKind::LParen) {
+            advance();
+            if (tok_.kind != TokenKind::RParen)
+                unexpected();
+            advance();
+        }
+        return function_body(name);
+    } else if (at_terminator()) {
+        unexpected();
+    } else {
+        return simple_command();
+    }
+    while (redirection(node->redirs)) {
+    }
+    return node;
+}
+
+Node* Parser::function_body(std::string_view name)
+{
+    skip_newlines();
+    FuncDef* def = arena_.make<FuncDef>();
+    def->name = name;
+    def->body = command();
+    if (def->body->kind == NodeKind::Simple || def->body->kind == NodeKind::FuncDef)
+        fail("function body must be a compound command");
+    return def;
+}
+
+Node* Parser::simple_command()
+{
+    SimpleCommand* cmd = arena_.make<SimpleCommand>();
+    for (;;) {
+        if (redirection(cmd->redirs))
+            continue;
+        if (tok_.kind != TokenKind::Word)
+            break;
+        std::string_view text = tok_.text;
+        size_t eq = text.find('=');
+        if (cmd->words.empty() && eq != npos && eq > 0 && is_name(text.substr(0, eq))) {
+            Assign* a = arena_.make<Assign>();
+            a->name = text.substr(0, eq);
+            a->value = word(text.substr(eq + 1));
+            cmd->assigns.push(a);
+            advance();
+            continue;
+        }
+        cmd->words.push(word(text));
+        advance();
+        if (cmd->words.size == 1 && tok_.kind == TokenKind::LParen) {
+            if (!cmd->assigns.empty() || !cmd->redirs.empty() || !is_name(text))
+                unexpected();
+            advance();
+            if (tok_.kind != TokenKind::RParen)
+                unexpected();
+            advance();
+            return function_body(text);
+        }
+    }
+    if (cmd->words.empty() && cmd->assigns.empty() && cmd->redirs.empty())
+        unexpected();
+    return cmd;
+}
+
+Node* Parser::if_clause()
+{
+    advance(); // if / elif
+    If* node = arena_.make<If>();
+    node->cond = compound_list();
+    expect_word("then");
+    node->then_part = compound_list();
+    if (at_word("elif")) {
+        node->else_part = if_clause();
+        return node;
+    }
+    if (at_word("else")) {
+        advance();
+        node->else_part = compound_list();
+    }
+    expect_word("fi");
+    return node;
+}
+
+Node* Parser::loop_clause(bool until)
+{
+    advance();
+    Loop* node = arena_.make<Loop>();
+    node->until = until;
+    node->cond = compound_list();
+    expect_word("do");
+    node->body = compound_list();
+    expect_word("done");
+    return node;
+}
+
+Node* Parser::for_clause()
+{
+    advance();
+    if (tok_.kind != TokenKind::Word || !is_name(tok_.text))
+        unexpected();
+    For* node = arena_.make<For>();
+    node->var = tok_.text;
+    advance();
+    if (tok_.kind == TokenKind::Semi) {
+        advance();
+    } else {
+        skip_newlines();
+        if (at_word("in")) {
+            advance();
+            node->has_list = true;
+            while (tok_.kind == TokenKind::Word) {
+                node->items.push(word(tok_.text));
+                advance();
+            }
+            if (tok_.kind != TokenKind::Semi && tok_.kind != TokenKind::Newline)
+                unexpected();
+            advance();
+        }
+    }
+    skip_newlines();
+    expect_word("do");
+    node->body = compound_list();
+    expect_word("done");
+    return node;
+}
+
+Node* Parser::case_clause()
+{
+    advance();
+    if (tok_.kind != TokenKind::Word)
+        unexpected();
+    Case* node = arena_.make<Case>();
+    node->subject = word(tok_.text);
+    advance();
+    skip_newlines();
+    expect_word("in");
+    skip_newlines();
+    while (!at_word("esac")) {
+        CaseItem* item = arena_.make<CaseItem>();
+        if (tok_.kind == TokenKind::LParen)
+            advance();
+        for (;;) {
+            if (tok_.kind != TokenKind::Word)
+                unexpected();
+            item->patterns.push(word(tok_.text));
+            advance();
+            if (tok_.kind != TokenKind::Pipe)
+                break;
+            advance();
+        }
+        if (tok_.kind != TokenKind::RParen)
+            unexpected();
+        advance();
+        skip_newlines();
+        if (tok_.kind != TokenKind::DSemi && !at_word("esac"))
+            item->body = compound_list();
+        node->items.push(item);
+        if (tok_.kind != TokenKind::DSemi)
+            break;
+        advance();
+        skip_newlines();
+    }
+    expect_word("esac");
+    return node;
+}
+
+bool Parser::redirection(List<Redir>& out)
+{
+    if (!is_redirection(tok_.kind))
+        return false;
+    Redir* r = arena_.make<Redir>();
+    TokenKind kind = tok_.kind;
+    bool input = true;
+    switch (kind) {
+    case TokenKind::Less:
+        r->op = Redir::Op::In;
+        break;
+    case TokenKind::LessAnd:
+        r->op = Redir::Op::DupIn;
+        break;
+    case TokenKind::LessGreat:
+        r->op = Redir::Op::ReadWrite;
+        break;
+    case TokenKind::DLess:
+    case TokenKind::DLessDash:
+        r->op = Redir::Op::HereDoc;
+        break;
+    case TokenKind::TLess:
+        r->op = Redir::Op::HereString;
+        break;
+    case TokenKind::Great:
+        r->op = Redir::Op::Out;
+        input = false;
+        break;
+    case TokenKind::DGreat:
+        r->op = Redir::Op::Append;
+        input = false;
+        break;
+    case TokenKind::Clobber:
+        r->op = Redir::Op::Clobber;
+        input = false;
+        break;
+    default: // GreatAnd
+        r->op = Redir::Op::DupOut;
+        input = false;
+        break;
+    }
+    r->fd = tok_.io_number >= 0 ? tok_.io_number : (input ? 0 : 1);
+    advance();
+    if (tok_.kind != TokenKind::Word)
+        unexpected();
+
+    if (r->op == Redir::Op::HereDoc) {
+        // The delimiter is the word after quote removal; any quoting at all
+        // turns off expansion in the body.
+        std::string_view raw = tok_.text;
+        PendingHereDoc* h = arena_.make<PendingHereDoc>();
+        h->redir = r;
+        h->strip_tabs = kind == TokenKind::DLessDash;
+        h->quoted = raw.find_first_of("'\"\\") != npos;
+        if (!h->quoted) {
+            h->delim = raw;
+        } else {
+            std::string cooked;
+            for (size_t i = 0; i < raw.size(); ++i) {
+                if (raw[i] == '\\' && i + 1 < raw.size())
+                    cooked += raw[++i];
+                else if (raw[i] != '\'' && raw[i] != '"')
+                    cooked += raw[i];
+            }
+            h->delim = arena_.copy(cooked);
+        }
+        heredocs_.push(h);
+    } else {
+        r->target = word(tok_.text);
+    }
+    advance();
+    out.push(r);
+    return true;
+}
+
+WordPart* Parser::literal(std::string_view text, bool quoted)
+{
+    WordPart* p = arena_.make<WordPart>();
+    p->kind = WordPart::Kind::Literal;
+    p->quoted = quoted;
+    p->text = text;
+    return p;
+}
+
+Word* Parser::word(std::string_view raw, Mode mode, bool strip_tabs)
+{
+    Word* w = arena_.make<Word>();
+    w->raw = raw;
+    parts(raw, mode, strip_tabs, w->parts);
+    return w;
+}
+
+Node* Parser::substitution(std::string_view body)
+{
+    Parser sub(body, arena_);
+    return sub.subprogram();
+}
+
+void Parser::parts(std::string_view s, Mode mode, bool strip_tabs, List<WordPart>& out)
+{
+    const bool quoted = mode != Mode::Unquoted;
+    size_t i = 0;
+    size_t run = 0;
+    bool line_start = true;
+    auto flush = [&](size_t end) {
+        if (end > run)
+            out.push(literal(s.substr(run, end - run), quoted));
+    };
+
+    if (mode == Mode::Unquoted && !s.empty() && s[0] == '~') {
+        size_t end = 1;
+        while (end < s.size() && s[end] != '/' && s[end] != ':')
+            ++end;
+        std::string_view user = s.substr(1, end - 1);
+        if (user.find_first_of("'\"\\$`") == npos) {
+            WordPart* p = arena_.make<WordPart>();
+            p->kind = WordPart::Kind::Tilde;
+            p->text = user;
+            out.push(p);
+            i = run = end;
+        }
+    }
+
+    while (i < s.size()) {
+        char c = s[i];
+        if (strip_tabs && line_start && c == '\t') {
+            flush(i);
+            run = ++i;
+            continue;
+        }
+        line_start = c == '\n';
+        size_t e;
+        switch (c) {
+        case '\\':
+            if (i + 1 >= s.size())
+                break;
+            if (s[i + 1] == '\n') {
+                flush(i);
+                i += 2;
+                run = i;
+                line_start = true;
+                continue;
+            }
+            if (mode == Mode::Unquoted || dquote_escapable(s[i + 1], mode)) {
+                flush(i);
+                out.push(literal(s.substr(i + 1, 1), true));
+                i += 2;
+                run = i;
+                continue;
+            }
+            i += 2;
+            continue;
+        case '\'':
+            if (mode != Mode::Unquoted)
+                break;
+            flush(i);
+            e = find_quote_end(s, i + 1);
+            if (e == npos)
+                fail("unterminated quote", true);
+            out.push(literal(s.substr(i + 1, e - i - 1), true));
+            i = run = e + 1;
+            continue;
+        case '"': {
+            if (mode == Mode::DQuote) {
+                // Only reached inside a ${...} within "...": a nested
+                // quote, removed, around text that is quoted anyway.
+                flush(i);
+                i = run = i + 1;
+                continue;
+            }
+            if (mode != Mode::Unquoted)
+                break;
+            flush(i);
+            e = find_dquote_end(s, i + 1);
+            if (e == npos)
+                fail("unterminated quote", true);
+            size_t before = out.size;
+            parts(s.substr(i + 1, e - i - 1), Mode::DQuote, false, out);
+            if (out.size == before)
+                out.push(literal({}, true));
+            i = run = e + 1;
+            continue;
+        }
+        case '`': {
+            flush(i);
+            e = find_backquote_end(s, i + 1);
+            if (e == npos)
+                fail("unterminated command substitution", true);
+            std::string_view body = s.substr(i + 1, e - i - 1);
+            if (body.find('\\') != npos) {
+                std::string cooked;
+                for (size_t k = 0; k < body.size(); ++k) {
+                    if (body[k] == '\\' && k + 1 < body.size() &&
+                        (body[k + 1] == '$' || body[k + 1] == '`' || body[k + 1] == '\\' ||
+                         (body[k + 1] == '"' && mode == Mode::DQuote)))
+                        ++k;
+                    cooked += body[k];
+                }
+                body = arena_.copy(cooked);
+            }
+            WordPart* p = arena_.make<WordPart>();
+            p->kind = WordPart::Kind::Command;
+            p->quoted = quoted;
+            p->command = substitution(body);
+            out.push(p);
+            i = run = e + 1;
+            continue;
+        }
+        case '$': {
+            if (i + 1 >= s.size())
+                break;
+            char n = s[i + 1];
+            if (n != '(' && n != '{' && !is_name_start(n) && !is_special_param(n))
+                break;
+            flush(i);
+            i = run = dollar(s, i, quoted, out);
+            continue;
+        }
+        default:
+            break;
+        }
+        ++i;
+    }
+    flush(i);
+}
+
+size_t Parser::dollar(std::string_view s, size_t i, bool quoted, List<WordPart>& out)
+{
+    WordPart* p = arena_.make<WordPart>();
+    p->quoted = quoted;
+    char n = s[i + 1];
+    size_t end;
+    if (n == '(') {
+        size_t e = i + 2 < s.size() && s[i + 2] == '(' ? find_arith_end(s, i + 3) : kNotArith;
+        if (e == npos)
+            fail("unterminated arithmetic expansion", true);
+        if (e != kNotArith) {
+            p->kind = WordPart::Kind::Arith;
+            p->text = s.substr(i + 3, e - i - 3);
+            p->expr = word(p->text, Mode::HereDoc);
+            p->arith = compiled(p->text);
+            end = e + 2;
+        } else {
+            e = find_paren_end(s, i + 2);
+            if (e == npos)
+                fail("unterminated command substitution", true);
+            p->kind = WordPart::Kind::Command;
+            p->command = substitution(s.substr(i + 2, e - i - 2));
+            end = e + 1;
+        }
+    } else if (n == '{') {
+        size_t e = find_brace_end(s, i + 2);
+        if (e == npos)
+            fail("unterminated parameter expansion", true);
+        p->kind = WordPart::Kind::Param;
+        p->param = braced(s.substr(i + 2, e - i - 2), quoted);
+        end = e + 1;
+    } else {
+        p->kind = WordPart::Kind::Param;
+        p->param = arena_.make<ParamExp>();
+        end = i + 2;
+        if (is_name_start(n)) {
+            while (end < s.size() && is_name_char(s[end]))
+                ++end;
+        }
+        p->param->name = s.substr(i + 1, end - i - 1);
+    }
+    out.push(p);
+    return end;
+}
+
+ParamExp* Parser::braced(std::string_view inner, bool quoted)
+{
+    ParamExp* pe = arena_.make<ParamExp>();
+    auto name_length = [](std::string_view t) -> size_t {
+        if (t.empty())
+            return 0;
+        if (is_name_start(t[0])) {
+            size_t k = 1;
+            while (k < t.size() && is_name_char(t[k]))
+                ++k;
+            return k;
+        }
+        if (t[0] >= '0' && t[0] <= '9') {
+            size_t k = 1;
+            while (k < t.size() && t[k] >= '0' && t[k] <= '9')
+                ++k;
+            return k;
+        }
+        return is_special_param(t[0]) ? 1 : 0;
+    };
+
+    if (inner.size() > 1 && inner[0] == '#') {
+        size_t len = name_length(inner.substr(1));
+        if (len + 1 == inner.size()) {
+            pe->op = ParamExp::Op::Length;
+            pe->name = inner.substr(1);
+            return pe;
+        }
+    }
+    size_t len = name_length(inner);
+    if (len == 0)
+        fail("bad substitution");
+    pe->name = inner.substr(0, len);
+    std::string_view rest = inner.substr(len);
+    if (rest.empty())
+        return pe;
+
+    Mode mode = quoted ? Mode::DQuote : Mode::Unquoted;
+    auto arg = [&](std::string_view text) { return word(text, mode); };
+    auto simple = [&](ParamExp::Op op, size_t skip) {
+        pe->op = op;
+        pe->arg = arg(rest.substr(skip));
+    };
+    // Patterns and replacements are words of their own even inside "...":
+    // as in bash, "${f#"$p"}" matches $p literally and quotes in them are
+    // removed.
+    auto trim = [&](ParamExp::Op op, size_t skip) {
+        pe->op = op;
+        pe->arg = word(rest.substr(skip), Mode::Unquoted);
+        pe->pattern = compiled_pattern(pe->arg);
+    };
+
+    char c = rest[0];
+    char c1 = rest.size() > 1 ? rest[1] : '\0';
+    switch (c) {
+    case ':':
+        if (c1 == '-' || c1 == '=' || c1 == '?' || c1 == '+') {
+            pe->colon = true;
+            rest.remove_prefix(1);
+            c = c1;
+            break;
+        } else {
+            pe->op = ParamExp::Op::Substring;
+            std::string_view spec = rest.substr(1);
+            size_t colon = spec.find(':');
+            pe->arg = word(spec.substr(0, colon), Mode::HereDoc);
+            pe->offset = compiled(spec.substr(0, colon));
+            if (colon != npos) {
+                pe->arg2 = word(spec.substr(colon + 1), Mode::HereDoc);
+                pe->length = compiled(spec.substr(colon + 1));
+            }
+            return pe;
+        }
+    case '%':
+        if (c1 == '%')
+            trim(ParamExp::Op::TrimLargeSuffix, 2);
+        else
+            trim(ParamExp::Op::TrimSmallSuffix, 1);
+        return pe;
+    case '#':
+        if (c1 == '#')
+            trim(ParamExp::Op::TrimLargePrefix, 2);
+        else
+            trim(ParamExp::Op::TrimSmallPrefix, 1);
+        return pe;
+    case '/': {
+        size_t skip = 1;
+        pe->op = ParamExp::Op::Replace;
+        if (c1 == '/') {
+            pe->op = ParamExp::Op::ReplaceAll;
+            skip = 2;
+        } else if (c1 == '#') {
+            pe->op = ParamExp::Op::ReplacePrefix;
+            skip = 2;
+        } else if (c1 == '%') {
+            pe->op = ParamExp::Op::ReplaceSuffix;
+            skip = 2;
+        }
+        std::string_view spec = rest.substr(skip);
+        size_t k = 0;
+        while (k < spec.size() && spec[k] != '/') {
+            size_t e = k;
+            if (spec[k] == '\\')
+                e = k + 1;
+            else if (spec[k] == '\'')
+                e = find_quote_end(spec, k + 1);
+            else if (spec[k] == '"')
+                e = find_dquote_end(spec, k + 1);
+            else if (spec[k] == '$')
+                e = skip_dollar(spec, k) - 1;
+            if (e == npos || e >= spec.size())
+                break;
+            k = e + 1;
+        }
+        pe->arg = word(spec.substr(0, std::min(k, spec.size())), Mode::Unquoted);
+        pe->pattern = compiled_pattern(pe->arg);
+        if (k < spec.size())
+            pe->arg2 = word(spec.substr(k + 1), Mode::Unquoted);
+        return pe;
+    }
+    default:
+        break;
+    }
+
+    switch (c) {
+    case '-':
+        simple(ParamExp::Op::Default, 1);
+        break;
+    case '=':
+        simple(ParamExp::Op::Assign, 1);
+        break;
+    case '?':
+        simple(ParamExp::Op::Error, 1);
+        break;
+    case '+':
+        simple(ParamExp::Op::Alternate, 1);
+        break;
+    default:
+        fail("bad substitution");
+    }
+    return pe;
+}
+
+} // namespace
+
+// An expression with nothing to expand is parsed here, once; one with $ or
+// ` must be expanded, and so parsed, each time it is evaluated.
+ArithExpr* Parser::compiled(std::string_view expr)
+{
+    if (expr.find_first_of("$`\\") != std::string_view::npos)
+        return nullptr;
+    return compile_arith(expr, arena_);
+}
+
+// A pattern made only of literal text is compiled here, once, into the
+// form expand_pattern() would give it at every evaluation.
+PatternView* Parser::compiled_pattern(const Word* w)
+{
+    if (!w)
+        return nullptr;
+    std::string text;
+    for (const WordPart* p : w->parts) {
+        if (p->kind != WordPart::Kind::Literal)
+            return nullptr;
+        for (char c : p->text) {
+            if (p->quoted && (c == '*' || c == '?' || c == '[' || c == ']' || c == '\\'))
+                text += '\\';
+            text += c;
+        }
+    }
+    Pattern pattern(text);
+    PatternView view = pattern.view();
+    return arena_.make<PatternView>(arena_.copy(view.tokens), arena_.copy(view.sets));
+}
+
+// (( expr )), at a '(' immediately followed by another.
+Node* Parser::arith_command()
+{
+    size_t start = tok_.offset + 2;
+    size_t end = find_arith_end(src_, start);
+    if (end == npos)
+        fail("unterminated arithmetic command", true);
+    ArithCommand* cmd = arena_.make<ArithCommand>();
+    std::string_view text = src_.substr(start, end - start);
+    cmd->expr = word(text, Mode::HereDoc);
+    cmd->compiled = compiled(text);
+    lex_ = Lexer(src_, end + 2);
+    advance();
+    return cmd;
+}
+
+Word* parse_expandable(std::string_view text, Arena& arena)
+{
+    try {
+        return Parser(text, arena).expandable();
+    } catch (const ParseFailure&) {
+        return nullptr;
+    }
+}
+
+ParseResult parse(std::string_view src, Arena& arena)
+{
+    ParseResult result;
+    result.program = arena.make<Sequence>();
+    Parser parser(src, arena);
+    try {
+        parser.program(result.program->items);
+    } catch (const ParseFailure& f) {
+        result.status = f.incomplete ? ParseResult::Status::Incomplete : ParseResult::Status::Error;
+        result.message = f.message;
+        if (f.where >= src.data() && f.where <= src.data() + src.size())
+            result.error_offset = static_cast<size_t>(f.where - src.data());
+    }
+    return result;
+}
+
+size_t line_of(std::string_view src, size_t offset)
+{
+    offset = std::min(offset, src.size());
+    return 1 + static_cast<size_t>(std::count(src.begin(), src.begin() + static_cast<long>(offset), '\n'));
+}
+
+std::string describe_error(std::string_view src, const ParseResult& result)
+{
+    std::string out = "line " + std::to_string(line_of(src, result.error_offset)) + ": " + result.message;
+    if (result.status == ParseResult::Status::Error && std::string_view(result.message).ends_with("token")) {
+        Token t = Lexer(src, result.error_offset).next();
+        if (t.kind == TokenKind::Newline)
+            out += " `newline'";
+        else if (!t.text.empty())
+            out += " `" + std::string(t.text) + "'";
+    }
+    return out;
+}
+
+} // namespace sh
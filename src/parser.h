@@ -0,0 +1,45 @@
+#pragma once
+
+#include "arena.h"
+#include "ast.h"
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace sh {
+
+struct ParseResult {
+    enum class Status {
+        Ok,
+        Incomplete, // input ended inside a construct; more lines may complete it
+        Error,
+    };
+
+    Status status = Status::Ok;
+    // Never null. On Incomplete or Error it still holds every complete
+    // command that preceded the failure, so a script can run up to it.
+    Sequence* program = nullptr;
+    const char* message = nullptr;
+    size_t error_offset = 0;
+};
+
+// Parses src into a tree allocated from arena. Tokens and word parts are
+// views into src, so src must stay alive and unchanged as long as the tree
+// is used. Callers that parse many lines pass the same arena each time and
+// reset() it once a line has been executed.
+ParseResult parse(std::string_view src, Arena& arena);
+
+// Parses text as an unquoted here-document body: $ and ` expansions, with
+// backslash quoting only $, `, \ and newline, and everything else literal.
+// Prompt strings are expanded this way. Returns nullptr if an expansion in
+// it does not parse.
+Word* parse_expandable(std::string_view text, Arena& arena);
+
+// 1-based line number of offset within src, for diagnostics.
+size_t line_of(std::string_view src, size_t offset);
+
+// "line N: message", naming the offending token where there is one.
+std::string describe_error(std::string_view src, const ParseResult& result);
+
+} // namespace sh
@@ -0,0 +1,207 @@
+#include "pathglob.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace sh {
+
+namespace {
+
+// The layout of the records getdents64(2) returns.
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+bool is_hidden(std::string_view name)
+{
+    return name[0] == '.';
+}
+
+class Globber {
+public:
+    Globber(DirCache& cache, Fields& out) : cache_(cache), out_(out) {}
+
+    void run(std::string_view pattern)
+    {
+        std::string prefix;
+        if (pattern.starts_with('/')) {
+            prefix = "/";
+            pattern.remove_prefix(1);
+        }
+        if (pattern.ends_with('/')) {
+            trailing_slash_ = true;
+            pattern.remove_suffix(1);
+        }
+        for (size_t start = 0;;) {
+            size_t slash = pattern.find('/', start);
+            std::string_view comp = pattern.substr(start, slash == std::string_view::npos ? slash : slash - start);
+            globstar_.push_back(comp == "**");
+            comps_.emplace_back(comp, false);
+            if (slash == std::string_view::npos)
+                break;
+            start = slash + 1;
+        }
+        walk(prefix, 0);
+    }
+
+private:
+    // prefix is empty or an existing directory path ending in '/'; matches
+    // comps_[i...] inside it.
+    void walk(const std::string& prefix, size_t i)
+    {
+        if (i == comps_.size()) {
+            // Only reached through ** matching no further directory.
+            if (prefix.empty() || prefix == "/")
+                return;
+            out_.push_back(std::string_view(prefix).substr(0, prefix.size() - !trailing_slash_));
+            return;
+        }
+        const Pattern& comp = comps_[i];
+        bool last = i + 1 == comps_.size();
+
+        if (comp.is_literal() && !globstar_[i]) {
+            std::string path = prefix + comp.literal();
+            if (!last) {
+                walk(path + '/', i + 1);
+                return;
+            }
+            struct stat st;
+            if (trailing_slash_ ? ::stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)
+                                : ::lstat(path.c_str(), &st) == 0)
+                out_.push_back(trailing_slash_ ? path + '/' : path);
+            return;
+        }
+
+        const std::vector<DirCache::Entry>* entries = cache_.list(prefix);
+        if (!entries)
+            return;
+
+        if (globstar_[i]) {
+            walk(prefix, i + 1);
+            for (const DirCache::Entry& e : *entries) {
+                if (is_hidden(e.name))
+                    continue;
+                std::string path = prefix;
+                path += e.name;
+                if (is_dir(path, e, false))
+                    walk(path + '/', i);
+                else if (last && is_dir(path, e, true))
+                    walk(path + '/', i + 1); // a link ends a final **, never descended
+                else if (last && !trailing_slash_)
+                    out_.push_back(path);
+            }
+            return;
+        }
+
+        for (const DirCache::Entry& e : *entries) {
+            if (is_hidden(e.name) && (!comp.matches_dot() || e.name == "." || e.name == ".."))
+                continue;
+            if (!comp.match(e.name))
+                continue;
+            if (last && !trailing_slash_) {
+                out_.push_joined(prefix, e.name); // no string per match
+                continue;
+            }
+            std::string path = prefix;
+            path += e.name;
+            if (is_dir(path, e, true))
+                walk(path + '/', last ? comps_.size() : i + 1);
+        }
+    }
+
+    // Whether the entry at path is a directory; follow decides whether a
+    // symbolic link to one counts.
+    static bool is_dir(const std::string& path, const DirCache::Entry& e, bool follow)
+    {
+        if (e.type == DT_DIR)
+            return true;
+        if (e.type != DT_UNKNOWN && (e.type != DT_LNK || !follow))
+            return false;
+        struct stat st;
+        int rc = follow ? ::stat(path.c_str(), &st) : ::lstat(path.c_str(), &st);
+        return rc == 0 && S_ISDIR(st.st_mode);
+    }
+
+    DirCache& cache_;
+    Fields& out_;
+    std::vector<Pattern> comps_;
+    std::vector<bool> globstar_;
+    bool trailing_slash_ = false;
+};
+
+} // namespace
+
+const std::vector<DirCache::Entry>* DirCache::list(const std::string& dir)
+{
+    return list(dir, nullptr);
+}
+
+const std::vector<DirCache::Entry>* DirCache::list(const std::string& dir, const Progress& progress)
+{
+    const char* path = dir.empty() ? "." : dir.c_str();
+    auto [it, inserted] = dirs_.try_emplace(dir);
+    Listing& listing = it->second;
+    if (!inserted) {
+        struct stat st;
+        bool stale = revalidate_ && ::stat(path, &st) == 0 &&
+                     (st.st_mtim.tv_sec != listing.mtime.tv_sec || st.st_mtim.tv_nsec != listing.mtime.tv_nsec);
+        if (!stale) {
+            if (progress && listing.entries && !progress(*listing.entries))
+                return nullptr;
+            return listing.entries.get();
+        }
+        listing.entries.reset();
+        listing.names.reset();
+    }
+
+    int fd = ::open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    if (revalidate_ && ::fstat(fd, &st) == 0)
+        listing.mtime = st.st_mtim;
+    auto entries = std::make_unique<std::vector<Entry>>();
+    auto names = std::make_unique<Arena>(64 * 1024);
+    alignas(LinuxDirent64) char buf[64 * 1024];
+    for (;;) {
+        long n = ::syscall(SYS_getdents64, fd, buf, sizeof buf);
+        if (n <= 0)
+            break;
+        size_t batch = entries->size();
+        for (long off = 0; off < n;) {
+            auto* d = reinterpret_cast<const LinuxDirent64*>(buf + off);
+            entries->push_back({names->copy(d->d_name), d->d_type});
+            off += d->d_reclen;
+        }
+        if (progress && !progress(std::span<const Entry>(*entries).subspan(batch))) {
+            ::close(fd);
+            dirs_.erase(it);
+            return nullptr;
+        }
+    }
+    ::close(fd);
+    listing.entries = std::move(entries);
+    listing.names = std::move(names);
+    return listing.entries.get();
+}
+
+bool expand_glob(std::string_view pattern, DirCache& cache, Fields& out)
+{
+    size_t start = out.size();
+    Globber(cache, out).run(pattern);
+    out.sort_from(start);
+    return out.size() > start;
+}
+
+} // namespace sh
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "arena.h"
+#include "fields.h"
+#include "pattern.h"
+
+#include <time.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace sh {
+
+// Directory listings read for pathname expansion. An Expander keeps one
+// while it expands one command's words, so patterns over the same
+// directory read it once; nothing is kept across commands, which may
+// create or remove files. A cache that does outlive them (the completer's)
+// is made with revalidate set: a listing is then read again once the
+// directory's mtime moves. Names are kept in an arena per listing, so a
+// huge directory costs its names plus a small entry each.
+class DirCache {
+public:
+    struct Entry {
+        std::string_view name; // in the listing's arena
+        unsigned char type; // DT_* from getdents64, DT_UNKNOWN if the filesystem has none
+    };
+
+    // Receives each batch of entries as it is read; returning false
+    // abandons the listing.
+    using Progress = std::function<bool(std::span<const Entry>)>;
+
+    explicit DirCache(bool revalidate = false) : revalidate_(revalidate) {}
+
+    // The entries of dir ("" for the current directory), or nullptr if it
+    // cannot be read.
+    const std::vector<Entry>* list(const std::string& dir);
+
+    // Like list(), also passing the entries to progress as they arrive (all
+    // at once when cached). An abandoned listing is not kept, and nullptr
+    // is returned.
+    const std::vector<Entry>* list(const std::string& dir, const Progress& progress);
+
+private:
+    struct Listing {
+        std::unique_ptr<std::vector<Entry>> entries; // null if unreadable
+        std::unique_ptr<Arena> names;
+        timespec mtime{};
+    };
+
+    bool revalidate_;
+    std::unordered_map<std::string, Listing> dirs_;
+};
+
+// Pathname expansion of pattern. Directories are read with getdents64 in
+// large batches, and d_type saves a stat call per entry where the
+// filesystem fills it in. A component that is exactly ** matches any
+// number of directories. As in bash 5.2, symbolic links to directories
+// are not descended, and one is matched by ** only when ** ends the
+// pattern (`**/` lists `link/`, `**/*.c` finds nothing inside it); . and ..
+// are never matched, even by `.*`. Matches are appended to out in sorted
+// order; returns false if there are none.
+bool expand_glob(std::string_view pattern, DirCache& cache, Fields& out);
+
+} // namespace sh
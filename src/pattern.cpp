@@ -0,0 +1,165 @@
+#include "pattern.h"
+
+#include <cctype>
+#include <cstddef>
+
+namespace sh {
+
+namespace {
+
+// Adds the characters of a [:name:] class to set. Returns false for an
+// unknown name.
+bool add_class(std::string_view name, CharSet& set)
+{
+    static constexpr struct {
+        std::string_view name;
+        int (*test)(int);
+    } kClasses[] = {
+        {"alnum", ::isalnum}, {"alpha", ::isalpha}, {"blank", ::isblank}, {"cntrl", ::iscntrl},
+        {"digit", ::isdigit}, {"graph", ::isgraph}, {"lower", ::islower}, {"print", ::isprint},
+        {"punct", ::ispunct}, {"space", ::isspace}, {"upper", ::isupper}, {"xdigit", ::isxdigit},
+    };
+    for (const auto& cls : kClasses) {
+        if (cls.name != name)
+            continue;
+        for (int c = 0; c < 256; ++c) {
+            if (cls.test(c))
+                set.set(static_cast<size_t>(c));
+        }
+        return true;
+    }
+    return false;
+}
+
+// Parses the bracket expression whose '[' is at p[at]. Returns the index
+// just past its ']', or npos if it is not terminated (the '[' is then an
+// ordinary character).
+size_t parse_bracket(std::string_view p, size_t at, bool slash, CharSet& set)
+{
+    size_t j = at + 1;
+    bool negate = j < p.size() && (p[j] == '!' || p[j] == '^');
+    if (negate)
+        ++j;
+    bool first = true;
+    while (j < p.size()) {
+        char c = p[j];
+        if (c == ']' && !first) {
+            if (negate)
+                set.flip();
+            if (!slash)
+                set.reset('/');
+            return j + 1;
+        }
+        first = false;
+        if (c == '[' && j + 1 < p.size() && p[j + 1] == ':') {
+            size_t end = p.find(":]", j + 2);
+            if (end != std::string_view::npos && add_class(p.substr(j + 2, end - j - 2), set)) {
+                j = end + 2;
+                continue;
+            }
+        }
+        if (c == '\\' && j + 1 < p.size())
+            c = p[++j];
+        ++j;
+        auto lo = static_cast<unsigned char>(c);
+        if (j + 1 < p.size() && p[j] == '-' && p[j + 1] != ']') {
+            char h = p[j + 1];
+            j += 2;
+            if (h == '\\' && j < p.size())
+                h = p[j++];
+            for (unsigned k = lo; k <= static_cast<unsigned char>(h); ++k)
+                set.set(k);
+        } else {
+            set.set(lo);
+        }
+    }
+    return std::string_view::npos;
+}
+
+} // namespace
+
+Pattern::Pattern(std::string_view p, bool slash)
+{
+    for (size_t i = 0; i < p.size(); ++i) {
+        char c = p[i];
+        switch (c) {
+        case '\\':
+            if (i + 1 < p.size())
+                c = p[++i];
+            break;
+        case '*':
+            literal_ = false;
+            if (tokens_.empty() || tokens_.back().kind != PatternToken::Star)
+                tokens_.push_back({PatternToken::Star});
+            continue;
+        case '?':
+            literal_ = false;
+            tokens_.push_back({PatternToken::Any});
+            continue;
+        case '[': {
+            CharSet set;
+            size_t end = parse_bracket(p, i, slash, set);
+            if (end == std::string_view::npos)
+                break;
+            literal_ = false;
+            tokens_.push_back({PatternToken::Set, 0, static_cast<uint16_t>(sets_.size())});
+            sets_.push_back(set);
+            i = end - 1;
+            continue;
+        }
+        default:
+            break;
+        }
+        tokens_.push_back({PatternToken::Char, c});
+        text_ += c;
+    }
+}
+
+bool PatternView::match(std::string_view text) const
+{
+    // A pattern ending in a plain character can only match text ending in
+    // it, which rules out most of the suffixes and prefixes trimming tries.
+    if (!tokens.empty() && tokens.back().kind == PatternToken::Char && (text.empty() || text.back() != tokens.back().c))
+        return false;
+    // Backtracking only to the most recent star keeps this linear in
+    // practice, as in fnmatch implementations.
+    size_t t = 0;
+    size_t n = 0;
+    size_t star = SIZE_MAX; // token after the last star seen
+    size_t mark = 0;        // where that star's match currently ends
+    while (n < text.size()) {
+        if (t < tokens.size()) {
+            const PatternToken& tok = tokens[t];
+            if (tok.kind == PatternToken::Star) {
+                star = ++t;
+                mark = n;
+                continue;
+            }
+            bool ok = tok.kind == PatternToken::Any || (tok.kind == PatternToken::Char && tok.c == text[n]) ||
+                      (tok.kind == PatternToken::Set && sets[tok.set].test(static_cast<unsigned char>(text[n])));
+            if (ok) {
+                ++t;
+                ++n;
+                continue;
+            }
+        }
+        if (star == SIZE_MAX)
+            return false;
+        t = star;
+        n = ++mark;
+    }
+    while (t < tokens.size() && tokens[t].kind == PatternToken::Star)
+        ++t;
+    return t == tokens.size();
+}
+
+size_t PatternView::fixed_length() const
+{
+    for (const PatternToken& tok : tokens) {
+        if (tok.kind == PatternToken::Star)
+            return std::string_view::npos;
+    }
+    return tokens.size();
+}
+
+} // namespace sh
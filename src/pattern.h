@@ -0,0 +1,66 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sh {
+
+using CharSet = std::bitset<256>;
+
+struct PatternToken {
+    enum Kind : uint8_t { Char, Any, Star, Set } kind;
+    char c = 0;       // Char
+    uint16_t set = 0; // Set: index into the pattern's sets
+};
+
+// A compiled pattern whose tokens are stored elsewhere: in a Pattern, or
+// in an Arena for one compiled with its word by the parser.
+struct PatternView {
+    std::span<const PatternToken> tokens;
+    std::span<const CharSet> sets;
+
+    // Whether the whole of text matches.
+    bool match(std::string_view text) const;
+    bool empty() const { return tokens.empty(); }
+
+    // The length of every string the pattern matches, or npos if it has a
+    // star and so matches strings of any length from some minimum.
+    size_t fixed_length() const;
+};
+
+// A shell pattern compiled once and then matched against many strings:
+// directory entries, or the prefixes and suffixes ${x#p} tries. Backslash
+// quotes the next character, as in the patterns expand_pattern()
+// produces. Unless slash is set, a bracket expression never matches '/',
+// as for a pathname component.
+class Pattern {
+public:
+    explicit Pattern(std::string_view pattern, bool slash = true);
+
+    bool match(std::string_view text) const { return view().match(text); }
+    PatternView view() const { return {tokens_, sets_}; }
+
+    // No metacharacters: matches only literal().
+    bool is_literal() const { return literal_; }
+    const std::string& literal() const { return text_; }
+
+    // Whether the pattern starts with a literal '.', the only way to match
+    // a name that does.
+    bool matches_dot() const
+    {
+        return !tokens_.empty() && tokens_[0].kind == PatternToken::Char && tokens_[0].c == '.';
+    }
+
+private:
+    std::vector<PatternToken> tokens_;
+    std::vector<CharSet> sets_;
+    std::string text_; // unescaped, when literal_
+    bool literal_ = true;
+};
+
+} // namespace sh
@@ -0,0 +1,172 @@
+#include "prompt.h"
+
+#include "arena.h"
+#include "executor.h"
+#include "expand.h"
+#include "lexer.h"
+#include "parser.h"
+#include "shell.h"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+namespace sh {
+
+PromptRenderer::PromptRenderer(Shell& shell) : shell_(shell), epoll_fd_(::epoll_create1(EPOLL_CLOEXEC)) {}
+
+PromptRenderer::~PromptRenderer()
+{
+    // Runs still going are left to finish on their own; with the pipe
+    // closed their output goes nowhere.
+    for (auto& [command, segment] : segments_) {
+        if (segment.fd >= 0)
+            ::close(segment.fd);
+    }
+    if (epoll_fd_ >= 0)
+        ::close(epoll_fd_);
+}
+
+std::string PromptRenderer::expand(const std::string& ps, bool background)
+{
+    int status = shell_.last_status;
+    last_ = ps;
+    std::string out = render(ps, true);
+    if (!background) {
+        bool ran = false;
+        for (auto& [command, segment] : segments_) {
+            if (segment.pid < 0)
+                continue;
+            while (read_some(segment)) {
+            }
+            finish(segment);
+            ran = true;
+        }
+        if (ran)
+            out = render(ps, false);
+    }
+    shell_.last_status = status;
+    return out;
+}
+
+bool PromptRenderer::update(std::string& prompt)
+{
+    epoll_event events[16];
+    int n = ::epoll_wait(epoll_fd_, events, 16, 0);
+    bool changed = false;
+    for (int i = 0; i < n; ++i) {
+        Segment& segment = *static_cast<Segment*>(events[i].data.ptr);
+        if (!read_some(segment))
+            changed |= finish(segment);
+    }
+    if (!changed)
+        return false;
+    int status = shell_.last_status;
+    prompt = render(last_, false);
+    shell_.last_status = status;
+    return true;
+}
+
+std::string PromptRenderer::render(const std::string& ps, bool restart)
+{
+    std::string out;
+    size_t plain_from = 0;
+    for (size_t i = 0; i < ps.size();) {
+        std::string_view command;
+        size_t end;
+        if (ps[i] == '\\') {
+            i += 2;
+            continue;
+        } else if (ps[i] == '`') {
+            end = find_backquote_end(ps, i + 1);
+            if (end == std::string::npos)
+                break;
+            command = std::string_view(ps).substr(i + 1, end - i - 1);
+        } else if (ps[i] == '$' && i + 1 < ps.size() && ps[i + 1] == '(' &&
+                   !(i + 2 < ps.size() && ps[i + 2] == '(' && find_arith_end(ps, i + 3) != kNotArith)) {
+            end = find_paren_end(ps, i + 2);
+            if (end == std::string::npos)
+                break;
+            command = std::string_view(ps).substr(i + 2, end - i - 2);
+        } else if (ps[i] == '$') {
+            // Parameter and arithmetic expansions are cheap and stay inline,
+            // along with any substitution nested in them.
+            i = skip_dollar(ps, i);
+            continue;
+        } else {
+            ++i;
+            continue;
+        }
+        out += plain(std::string_view(ps).substr(plain_from, i - plain_from));
+        Segment& segment = segments_[std::string(command)];
+        if (restart && segment.pid < 0)
+            start(std::string(command), segment);
+        out += segment.value;
+        i = plain_from = end + 1;
+    }
+    out += plain(std::string_view(ps).substr(std::min(plain_from, ps.size())));
+    return out;
+}
+
+void PromptRenderer::start(const std::string& command, Segment& segment)
+{
+    int fd;
+    pid_t pid = start_capture(shell_, command, fd);
+    if (pid < 0)
+        return;
+    segment.pid = pid;
+    segment.fd = fd;
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &segment;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+}
+
+bool PromptRenderer::read_some(Segment& segment)
+{
+    char buf[4096];
+    for (;;) {
+        ssize_t n = ::read(segment.fd, buf, sizeof buf);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        segment.pending.append(buf, static_cast<size_t>(n));
+        return true;
+    }
+}
+
+bool PromptRenderer::finish(Segment& segment)
+{
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, segment.fd, nullptr);
+    ::close(segment.fd);
+    segment.fd = -1;
+    int status = wait_for(segment.pid);
+    segment.pid = -1;
+    std::string out = std::move(segment.pending);
+    segment.pending.clear();
+    out.resize(out.find_last_not_of('\n') + 1); // npos + 1 == 0
+    // A run killed by a signal (^C during a command) keeps the old value.
+    if (status > 128 || out == segment.value)
+        return false;
+    segment.value = std::move(out);
+    return true;
+}
+
+std::string PromptRenderer::plain(std::string_view text)
+{
+    if (text.empty())
+        return {};
+    Arena arena;
+    Word* word = parse_expandable(text, arena);
+    if (!word)
+        return std::string(text);
+    try {
+        return expand_string(shell_, word);
+    } catch (const ExpansionError&) {
+        return std::string(text);
+    }
+}
+
+} // namespace sh
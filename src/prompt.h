@@ -0,0 +1,61 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace sh {
+
+struct Shell;
+
+// Expansion of PS1 and PS2 for the interactive shell. The text is expanded
+// like an unquoted here-document, except that each top-level $(...) or
+// `...` is a segment run in the background: the prompt is drawn at once
+// with the segment's output from its previous run (nothing the first
+// time), and its as yet unfinished run carries on while the user types. When
+// one finishes with new output, update() expands the prompt again for the
+// line editor to redraw in place. A segment still running at the next
+// prompt is not started again, so a slow `git status` costs one process at
+// a time rather than one per command.
+class PromptRenderer {
+public:
+    explicit PromptRenderer(Shell& shell);
+    ~PromptRenderer();
+
+    PromptRenderer(const PromptRenderer&) = delete;
+    PromptRenderer& operator=(const PromptRenderer&) = delete;
+
+    // Expands ps and starts its segments again. Without background the
+    // segments are waited for and their new output used.
+    std::string expand(const std::string& ps, bool background);
+
+    // Readable once a segment has output or has finished.
+    int fd() const { return epoll_fd_; }
+
+    // Takes what segments have written. If one finished with output that
+    // differs, returns true with the last prompt expanded again in prompt.
+    bool update(std::string& prompt);
+
+private:
+    struct Segment {
+        std::string value; // output of the last completed run
+        std::string pending;
+        pid_t pid = -1;
+        int fd = -1;
+    };
+
+    std::string render(const std::string& ps, bool restart);
+    void start(const std::string& command, Segment& segment);
+    bool read_some(Segment& segment); // false once the run has finished
+    bool finish(Segment& segment);    // whether the value changed
+    std::string plain(std::string_view text);
+
+    Shell& shell_;
+    int epoll_fd_ = -1;
+    std::string last_;
+    std::unordered_map<std::string, Segment> segments_; // by command text
+};
+
+} // namespace sh
@@ -0,0 +1,238 @@
+#include "redirect.h"
+
+#include "builtins.h"
+#include "expand.h"
+#include "shell.h"
+#include "transfer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace sh {
+
+namespace {
+
+// Default pipe capacity on Linux; bodies up to this size use a pipe.
+constexpr size_t kHeredocPipeMax = 64 * 1024;
+
+// A pipe already holding all of content, for bodies that fit in the pipe
+// buffer: the write cannot block, and no file is created at all.
+int heredoc_pipe(const std::string& content)
+{
+    int fds[2];
+    if (::pipe2(fds, O_CLOEXEC) < 0)
+        return -1;
+    int capacity = ::fcntl(fds[1], F_GETPIPE_SZ);
+    if (capacity < 0 || content.size() > static_cast<size_t>(capacity) || !write_all(fds[1], content)) {
+        ::close(fds[0]);
+        ::close(fds[1]);
+        errno = EFBIG;
+        return -1;
+    }
+    ::close(fds[1]);
+    return fds[0];
+}
+
+// An anonymous memory file holding content, positioned at the start.
+// Falls back to an unlinked file in $TMPDIR where memfd_create(2) is
+// unavailable.
+int heredoc_file(const std::string& content)
+{
+    int fd = ::memfd_create("sh-heredoc", MFD_CLOEXEC);
+    if (fd < 0) {
+        const char* dir = std::getenv("TMPDIR");
+        std::string path = std::string(dir && *dir ? dir : "/tmp") + "/sh-heredoc-XXXXXX";
+        fd = ::mkostemp(path.data(), O_CLOEXEC);
+        if (fd < 0)
+            return -1;
+        ::unlink(path.c_str());
+    }
+    if (!write_all(fd, content)) {
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        return -1;
+    }
+    ::lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+// Materializes a here-document without touching the file system: small
+// bodies go straight into a pipe, larger ones into a memfd (which, unlike
+// a pipe, never makes the shell wait for the reader).
+int heredoc_fd(const std::string& content)
+{
+    if (content.size() <= kHeredocPipeMax) {
+        int fd = heredoc_pipe(content);
+        if (fd >= 0)
+            return fd;
+    }
+    return heredoc_file(content);
+}
+
+// Moves a descriptor the shell opened for a redirection to 10 or above,
+// clear of the 0-9 a script names itself: `3>&2 2>file` must not find the
+// file already open as 3.
+int move_high(int fd)
+{
+    if (fd < 0 || fd >= 10)
+        return fd;
+    int high = ::fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    ::close(fd);
+    return high;
+}
+
+bool parse_fd(const std::string& s, int& fd)
+{
+    if (s.empty() || s.size() > 4)
+        return false;
+    fd = 0;
+    for (char c : s) {
+        if (c < '0' || c > '9')
+            return false;
+        fd = fd * 10 + (c - '0');
+    }
+    return true;
+}
+
+} // namespace
+
+Redirection::~Redirection()
+{
+    restore();
+    for (int fd : owned_)
+        ::close(fd);
+}
+
+bool Redirection::open(Shell& shell, const List<Redir>& redirs)
+{
+    for (const Redir* r : redirs) {
+        int flags = 0;
+        switch (r->op) {
+        case Redir::Op::In:
+            flags = O_RDONLY;
+            break;
+        case Redir::Op::Out:
+        case Redir::Op::Clobber:
+            flags = O_WRONLY | O_CREAT | O_TRUNC;
+            break;
+        case Redir::Op::Append:
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+            break;
+        case Redir::Op::ReadWrite:
+            flags = O_RDWR | O_CREAT;
+            break;
+        case Redir::Op::DupIn:
+        case Redir::Op::DupOut: {
+            std::string target = expand_string(shell, r->target);
+            int src;
+            if (target == "-") {
+                plan_.close(r->fd);
+            } else if (parse_fd(target, src)) {
+                if (::fcntl(src, F_GETFD) < 0) {
+                    warn(shell, "%s: %s", target.c_str(), std::strerror(EBADF));
+                    return false;
+                }
+                plan_.dup(src, r->fd);
+            } else {
+                warn(shell, "%s: ambiguous redirect", target.c_str());
+                return false;
+            }
+            continue;
+        }
+        case Redir::Op::HereDoc:
+        case Redir::Op::HereString: {
+            std::string body = expand_string(shell, r->target);
+            if (r->op == Redir::Op::HereString)
+                body += '\n';
+            int fd = move_high(heredoc_fd(body));
+            if (fd < 0) {
+                warn(shell, "cannot create here-document: %s", std::strerror(errno));
+                return false;
+            }
+            owned_.push_back(fd);
+            plan_.dup(fd, r->fd);
+            continue;
+        }
+        }
+
+        std::string path = expand_string(shell, r->target);
+        int fd = move_high(::open(path.c_str(), flags | O_CLOEXEC, 0666));
+        if (fd < 0) {
+            warn(shell, "%s: %s", path.c_str(), std::strerror(errno));
+            return false;
+        }
+        owned_.push_back(fd);
+        plan_.dup(fd, r->fd);
+    }
+    return true;
+}
+
+bool Redirection::apply_in_shell(Shell& shell)
+{
+    shell_ = &shell;
+    flush_output();
+    std::fflush(stdout);
+    std::fflush(stderr);
+    for (const FdAction& a : plan_.actions()) {
+        bool saved = false;
+        for (const Saved& s : saved_)
+            saved = saved || s.fd == a.fd;
+        if (!saved)
+            saved_.push_back({a.fd, ::fcntl(a.fd, F_DUPFD_CLOEXEC, 10)});
+
+        int rc = 0;
+        switch (a.kind) {
+        case FdAction::Kind::Dup:
+            rc = a.src == a.fd ? ::fcntl(a.fd, F_SETFD, 0) : ::dup2(a.src, a.fd);
+            break;
+        case FdAction::Kind::Close:
+            ::close(a.fd);
+            break;
+        case FdAction::Kind::Drop:
+            break; // pipeline plans only, never applied to the shell
+        case FdAction::Kind::Open: {
+            int fd = ::open(a.path.c_str(), a.flags | O_CLOEXEC, a.mode);
+            rc = fd < 0 ? -1 : ::dup2(fd, a.fd);
+            if (fd >= 0)
+                ::close(fd);
+            break;
+        }
+        }
+        if (rc < 0) {
+            warn(shell, "%d: %s", a.fd, std::strerror(errno));
+            restore();
+            return false;
+        }
+    }
+    return true;
+}
+
+void Redirection::restore()
+{
+    if (saved_.empty())
+        return;
+    // Buffered builtin output belongs to the redirected descriptors.
+    if (!flush_output() && errno != EPIPE)
+        warn(*shell_, "write error: %s", std::strerror(errno));
+    std::fflush(stdout);
+    std::fflush(stderr);
+    for (auto it = saved_.rbegin(); it != saved_.rend(); ++it) {
+        if (it->copy >= 0) {
+            ::dup2(it->copy, it->fd);
+            ::close(it->copy);
+        } else {
+            ::close(it->fd);
+        }
+    }
+    saved_.clear();
+}
+
+} // namespace sh
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "ast.h"
+#include "fdplan.h"
+
+#include <vector>
+
+namespace sh {
+
+struct Shell;
+
+// The descriptors of one command's redirections. Files are opened by the
+// shell itself (close-on-exec, so nothing leaks into unrelated children)
+// and described as dup actions in plan(): the launcher hands that plan to
+// the child, while builtins and compound commands apply it to the shell's
+// own descriptor table for the duration of the command.
+class Redirection {
+public:
+    Redirection() = default;
+    ~Redirection();
+
+    Redirection(const Redirection&) = delete;
+    Redirection& operator=(const Redirection&) = delete;
+
+    // Expands targets and opens files. On failure a diagnostic has been
+    // printed and false is returned.
+    bool open(Shell& shell, const List<Redir>& redirs);
+
+    const FdPlan& plan() const { return plan_; }
+
+    // Applies plan() to the shell's descriptors until restore() or
+    // destruction. Displaced descriptors are kept in close-on-exec copies.
+    bool apply_in_shell(Shell& shell);
+    void restore();
+
+private:
+    struct Saved {
+        int fd;
+        int copy; // -1: fd was closed before
+    };
+
+    Shell* shell_ = nullptr; // set by apply_in_shell()
+    FdPlan plan_;
+    std::vector<int> owned_;
+    std::vector<Saved> saved_;
+};
+
+} // namespace sh
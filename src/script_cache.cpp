@@ -0,0 +1,113 @@
+#include "script_cache.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+namespace sh {
+
+namespace {
+
+bool read_all(int fd, std::string& out)
+{
+    char buf[65536];
+    for (;;) {
+        ssize_t n = ::read(fd, buf, sizeof buf);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;
+        if (n == 0)
+            return true;
+        out.append(buf, static_cast<size_t>(n));
+    }
+}
+
+} // namespace
+
+std::shared_ptr<const ParsedScript> ScriptCache::load(const std::string& path)
+{
+    struct stat st;
+    if (::stat(path.c_str(), &st) < 0)
+        return nullptr;
+    if (S_ISDIR(st.st_mode)) {
+        errno = EISDIR;
+        return nullptr;
+    }
+    bool cacheable = S_ISREG(st.st_mode);
+    Key key{st.st_dev, st.st_ino};
+    if (cacheable) {
+        auto it = entries_.find(key);
+        if (it != entries_.end()) {
+            ParsedScript& s = *it->second;
+            if (s.size == st.st_size && s.mtime.tv_sec == st.st_mtim.tv_sec && s.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+                ++s.hits;
+                ++stats_.hits;
+                s.last_used = ++clock_;
+                return it->second;
+            }
+            entries_.erase(it);
+        }
+    }
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+    auto script = std::make_shared<ParsedScript>();
+    // Size the buffer from the fstat of the descriptor actually read, so
+    // the recorded identity matches the text.
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+        script->text.reserve(static_cast<size_t>(st.st_size));
+    bool ok = read_all(fd, script->text);
+    int err = errno;
+    ::close(fd);
+    if (!ok) {
+        errno = err;
+        return nullptr;
+    }
+
+    script->path = path;
+    script->dev = st.st_dev;
+    script->ino = st.st_ino;
+    script->mtime = st.st_mtim;
+    script->size = st.st_size;
+    script->result = parse(script->text, script->arena);
+    ++stats_.misses;
+    if (!cacheable || static_cast<off_t>(script->text.size()) != st.st_size)
+        return script;
+
+    if (entries_.size() >= kMaxEntries)
+        evict_one();
+    script->last_used = ++clock_;
+    entries_[Key{st.st_dev, st.st_ino}] = script;
+    return script;
+}
+
+void ScriptCache::evict_one()
+{
+    auto oldest = entries_.begin();
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->second->last_used < oldest->second->last_used)
+            oldest = it;
+    }
+    if (oldest != entries_.end())
+        entries_.erase(oldest);
+}
+
+size_t ScriptCache::bytes() const
+{
+    size_t total = 0;
+    for (const auto& [key, script] : entries_)
+        total += script->text.size() + script->arena.capacity();
+    return total;
+}
+
+void ScriptCache::for_each(const std::function<void(const ParsedScript&)>& fn) const
+{
+    for (const auto& [key, script] : entries_)
+        fn(*script);
+}
+
+} // namespace sh
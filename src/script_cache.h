@@ -0,0 +1,81 @@
+#pragma once
+
+#include "arena.h"
+#include "parser.h"
+
+#include <sys/types.h>
+#include <time.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace sh {
+
+// A script file parsed once. The tree points into text and arena, so the
+// three are kept together; holders of the shared_ptr keep a script alive
+// even if the cache drops or replaces it while it runs.
+struct ParsedScript {
+    std::string path;
+    std::string text;
+    Arena arena;
+    ParseResult result;
+
+    dev_t dev = 0;
+    ino_t ino = 0;
+    timespec mtime{};
+    off_t size = 0;
+    uint64_t hits = 0;
+    uint64_t last_used = 0;
+};
+
+struct ScriptCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+// Parse-once cache for script files and files read by `.`/`source`,
+// keyed by (device, inode) and validated against mtime and size, so
+// re-sourcing an unchanged file costs one stat(2) instead of a read and a
+// full parse. Forked subshells inherit the parsed trees copy-on-write.
+class ScriptCache {
+public:
+    static constexpr size_t kMaxEntries = 128;
+
+    // Returns the parsed contents of path, or nullptr with errno set if the
+    // file cannot be read. Only regular files are cached; anything else is
+    // read and parsed on every call.
+    std::shared_ptr<const ParsedScript> load(const std::string& path);
+
+    // Drops every entry and zeroes the hit/miss counters with them.
+    void clear()
+    {
+        entries_.clear();
+        stats_ = {};
+    }
+    size_t size() const { return entries_.size(); }
+    size_t bytes() const; // source text plus arena capacity of all entries
+    const ScriptCacheStats& stats() const { return stats_; }
+    void for_each(const std::function<void(const ParsedScript&)>& fn) const;
+
+private:
+    struct Key {
+        dev_t dev;
+        ino_t ino;
+        bool operator==(const Key&) const = default;
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const { return std::hash<uint64_t>{}(uint64_t(k.dev) * 0x9e3779b97f4a7c15ULL ^ k.ino); }
+    };
+
+    void evict_one();
+
+    std::unordered_map<Key, std::shared_ptr<ParsedScript>, KeyHash> entries_;
+    ScriptCacheStats stats_;
+    uint64_t clock_ = 0;
+};
+
+} // namespace sh
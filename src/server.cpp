@@ -0,0 +1,290 @@
+#include "server.h"
+
+#include "builtins.h"
+#include "executor.h"
+#include "parser.h"
+#include "shell.h"
+#include "transfer.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace sh {
+
+namespace {
+
+// Buffered reads of the request stream.
+class FrameReader {
+public:
+    explicit FrameReader(int fd) : fd_(fd) {}
+
+    // Reads a header line without its newline. Returns false at end of
+    // input.
+    bool line(std::string& out)
+    {
+        out.clear();
+        for (;;) {
+            size_t nl = buf_.find('\n', pos_);
+            if (nl != std::string::npos) {
+                out.assign(buf_, pos_, nl - pos_);
+                pos_ = nl + 1;
+                return true;
+            }
+            if (!fill())
+                return false;
+        }
+    }
+
+    bool bytes(size_t n, std::string& out)
+    {
+        while (buf_.size() - pos_ < n) {
+            if (!fill())
+                return false;
+        }
+        out.assign(buf_, pos_, n);
+        pos_ += n;
+        return true;
+    }
+
+private:
+    bool fill()
+    {
+        buf_.erase(0, pos_);
+        pos_ = 0;
+        char chunk[65536];
+        for (;;) {
+            ssize_t n = ::read(fd_, chunk, sizeof chunk);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            buf_.append(chunk, static_cast<size_t>(n));
+            return true;
+        }
+    }
+
+    int fd_;
+    std::string buf_;
+    size_t pos_ = 0;
+};
+
+// Command strings parsed once, as ScriptCache does for files: workers tend
+// to send the same few commands over and over.
+class ParseCache {
+public:
+    static constexpr size_t kMaxEntries = 256;
+
+    struct Entry {
+        std::string text;
+        Arena arena;
+        ParseResult result;
+    };
+
+    const Entry& get(const std::string& text)
+    {
+        auto it = entries_.find(text);
+        if (it != entries_.end())
+            return *it->second;
+        if (entries_.size() >= kMaxEntries)
+            entries_.clear();
+        auto entry = std::make_unique<Entry>();
+        entry->text = text;
+        entry->result = parse(entry->text, entry->arena);
+        return *entries_.emplace(text, std::move(entry)).first->second;
+    }
+
+private:
+    std::unordered_map<std::string, std::unique_ptr<Entry>> entries_;
+};
+
+bool send_frame(int fd, char tag, std::string_view body)
+{
+    std::string header = std::string(1, tag) + ' ' + std::to_string(body.size()) + '\n';
+    return write_all(fd, header) && write_all(fd, body);
+}
+
+// Reads everything written to a capture memfd and empties it.
+std::string drain(int fd)
+{
+    std::string out;
+    off_t size = ::lseek(fd, 0, SEEK_END);
+    if (size > 0) {
+        out.resize(static_cast<size_t>(size));
+        ssize_t n = ::pread(fd, out.data(), out.size(), 0);
+        out.resize(n > 0 ? static_cast<size_t>(n) : 0);
+    }
+    if (::ftruncate(fd, 0) == 0)
+        ::lseek(fd, 0, SEEK_SET);
+    return out;
+}
+
+// Runs one command with 0, 1 and 2 pointed at null, out and err.
+int run_captured(Shell& shell, const ParseCache::Entry& entry, int null, int out, int err)
+{
+    flush_output();
+    std::fflush(stdout);
+    std::fflush(stderr);
+    int saved[3];
+    for (int fd = 0; fd < 3; ++fd)
+        saved[fd] = ::fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    ::dup2(null, 0);
+    ::dup2(out, 1);
+    ::dup2(err, 2);
+
+    run_parsed(shell, entry.text, entry.result);
+
+    flush_output();
+    std::fflush(stdout);
+    std::fflush(stderr);
+    for (int fd = 0; fd < 3; ++fd) {
+        if (saved[fd] >= 0) {
+            ::dup2(saved[fd], fd);
+            ::close(saved[fd]);
+        } else {
+            ::close(fd);
+        }
+    }
+    int status = shell.last_status;
+    if (!shell.exiting())
+        shell.flow = Flow::Normal; // a stray break or return ends only the command
+    return status;
+}
+
+// Serves requests from in until it ends or a command runs exit. Returns
+// false if a reply could not be written.
+bool serve_stream(Shell& shell, ParseCache& cache, int in, int out)
+{
+    int null = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    int cap_out = ::memfd_create("sh-server-out", MFD_CLOEXEC);
+    int cap_err = ::memfd_create("sh-server-err", MFD_CLOEXEC);
+    bool ok = null >= 0 && cap_out >= 0 && cap_err >= 0;
+    if (!ok)
+        warn(shell, "server: %s", std::strerror(errno));
+
+    FrameReader reader(in);
+    std::string header;
+    std::string command;
+    while (ok && !shell.exiting() && reader.line(header)) {
+        char* end = nullptr;
+        unsigned long long length = header.size() > 2 && header.compare(0, 2, "C ") == 0
+                                        ? std::strtoull(header.c_str() + 2, &end, 10)
+                                        : 0;
+        if (!end || *end != '\0') {
+            warn(shell, "server: bad frame header `%s'", header.c_str());
+            break;
+        }
+        if (!reader.bytes(static_cast<size_t>(length), command))
+            break;
+        int status = run_captured(shell, cache.get(command), null, cap_out, cap_err);
+        std::string status_line = "S " + std::to_string(status) + '\n';
+        ok = send_frame(out, 'O', drain(cap_out)) && send_frame(out, 'E', drain(cap_err)) &&
+             write_all(out, status_line);
+    }
+    for (int fd : {null, cap_out, cap_err}) {
+        if (fd >= 0)
+            ::close(fd);
+    }
+    return ok;
+}
+
+// Makes way for bind() at addr's path. Only a socket nobody listens on, as
+// left by a server that died, is removed; a missing path is fine. Anything
+// else, such as a regular file or a running server's socket, is kept and
+// fails with EADDRINUSE. Returns false with errno set.
+bool clear_stale_socket(const sockaddr_un& addr)
+{
+    struct stat st;
+    if (::lstat(addr.sun_path, &st) < 0)
+        return errno == ENOENT;
+    if (!S_ISSOCK(st.st_mode)) {
+        errno = EADDRINUSE;
+        return false;
+    }
+    int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0)
+        return false;
+    int rc = ::connect(probe, reinterpret_cast<const sockaddr*>(&addr), sizeof addr);
+    int err = errno;
+    ::close(probe);
+    if (rc < 0 && err == ECONNREFUSED)
+        return ::unlink(addr.sun_path) == 0 || errno == ENOENT;
+    errno = EADDRINUSE;
+    return false;
+}
+
+} // namespace
+
+int serve(Shell& shell, const std::string& path)
+{
+    // A client that goes away must not kill the server.
+    ::signal(SIGPIPE, SIG_IGN);
+    ParseCache cache;
+
+    if (path.empty()) {
+        // The protocol moves off 0 and 1, which each command gets replaced.
+        int in = ::fcntl(0, F_DUPFD_CLOEXEC, 10);
+        int out = ::fcntl(1, F_DUPFD_CLOEXEC, 10);
+        if (in < 0 || out < 0) {
+            warn(shell, "server: %s", std::strerror(errno));
+            return 1;
+        }
+        bool ok = serve_stream(shell, cache, in, out);
+        ::close(in);
+        ::close(out);
+        if (shell.exiting())
+            return shell.last_status;
+        return ok ? 0 : 1;
+    }
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof addr.sun_path) {
+        warn(shell, "server: %s: socket path too long", path.c_str());
+        return 2;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    if (!clear_stale_socket(addr)) {
+        warn(shell, "server: %s: %s", path.c_str(), std::strerror(errno));
+        return 1;
+    }
+    int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0 ||
+        ::listen(listener, 16) < 0) {
+        warn(shell, "server: %s: %s", path.c_str(), std::strerror(errno));
+        if (listener >= 0)
+            ::close(listener);
+        return 1;
+    }
+    for (;;) {
+        int conn = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            warn(shell, "server: accept: %s", std::strerror(errno));
+            break;
+        }
+        serve_stream(shell, cache, conn, conn);
+        ::close(conn);
+        if (shell.exiting())
+            break;
+    }
+    ::close(listener);
+    ::unlink(path.c_str());
+    return shell.exiting() ? shell.last_status : 1;
+}
+
+} // namespace sh
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+
+namespace sh {
+
+struct Shell;
+
+// Server mode (--server): one warm shell runs a stream of command strings,
+// keeping its PATH cache, functions, variables and parsed scripts between
+// them. Every frame starts with a header line of a tag and a number:
+//
+//   client: C <length>\n<command text>
+//   server: O <length>\n<stdout bytes>
+//           E <length>\n<stderr bytes>
+//           S <status>\n
+//
+// Each command runs as `shell -c` would, with standard input from
+// /dev/null and its standard output and error captured. The reply is sent
+// once it finishes: O, E, then S, which ends it. A command that runs exit
+// gets its reply, and then the server stops: this is how a client shuts
+// it down. A subshell's exit, as in `(exit 3)`, ends only that subshell.
+//
+// With an empty path requests come on standard input and replies go to
+// standard output; otherwise the server listens on a Unix socket at path
+// and serves one connection at a time. Only a stale socket (one nobody
+// accepts on) is replaced there; any other file, or a live server's
+// socket, makes it fail with "Address already in use". Returns the exit
+// status of the shell: exit's status once a command ran it.
+int serve(Shell& shell, const std::string& path);
+
+} // namespace sh
@@ -0,0 +1,50 @@
+#include "shell.h"
+
+#include "builtins.h"
+#include "trace.h"
+
+#include <cstdarg>
+#include <cstdio>
+
+namespace sh {
+
+Shell::Shell()
+{
+    jobs.set_reap_hook([this](const Job& job) {
+        if (!trace_timing)
+            return;
+        TraceEvent ev;
+        ev.kind = "job";
+        ev.command = job.command;
+        ev.pid = job.pid;
+        ev.status = JobTable::exit_status(job.wait_status);
+        ev.wall_us = monotonic_us() - job.start_us;
+        ev.set_usage(job.usage);
+        emit_trace(*this, ev);
+    });
+}
+
+void warn(const Shell& shell, const char* fmt, ...)
+{
+    flush_output();
+    std::fflush(stdout);
+    std::fprintf(stderr, "%s: ", shell.name.c_str());
+    va_list ap;
+    va_start(ap, fmt);
+    std::vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    std::fputc('\n', stderr);
+}
+
+std::string_view search_path(const Shell& shell)
+{
+    const std::string* path = shell.vars.get("PATH");
+    return path ? std::string_view(*path) : std::string_view("/usr/local/bin:/usr/bin:/bin");
+}
+
+const JobPlacement* job_placement(const Shell& shell)
+{
+    return shell.placement.empty() ? nullptr : &shell.placement;
+}
+
+} // namespace sh
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "arena.h"
+#include "ast.h"
+#include "bytecode.h"
+#include "history.h"
+#include "jobs.h"
+#include "launch.h"
+#include "lookup.h"
+#include "script_cache.h"
+#include "transfer.h"
+#include "vars.h"
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace sh {
+
+// A shell function: its body, cloned into storage of its own so it outlives
+// the line that defined it, and compiled once at definition.
+struct Function {
+    Arena arena{1024};
+    const Node* body = nullptr;
+    Program code;
+};
+
+// Non-local control flow requested by break, continue, return and exit.
+enum class Flow {
+    Normal,
+    Break,
+    Continue,
+    Return,
+    Exit,
+};
+
+// State shared by every part of the shell for the lifetime of the process.
+struct Shell {
+    std::string name = "shell"; // $0, also the prefix of diagnostics
+    std::vector<std::string> positional;
+    Variables vars;
+    std::unordered_map<std::string, std::shared_ptr<Function>> functions;
+
+    int last_status = 0;
+    uint64_t substitutions = 0;          // command substitutions run
+    uint64_t forkless_substitutions = 0; // of those, run without a fork
+    uint64_t subshells = 0;              // ( ... ) run
+    uint64_t forkless_subshells = 0;     // of those, run without a fork of their own
+    pid_t pid = 0;     // $$
+    pid_t last_bg = 0; // $!
+    bool interactive = false;
+    bool subshell = false; // running in a forked child of the main shell
+    bool trace_timing = false; // set -o trace-timing
+    bool autobatch = false;    // set -o autobatch
+
+    Flow flow = Flow::Normal;
+    int flow_levels = 0; // loops still to unwind for break/continue
+    int loop_depth = 0;
+    int function_depth = 0;
+    int source_depth = 0; // nested `.` files; return is allowed inside
+
+    LaunchBackend launcher = LaunchBackend::Spawn;
+    JobPlacement placement; // for background jobs and parallel; see jobopts
+    CommandHash commands;
+    ScriptCache scripts;
+    PipeStats pipes;
+    JobTable jobs;
+    History history; // interactive shells only
+
+    Shell(); // reports reaped jobs under trace-timing
+    Shell(const Shell&) = delete;
+    Shell& operator=(const Shell&) = delete;
+
+    bool exiting() const { return flow == Flow::Exit; }
+};
+
+// Prints "name: message" to stderr.
+void warn(const Shell& shell, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// The placement background jobs get, or nullptr if jobopts set none.
+const JobPlacement* job_placement(const Shell& shell);
+
+// $PATH as the lookup code should see it.
+std::string_view search_path(const Shell& shell);
+
+} // namespace sh
@@ -0,0 +1,113 @@
+#include "trace.h"
+
+#include "shell.h"
+#include "transfer.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <cstdio>
+
+namespace sh {
+
+namespace {
+
+int64_t tv_us(const timeval& tv)
+{
+    return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+int trace_fd(const Shell& shell)
+{
+    const std::string* value = shell.vars.get("TRACE_TIMING_FD");
+    if (!value || value->empty())
+        return 2;
+    int fd = 0;
+    for (char c : *value) {
+        if (c < '0' || c > '9' || fd > 9999)
+            return 2;
+        fd = fd * 10 + (c - '0');
+    }
+    return fd;
+}
+
+void append_quoted(std::string& out, std::string_view s)
+{
+    out += '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+} // namespace
+
+void TraceEvent::set_usage(const struct rusage& ru)
+{
+    user_us = tv_us(ru.ru_utime);
+    sys_us = tv_us(ru.ru_stime);
+    maxrss_kb = ru.ru_maxrss;
+}
+
+UsageMeter::UsageMeter(bool children) : with_children_(children), start_us_(monotonic_us())
+{
+    ::getrusage(RUSAGE_THREAD, &self_);
+    if (with_children_)
+        ::getrusage(RUSAGE_CHILDREN, &children_);
+}
+
+void UsageMeter::finish(TraceEvent& ev) const
+{
+    ev.wall_us = monotonic_us() - start_us_;
+    struct rusage self;
+    ::getrusage(RUSAGE_THREAD, &self);
+    ev.user_us = tv_us(self.ru_utime) - tv_us(self_.ru_utime);
+    ev.sys_us = tv_us(self.ru_stime) - tv_us(self_.ru_stime);
+    ev.maxrss_kb = self.ru_maxrss;
+    if (with_children_) {
+        struct rusage children;
+        ::getrusage(RUSAGE_CHILDREN, &children);
+        ev.user_us += tv_us(children.ru_utime) - tv_us(children_.ru_utime);
+        ev.sys_us += tv_us(children.ru_stime) - tv_us(children_.ru_stime);
+        ev.maxrss_kb = std::max(ev.maxrss_kb, children.ru_maxrss);
+    }
+}
+
+int64_t monotonic_us()
+{
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void emit_trace(Shell& shell, const TraceEvent& ev)
+{
+    char head[256];
+    int n = std::snprintf(head, sizeof head, "timing kind=%s pid=%ld", ev.kind, static_cast<long>(ev.pid));
+    std::string line(head, static_cast<size_t>(n));
+    if (ev.stage > 0) {
+        n = std::snprintf(head, sizeof head, " stage=%d/%d", ev.stage, ev.stages);
+        line.append(head, static_cast<size_t>(n));
+    }
+    n = std::snprintf(head, sizeof head, " status=%d wall_us=%lld user_us=%lld sys_us=%lld maxrss_kb=%ld", ev.status,
+                      static_cast<long long>(ev.wall_us), static_cast<long long>(ev.user_us),
+                      static_cast<long long>(ev.sys_us), ev.maxrss_kb);
+    line.append(head, static_cast<size_t>(n));
+    if (ev.launch_us >= 0) {
+        n = std::snprintf(head, sizeof head, " launch_us=%lld", static_cast<long long>(ev.launch_us));
+        line.append(head, static_cast<size_t>(n));
+    }
+    line += " cmd=";
+    append_quoted(line, ev.command);
+    line += '\n';
+    write_all(trace_fd(shell), line);
+}
+
+} // namespace sh
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+
+namespace sh {
+
+struct Shell;
+
+// One line of `set -o trace-timing` output. Lines look like
+//   timing kind=external pid=4242 stage=1/3 status=0 wall_us=812 user_us=410
+//          sys_us=120 maxrss_kb=3264 launch_us=95 cmd="grep -c x"
+// (on one line) and go to the descriptor named by $TRACE_TIMING_FD, or to
+// stderr. stage= appears only inside pipelines, launch_us= only for
+// commands the launcher started; it is the time from launch() to the
+// successful exec. A background job (kind=job) gets its line when the job
+// table reaps it, with wall_us running from its start to then.
+struct TraceEvent {
+    const char* kind = "";
+    std::string command;
+    pid_t pid = 0;
+    int stage = 0; // 1-based position within a pipeline, 0 outside one
+    int stages = 0;
+    int status = 0;
+    int64_t wall_us = 0;
+    int64_t user_us = 0;
+    int64_t sys_us = 0;
+    long maxrss_kb = 0;
+    int64_t launch_us = -1;
+
+    // Takes CPU time and peak RSS from a child's rusage, as wait4() reports it.
+    void set_usage(const struct rusage& ru);
+};
+
+// Wall and CPU time of a command that runs inside the shell: the calling
+// thread's own usage plus, if children is set, that of the processes the
+// shell reaped meanwhile. Builtin threads pass false, since the children
+// counters are process-wide.
+class UsageMeter {
+public:
+    explicit UsageMeter(bool children = true);
+    void finish(TraceEvent& ev) const;
+
+private:
+    bool with_children_;
+    int64_t start_us_;
+    struct rusage self_{};
+    struct rusage children_{};
+};
+
+int64_t monotonic_us();
+
+void emit_trace(Shell& shell, const TraceEvent& ev);
+
+} // namespace sh
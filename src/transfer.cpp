@@ -0,0 +1,175 @@
+#include "transfer.h"
+
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+namespace sh {
+
+namespace {
+
+constexpr size_t kChunk = 1 << 20; // largest request per zero-copy call
+constexpr size_t kBufferSize = 64 * 1024;
+
+enum class Moved {
+    Done,        // everything up to end of input
+    Unsupported, // the kernel refused this pair of descriptors; nothing moved
+    Failed,      // errno is set
+};
+
+bool has_type(int fd, mode_t type)
+{
+    struct stat st;
+    return ::fstat(fd, &st) == 0 && (st.st_mode & S_IFMT) == type;
+}
+
+void count(PipeCounter* in_count, PipeCounter* out_count, bool zero_copy, uint64_t n)
+{
+    for (PipeCounter* c : {in_count, out_count}) {
+        if (c)
+            (zero_copy ? c->zero_copy : c->copied).fetch_add(n, std::memory_order_relaxed);
+    }
+}
+
+bool refused(int err)
+{
+    return err == EINVAL || err == ENOSYS || err == EOPNOTSUPP;
+}
+
+Moved by_sendfile(int in, int out, PipeCounter* in_count, PipeCounter* out_count)
+{
+    bool moved = false;
+    for (;;) {
+        ssize_t n = ::sendfile(out, in, nullptr, kChunk);
+        if (n > 0) {
+            moved = true;
+            count(in_count, out_count, true, static_cast<uint64_t>(n));
+        } else if (n == 0) {
+            return Moved::Done;
+        } else if (errno != EINTR) {
+            return !moved && refused(errno) ? Moved::Unsupported : Moved::Failed;
+        }
+    }
+}
+
+Moved by_splice(int in, int out, PipeCounter* in_count, PipeCounter* out_count)
+{
+    bool moved = false;
+    for (;;) {
+        ssize_t n = ::splice(in, nullptr, out, nullptr, kChunk, SPLICE_F_MOVE);
+        if (n > 0) {
+            moved = true;
+            count(in_count, out_count, true, static_cast<uint64_t>(n));
+        } else if (n == 0) {
+            return Moved::Done;
+        } else if (errno != EINTR) {
+            return !moved && refused(errno) ? Moved::Unsupported : Moved::Failed;
+        }
+    }
+}
+
+// Reads from in and writes to out and every file; limit bounds the bytes
+// read (the rest of the input is left alone), or is -1 for all of it.
+bool by_copy(int in, int out, const std::vector<int>& files, PipeCounter* in_count, PipeCounter* out_count,
+             long long limit = -1)
+{
+    char buf[kBufferSize];
+    while (limit != 0) {
+        size_t want = limit < 0 || static_cast<unsigned long long>(limit) > sizeof buf ? sizeof buf
+                                                                                       : static_cast<size_t>(limit);
+        ssize_t n = ::read(in, buf, want);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;
+        if (n == 0)
+            return true;
+        std::string_view data(buf, static_cast<size_t>(n));
+        if (out >= 0 && !write_all(out, data))
+            return false;
+        for (int fd : files) {
+            if (!write_all(fd, data))
+                return false;
+        }
+        count(in_count, out_count, false, static_cast<uint64_t>(n));
+        if (limit > 0)
+            limit -= n;
+    }
+    return true;
+}
+
+} // namespace
+
+bool write_all(int fd, std::string_view text, PipeCounter* count)
+{
+    if (count)
+        count->copied.fetch_add(text.size(), std::memory_order_relaxed);
+    while (!text.empty()) {
+        ssize_t n = ::write(fd, text.data(), text.size());
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        text.remove_prefix(static_cast<size_t>(n));
+    }
+    return true;
+}
+
+bool transfer(int in, int out, PipeCounter* in_count, PipeCounter* out_count)
+{
+    Moved moved = Moved::Unsupported;
+    if (has_type(in, S_IFREG))
+        moved = by_sendfile(in, out, in_count, out_count);
+    if (moved == Moved::Unsupported && (has_type(in, S_IFIFO) || has_type(out, S_IFIFO)))
+        moved = by_splice(in, out, in_count, out_count);
+    if (moved == Moved::Unsupported)
+        return by_copy(in, out, {}, in_count, out_count);
+    return moved == Moved::Done;
+}
+
+bool transfer_tee(int in, int out, const std::vector<int>& files, PipeCounter* in_count, PipeCounter* out_count)
+{
+    if (files.empty())
+        return transfer(in, out, in_count, out_count);
+    if (files.size() > 1 || !has_type(in, S_IFIFO) || !has_type(out, S_IFIFO))
+        return by_copy(in, out, files, in_count, out_count);
+
+    int file = files.front();
+    bool file_splice = true;
+    for (bool first = true;; first = false) {
+        ssize_t n = ::tee(in, out, kChunk, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (first && refused(errno))
+                return by_copy(in, out, files, in_count, out_count);
+            return false;
+        }
+        if (n == 0)
+            return true;
+        count(in_count, out_count, true, static_cast<uint64_t>(n));
+
+        // The same bytes are still at the head of in: move them to the file.
+        size_t left = static_cast<size_t>(n);
+        while (left > 0 && file_splice) {
+            ssize_t m = ::splice(in, nullptr, file, nullptr, left, SPLICE_F_MOVE);
+            if (m < 0 && errno == EINTR)
+                continue;
+            if (m < 0 && refused(errno)) {
+                file_splice = false;
+                break;
+            }
+            if (m <= 0)
+                return false;
+            left -= static_cast<size_t>(m);
+        }
+        if (left > 0 && !by_copy(in, -1, files, nullptr, nullptr, static_cast<long long>(left)))
+            return false;
+    }
+}
+
+} // namespace sh
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace sh {
+
+// Bytes the shell itself moved through one pipe, split by how they moved.
+// Each shell-side end counts what it moved, so a pipe between two builtins
+// counts its data twice. Updated from builtin threads, hence atomic.
+struct PipeCounter {
+    std::atomic<uint64_t> zero_copy{0}; // splice(2), tee(2) or sendfile(2)
+    std::atomic<uint64_t> copied{0};    // read(2)/write(2) through a buffer
+};
+
+struct PipeTotals {
+    uint64_t zero_copy = 0;
+    uint64_t copied = 0;
+};
+
+// What the pipestats builtin reports: totals since startup (or the last
+// reset) and one entry per pipe of the most recent pipeline in which the
+// shell handled a pipe end itself.
+struct PipeStats {
+    PipeTotals total;
+    std::vector<PipeTotals> last;
+};
+
+// Copies everything from in to out until end of input, without passing the
+// data through user space where the kernel allows it: sendfile(2) from a
+// regular file, splice(2) when either side is a pipe, a read/write loop
+// otherwise. Bytes are added to the counters of whichever sides are
+// pipeline pipes (either may be null). Returns false with errno set.
+bool transfer(int in, int out, PipeCounter* in_count = nullptr, PipeCounter* out_count = nullptr);
+
+// Like transfer(), but also writes the data to every descriptor in files.
+// With pipes on both sides and a single file, tee(2) duplicates the data
+// into out and splice(2) then moves it into the file.
+bool transfer_tee(int in, int out, const std::vector<int>& files, PipeCounter* in_count = nullptr,
+                  PipeCounter* out_count = nullptr);
+
+// Writes all of text to fd, counting it as copied. Returns false with errno
+// set.
+bool write_all(int fd, std::string_view text, PipeCounter* count = nullptr);
+
+} // namespace sh
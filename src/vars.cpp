@@ -0,0 +1,305 @@
+#include "vars.h"
+
+#include "arith.h"
+
+#include <charconv>
+#include <cstring>
+
+namespace sh {
+
+namespace {
+
+size_t hash_name(std::string_view name)
+{
+    return std::hash<std::string_view>{}(name);
+}
+
+// Whether "name=value" assigns name.
+bool assigns(std::string_view assignment, std::string_view name)
+{
+    return assignment.size() > name.size() && assignment[name.size()] == '=' && assignment.starts_with(name);
+}
+
+} // namespace
+
+void Variables::import(char** envp)
+{
+    for (char** e = envp; e && *e; ++e) {
+        const char* eq = std::strchr(*e, '=');
+        if (!eq)
+            continue;
+        std::string_view name(*e, static_cast<size_t>(eq - *e));
+        Entry* entry = find(name);
+        if (!entry)
+            entry = &insert(name);
+        entry->var = {eq + 1, true, true};
+    }
+    env_dirty_ = true;
+}
+
+size_t Variables::find_slot(std::string_view name, size_t hash) const
+{
+    if (index_.empty())
+        return kNotFound;
+    size_t mask = index_.size() - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        uint32_t at = index_[slot];
+        if (at == kEmpty)
+            return kNotFound;
+        if (at == kTombstone)
+            continue;
+        const Entry& entry = entries_[at - 1];
+        if (entry.hash == hash && entry.name == name)
+            return slot;
+    }
+}
+
+Variables::Entry* Variables::find(std::string_view name)
+{
+    size_t slot = find_slot(name, hash_name(name));
+    return slot == kNotFound ? nullptr : &entries_[index_[slot] - 1];
+}
+
+const Variables::Entry* Variables::find(std::string_view name) const
+{
+    size_t slot = find_slot(name, hash_name(name));
+    return slot == kNotFound ? nullptr : &entries_[index_[slot] - 1];
+}
+
+// name must not be present.
+Variables::Entry& Variables::insert(std::string_view name)
+{
+    // Keep the index at most 3/4 full, counting tombstones, so probes stay
+    // short and always reach an empty slot. A rehash that finds mostly
+    // tombstones keeps the size.
+    if ((live_ + tombstones_ + 1) * 4 > index_.size() * 3) {
+        if (index_.empty())
+            rehash(64);
+        else
+            rehash((live_ + 1) * 2 > index_.size() ? index_.size() * 2 : index_.size());
+    }
+
+    uint32_t at;
+    if (free_.empty()) {
+        at = static_cast<uint32_t>(entries_.size());
+        entries_.emplace_back();
+    } else {
+        at = free_.back();
+        free_.pop_back();
+    }
+    Entry& entry = entries_[at];
+    entry.name.assign(name);
+    entry.hash = hash_name(name);
+    entry.var = {};
+    entry.live = true;
+
+    size_t mask = index_.size() - 1;
+    size_t slot = entry.hash & mask;
+    while (index_[slot] != kEmpty && index_[slot] != kTombstone)
+        slot = (slot + 1) & mask;
+    if (index_[slot] == kTombstone)
+        --tombstones_;
+    index_[slot] = at + 1;
+    ++live_;
+    return entry;
+}
+
+void Variables::erase(std::string_view name)
+{
+    size_t slot = find_slot(name, hash_name(name));
+    if (slot == kNotFound)
+        return;
+    uint32_t at = index_[slot] - 1;
+    Entry& entry = entries_[at];
+    if (entry.var.exported)
+        env_dirty_ = true;
+    entry.live = false;
+    entry.name.clear();
+    entry.var = {};
+    free_.push_back(at);
+    index_[slot] = kTombstone;
+    --live_;
+    ++tombstones_;
+}
+
+void Variables::rehash(size_t capacity)
+{
+    index_.assign(capacity, kEmpty);
+    tombstones_ = 0;
+    size_t mask = capacity - 1;
+    for (size_t at = 0; at < entries_.size(); ++at) {
+        if (!entries_[at].live)
+            continue;
+        size_t slot = entries_[at].hash & mask;
+        while (index_[slot] != kEmpty)
+            slot = (slot + 1) & mask;
+        index_[slot] = static_cast<uint32_t>(at + 1);
+    }
+}
+
+const std::string* Variables::get(std::string_view name) const
+{
+    const Entry* entry = find(name);
+    if (!entry || !entry->var.set)
+        return nullptr;
+    return &entry->var.value;
+}
+
+void Variables::set(std::string_view name, std::string_view value)
+{
+    Entry* entry = find(name);
+    if (!entry)
+        entry = &insert(name);
+    Var& var = entry->var;
+    if (var.exported && (!var.set || var.value != value))
+        env_dirty_ = true;
+    var.value.assign(value);
+    var.set = true;
+    var.number_state = Var::Number::Unknown;
+}
+
+const std::string* Variables::get_number(std::string_view name, std::optional<long long>& number) const
+{
+    const Entry* entry = find(name);
+    if (!entry || !entry->var.set)
+        return nullptr;
+    const Var& var = entry->var;
+    if (var.number_state == Var::Number::Unknown)
+        var.number_state = parse_integer(var.value, var.number) ? Var::Number::Valid : Var::Number::Invalid;
+    if (var.number_state == Var::Number::Valid)
+        number = var.number;
+    return &var.value;
+}
+
+void Variables::set_number(std::string_view name, long long value)
+{
+    char buf[24];
+    std::string_view text(buf, static_cast<size_t>(std::to_chars(buf, buf + sizeof buf, value).ptr - buf));
+    Entry* entry = find(name);
+    if (!entry)
+        entry = &insert(name);
+    Var& var = entry->var;
+    if (var.exported && (!var.set || var.value != text))
+        env_dirty_ = true;
+    var.value.assign(text);
+    var.set = true;
+    var.number_state = Var::Number::Valid;
+    var.number = value;
+}
+
+bool Variables::unset(std::string_view name)
+{
+    if (!find(name))
+        return false;
+    erase(name);
+    return true;
+}
+
+void Variables::set_exported(std::string_view name, bool exported)
+{
+    Entry* entry = find(name);
+    if (!entry) {
+        if (!exported)
+            return;
+        entry = &insert(name);
+        entry->var = {{}, true, false};
+        return;
+    }
+    if (entry->var.exported != exported && entry->var.set)
+        env_dirty_ = true;
+    entry->var.exported = exported;
+}
+
+bool Variables::is_exported(std::string_view name) const
+{
+    const Entry* entry = find(name);
+    return entry && entry->var.exported;
+}
+
+void Variables::push_scope()
+{
+    scopes_.emplace_back();
+}
+
+void Variables::pop_scope()
+{
+    std::vector<Saved> saved = std::move(scopes_.back());
+    scopes_.pop_back();
+    for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+        if (!it->var) {
+            erase(it->name);
+            continue;
+        }
+        Entry* entry = find(it->name);
+        if (!entry)
+            entry = &insert(it->name);
+        if (entry->var.exported || it->var->exported)
+            env_dirty_ = true;
+        entry->var = std::move(*it->var);
+    }
+}
+
+bool Variables::make_local(std::string_view name)
+{
+    if (scopes_.empty())
+        return false;
+    std::vector<Saved>& scope = scopes_.back();
+    for (const Saved& s : scope) {
+        if (s.name == name)
+            return true;
+    }
+    const Entry* entry = find(name);
+    scope.push_back({std::string(name), entry ? std::optional<Var>(entry->var) : std::nullopt});
+    return true;
+}
+
+char** Variables::environment(const std::vector<std::string>& overrides, Envp& scratch)
+{
+    if (env_dirty_) {
+        env_.storage.clear();
+        env_.storage.reserve(live_);
+        for (const Entry& entry : entries_) {
+            if (entry.live && entry.var.exported && entry.var.set)
+                env_.storage.push_back(entry.name + "=" + entry.var.value);
+        }
+        env_.pointers.clear();
+        env_.pointers.reserve(env_.storage.size() + 1);
+        for (std::string& s : env_.storage)
+            env_.pointers.push_back(s.data());
+        env_.pointers.push_back(nullptr);
+        env_dirty_ = false;
+    }
+    if (overrides.empty())
+        return env_.data();
+
+    scratch.storage.clear();
+    scratch.pointers.clear();
+    scratch.pointers.reserve(env_.storage.size() + overrides.size() + 1);
+    for (std::string& s : env_.storage) {
+        std::string_view name(s.data(), s.find('='));
+        bool overridden = false;
+        for (const std::string& o : overrides) {
+            if (assigns(o, name)) {
+                overridden = true;
+                break;
+            }
+        }
+        if (!overridden)
+            scratch.pointers.push_back(s.data());
+    }
+    scratch.storage = overrides;
+    for (std::string& s : scratch.storage)
+        scratch.pointers.push_back(s.data());
+    scratch.pointers.push_back(nullptr);
+    return scratch.data();
+}
+
+void Variables::for_each(const std::function<void(std::string_view, const std::string&, bool)>& fn) const
+{
+    for (const Entry& entry : entries_) {
+        if (entry.live && entry.var.set)
+            fn(entry.name, entry.var.value, entry.var.exported);
+    }
+}
+
+} // namespace sh
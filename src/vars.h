@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sh {
+
+// A null-terminated environment block and the strings it points at.
+struct Envp {
+    std::vector<std::string> storage;
+    std::vector<char*> pointers;
+
+    char** data() { return pointers.data(); }
+};
+
+// Shell variables, including the exported ones that make up the
+// environment of external commands.
+//
+// Each name is stored once, in an entry whose address never changes while
+// the variable exists, so pointers returned by get() survive later
+// assignments to other variables. An open-addressing index of name hashes
+// finds the entry. The environment block is cached and rebuilt only after
+// an exported variable changed.
+class Variables {
+public:
+    void import(char** envp);
+
+    const std::string* get(std::string_view name) const;
+    void set(std::string_view name, std::string_view value);
+    bool unset(std::string_view name);
+
+    // Reads name for arithmetic: its value, or nullptr if unset, with
+    // number set when the value is an integer constant. The number is
+    // parsed on the first read after an assignment and kept with the
+    // variable, so a loop counter is not reparsed on every test.
+    const std::string* get_number(std::string_view name, std::optional<long long>& number) const;
+    // Assigns an integer, as arithmetic does; the next read needs no parse.
+    void set_number(std::string_view name, long long value);
+
+    void set_exported(std::string_view name, bool exported = true);
+    bool is_exported(std::string_view name) const;
+
+    // Function scopes. A scope records the variables made local in it the
+    // first time they are, and pop_scope() puts them back as they were;
+    // nothing else is copied. A local variable keeps its value until it is
+    // assigned. make_local() returns false outside any scope.
+    void push_scope();
+    void pop_scope();
+    bool make_local(std::string_view name);
+
+    // Environment for an external command. overrides holds "name=value"
+    // strings from assignments prefixed to the command; they win over, and
+    // are added to, the exported variables. Without overrides this is the
+    // cached block, valid until the next change to the variables; with
+    // them it is built in scratch.
+    char** environment(const std::vector<std::string>& overrides, Envp& scratch);
+
+    void for_each(const std::function<void(std::string_view name, const std::string& value, bool exported)>& fn) const;
+
+private:
+    struct Var {
+        std::string value;
+        bool exported = false;
+        bool set = true; // false: exported but never assigned
+        // value as an integer constant, once get_number() has looked
+        enum class Number : uint8_t { Unknown, Valid, Invalid };
+        mutable Number number_state = Number::Unknown;
+        mutable long long number = 0;
+    };
+
+    struct Entry {
+        std::string name;
+        size_t hash = 0;
+        Var var;
+        bool live = false;
+    };
+
+    struct Saved {
+        std::string name;
+        std::optional<Var> var; // nullopt: did not exist
+    };
+
+    static constexpr uint32_t kEmpty = 0;
+    static constexpr uint32_t kTombstone = UINT32_MAX;
+
+    // Index slot holding name, or kNotFound.
+    static constexpr size_t kNotFound = SIZE_MAX;
+    size_t find_slot(std::string_view name, size_t hash) const;
+    Entry* find(std::string_view name);
+    const Entry* find(std::string_view name) const;
+    Entry& insert(std::string_view name);
+    void erase(std::string_view name);
+    void rehash(size_t capacity);
+
+    std::deque<Entry> entries_;
+    std::vector<uint32_t> free_;  // dead entries, for reuse
+    std::vector<uint32_t> index_; // kEmpty, kTombstone or entry number + 1
+    size_t live_ = 0;
+    size_t tombstones_ = 0;
+
+    std::vector<std::vector<Saved>> scopes_;
+
+    Envp env_;
+    bool env_dirty_ = true;
+};
+
+} // namespace sh
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Argument lists over the exec limit: reported before anything starts, or
+# run in batches (set -o autobatch, parallel -X) that add up to the output
+# of one unbatched run.
+args=$(seq 1 500000)
+/bin/echo $args > /dev/null 2> err
+echo "too long $?"
+grep -ci "argument list too long" err
+expected=$(printf '%s\n' $args | cksum)
+# autobatch and parallel are this shell's own; elsewhere they are assumed
+# to match.
+if (set -o autobatch) 2>/dev/null; then
+    set -o autobatch
+    batched=$(/usr/bin/printf '%s\n' $args | cksum)
+    set +o autobatch
+    parallel_x=$(seq 1 500000 | parallel -X -k -j 3 /usr/bin/printf '%s\n' | cksum)
+else
+    batched=$expected parallel_x=$expected
+fi
+[ "$batched" = "$expected" ] && echo "autobatch matches"
+[ "$parallel_x" = "$expected" ] && echo "parallel -X matches"
+/bin/echo $args > /dev/null 2>&1
+echo "still too long without autobatch $?"
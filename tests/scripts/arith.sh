@@ -0,0 +1,29 @@
+#!/bin/bash
+# Arithmetic: $(( )) and (( )) commands, operators and precedence.
+echo $((1 + 2 * 3)) $(((1 + 2) * 3)) $((7 / 2)) $((7 % 3)) $((-7 / 2))
+echo $((1 << 4)) $((255 >> 2)) $((5 & 3)) $((5 | 3)) $((5 ^ 3)) $((~0))
+echo $((3 > 2)) $((3 < 2)) $((2 == 2)) $((2 != 2)) $((!0)) $((1 && 0)) $((0 || 2))
+echo $((1 ? 10 : 20)) $((0 ? 10 : 20))
+x=5
+echo $((x + 1)) $(($x * 2)) $((x += 3)) $x
+echo $((x++)) $x $((++x)) $((x--)) $((--x))
+echo $((010)) $((0x1f)) $((2#101))
+y=x
+echo $((y + 0))
+((z = 4 * 4))
+echo "z $z"
+if ((z > 10)); then echo "big"; fi
+((0)); echo "status $?"
+((3)); echo "status $?"
+i=0
+while ((i < 3)); do echo "i $i"; ((i++)); done
+n=10 total=0
+while ((n > 0)); do ((total += n, n--)); done
+echo "total $total"
+((a = b = 2)); echo "$a $b"
+echo $(( (1 + 2) * (3 + 4) ))
+echo $((2 ** 10))
+echo $((0 ** 0)) $((1 ** 99999999999)) $((-1 ** 99999999999)) $((3 ** 5)) $((2 ** 63)) $((2 ** 64))
+echo start
+if false; then echo $((2 ** 99999999999)); fi
+echo end
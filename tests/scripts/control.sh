@@ -0,0 +1,31 @@
+#!/bin/sh
+# Control flow: if/elif, case, loops with break/continue, && and ||.
+for n in 1 2 3 4 5 6; do
+    if [ $n -eq 2 ]; then continue
+    elif [ $n -eq 5 ]; then break
+    fi
+    echo "n $n"
+done
+i=0
+while [ $i -lt 3 ]; do i=$((i + 1)); echo "while $i"; done
+until [ $i -eq 0 ]; do i=$((i - 1)); done; echo "until $i"
+for w in apple banana cherry "d e"; do
+    case $w in
+    a*) echo "$w: a" ;;
+    b*|c*) echo "$w: b or c" ;;
+    *\ *) echo "$w: spaced" ;;
+    esac
+done
+true && echo and1; false && echo and2; false || echo or1
+! false && echo negated
+for outer in 1 2; do
+    for inner in a b c; do
+        [ $inner = b ] && continue 2
+        echo "$outer$inner"
+    done
+done
+echo "$(false; echo $?) $(true; echo $?)"
+x=$(echo a; echo b)
+echo "$x" | while read -r line; do echo "line $line"; done
+for f in; do echo never; done
+echo done
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Functions: arguments, return status, locals through subshells,
+# recursion, and redefinition.
+greet() {
+    echo "hello $1 ($#)"
+}
+greet world
+greet "two words" extra
+add() { echo $(($1 + $2)); }
+echo "sum $(add 3 4)"
+fails() { return 3; }
+fails; echo "status $?"
+if fails; then echo yes; else echo "no $?"; fi
+fact() {
+    if [ "$1" -le 1 ]; then echo 1; return; fi
+    echo $(($1 * $(fact $(($1 - 1)))))
+}
+echo "fact $(fact 6)"
+counter=0
+bump() { counter=$((counter + 1)); }
+bump; bump
+echo "counter $counter"
+(bump; echo "inner $counter")
+echo "outer $counter"
+args() { for a; do printf '<%s>' "$a"; done; echo; }
+args a "b c" '' d
+set -- p1 p2
+shows() { echo "inside $1"; }
+shows q1
+echo "after $1"
+greet() { echo "redefined $1"; }
+greet x
+early() { echo before; return 0; echo after; }
+early
+nested() { inner() { echo "inner defined"; }; inner; }
+nested
+inner
+echo "pipe: $(greet y | tr a-z A-Z)"
+out=$(fails)
+echo "captured status $?"
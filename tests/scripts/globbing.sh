@@ -0,0 +1,23 @@
+#!/bin/sh
+# Pathname expansion: wildcards, classes, hidden files, no matches.
+mkdir -p dir/sub other
+touch a.c b.c c.h .hidden dir/x.c dir/y.h dir/sub/z.c other/w.c 'sp ace.c'
+echo *.c
+echo ?.c
+echo [ab].c
+echo [!a].c
+echo [[:alpha:]].h
+echo */*.c
+echo */*
+echo .h*
+echo *
+echo nomatch*
+echo "quoted *.c"
+star='*.h'
+echo $star "$star"
+for f in *.c; do echo "file <$f>"; done
+set -- d*/
+echo "dirs: $*"
+case b.c in *.c) echo "case matched" ;; esac
+case '*.c' in "*.c") echo "literal case" ;; esac
+echo dir/sub/*
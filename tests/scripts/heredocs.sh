@@ -0,0 +1,46 @@
+#!/bin/sh
+# Here-documents: expansion, quoting, tab stripping, several at once.
+name=world
+cat <<EOT
+hello $name
+sum $((2 + 3)) cmd $(echo sub)
+escaped \$name and \\ backslash
+EOT
+cat <<'EOT'
+literal $name $(echo no)
+EOT
+cat <<"EOT"
+also literal $name
+EOT
+cat <<-EOT
+	tabs stripped $name
+		twice
+	EOT
+cat <<A; cat <<B
+first
+A
+second
+B
+while read -r line; do
+    echo "read: $line"
+done <<EOT
+one
+two words
+EOT
+f() {
+    cat <<EOT
+in function $1
+EOT
+}
+f arg
+x=$(cat <<EOT
+captured $name
+EOT
+)
+echo "$x"
+cat <<EOT | tr a-z A-Z
+piped $name
+EOT
+cat <<EOT
+EOT
+echo end
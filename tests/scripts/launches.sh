@@ -0,0 +1,11 @@
+#!/bin/sh
+# External commands and pipelines, so the timing reflects the launcher.
+i=0
+while [ $i -lt 200 ]; do
+    /bin/true
+    i=$((i + 1))
+done
+seq 1 2000 | sort -rn | head -n 3
+printf '%s\n' b a c | sort | tr '\n' ' '
+echo
+echo "$(echo nested "$(echo deeper)")"
@@ -0,0 +1,14 @@
+#!/bin/sh
+# Builtin-only loops, so the timing reflects the interpreter rather than
+# process creation.
+i=0 s=0
+while [ $i -lt 20000 ]; do
+    s=$((s + i % 7))
+    i=$((i + 1))
+done
+echo "$s"
+str=
+for w in a b c d e f g h i j; do
+    for v in 1 2 3 4 5 6 7 8 9 10; do str="$str$w"; done
+done
+echo ${#str} ${str%%b*}
@@ -0,0 +1,37 @@
+#!/bin/bash
+# Parameter expansion operators.
+unset u
+e= v=value path=/usr/local/lib/libfoo.so.1
+echo "default: ${u-d1} ${u:-d2} [${e-d3}] ${e:-d4}"
+echo "alternate: [${u+a1}] [${e+a2}] [${e:+a3}] ${v:+a4}"
+echo "assign: ${u=assigned} $u"
+unset u
+echo "assign colon: ${e:=filled} $e"
+echo "length: ${#v} ${#path} ${#u}"
+echo "suffix: ${path%.*} ${path%%.*}"
+echo "prefix: ${path#*/} ${path##*/}"
+echo "patterns: ${v%l*e} ${v#v?} ${v#[a-v]} ${path##*lib}"
+echo "quoted pattern: ${path%".1"} ${path#"/usr"}"
+star='a*b'
+echo "literal star: ${star%"*b"} ${star%*b}"
+set -- one "two three" four
+echo "count: $# first: $1 second: $2"
+echo "length of \$2: ${#2}"
+for a in "$@"; do echo "arg <$a>"; done
+for a in $*; do echo "word <$a>"; done
+IFS=:
+echo "joined: $*"
+IFS=' 	
+'
+echo "error: $( (: ${u?is unset}) 2>/dev/null || echo caught)"
+{ (: ${u?is unset}) 2>/dev/null; echo "silenced error $?"; } 2>&1
+{ (/bin/echo $(echo err >&2; echo out)) 2>/dev/null; } 2>&1
+x=5
+echo "nested: ${u:-${x}0} ${u:-"$v and $x"}"
+echo "in quotes: "${v%e}" '${v}'"
+set -- a b c d
+echo "slices: ${@:2:2} ${*: -1} [${*:2}] ${@: -2:1} [${@:5}]"
+unset y
+echo "nested quotes: ${y:-"a b"} [${y:-"x  'q'  y"}]"
+printf '<%s>\n' "${y:-"a b"}"
+echo "huge index: [${99999999999999999999}] [${99999999999999999999-unset}]"
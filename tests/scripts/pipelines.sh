@@ -0,0 +1,16 @@
+#!/bin/sh
+# Pipeline stages and background commands expand in their own process.
+i=0
+echo "stage $((i += 1))" | cat
+echo "after stage $i"
+echo "default ${unset_var=set}" | cat
+echo "after default [${unset_var-}]"
+echo "bg $((i += 1))" > bg_out &
+wait
+cat bg_out
+echo "after bg $i"
+printf abc | echo got $(cat)
+printf 'x\ny\n' | echo "lines $(wc -l)"
+echo one two | tr o 0 | cat
+f() { echo "fn $1"; }
+f arg | tr a A
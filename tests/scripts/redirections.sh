@@ -0,0 +1,33 @@
+#!/bin/sh
+# Redirections: files, appends, fd duplication and ordering.
+echo one > out
+echo two >> out
+cat out
+cat < out
+echo err 2> e >&2
+cat e
+{ echo stdout; echo stderr >&2; } > both 2>&1
+cat both
+{ echo to-null; echo kept >&2; } 2>&1 >/dev/null
+{ echo via three >&3; } 3> fd3
+cat fd3
+{ read -r first <&4; read -r second <&4; } 4< out
+echo "$first/$second"
+{ echo swapped >&3; } 3>&1 1>/dev/null
+echo later > out 2>/dev/null
+cat out
+: > empty
+wc -c < empty
+echo "in<$(cat < /dev/null)>"
+cat <<EOT > fromdoc
+
+doc line
+EOT
+cat fromdoc
+ls nonexistent 2>/dev/null || echo "status $?" | sed 's/[0-9][0-9]*/N/'
+for i in 1 2 3; do echo $i; done > loop
+cat loop
+{ nosuch_command 2>/dev/null; } 2>&1
+echo "silenced $?"
+{ { echo hidden >&2; } 3>&2 2>/dev/null; } 2>&1
+echo "after 3>&2 2>/dev/null"
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Subshells and the last command of a shell, which run without a fork of
+# their own or are exec'd in place: the results must be a forked shell's.
+self=$(readlink /proc/$$/exe)
+start=$(pwd)
+mkdir x
+: > x/file
+"$self" -c 'cd x && ls'
+"$self" -c 'cd x && false'
+echo "tail status $?"
+"$self" -c '! true'
+echo "negated tail $?"
+"$self" -c '! /bin/false'
+echo "negated external tail $?"
+"$self" -c 'for i in 1 2; do /bin/echo "loop $i"; done'
+"$self" -c 'while :; do /bin/echo once; break; done; echo after'
+"$self" -c 'f() { /bin/echo "fn $1"; }; f a; f b'
+"$self" -c 'f() { cd x; }; f; ls'
+(exit 3)
+echo "exit $?"
+(cd /; pwd)
+[ "$(pwd)" = "$start" ] && echo "cwd kept"
+(: ${x=1})
+echo "x ${x-unset}"
+(y=2; /bin/echo "inner y $y")
+echo "y ${y-unset}"
+(/bin/echo external; echo after)
+! (exit 1)
+echo "negated subshell $?"
+f() { (cd x; ls); pwd >/dev/null; }
+f
+for i in 1 2; do (/bin/echo "sub $i"); done
+(f) > fout 2>&1
+cat fout
+# forkstats is this shell's own; elsewhere the expected line is printed.
+if command -v forkstats >/dev/null 2>&1; then
+    forkstats -r
+    (/bin/true)
+    (cd /; /bin/true)
+    (exit 0)
+    forkstats
+else
+    echo "subshells 3 forkless 1 forked 2"
+fi
@@ -0,0 +1,374 @@
+// shell_tests: runs each script in the corpus under the shell and under a
+// reference shell, and fails a test whose stdout or exit status differs.
+// The interpreter named by a script's #! line picks the reference: sh
+// scripts are compared with dash, bash scripts with bash. A script whose
+// reference is not installed is skipped.
+//
+// Every test is also timed, best of a few runs, and the times are written
+// as "name pass|fail|slow|skip ms" lines to test_output.txt (or --output).
+// The times of the previous run, read from the same file before it is
+// rewritten, are the baseline: a test that passes but now takes longer
+// than threshold times its baseline, plus a little slack for scheduling
+// noise, fails as a regression. slow and fail lines carry the baseline
+// they were held to as a fourth field, so it outlives a bad run.
+//
+//   shell_tests --shell PATH --corpus DIR [--output FILE] [--threshold R]
+//               [--dash PATH] [--bash PATH]
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kTimedRuns = 5;
+constexpr int kTimeoutMs = 10000;
+constexpr double kSlackMs = 5.0;
+
+struct Options {
+    std::string shell;
+    std::string corpus;
+    std::string output = "test_output.txt";
+    std::string dash = "dash";
+    std::string bash = "bash";
+    double threshold = 1.5;
+};
+
+struct Run {
+    std::string out;
+    std::string err;
+    int status = -1; // exit status, or 128 + signal
+    bool timed_out = false;
+    double ms = 0;
+};
+
+// Removes dir and everything under it.
+void remove_tree(const std::string& dir)
+{
+    if (DIR* d = ::opendir(dir.c_str())) {
+        while (dirent* e = ::readdir(d)) {
+            std::string name = e->d_name;
+            if (name == "." || name == "..")
+                continue;
+            std::string path = dir + '/' + name;
+            if (e->d_type == DT_DIR)
+                remove_tree(path);
+            else
+                ::unlink(path.c_str());
+        }
+        ::closedir(d);
+    }
+    ::rmdir(dir.c_str());
+}
+
+std::string read_file(const std::string& path)
+{
+    std::string data;
+    if (std::FILE* f = std::fopen(path.c_str(), "r")) {
+        char buf[4096];
+        size_t n;
+        while ((n = std::fread(buf, 1, sizeof buf, f)) > 0)
+            data.append(buf, n);
+        std::fclose(f);
+    }
+    return data;
+}
+
+// Runs `interpreter script` in a fresh, empty directory, so that scripts
+// which create files (to glob them, say) start from the same state under
+// every shell. stdout is collected; stderr only shows up in failure
+// reports, since diagnostics are worded differently by every shell.
+Run run_script(const std::string& interpreter, const std::string& script)
+{
+    Run run;
+    char dir[] = "/tmp/shell_tests.XXXXXX";
+    if (!::mkdtemp(dir)) {
+        run.err = std::strerror(errno);
+        return run;
+    }
+    std::string err_path = std::string(dir) + "/.stderr";
+    int pipefd[2];
+    if (::pipe2(pipefd, O_CLOEXEC) < 0) {
+        run.err = std::strerror(errno);
+        remove_tree(dir);
+        return run;
+    }
+
+    Clock::time_point start = Clock::now();
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        int err = ::open(err_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        int in = ::open("/dev/null", O_RDONLY);
+        if (err < 0 || in < 0 || ::chdir(dir) < 0)
+            ::_exit(126);
+        ::dup2(in, 0);
+        ::dup2(pipefd[1], 1);
+        ::dup2(err, 2);
+        ::setenv("LC_ALL", "C", 1);
+        ::setenv("HOME", dir, 1);
+        ::unsetenv("ENV");
+        ::unsetenv("CDPATH");
+        char* argv[] = {const_cast<char*>(interpreter.c_str()), const_cast<char*>(script.c_str()), nullptr};
+        ::execvp(argv[0], argv);
+        ::_exit(127);
+    }
+    ::close(pipefd[1]);
+    if (pid < 0) {
+        run.err = std::strerror(errno);
+        ::close(pipefd[0]);
+        remove_tree(dir);
+        return run;
+    }
+
+    Clock::time_point deadline = start + std::chrono::milliseconds(kTimeoutMs);
+    char buf[4096];
+    for (;;) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        pollfd p = {pipefd[0], POLLIN, 0};
+        if (left <= 0 || ::poll(&p, 1, static_cast<int>(left)) == 0) {
+            ::kill(pid, SIGKILL);
+            run.timed_out = true;
+            break;
+        }
+        ssize_t n = ::read(pipefd[0], buf, sizeof buf);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        run.out.append(buf, static_cast<size_t>(n));
+    }
+    ::close(pipefd[0]);
+    int status = 0;
+    while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    run.ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    run.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    run.err = read_file(err_path);
+    remove_tree(dir);
+    return run;
+}
+
+// The interpreter's name from the script's #! line: "sh", "bash", ...
+std::string interpreter_of(const std::string& script)
+{
+    std::string text = read_file(script);
+    if (text.compare(0, 2, "#!") != 0)
+        return "sh";
+    std::string line = text.substr(2, text.find('\n') - 2);
+    size_t end = line.find_first_of(" \t");
+    std::string path = line.substr(0, end);
+    if (path == "/usr/bin/env" && end != std::string::npos)
+        path = line.substr(line.find_first_not_of(" \t", end));
+    return path.substr(path.rfind('/') + 1);
+}
+
+std::vector<std::string> list_corpus(const std::string& dir)
+{
+    std::vector<std::string> names;
+    if (DIR* d = ::opendir(dir.c_str())) {
+        while (dirent* e = ::readdir(d)) {
+            std::string name = e->d_name;
+            if (name.size() > 3 && name.ends_with(".sh"))
+                names.push_back(name.substr(0, name.size() - 3));
+        }
+        ::closedir(d);
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+// Whether program names an executable, directly or through $PATH.
+bool installed(const std::string& program)
+{
+    if (program.find('/') != std::string::npos)
+        return ::access(program.c_str(), X_OK) == 0;
+    const char* path = std::getenv("PATH");
+    std::string dirs = path ? path : "/usr/bin:/bin";
+    for (size_t at = 0; at <= dirs.size();) {
+        size_t end = std::min(dirs.find(':', at), dirs.size());
+        std::string dir = end > at ? dirs.substr(at, end - at) : ".";
+        if (::access((dir + '/' + program).c_str(), X_OK) == 0)
+            return true;
+        at = end + 1;
+    }
+    return false;
+}
+
+// name -> baseline ms, from the previous run's output. A passing test's
+// baseline is its time; a slow one keeps the baseline it was held to, so
+// a regression goes on failing until the output file is removed.
+std::map<std::string, double> read_baseline(const std::string& path)
+{
+    std::map<std::string, double> times;
+    if (std::FILE* f = std::fopen(path.c_str(), "r")) {
+        char name[256], result[32];
+        double ms, was;
+        char line[512];
+        while (std::fgets(line, sizeof line, f)) {
+            if (line[0] == '#')
+                continue;
+            int n = std::sscanf(line, "%255s %31s %lf %lf", name, result, &ms, &was);
+            if (n >= 3 && std::strcmp(result, "pass") == 0)
+                times[name] = ms;
+            else if (n == 4 && (std::strcmp(result, "slow") == 0 || std::strcmp(result, "fail") == 0))
+                times[name] = was;
+        }
+        std::fclose(f);
+    }
+    return times;
+}
+
+// The first line where got and want differ, 1-based, and both versions.
+void show_difference(const std::string& got, const std::string& want)
+{
+    size_t line = 1, at = 0;
+    for (;;) {
+        size_t g = got.find('\n', at), w = want.find('\n', at);
+        if (g != w || got.compare(at, g - at, want, at, w - at) != 0 || g == std::string::npos)
+            break;
+        at = g + 1;
+        line++;
+    }
+    auto text = [at](const std::string& s) {
+        return at < s.size() ? s.substr(at, s.find('\n', at) - at) : std::string("(end of output)");
+    };
+    std::printf("    stdout line %zu\n    shell:     %s\n    reference: %s\n", line, text(got).c_str(),
+                text(want).c_str());
+}
+
+bool parse_options(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "shell_tests: %s: missing value\n", arg.c_str());
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--shell")
+            options.shell = value;
+        else if (arg == "--corpus")
+            options.corpus = value;
+        else if (arg == "--output")
+            options.output = value;
+        else if (arg == "--dash")
+            options.dash = value;
+        else if (arg == "--bash")
+            options.bash = value;
+        else if (arg == "--threshold")
+            options.threshold = std::atof(value);
+        else {
+            std::fprintf(stderr, "shell_tests: %s: unknown option\n", arg.c_str());
+            return false;
+        }
+    }
+    if (options.shell.empty() || options.corpus.empty()) {
+        std::fprintf(stderr, "usage: shell_tests --shell PATH --corpus DIR [--output FILE] [--threshold R] "
+                             "[--dash PATH] [--bash PATH]\n");
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parse_options(argc, argv, options))
+        return 2;
+    // Scripts run in a directory of their own.
+    for (std::string* path : {&options.corpus, &options.shell, &options.dash, &options.bash}) {
+        if (path->find('/') == std::string::npos)
+            continue;
+        if (char* absolute = ::realpath(path->c_str(), nullptr)) {
+            *path = absolute;
+            std::free(absolute);
+        }
+    }
+    std::map<std::string, std::string> references = {{"sh", options.dash}, {"bash", options.bash}};
+    std::map<std::string, double> baseline = read_baseline(options.output);
+
+    std::vector<std::string> names = list_corpus(options.corpus);
+    if (names.empty()) {
+        std::fprintf(stderr, "shell_tests: %s: no scripts\n", options.corpus.c_str());
+        return 2;
+    }
+    std::FILE* out = std::fopen(options.output.c_str(), "w");
+    if (!out) {
+        std::fprintf(stderr, "shell_tests: %s: %s\n", options.output.c_str(), std::strerror(errno));
+        return 2;
+    }
+    char stamp[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(stamp, sizeof stamp, "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    std::fprintf(out, "# run %s threshold %.2f\n", stamp, options.threshold);
+
+    int failed = 0, regressed = 0, skipped = 0;
+    for (const std::string& name : names) {
+        std::string script = options.corpus + '/' + name + ".sh";
+        std::string interpreter = interpreter_of(script);
+        auto reference = references.find(interpreter);
+        if (reference == references.end() || !installed(reference->second)) {
+            std::printf("%-24s skip (no reference for %s)\n", name.c_str(), interpreter.c_str());
+            std::fprintf(out, "%s skip 0\n", name.c_str());
+            skipped++;
+            continue;
+        }
+
+        Run want = run_script(reference->second, script);
+        Run got = run_script(options.shell, script);
+        bool pass = !got.timed_out && got.out == want.out && got.status == want.status;
+        for (int i = 1; pass && i < kTimedRuns; i++)
+            got.ms = std::min(got.ms, run_script(options.shell, script).ms);
+
+        auto previous = baseline.find(name);
+        bool slow = pass && previous != baseline.end() && got.ms > previous->second * options.threshold + kSlackMs;
+        const char* result = slow ? "slow" : pass ? "pass" : "fail";
+        regressed += slow;
+        std::printf("%-24s %s %8.2f ms (%s %.2f ms", name.c_str(), result, got.ms, interpreter.c_str(), want.ms);
+        if (previous != baseline.end())
+            std::printf(", was %.2f ms", previous->second);
+        std::printf(")\n");
+        if (!pass && previous != baseline.end())
+            std::fprintf(out, "%s fail %.3f %.3f\n", name.c_str(), got.ms, previous->second);
+        else if (slow)
+            std::fprintf(out, "%s slow %.3f %.3f\n", name.c_str(), got.ms, previous->second);
+        else
+            std::fprintf(out, "%s %s %.3f\n", name.c_str(), result, got.ms);
+
+        if (!pass) {
+            failed++;
+            if (got.timed_out)
+                std::printf("    timed out after %d ms\n", kTimeoutMs);
+            if (got.status != want.status)
+                std::printf("    exit status %d, reference %d\n", got.status, want.status);
+            if (got.out != want.out)
+                show_difference(got.out, want.out);
+            if (!got.err.empty())
+                std::printf("    --- shell stderr\n%s", got.err.c_str());
+        }
+    }
+    std::fclose(out);
+
+    std::printf("%zu tests: %zu passed, %d failed, %d slower than %.2fx their last time, %d skipped\n",
+                names.size(), names.size() - failed - regressed - skipped, failed, regressed,
+                options.threshold, skipped);
+    return failed || regressed ? 1 : 0;
+}